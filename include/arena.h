@@ -0,0 +1,93 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_PATH_ORAM_ARENA_H
+#define CDS_PATH_ORAM_ARENA_H 1
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+#define ORAM_ARENA_ALIGNMENT 64
+
+/**
+ * @brief A caller-supplied region of memory that the components of ORAMs are carved from, see `oram_create_in`.
+ * Allocations are bump allocated, cache line aligned and zeroed, and are only released all at once by the caller, who
+ * owns the region. Memory that a component allocates later, e.g. when its stash grows past its initial capacity, comes
+ * from the heap as usual and is freed by the component. An arena is not thread safe.
+ */
+typedef struct {
+    u8 *base;
+    size_t size;
+    size_t used;
+} oram_arena;
+
+/**
+ * @brief Place an arena over `size` bytes at `base`, which must be aligned to `ORAM_ARENA_ALIGNMENT`.
+ */
+static inline void oram_arena_init(oram_arena *arena, void *base, size_t size)
+{
+    CHECK((uintptr_t)base % ORAM_ARENA_ALIGNMENT == 0);
+    arena->base = base;
+    arena->size = size;
+    arena->used = 0;
+}
+
+// Bytes of the arena that an allocation of `size` bytes takes. Every allocation takes some, so that it is owned by the
+// arena, see `oram_arena_owns`.
+static inline size_t oram_arena_bytes(size_t size)
+{
+    size_t lines = (size + ORAM_ARENA_ALIGNMENT - 1) / ORAM_ARENA_ALIGNMENT;
+    return (lines > 0 ? lines : 1) * ORAM_ARENA_ALIGNMENT;
+}
+
+/**
+ * @brief Allocate `size` zeroed bytes from the arena. Fails a `CHECK` if the arena is full: the size of everything
+ * placed in an arena is known in advance, see `oram_arena_size_bytes`.
+ */
+static inline void *oram_arena_alloc(oram_arena *arena, size_t size)
+{
+    size_t bytes = oram_arena_bytes(size);
+    CHECK(bytes <= arena->size - arena->used);
+    void *result = arena->base + arena->used;
+    arena->used += bytes;
+    memset(result, 0, size);
+    return result;
+}
+
+/**
+ * @brief Like `calloc(count, size)` if `arena` is NULL, otherwise an allocation from the arena. Never returns NULL.
+ */
+static inline void *oram_arena_calloc(oram_arena *arena, size_t count, size_t size)
+{
+    // Acceptable if: not executed in an oram_access
+    if (arena)
+    {
+        return oram_arena_alloc(arena, count * size);
+    }
+    void *result;
+    CHECK(result = calloc(count, size));
+    return result;
+}
+
+// Whether `p` was allocated from `arena`. False for a NULL arena.
+static inline bool oram_arena_owns(const oram_arena *arena, const void *p)
+{
+    return arena != NULL && (const u8 *)p >= arena->base && (const u8 *)p < arena->base + arena->size;
+}
+
+/**
+ * @brief Free memory from `oram_arena_calloc`, or from the heap. Memory in the arena is left to its owner.
+ */
+static inline void oram_arena_free(const oram_arena *arena, void *p)
+{
+    // Acceptable if: not executed in an oram_access
+    if (!oram_arena_owns(arena, p))
+    {
+        free(p);
+    }
+}
+
+#endif // CDS_PATH_ORAM_ARENA_H
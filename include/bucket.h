@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include "util.h"
+#include "tree_path.h"
 
 // 4 KB Page
 // This is the size of an SGX EPC page. We can vary this parameter as we are tuning performance.
@@ -24,16 +25,206 @@
 
 #define EMPTY_BLOCK_ID UINT64_MAX
 
-typedef u64 bucket_store[3];
+// A block is its id, its position and then its data.
+#define BLOCK_HEADER_QWORDS 2
+
+/**
+ * @brief Layout of the buckets of one bucket store. A bucket is `bucket_size` bytes and holds `blocks_per_bucket`
+ * blocks of `BLOCK_HEADER_QWORDS + block_data_qwords` u64s, followed by the generation of the bucket. Every internal
+ * bucket of the tree has `branching` children, see `tree_path_create_kary`.
+ *
+ * The bottom `leaf_levels` levels of the tree may hold fewer blocks per bucket: `leaf_blocks_per_bucket` blocks in
+ * buckets of `bucket_geometry_level_bucket_size` bytes. Most buckets are near the leaves while the pressure on the
+ * stash comes from the upper levels, so this saves memory for each real block at little cost in stash size. 0 leaf levels
+ * means every level holds `blocks_per_bucket` blocks.
+ *
+ * `BUCKET_GEOMETRY_DEFAULT` is the layout above in a binary tree, which the Jasmin implementation is built for.
+ */
+typedef struct {
+    size_t bucket_size;
+    size_t blocks_per_bucket;
+    size_t block_data_qwords;
+    size_t branching;
+    size_t leaf_levels;
+    size_t leaf_blocks_per_bucket;
+} bucket_geometry;
+
+#define BUCKET_GEOMETRY_DEFAULT ((bucket_geometry){ \
+    .bucket_size = ENCRYPTED_BUCKET_SIZE,          \
+    .blocks_per_bucket = BLOCKS_PER_BUCKET,        \
+    .block_data_qwords = BLOCK_DATA_SIZE_QWORDS,   \
+    .branching = 2})
+
+/**
+ * @brief Complete a partial geometry. A zero `blocks_per_bucket` means `BLOCKS_PER_BUCKET`. If only one of
+ *        `bucket_size` and `block_data_bytes` is zero it is derived from the other: the largest blocks that fit in the
+ *        bucket, or the smallest bucket, rounded up to a cache line, that fits the blocks. If both are zero the bucket
+ *        is `ENCRYPTED_BUCKET_SIZE`. The tree is binary. Fails a `CHECK` if the result is not valid.
+ *
+ * @param bucket_size Bytes per bucket, a multiple of 64, or 0
+ * @param blocks_per_bucket Z, or 0
+ * @param block_data_bytes Bytes of data per block, a multiple of 8, or 0
+ * @return bucket_geometry
+ */
+bucket_geometry bucket_geometry_create(size_t bucket_size, size_t blocks_per_bucket, size_t block_data_bytes);
+
+#define BUCKET_MAX_BRANCHING 64
+
+/**
+ * @brief Whether the blocks and the generation fit in the bucket, buckets stay cache line aligned, the branching is
+ *        a power of two from 2 to `BUCKET_MAX_BRANCHING` and leaf buckets hold from 1 to `blocks_per_bucket` blocks.
+ *        Geometries read from a snapshot must be checked with this.
+ */
+bool bucket_geometry_is_valid(const bucket_geometry *geometry);
+
+static inline size_t bucket_geometry_block_qwords(const bucket_geometry *geometry) {
+    return BLOCK_HEADER_QWORDS + geometry->block_data_qwords;
+}
+
+// Blocks per bucket on `level`, counted from the leaves. At most `blocks_per_bucket`.
+static inline size_t bucket_geometry_level_blocks(const bucket_geometry *geometry, size_t level) {
+    return level < geometry->leaf_levels ? geometry->leaf_blocks_per_bucket : geometry->blocks_per_bucket;
+}
+
+/**
+ * @brief Bytes per bucket on `level`, counted from the leaves: `bucket_size` for buckets of `blocks_per_bucket`
+ *        blocks, otherwise the smallest multiple of 64 that holds the blocks and the generation.
+ */
+size_t bucket_geometry_level_bucket_size(const bucket_geometry *geometry, size_t level);
+
+/**
+ * @brief Bytes of buckets in a store with `num_leaves` leaves and this geometry, see
+ *        `bucket_store_create_with_geometry`.
+ */
+size_t bucket_tree_size_bytes(size_t num_leaves, const bucket_geometry *geometry);
+
+typedef u64 bucket_store[25];
 
 // Create a path ORAM bucket store with capacity for a tree with `num_levels` levels,
 // i.e. 2^num_levels - 1 tree nodes and 2^(num_levels - 1) leaf nodes/pathORAM positions.
 bucket_store *bucket_store_create(size_t num_levels);
+
+/**
+ * @brief Create a bucket store for a tree with `num_leaves` leaves whose buckets are laid out as `geometry`. Buckets
+ *        of 2 MB or more are backed by transparent huge pages where the kernel allows it.
+ *
+ *        If `num_leaves` is not a power of two the tree is pruned, see `tree_path_num_levels`: it has the
+ *        `tree_path_num_nodes_pruned(num_leaves)` buckets on the paths to the leaves below `num_leaves` and takes only
+ *        that much memory. Bucket ids and paths are those of the full tree. Only stores with a power of two leaves
+ *        and the default geometry can be used by the Jasmin implementation.
+ *
+ * @param num_leaves Number of leaves, at least 1
+ * @param geometry A valid geometry, see `bucket_geometry_create`
+ * @return bucket_store*
+ */
+bucket_store *bucket_store_create_with_geometry(size_t num_leaves, const bucket_geometry *geometry);
+
+/**
+ * @brief Like `bucket_store_create_with_geometry`, but the store and its buckets are allocated from `arena`, or from the
+ *        heap if it is NULL. An arena store cannot grow. It takes `bucket_store_arena_bytes` of the arena.
+ */
+bucket_store *bucket_store_create_in(oram_arena *arena, size_t num_leaves, const bucket_geometry *geometry);
+size_t bucket_store_arena_bytes(size_t num_leaves, const bucket_geometry *geometry);
+
+/**
+ * @brief Create a tiered bucket store: the top `memory_levels` levels are kept in memory like `bucket_store_create`
+ *        and the levels below them in the file at `path`, which is created or truncated. Disk buckets are only
+ *        accessible for the path passed to the last `bucket_store_fetch_path`, and must be written back with
+ *        `bucket_store_flush_path`. Snapshots of tiered stores are not supported.
+ *
+ * @param num_leaves Number of leaves, see `bucket_store_create_with_geometry`
+ * @param geometry A valid geometry whose bucket sizes on every level are multiples of 4096, as direct I/O requires
+ * @param memory_levels Number of levels, counted from the root, kept in memory. If this is at least the number of
+ *        levels of the tree the store is entirely in memory.
+ * @param path File that will hold the lower levels, ideally on local NVMe
+ * @return bucket_store*
+ */
+bucket_store *bucket_store_create_tiered(size_t num_leaves, const bucket_geometry *geometry, size_t memory_levels, const char *path);
+
+/**
+ * @brief Create a bucket store like `bucket_store_create_with_geometry`, but backed by a shared mapping of the file at
+ *        `path` instead of anonymous memory. The file is created, or truncated if it exists. Writes reach the file
+ *        through the page cache; `bucket_store_snapshot` to the same `path` flushes them.
+ *
+ * @param num_leaves
+ * @param geometry A valid geometry
+ * @param path File that will hold the buckets
+ * @return bucket_store*
+ */
+bucket_store *bucket_store_create_file_backed(size_t num_leaves, const bucket_geometry *geometry, const char *path);
+
+/**
+ * @brief Map an existing bucket file written by `bucket_store_snapshot` or by a file-backed store. Nothing is read
+ *        up front: pages are faulted in when buckets are first accessed.
+ *
+ * @param num_leaves Number of leaves of the store that wrote the file
+ * @param geometry Geometry of the store that wrote the file
+ * @param epoch Epoch of the store that wrote the file, see `bucket_store_epoch`
+ * @param path
+ * @param result On success, a file-backed store for `path`
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the file does not exist
+ * @return err_ORAM__SNAPSHOT_INVALID if the file does not have the size of a store with `num_leaves` leaves and
+ *         this geometry
+ */
+error_t bucket_store_open_file_backed(size_t num_leaves, const bucket_geometry *geometry, u64 epoch, const char *path, bucket_store **result);
 void bucket_store_destroy(bucket_store *bucket_store);
 
+u64 bucket_store_epoch(const bucket_store *bucket_store);
+// Path of the backing file of a file-backed store, NULL for a store in anonymous memory
+const char *bucket_store_path(const bucket_store *bucket_store);
+
+/**
+ * @brief Persist the buckets to the file at `path`. If the store is backed by `path` this only flushes the mapping,
+ *        otherwise the written buckets are copied to a new sparse file. Marks every bucket clean.
+ *
+ * @param bucket_store
+ * @param path
+ * @param bytes_written On return, the bytes of the buckets copied to the file
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the file could not be written
+ * @return err_ORAM__SNAPSHOT_UNSUPPORTED for a tiered store
+ */
+error_t bucket_store_snapshot(bucket_store *bucket_store, const char *path, size_t *bytes_written);
+
+/**
+ * @brief Bring the file at `path`, written by the last `bucket_store_snapshot` or `bucket_store_checkpoint` of this
+ *        store, up to date by writing only the buckets written since then. Adjacent dirty buckets are written
+ *        together in file order. Marks every bucket clean.
+ *
+ * @param bucket_store
+ * @param path
+ * @param bytes_written On return, the bytes of the dirty buckets written
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the file could not be written
+ * @return err_ORAM__SNAPSHOT_UNSUPPORTED for a tiered store
+ */
+error_t bucket_store_checkpoint(bucket_store *bucket_store, const char *path, size_t *bytes_written);
+
+// Empty every bucket in the store in O(1) time by starting a new epoch. Buckets written in an earlier
+// epoch read as empty.
 void bucket_store_clear(bucket_store *bucket_store);
 
-typedef u64 block[2 + BLOCK_DATA_SIZE_QWORDS];
+/**
+ * @brief Add `levels` levels below the leaves, so that every leaf is the ancestor of `branching^levels` leaves of the
+ *        grown tree. Every bucket keeps its blocks and becomes the node `tree_path_id_after_growth` of the grown tree,
+ *        and the positions of its blocks are renumbered the same way, so a block stays on the path to every leaf below
+ *        its old leaf. The new leaves start empty.
+ *
+ *        Buckets are moved to the grown tree lazily: `bucket_store_fetch_path` moves the buckets of its path that have
+ *        not moved yet, and then as many more as the path has levels, in slot order, so the move is spread over the
+ *        next accesses and adds at most a path of copying to each. Snapshots and checkpoints finish the move first.
+ *
+ * @param bucket_store
+ * @param levels Levels to add, at least 1
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__GROW_UNSUPPORTED for a file-backed, tiered or arena store
+ */
+error_t bucket_store_grow(bucket_store *bucket_store, size_t levels);
+
+// A block of the default geometry. Blocks of other geometries are addressed as `u64*` with a stride of
+// `bucket_geometry_block_qwords`; the accessors below work on both.
+typedef u64 block[BLOCK_HEADER_QWORDS + BLOCK_DATA_SIZE_QWORDS];
 
 #define BLOCK_ID(b)        ((b)[0])
 #define BLOCK_POSITION(b)  ((b)[1])
@@ -48,32 +239,92 @@ struct block
 */
 
 u64 bucket_store_root(const bucket_store *bucket_store);
+bucket_geometry bucket_store_geometry(const bucket_store *bucket_store);
 size_t bucket_store_num_levels(const bucket_store *bucket_store);
 // The capacity of the LEAF bucket ids - internal buckets are for path ORAM use only
 size_t bucket_store_capacity_bytes(const bucket_store *bucket_store);
 size_t bucket_store_num_leaves(const bucket_store *bucket_store);
+// Bytes of buckets in the store, including the internal buckets
+size_t bucket_store_size_bytes(const bucket_store *bucket_store);
+
+/**
+ * @brief Read the disk buckets of `path` with one batch of I/O. For a tiered store, and for a store that is still
+ *        moving buckets after `bucket_store_grow`, this must be called before the buckets of a path are read. Waits
+ *        for the write-back of the previous path first. Is a no-op for a store without disk levels that is not growing.
+ *
+ * @param bucket_store
+ * @param path
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__STORAGE_IO if a read or an earlier write failed
+ */
+error_t bucket_store_fetch_path(bucket_store *bucket_store, const tree_path *path);
+
+/**
+ * @brief Submit the write-back of the disk buckets of `path` as one batch, after they were written with
+ *        `bucket_store_write_bucket_blocks`. Does not wait for the writes. Is a no-op for a store without disk levels.
+ *
+ * @param bucket_store
+ * @param path Path passed to the last `bucket_store_fetch_path`
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__STORAGE_IO if the writes could not be submitted
+ */
+error_t bucket_store_flush_path(bucket_store *bucket_store, const tree_path *path);
+
+/**
+ * @brief Start loading a bucket into the cache without waiting for it. The bucket is the same one that
+ *        `bucket_store_read_bucket_blocks` will read, so this reveals nothing the read does not.
+ *
+ * @param bucket_store
+ * @param bucket_id ID of a bucket on the current path
+ */
+void bucket_store_prefetch_bucket(bucket_store *bucket_store, u64 bucket_id);
+
+/**
+ * @brief Start loading the first cache line of each of the bottom `num_levels` buckets of `path`, so that the misses
+ *        for the whole path overlap instead of being taken one bucket at a time. Reveals nothing the reads of the
+ *        path do not.
+ *
+ * @param bucket_store
+ * @param path Path passed to the last `bucket_store_fetch_path`
+ * @param num_levels Number of levels, counted from the leaf, that are read from the bucket store
+ */
+void bucket_store_prefetch_path(bucket_store *bucket_store, const tree_path *path, size_t num_levels);
 
 /**
  * @brief Read all blocks, including empty ones, from a bucket into a buffer
  * 
  * @param bucket_store 
  * @param bucket_id ID of bucket to read
- * @param bucket_data buffer where blocks will be written
+ * @param bucket_data buffer where `blocks_per_bucket` blocks will be written: the blocks of the bucket, then empty
+ *        blocks for a bucket on a level with fewer blocks
  */
-void bucket_store_read_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, block bucket_data[BLOCKS_PER_BUCKET]);
+void bucket_store_read_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, u64 *bucket_data);
 
 /**
- * @brief Write a full set of blocks to a buffer. Must write `BLOCKS_PER_BUCKET` blocks, partial writes
+ * @brief Write a full set of blocks to a buffer. Must write `blocks_per_bucket` blocks, partial writes
  *        will produce undefined behavior. Pad with empty blocks if needed.
  * 
  * @param bucket_store 
  * @param bucket_id ID of bucket to write
- * @param bucket_data Array of `BLOCKS_PER_BUCKET` blocks that will be stored in `bucket_store`
+ * @param bucket_data `blocks_per_bucket` blocks. Only as many as the level of the bucket holds are stored, and the
+ *        others must be empty.
+ */
+void bucket_store_write_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, const u64 *bucket_data);
+
+/**
+ * @brief Blocks of a bucket on the current path, in place in the store, for an access that sorts its path without
+ *        staging it. A bucket not written since the last clear is first filled with empty blocks. The bucket counts as
+ *        written: every access writes its whole path back, so it must be fully rewritten before the access ends.
+ *
+ * @param bucket_store
+ * @param bucket_id ID of a bucket on the path passed to the last `bucket_store_fetch_path`
+ * @return u64* the blocks of the bucket, `bucket_geometry_level_blocks` of them, valid until the next
+ *         `bucket_store_fetch_path`
  */
-void bucket_store_write_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, const block bucket_data[BLOCKS_PER_BUCKET]);
+u64 *bucket_store_open_bucket(bucket_store *bucket_store, u64 bucket_id);
 
 // The number of 64-bit ints the block will hold
-size_t bucket_store_block_data_size(bucket_store *bucket_store);
+size_t bucket_store_block_data_size(const bucket_store *bucket_store);
 
 bool block_is_empty(block block);
 
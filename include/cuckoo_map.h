@@ -0,0 +1,104 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_CUCKOO_MAP_H
+#define CDS_CUCKOO_MAP_H 1
+
+#include "util.h"
+#include "statistics.h"
+
+// Key of an empty slot. Cannot be stored.
+#define CUCKOO_MAP_EMPTY_KEY UINT64_MAX
+
+// Defaults for the fields of `cuckoo_map_config` that are 0
+#define CUCKOO_MAP_DEFAULT_LOAD_FACTOR 0.8
+#define CUCKOO_MAP_DEFAULT_MAX_EVICTIONS 8
+#define CUCKOO_MAP_DEFAULT_STASH_SIZE 16
+
+typedef struct {
+    // Records per slot of the two tables when the map holds `capacity` records, at most 0.95.
+    double load_factor;
+    // Blocks visited by the eviction chain of every put.
+    size_t max_evictions;
+    // Records held by the stash.
+    size_t stash_size;
+} cuckoo_map_config;
+
+/**
+ * @brief An oblivious key-value map of fixed-size records stored in the blocks of an ORAM by bucketized cuckoo
+ * hashing. A record is `record_size_qwords` u64s whose first u64 is its key. There are two tables of blocks, and a key
+ * hashes, with a secret salt per table, to one block in each. A record is in one of its two blocks, or in a small stash
+ * of records that is kept outside the ORAM.
+ *
+ * A get or a remove accesses exactly the two blocks of its key with `oram_function_access` and scans the whole stash.
+ * A put does the same, then makes an eviction chain of exactly `max_evictions` accesses that alternate between the
+ * tables: the carried record takes an empty slot of its block if there is one, and otherwise takes the place of a
+ * random record, which is carried on to its block in the other table. Once the carried record is placed the remaining
+ * steps change nothing. A record still carried at the end of the chain goes to the stash, and a put that does not
+ * insert a new record instead carries a record out of the stash, so that the stash drains. The accessors visit every
+ * slot of a block, and every slot of the stash, with the same instructions, so the ORAM accesses of an operation depend
+ * only on its kind and reveal neither the key, nor whether it is present, nor where its record is. A `cuckoo_map` is
+ * not thread safe.
+ */
+typedef struct cuckoo_map cuckoo_map;
+
+/**
+ * @brief Create an empty map.
+ *
+ * @param capacity Number of records the map holds.
+ * @param record_size_qwords u64s per record, including the key. At most a block of the ORAM.
+ * @param config Sizes of the map, or NULL for the defaults.
+ * @param stash_overflow_size Size, in `block`s, of the overflow stash of the ORAM.
+ * @param getentropy entropy function used for the salts of the hashes, to pick evicted records and to randomize block
+ *        positions.
+ * @return cuckoo_map* Must be destroyed using `cuckoo_map_destroy`.
+ */
+cuckoo_map *cuckoo_map_create(size_t capacity, size_t record_size_qwords, const cuckoo_map_config *config,
+                              size_t stash_overflow_size, entropy_func getentropy);
+
+/**
+ * @brief Frees the map and its ORAM. Is a no-op if the input is null.
+ */
+void cuckoo_map_destroy(cuckoo_map *map);
+
+/**
+ * @brief Look up the record with key `key`.
+ *
+ * @param record Output, `record_size_qwords` u64s: the record, or all `CUCKOO_MAP_EMPTY_KEY` if there is none.
+ * @return err_SUCCESS if the key is present
+ * @return err_OHTABLE__GET__FAILURE if it is not
+ */
+error_t cuckoo_map_get(cuckoo_map *map, u64 key, u64 *record);
+
+/**
+ * @brief Insert a record, or replace the record with the same key.
+ *
+ * @param record `record_size_qwords` u64s, the key first
+ * @return err_SUCCESS if successful
+ * @return err_OHTABLE__PUT__FAILURE if the key is `CUCKOO_MAP_EMPTY_KEY`
+ * @return err_OHTABLE__TABLE_FULL if the key is new and the map holds `capacity` records or its stash is full. The
+ *         record is not inserted.
+ */
+error_t cuckoo_map_put(cuckoo_map *map, const u64 *record);
+
+/**
+ * @brief Remove the record with key `key`.
+ *
+ * @return err_SUCCESS if the key was present
+ * @return err_OHTABLE__GET__FAILURE if it was not
+ */
+error_t cuckoo_map_remove(cuckoo_map *map, u64 key);
+
+size_t cuckoo_map_capacity(const cuckoo_map *map);
+size_t cuckoo_map_num_items(const cuckoo_map *map);
+size_t cuckoo_map_record_size(const cuckoo_map *map);
+
+/**
+ * @brief Report statistics of the map and of its ORAM. `stash_items` is the number of records in the stash and
+ * `stashed_count` the number of puts that ended their eviction chain still carrying a record.
+ *
+ * @return const cuckoo_map_statistics* Valid until the next call on this map.
+ */
+const cuckoo_map_statistics *cuckoo_map_report_statistics(cuckoo_map *map);
+
+#endif // CDS_CUCKOO_MAP_H
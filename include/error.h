@@ -82,6 +82,12 @@ typedef enum {
   err_ORAM__ACCESS_UNALLOCATED_BLOCK,
   err_ORAM__POSITION_MAP_NOT_FOUND,
   err_ORAM__STASH_NOT_FOUND,
+  err_ORAM__SNAPSHOT_IO,
+  err_ORAM__SNAPSHOT_INVALID,
+  err_ORAM__SNAPSHOT_UNSUPPORTED,
+  err_ORAM__STORAGE_IO,
+  err_ORAM__GROW_UNSUPPORTED,
+  err_ORAM__PLAN_INFEASIBLE,
 
   err_OHTABLE__ = 900,
   err_OHTABLE__PUT__FAILURE,
@@ -103,6 +109,7 @@ typedef enum {
 
   err_SHARD__ = 1300,
   err_SHARD__DESTROYING,
+  err_SHARD__BATCH_OVERFLOW,
 
   err_ENCLAVE__TABLE_STATISTICS__ = 1400,
   err_ENCLAVE__TABLE_STATISTICS__RESPONSE_PB_NEW,
@@ -110,6 +117,9 @@ typedef enum {
   err_ENCLAVE__TABLE_STATISTICS__RESPONSE_PB_ALLOC_SHARDS,
   err_ENCLAVE__TABLE_STATISTICS__RESPONSE_PB_ALLOC_VALUES,
 
+  err_SERVER__ = 1500,
+  err_SERVER__ATTACH,
+
   err_TEST__ = 1000000,
   err_TEST__ASSERTION,
 
@@ -0,0 +1,90 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_OHTABLE_H
+#define CDS_OHTABLE_H 1
+
+#include "util.h"
+#include "statistics.h"
+
+// Key of an empty slot. Cannot be stored.
+#define OHTABLE_EMPTY_KEY UINT64_MAX
+
+// Blocks probed by every operation if 0 is passed to `ohtable_create`
+#define OHTABLE_DEFAULT_PROBE_BLOCKS 2
+
+/**
+ * @brief An oblivious hash table of fixed-size records stored in the blocks of an ORAM. A record is
+ * `record_size_qwords` u64s whose first u64 is its key. Records are placed by robin-hood hashing: a key hashes, with a
+ * secret salt, to a home block, and the record is stored in the window of `probe_blocks` consecutive blocks starting
+ * there, ahead of records that are closer to their own home.
+ *
+ * Every operation probes the whole window of its key with `oram_function_access`, and the accessors visit every slot
+ * of a block with the same instructions, so the ORAM accesses of an operation depend only on its kind: a get makes
+ * `probe_blocks` accesses and a put or a remove `2 * probe_blocks`. Neither the key, nor whether it is present, nor
+ * where its record is, is revealed. A put fails, and changes nothing, if the window of its key is full. An `ohtable` is
+ * not thread safe.
+ */
+typedef struct ohtable ohtable;
+
+/**
+ * @brief Create an empty table.
+ *
+ * @param capacity Number of records the table holds. It has twice as many slots, so that windows rarely fill up.
+ * @param record_size_qwords u64s per record, including the key. At most a block of the ORAM.
+ * @param probe_blocks Blocks in the window of a key, or 0 for `OHTABLE_DEFAULT_PROBE_BLOCKS`. A longer window makes
+ *        failed puts rarer and every operation slower.
+ * @param stash_overflow_size Size, in `block`s, of the overflow stash of the ORAM.
+ * @param getentropy entropy function used for the salt of the hash and to randomize block positions.
+ * @return ohtable* Must be destroyed using `ohtable_destroy`.
+ */
+ohtable *ohtable_create(size_t capacity, size_t record_size_qwords, size_t probe_blocks, size_t stash_overflow_size, entropy_func getentropy);
+
+/**
+ * @brief Frees the table and its ORAM. Is a no-op if the input is null.
+ */
+void ohtable_destroy(ohtable *ohtable);
+
+/**
+ * @brief Look up the record with key `key`.
+ *
+ * @param record Output, `record_size_qwords` u64s: the record, or all `OHTABLE_EMPTY_KEY` if there is none.
+ * @return err_SUCCESS if the key is present
+ * @return err_OHTABLE__GET__FAILURE if it is not
+ */
+error_t ohtable_get(ohtable *ohtable, u64 key, u64 *record);
+
+/**
+ * @brief Insert a record, or replace the record with the same key.
+ *
+ * @param record `record_size_qwords` u64s, the key first
+ * @return err_SUCCESS if successful
+ * @return err_OHTABLE__ROBIN_HOOD_UPSERT__RECORD_EMPTY if the key is `OHTABLE_EMPTY_KEY`
+ * @return err_OHTABLE__TABLE_FULL if the key is new and the table holds `capacity` records or the window of the key
+ *         has no empty slot. The table is unchanged.
+ */
+error_t ohtable_put(ohtable *ohtable, const u64 *record);
+
+/**
+ * @brief Remove the record with key `key`. The records that follow it in its window, up to the first empty slot or
+ * record at the start of its home block, move back by one slot, so that no tombstone is left.
+ *
+ * @return err_SUCCESS if the key was present
+ * @return err_OHTABLE__GET__FAILURE if it was not
+ */
+error_t ohtable_remove(ohtable *ohtable, u64 key);
+
+size_t ohtable_capacity(const ohtable *ohtable);
+size_t ohtable_num_items(const ohtable *ohtable);
+size_t ohtable_record_size(const ohtable *ohtable);
+
+/**
+ * @brief Report statistics of the table and of its ORAM. `max_trace_length` is the longest distance, in slots, from
+ * the start of a home block to the slot where a put ended its chain of displacements, and `total_displacement` the
+ * sum over the records of their distance from the start of their home block.
+ *
+ * @return const ohtable_statistics* Valid until the next call on this table.
+ */
+const ohtable_statistics *ohtable_report_statistics(ohtable *ohtable);
+
+#endif // CDS_OHTABLE_H
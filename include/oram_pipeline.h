@@ -0,0 +1,76 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_ORAM_PIPELINE_H
+#define CDS_ORAM_PIPELINE_H 1
+
+#include "util.h"
+#include "path_oram.h"
+
+#define ORAM_PIPELINE_MAX_STAGES 8
+
+/**
+ * @brief Executes accesses to a recursive ORAM with one thread per recursion level. A request starts at the deepest
+ * position map ORAM, which finds the leaf of the request's block in the level above and hands it on, so while level
+ * i serves request n, level i + 1 already serves request n + 1. Steady-state throughput is bounded by the slowest
+ * level rather than by the sum of all levels. Each level sees exactly the same sequence of accesses as it would
+ * under `oram_function_access`.
+ *
+ * While a pipeline exists, its ORAM must only be accessed through it. An `oram_pipeline` is not thread safe.
+ */
+typedef struct oram_pipeline oram_pipeline;
+
+/**
+ * @brief Create a pipeline over `oram` with one stage per recursion level.
+ * New block positions come from `oram_random_position` on each level, so they match how that level stores them.
+ *
+ * @param oram Not owned by the pipeline, and must outlive it.
+ * @param depth Maximum number of requests in flight. `oram_pipeline_submit` blocks while `depth` requests are in
+ *        flight.
+ * @return oram_pipeline* Must be destroyed using `oram_pipeline_destroy`.
+ */
+oram_pipeline *oram_pipeline_create(oram *oram, size_t depth);
+
+/**
+ * @brief Wait for all requests in flight, then stop the stages. Is a no-op if the input is null.
+ */
+void oram_pipeline_destroy(oram_pipeline *pipeline);
+
+/**
+ * @brief Number of stages, equal to the recursion depth of the ORAM's position map.
+ */
+size_t oram_pipeline_num_stages(const oram_pipeline *pipeline);
+
+/**
+ * @brief Queue an access that applies `accessor` to block `block_id`. Requests complete in submission order.
+ *
+ * @param pipeline
+ * @param block_id
+ * @param accessor runs on the thread of the data ORAM stage
+ * @param accessor_args must stay valid until `oram_pipeline_drain` returns
+ */
+void oram_pipeline_submit(oram_pipeline *pipeline, u64 block_id, accessor_func accessor, void *accessor_args);
+
+/**
+ * @brief Queue a read of block `block_id` into `buf`, a buffer of length `BLOCK_DATA_SIZE_QWORDS` that must stay
+ * valid until `oram_pipeline_drain` returns. `oram_pipeline_get` and `oram_pipeline_put` require the default block
+ * size; use `oram_pipeline_submit` for other geometries.
+ */
+void oram_pipeline_get(oram_pipeline *pipeline, u64 block_id, u64 buf[]);
+
+/**
+ * @brief Queue a write of `data`, a buffer of length `BLOCK_DATA_SIZE_QWORDS` that must stay valid until
+ * `oram_pipeline_drain` returns, to block `block_id`.
+ */
+void oram_pipeline_put(oram_pipeline *pipeline, u64 block_id, const u64 data[]);
+
+/**
+ * @brief Wait until every submitted request has completed.
+ *
+ * @param pipeline
+ * @return err_SUCCESS if every request since the last drain succeeded
+ * @return the error of the first request that failed otherwise, e.g. err_ORAM__ACCESS_UNALLOCATED_BLOCK
+ */
+error_t oram_pipeline_drain(oram_pipeline *pipeline);
+
+#endif // CDS_ORAM_PIPELINE_H
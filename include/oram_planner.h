@@ -0,0 +1,102 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_ORAM_PLANNER_H
+#define CDS_ORAM_PLANNER_H 1
+
+#include "util.h"
+#include "path_oram.h"
+
+/**
+ * @brief Time of one ORAM access, in nanoseconds, as a linear function of the work it does on every recursion level:
+ * the bytes of the buckets on the path, read and written, of the overflow stash or of a scan position map; the bytes
+ * of blocks moved by the compare-exchanges of the oblivious sort of the stash; the blocks of the stash times the
+ * buckets on the path, which is the work of assigning blocks to buckets; and a fixed cost per level. Fit it to a host
+ * with `oram_cost_model_calibrate`.
+ */
+typedef struct {
+    double ns_per_byte;
+    double ns_per_sort_byte;
+    double ns_per_assignment;
+    double ns_per_level;
+} oram_cost_model;
+
+// Typical of the fits of `oram_cost_model_calibrate` for ORAMs of 2^20 to 2^21 u64s on one x86-64 core
+#define ORAM_COST_MODEL_DEFAULT ((oram_cost_model){0.07, 0.066, 18.0, 500.0})
+
+/**
+ * @brief Fit a cost model to this host. Times accesses to ORAMs of `capacity_u64` u64s in a range of geometries and
+ * recursion depths and fits the coefficients by least squares, clamped to be non-negative. Takes about as long as
+ * writing every block of twelve such ORAMs twice.
+ *
+ * @param model Output
+ * @param capacity_u64 Capacity of the ORAMs to time. Timings of ORAMs that fit in the caches underestimate the cost
+ *        of larger ones.
+ * @param getentropy entropy function used to randomize block positions.
+ */
+void oram_cost_model_calibrate(oram_cost_model *model, size_t capacity_u64, entropy_func getentropy);
+
+typedef struct {
+    double mean_overflow;
+    size_t max_overflow;
+} oram_stash_simulation;
+
+/**
+ * @brief Simulate the positions of the blocks of a binary Path ORAM, without their data, to measure how many blocks
+ * its stash holds between accesses. The tree has `num_leaves` leaves, a power of two, and holds `num_leaves *
+ * load_factor` blocks. Every block is accessed once to place it, then `num_accesses` random blocks are accessed.
+ *
+ * @param num_leaves Leaves of the simulated tree. The stash size depends little on it beyond 2^10.
+ * @param blocks_per_bucket Z
+ * @param load_factor Blocks per leaf, from 1.0 to 3.0
+ * @param num_accesses Accesses to measure
+ * @param getentropy entropy function used to seed the simulation.
+ * @return The mean and the maximum number of blocks in the overflow stash after an access
+ */
+oram_stash_simulation oram_simulate_stash(size_t num_leaves, size_t blocks_per_bucket, double load_factor, size_t num_accesses, entropy_func getentropy);
+
+/**
+ * @brief A configuration chosen by `oram_plan_create`, with the size and throughput predicted for it.
+ */
+typedef struct {
+    size_t capacity_u64;
+    size_t stash_overflow_size;
+    // data ORAM, see `oram_config`
+    size_t blocks_per_bucket;
+    size_t block_size_bytes;
+    double load_factor;
+    // position map, see `oram_config`
+    size_t scan_threshold;
+    oram_posmap_level_config posmap_level;
+
+    size_t size_bytes;
+    size_t recursion_depth;
+    size_t access_bytes;
+    double accesses_per_second;
+} oram_plan;
+
+/**
+ * @brief Find the binary ORAM configuration with the highest predicted accesses per second that holds `capacity_u64`
+ * u64s in `budget_bytes`. Searches the block size, Z and load factor of the data ORAM, and the shape of the position
+ * map recursion: the block size and Z of the position map ORAMs and the scan threshold. Stash overflow sizes are the
+ * largest stashes seen by `oram_simulate_stash` for each Z and load factor, and the stash grows past them if needed.
+ *
+ * @param capacity_u64 The number of 64-bit integers the ORAM must hold.
+ * @param budget_bytes Bytes the ORAM may take: its buckets, stashes and position map at every recursion level.
+ * @param block_size_bytes Bytes of data per block of the data ORAM, or 0 to search for it.
+ * @param model Cost model, e.g. `ORAM_COST_MODEL_DEFAULT`.
+ * @param getentropy entropy function used to seed the stash simulations.
+ * @param plan Output
+ * @return err_SUCCESS if a configuration fits
+ * @return err_ORAM__PLAN_INFEASIBLE if none does
+ */
+error_t oram_plan_create(size_t capacity_u64, size_t budget_bytes, size_t block_size_bytes, const oram_cost_model *model, entropy_func getentropy, oram_plan *plan);
+
+/**
+ * @brief Create the ORAM described by a plan. See `oram_create_with_config`.
+ *
+ * @return oram* Must be destroyed using `oram_destroy`.
+ */
+oram *oram_create_from_plan(const oram_plan *plan, entropy_func getentropy);
+
+#endif // CDS_ORAM_PLANNER_H
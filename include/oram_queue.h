@@ -0,0 +1,90 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_ORAM_QUEUE_H
+#define CDS_ORAM_QUEUE_H 1
+
+#include "util.h"
+#include "path_oram.h"
+
+/**
+ * @brief Asynchronous access to an ORAM from many threads. Requests are pushed onto a lock-free multi-producer,
+ * single-consumer submission ring, and a dedicated worker thread, the only thread that touches the ORAM, drains it
+ * in batches of up to `batch_size` requests with `oram_function_access`. Completions are delivered through a
+ * callback, which runs on the worker, or a future that can be polled or waited on.
+ *
+ * While a queue exists, its ORAM must only be accessed through it. Submission is thread safe.
+ */
+typedef struct oram_queue oram_queue;
+
+/**
+ * @brief Called on the worker thread when a request completes. Must not block.
+ */
+typedef void (*oram_completion_func)(error_t err, void *completion_args);
+
+/**
+ * @brief Completion of a request, owned by the submitter. Must stay valid until it is done.
+ */
+typedef struct
+{
+    u32 state;
+    error_t err;
+} oram_future;
+
+/**
+ * @brief Create a queue and start its worker.
+ *
+ * @param oram Not owned by the queue, and must outlive it.
+ * @param capacity Number of requests the submission ring holds, a power of two.
+ * @param batch_size Maximum number of requests the worker takes from the ring at a time.
+ * @return oram_queue* Must be destroyed using `oram_queue_destroy`.
+ */
+oram_queue *oram_queue_create(oram *oram, size_t capacity, size_t batch_size);
+
+/**
+ * @brief Close the queue, complete every request that was submitted, and stop the worker. Is a no-op if the input
+ * is null.
+ */
+void oram_queue_destroy(oram_queue *queue);
+
+/**
+ * @brief Stop accepting requests. Requests already submitted still complete.
+ */
+void oram_queue_close(oram_queue *queue);
+
+/**
+ * @brief Submit an access that applies `accessor` to block `block_id`, and call `completion` when it is done. Spins
+ * while the ring is full.
+ *
+ * @param queue
+ * @param block_id
+ * @param accessor runs on the worker thread
+ * @param accessor_args must stay valid until the request completes
+ * @param completion may be NULL
+ * @param completion_args
+ * @return err_SUCCESS if the request was submitted
+ * @return err_QUEUE__CLOSED if the queue is closed
+ */
+error_t oram_queue_submit(oram_queue *queue, u64 block_id, accessor_func accessor, void *accessor_args, oram_completion_func completion, void *completion_args);
+
+/**
+ * @brief Submit an access like `oram_queue_submit`, and complete `future` when it is done.
+ *
+ * @return err_SUCCESS if the request was submitted
+ * @return err_QUEUE__CLOSED if the queue is closed. `future` is not touched.
+ */
+error_t oram_queue_submit_future(oram_queue *queue, u64 block_id, accessor_func accessor, void *accessor_args, oram_future *future);
+
+/**
+ * @brief True if the request of `future` has completed.
+ */
+bool oram_future_done(const oram_future *future);
+
+/**
+ * @brief Wait until the request of `future` has completed.
+ *
+ * @return the result of `oram_function_access` for the request
+ */
+error_t oram_future_wait(oram_future *future);
+
+#endif // CDS_ORAM_QUEUE_H
@@ -0,0 +1,108 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_ORAM_SERVER_H
+#define CDS_ORAM_SERVER_H 1
+
+#include "util.h"
+#include "path_oram.h"
+
+/**
+ * @brief Serves one ORAM to other processes on the same host. The server owns the `oram` and a shared memory region
+ * (a sealed memfd) that holds a submission ring and `num_slots` request slots, each with room for one block. A client
+ * maps the region, claims a slot, writes its request there, pushes the slot onto the ring and waits on the slot's
+ * futex. The server thread drains the ring in batches and moves block payloads directly between the ORAM and the
+ * slots, so a read lands in memory the client has mapped without another copy.
+ *
+ * While a server exists, its ORAM must only be accessed through it.
+ */
+typedef struct oram_server oram_server;
+typedef struct oram_client oram_client;
+
+/**
+ * @brief A claimed request slot. `data` points into the shared region.
+ */
+typedef struct
+{
+    u64 *data;
+    size_t index;
+} oram_client_slot;
+
+/**
+ * @brief Create a server for `oram` and start its thread.
+ *
+ * @param oram Not owned by the server, and must outlive it. Must have the default block size,
+ *        `BLOCK_DATA_SIZE_QWORDS`, which is the size of a slot.
+ * @param num_slots Number of requests that can be in flight at once, a power of two.
+ * @param batch_size Maximum number of requests the server takes from the ring at a time.
+ * @return oram_server* Must be destroyed using `oram_server_destroy`.
+ */
+oram_server *oram_server_create(oram *oram, size_t num_slots, size_t batch_size);
+
+/**
+ * @brief Stop accepting requests, complete those in flight, and stop the server thread. Requests that clients are
+ * still submitting get a grace period of 100ms, after which they are abandoned, so a client that dies or misbehaves
+ * cannot keep the server from stopping. Clients must be detached before the ORAM is destroyed. Is a no-op if the input
+ * is null.
+ */
+void oram_server_destroy(oram_server *server);
+
+/**
+ * @brief File descriptor of the shared region, to be handed to client processes by `fork` or over a unix socket
+ * (`SCM_RIGHTS`). It is close-on-exec and owned by the server.
+ */
+int oram_server_fd(const oram_server *server);
+
+/**
+ * @brief Map the region of a server.
+ *
+ * @param fd descriptor from `oram_server_fd`. Not owned by the client.
+ * @param client set to the new client, which must be detached using `oram_client_detach`.
+ * @return err_SUCCESS
+ * @return err_SERVER__ATTACH if `fd` is not the region of a server
+ */
+error_t oram_client_attach(int fd, oram_client **client);
+
+/**
+ * @brief Unmap the region. Is a no-op if the input is null.
+ */
+void oram_client_detach(oram_client *client);
+
+/**
+ * @brief Number of blocks in the served ORAM.
+ */
+size_t oram_client_capacity_blocks(const oram_client *client);
+
+/**
+ * @brief Claim a request slot, waiting for one to be released if all are in use.
+ *
+ * @return err_SUCCESS
+ * @return err_QUEUE__CLOSED if the server is shutting down
+ */
+error_t oram_client_acquire(oram_client *client, oram_client_slot *slot);
+
+/**
+ * @brief Release a slot claimed with `oram_client_acquire`.
+ */
+void oram_client_release(oram_client *client, oram_client_slot *slot);
+
+/**
+ * @brief Access block `block_id` through a claimed slot and wait for the result. If `write` is set, the block is
+ * replaced with `slot->data`. Either way `slot->data` then holds the previous contents of the block.
+ *
+ * @return the result of `oram_function_access` on the server
+ * @return err_QUEUE__CLOSED if the server is shutting down
+ */
+error_t oram_client_access(oram_client *client, oram_client_slot *slot, u64 block_id, bool write);
+
+/**
+ * @brief Read block `block_id` into `buf`.
+ */
+error_t oram_client_get(oram_client *client, u64 block_id, u64 buf[]);
+
+/**
+ * @brief Write `data` to block `block_id`.
+ */
+error_t oram_client_put(oram_client *client, u64 block_id, const u64 data[]);
+
+#endif // CDS_ORAM_SERVER_H
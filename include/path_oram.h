@@ -6,12 +6,124 @@
 
 #include "util.h"
 #include "statistics.h"
+#include "arena.h"
 
 // typedef struct oram oram;
-typedef u64 oram[9];
+typedef u64 oram[17];
 
 typedef error_t (*accessor_func)(u64* rw_block_data, void* args);
 
+/**
+ * @brief Parameters for one recursion level of a position map. A zero field keeps the default: the default geometry,
+ * a binary tree and the same Z on every level (see `oram_config`), and the stash overflow size of the ORAM one level
+ * up.
+ */
+typedef struct {
+    size_t bucket_size;
+    size_t blocks_per_bucket;
+    size_t block_size_bytes;
+    size_t branching;
+    size_t leaf_levels;
+    size_t leaf_blocks_per_bucket;
+    size_t stash_overflow_size;
+} oram_posmap_level_config;
+
+/**
+ * @brief Optional creation parameters for an ORAM. A zero-initialized `oram_config` gives the same ORAM as `oram_create`.
+ */
+typedef struct {
+    /**
+     * @brief Number of levels, counted from the root, that are kept in a dense, cache-resident treetop owned by the
+     * stash instead of in the bucket store. These levels are on every path, so each access saves this many bucket
+     * store reads and writes. Clamped to the height of the tree.
+     */
+    size_t treetop_levels;
+
+    /**
+     * @brief If not NULL, a directory, created if needed, where the bucket store is kept in a file that is mapped
+     * shared instead of in anonymous memory. Position map ORAMs are stored in subdirectories. An `oram_snapshot` to
+     * this directory only has to flush the mapping and write the metadata.
+     */
+    const char *storage_dir;
+
+    /**
+     * @brief If not NULL, the bucket store is tiered: the top `memory_levels` levels stay in memory and the levels
+     * below them are kept in this file, ideally on local NVMe, and accessed with direct I/O. The disk buckets of a
+     * path are read in one batch as soon as the leaf is known and written back in one batch after the access.
+     * Only the data ORAM is tiered, not its position map ORAMs. Cannot be combined with `storage_dir`, and
+     * `oram_snapshot` is not supported.
+     */
+    const char *tier_file;
+    size_t memory_levels;
+
+    /**
+     * @brief Position maps with more entries than this are backed by an ORAM rather than a linear scan. 0 means
+     * `SCAN_THRESHOLD`. Applies to every recursion level; lowering it gives deeper recursion for a given capacity.
+     */
+    size_t scan_threshold;
+
+    /**
+     * @brief Sort each path in place in the bucket store instead of copying it into the stash and back. Blocks move
+     * directly between their buckets and the overflow stash, which halves the payload memory traffic of an access.
+     * Applies to the position map ORAMs too. Not recorded in snapshots: a restored ORAM stages its paths.
+     */
+    bool zero_copy_path;
+
+    /**
+     * @brief Geometry of the data ORAM's buckets: bytes per bucket (a multiple of 64, e.g. 4 KB, 8 KB or 2 MB), blocks
+     * per bucket (Z) and bytes of data per block (a multiple of 8), which sets `oram_block_size`. 0 means the default,
+     * and a zero size is derived from the others as in `bucket_geometry_create`. Small blocks with a larger Z suit
+     * small tables, since every access moves a whole path of buckets, while large blocks suit large values. Position
+     * map ORAMs are configured by `posmap_levels`. Recorded in snapshots.
+     */
+    size_t bucket_size;
+    size_t blocks_per_bucket;
+    size_t block_size_bytes;
+
+    /**
+     * @brief Blocks per leaf of the data ORAM, from 1.0 to 3.0. 0 means 2. A higher load factor takes fewer buckets
+     * for the same capacity but needs a larger Z or a larger stash, see `oram_simulate_stash`. Position map ORAMs keep
+     * the default. Not recorded in snapshots: the tree is.
+     */
+    double load_factor;
+
+    /**
+     * @brief Children per internal bucket, a power of two up to `BUCKET_MAX_BRANCHING`. 0 means 2. A k-ary tree has
+     * about log2(k) times fewer levels, so an access touches fewer, larger buckets, e.g. 2 MB pages or the read unit
+     * of an SSD. It has far fewer internal buckets for the same number of leaves, so Z must grow with k to keep the
+     * stash small: about 3k/2 blocks per bucket. The treetop then holds 1 + k + ... + k^(treetop_levels - 1) buckets.
+     * Recorded in snapshots.
+     */
+    size_t branching;
+
+    /**
+     * @brief Number of levels, counted from the leaves, whose buckets hold `leaf_blocks_per_bucket` blocks instead of
+     * `blocks_per_bucket`, in buckets just large enough for them. 0 means every level holds `blocks_per_bucket`. The
+     * bottom levels have most of the buckets but take few of the blocks evicted from the stash, so e.g. Z = 2 on the
+     * bottom three levels under Z = 4 takes 45% less bucket memory than Z = 4 on every level, and less than Z = 3,
+     * with the stash of Z = 4. See `bench_path_oram leafz`. Recorded in snapshots.
+     */
+    size_t leaf_levels;
+    size_t leaf_blocks_per_bucket;
+
+    /**
+     * @brief Parameters for the ORAMs that back the position map: entry 0 for the position map of this ORAM, entry 1
+     * for the position map of that ORAM, and so on. Levels past the last entry use the last entry, and with no entries
+     * every level has the default geometry and this ORAM's stash overflow size. A position lookup only needs one u64
+     * of a block, so small blocks move far fewer bytes per access than the default, at the cost of more levels. See
+     * `oram_access_bytes`. Not retained after the call.
+     */
+    const oram_posmap_level_config *posmap_levels;
+    size_t num_posmap_levels;
+
+    /**
+     * @brief If not NULL, every component of the ORAM and of its position map ORAMs is allocated from this arena
+     * instead of the heap, see `oram_create_in`. Retained by the ORAM. Cannot be combined with `storage_dir` or
+     * `tier_file`.
+     */
+    oram_arena *arena;
+} oram_config;
+
 /**
  * @brief Uses available memory to create a new recursive ORAM block store. Implements a modified version of the
  * Path ORAM algorithm (https://eprint.iacr.org/2013/280.pdf) with an ORAM-backed
@@ -31,6 +143,11 @@ oram* oram_create_for_available_mem(size_t available_bytes, double load_factor,
  * Path ORAM algorithm (https://eprint.iacr.org/2013/280.pdf) with an ORAM-backed
  * position map.
  *
+ * The tree has one leaf for every two blocks, see `oram_config.load_factor`. When that is not a power of two the bottom
+ * of the tree is pruned to those leaves, so memory tracks the capacity instead of doubling at each power of two.
+ * The Jasmin implementation in `jasmin/path_oram.jinc` only handles full binary trees with leaf-valued position maps,
+ * and cannot access an ORAM created here.
+ *
  * @param capacity_u64 The number of 64-bit integers the ORAM must hold. Actual
  * capacity will usually be higher.
  * @param stash_overflow_size Size, in `block`s, of the overflow stash for this ORAM. 
@@ -39,12 +156,87 @@ oram* oram_create_for_available_mem(size_t available_bytes, double load_factor,
  */
 oram *oram_create(size_t capacity_u64, size_t stash_overfow_size, entropy_func getentropy);
 
+/**
+ * @brief Creates a new recursive ORAM block store with non-default parameters. See `oram_create`.
+ *
+ * @param capacity_u64 The number of 64-bit integers the ORAM must hold. Actual
+ * capacity will usually be higher.
+ * @param stash_overflow_size Size, in `block`s, of the overflow stash for this ORAM.
+ * @param config Creation parameters. Not retained after the call.
+ * @param getentropy entropy function used to randomize block positions.
+ * @return oram* Opaque pointer to an ORAM object. Must be destroyed using `oram_destroy`.
+ */
+oram *oram_create_with_config(size_t capacity_u64, size_t stash_overflow_size, const oram_config *config, entropy_func getentropy);
+
+/**
+ * @brief Creates an ORAM as `oram_create_with_config` does, with its buckets, stash, position map and every recursion
+ * level of the position map placed in `arena`: one region, e.g. a huge page mapping or memory pinned or registered by
+ * the caller, with no heap allocation per component. The layout is fixed at creation, so the ORAM cannot grow. If a
+ * stash outgrows its overflow size it moves to the heap, as do the free block set and snapshot paths, which are not
+ * needed to serve accesses. `oram_destroy` frees those and leaves the arena to the caller.
+ *
+ * @param arena Arena with at least `oram_arena_size_bytes` bytes left. Must outlive the ORAM.
+ * @param config Creation parameters, as for `oram_create_with_config`. Its arena is ignored. Not retained.
+ * @return oram* Must be destroyed using `oram_destroy` before the arena is released.
+ */
+oram *oram_create_in(oram_arena *arena, size_t capacity_u64, size_t stash_overflow_size, const oram_config *config, entropy_func getentropy);
+
+/**
+ * @brief Bytes of an arena that `oram_create_in` takes for these parameters. Exact: the ORAM takes no more and no less.
+ */
+size_t oram_arena_size_bytes(size_t capacity_u64, size_t stash_overflow_size, const oram_config *config);
+
 /**
  * @brief Frees resources held by the ORAM object. Is a no-op if the input is null.
  *
  */
 void oram_destroy(oram *);
 
+/**
+ * @brief Persist an ORAM to the directory `dir`, creating it if needed: the bucket store, the stash overflow and
+ * treetop, the allocation bound, the statistics and the position map, including all of its recursion levels.
+ *
+ * If the ORAM was created with `storage_dir` equal to `dir`, or restored from `dir`, its buckets already live there
+ * and are flushed instead of copied. In that case the next access marks the snapshot as no longer restorable, so take
+ * a new snapshot before a planned shutdown.
+ *
+ * @param oram
+ * @param dir
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the snapshot could not be written
+ */
+error_t oram_snapshot(oram *oram, const char *dir);
+
+/**
+ * @brief Update the snapshot in `dir` by writing only the buckets written since the last snapshot or checkpoint of
+ * this ORAM, together with fresh metadata. The cost is proportional to the number of accesses since then rather than
+ * to the size of the ORAM. If `dir` does not hold this ORAM's last snapshot or checkpoint, this is `oram_snapshot`.
+ *
+ * The buckets are updated in place: if this fails or is interrupted, the snapshot in `dir` can no longer be restored
+ * until a later checkpoint succeeds.
+ *
+ * @param oram
+ * @param dir
+ * @param bucket_bytes_written On return, the number of bucket bytes written for all recursion levels
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the snapshot could not be written
+ */
+error_t oram_checkpoint_incremental(oram *oram, const char *dir, size_t *bucket_bytes_written);
+
+/**
+ * @brief Restore an ORAM from a snapshot written by `oram_snapshot`. The bucket files are mapped shared, so this
+ * takes time proportional to the stash and scan position map rather than the size of the ORAM: buckets are faulted
+ * in on demand, and accesses on the restored ORAM write back to the snapshot's bucket files.
+ *
+ * @param dir Directory passed to `oram_snapshot`
+ * @param getentropy entropy function used to randomize block positions.
+ * @param result On success, the restored ORAM. Must be destroyed using `oram_destroy`.
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the snapshot files could not be opened
+ * @return err_ORAM__SNAPSHOT_INVALID if the snapshot is malformed or was modified after it was taken
+ */
+error_t oram_restore(const char *dir, entropy_func getentropy, oram **result);
+
 /**
  * @brief Deallocate blocks and clear all of the data in an ORAM
  *
@@ -68,6 +260,31 @@ size_t oram_block_size(const oram *);
  */
 size_t oram_capacity_blocks(const oram *oram);
 
+/**
+ * @brief Whether a block is allocated, i.e. whether `oram_function_access` would access it rather than fail with
+ * err_ORAM__ACCESS_UNALLOCATED_BLOCK.
+ *
+ * @param oram
+ * @param block_id
+ */
+bool oram_block_allocated(const oram *oram, u64 block_id);
+
+/**
+ * @brief Raise the capacity of an ORAM without rebuilding it. If the tree is too small for `capacity_blocks`, levels
+ * are added below its leaves, each leaf becoming the parent of `branching` new leaves, until there is a leaf for
+ * every two blocks again. Buckets move to their node in the grown tree lazily: each access moves the buckets of its
+ * path, and as many more, so the cost is spread over the accesses that follow. Positions need not be rewritten, see
+ * `oram_num_leaves`. The position map grows with the ORAM, recursively. Blocks and their ids are unchanged, and the
+ * new blocks are allocated as usual. The next `oram_checkpoint_incremental` writes a full snapshot.
+ *
+ * @param oram
+ * @param capacity_blocks New capacity, at least `oram_capacity_blocks(oram)`
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__GROW_UNSUPPORTED if the buckets are in a file, as for a `storage_dir`, a `tier_file` or a
+ *         restored ORAM, or in an arena. The ORAM is unchanged.
+ */
+error_t oram_grow(oram *oram, size_t capacity_blocks);
+
 /**
  * @brief Read a block of data from an ORAM.
  *
@@ -114,7 +331,67 @@ error_t oram_put_partial(oram *, u64 block_id, size_t start, size_t len, u64 dat
 error_t oram_function_access(oram* oram, u64 block_id, accessor_func accessor, void* accessor_args);
 
 /**
- * @brief Allocate an ORAM block and get the `block_id` for the new block.
+ * @brief Like `oram_function_access`, but without the position map lookup. This lets a caller, such as
+ * `oram_pipeline`, drive the recursion levels itself.
+ *
+ * @param oram
+ * @param block_id
+ * @param position current position of the block, as read from this ORAM's position map
+ * @param new_position position of the block after the access, from `oram_random_position`, already stored in this
+ *        ORAM's position map
+ * @param accessor
+ * @param accessor_args
+ * @return error_t
+ */
+error_t oram_function_access_at(oram *oram, u64 block_id, u64 position, u64 new_position, accessor_func accessor, void *accessor_args);
+
+#define ORAM_MAX_INTERLEAVED 16
+
+/**
+ * @brief Perform one access in each of `count` distinct ORAMs on the calling thread, interleaved so that the cache
+ * misses of one access overlap with the work of the others. The bucket reads of all paths proceed one level at a
+ * time, and the next bucket of each path is prefetched while the other paths are read. Each ORAM sees exactly the
+ * accesses it would see under `oram_function_access`. Meant for hosts with many small independent ORAMs, e.g. one
+ * per tenant or shard.
+ *
+ * @param count number of accesses, at most `ORAM_MAX_INTERLEAVED`
+ * @param orams `count` distinct ORAMs
+ * @param block_ids block to access in each ORAM
+ * @param accessor applied to the block of each access
+ * @param accessor_args arguments for the accessor of each access
+ * @return err_SUCCESS if every access succeeded
+ * @return err_ORAM__ACCESS_UNALLOCATED_BLOCK if any block is not allocated. No access is performed.
+ */
+error_t oram_function_access_interleaved(size_t count, oram *orams[], const u64 block_ids[], accessor_func accessor, void *accessor_args[]);
+
+/**
+ * @brief Number of leaves of the tree. Not necessarily a power of two. The position map does not hold leaves but
+ * uniformly random 64-bit positions, each on the leaf it scales to in `[0, oram_num_leaves)`. When the tree grows, a
+ * position scales to a uniformly random new leaf below its old one, which is on the path the block is found on.
+ */
+size_t oram_num_leaves(const oram *oram);
+
+/**
+ * @brief Leaves of the tree `oram_create_with_config` builds for `num_blocks` blocks at a `load_factor` from 1.0 to
+ * 3.0: ceil(num_blocks / load_factor), and at least 1.
+ */
+size_t oram_num_leaves_for_blocks(size_t num_blocks, double load_factor);
+
+/**
+ * @brief A new position for a block, uniformly random, to store in the position map. See `oram_num_leaves`.
+ */
+u64 oram_random_position(oram *oram);
+
+/**
+ * @brief Bytes of memory an access moves, summed over this ORAM and every recursion level of its position map: each
+ * bucket on the path is read and written, including the treetop levels, and a scan position map is read and written
+ * in full.
+ */
+size_t oram_access_bytes(const oram *oram);
+
+/**
+ * @brief Allocate an ORAM block and get the `block_id` for the new block. The lowest freed block is reused before
+ * any block above every allocated block, so block ids stay compact.
  *
  * @return u64 The `block_id` of the allocated block. If the allocation fails, returns
  * UINT64_MAX.
@@ -122,7 +399,8 @@ error_t oram_function_access(oram* oram, u64 block_id, accessor_func accessor, v
 u64 oram_allocate_block(oram *);
 
 /**
- * @brief Allocate multiple blocks at once.
+ * @brief Allocate multiple blocks at once. The blocks are taken above every allocated block; freed blocks below them
+ * are only reused by `oram_allocate_block`.
  *
  * @param num_blocks Number of blocks to allocate.
  * @return u64 The `block_id` of the first allocated block. All blocks up to
@@ -131,6 +409,26 @@ u64 oram_allocate_block(oram *);
  */
 u64 oram_allocate_contiguous(oram *, size_t num_blocks);
 
+/**
+ * @brief Free an allocated block so that its id can be allocated again. The block is removed from the tree with one
+ * access that is indistinguishable from an `oram_get`, so a later allocation of the id reads as a new block: all
+ * bits set. Freeing the highest allocated blocks lowers the bound that `oram_allocate_contiguous` allocates from.
+ *
+ * @param block_id
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__ACCESS_UNALLOCATED_BLOCK if the block is not allocated
+ */
+error_t oram_free_block(oram *oram, u64 block_id);
+
+/**
+ * @brief Free the blocks `first_block_id`, ..., `first_block_id + num_blocks - 1`, for example a range from
+ * `oram_allocate_contiguous`. Performs one access per block.
+ *
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__ACCESS_UNALLOCATED_BLOCK if any block in the range is not allocated. No block is freed.
+ */
+error_t oram_free_range(oram *oram, u64 first_block_id, size_t num_blocks);
+
 /**
  * @brief Collect statistics about the health of this ORAM
  * 
@@ -142,13 +440,14 @@ const oram_statistics* oram_report_statistics(oram* oram);
 size_t oram_max_stash_size(const oram* oram);
 
 /**
- * @brief Number of bytes needed to hold an ORAM with a given number of levels and blocks.
+ * @brief Number of bytes needed to hold an ORAM with a given number of leaves and blocks, counting only the buckets
+ * of a pruned tree.
  * 
- * @param num_levels
+ * @param num_leaves
  * @param num_blocks 
  * @return size_t 
  */
-size_t oram_size_bytes(size_t num_levels, size_t num_blocks, size_t stash_overflow_size);
+size_t oram_size_bytes(size_t num_leaves, size_t num_blocks, size_t stash_overflow_size);
 
 #ifdef IS_TEST
 
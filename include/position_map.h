@@ -9,22 +9,71 @@
 #define POSITION_MAP_NOT_PRESENT UINT64_MAX
 #define SCAN_THRESHOLD (1 << 14)
 
-typedef u64 position_map[6];
+typedef u64 position_map[8];
 
 /**
  * @brief The `position_map` is used internally by an ORAM to keep track of the current physical
  * location of ORAM blocks.
  *
+ * The entries of a map created by `oram_create` are uniform 64-bit positions, which the ORAM maps to leaves. The Jasmin
+ * implementation in `jasmin/position_map.jinc` still stores leaves drawn as a power of two and cannot read these maps.
+ *
  * @param num_blocks size of the domain of the map - the number of blocks in an ORAM
- * @param num_positions size of the range of the map - number of leaves in the bucket store
+ * @param num_positions size of the range of the map - entries are random in `[0, num_positions)`
  * @param overflow_stash_size size of overflow stash, in blocks, to be used by any ORAM built to back this position map.
  * @return position_map*
  */
 position_map *position_map_create(size_t num_blocks, size_t num_positions, size_t overflow_stash_size, entropy_func getentropy);
+
+/**
+ * @brief Create a position map whose backing ORAM, if it needs one, is created with `config`. See `position_map_create`.
+ *
+ * @param config Creation parameters for the backing ORAM. Not retained after the call, except for its arena: the map
+ *        and its backing ORAM are allocated from `config->arena` if it is not NULL, and the map then cannot grow.
+ */
+position_map *position_map_create_with_config(size_t num_blocks, size_t num_positions, size_t overflow_stash_size, const oram_config *config, entropy_func getentropy);
 void position_map_destroy(position_map *position_map);
 
+/**
+ * @brief Write a position map to a snapshot file. A scan map is written to `file` directly. An ORAM-backed map
+ * writes its parameters to `file` and snapshots its ORAM, recursively, to the directory `oram_dir`.
+ *
+ * @param position_map
+ * @param file
+ * @param oram_dir Directory for the snapshot of the backing ORAM. Unused for a scan map.
+ * @param incremental Use `oram_checkpoint_incremental` rather than `oram_snapshot` for the backing ORAM
+ * @param bucket_bytes_written The bucket bytes written for the backing ORAM are added to this
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the snapshot could not be written
+ */
+error_t position_map_snapshot(const position_map *position_map, FILE *file, const char *oram_dir, bool incremental, size_t *bucket_bytes_written);
+
+/**
+ * @brief Create a position map from data written by `position_map_snapshot`.
+ *
+ * @param file
+ * @param oram_dir Directory passed to `position_map_snapshot`
+ * @param getentropy entropy function used to randomize block positions.
+ * @param result On success, the restored position map. Must be destroyed using `position_map_destroy`.
+ * @return error_t
+ */
+error_t position_map_restore(FILE *file, const char *oram_dir, entropy_func getentropy, position_map **result);
+
 size_t position_map_capacity(const position_map *position_map);
 
+/**
+ * @brief Raise the number of blocks of a position map for `oram_grow`. Existing entries are kept, and the new ones
+ * are random positions, as for a new map. A scan map that would exceed `SCAN_THRESHOLD` is moved into a new ORAM
+ * map with the default configuration, and the ORAM of an ORAM map grows with `oram_grow` if it is too small.
+ *
+ * @param position_map
+ * @param num_blocks New size of the domain of the map, at least `position_map_capacity(position_map)`
+ * @param overflow_stash_size Size of the overflow stash of an ORAM created to back this map
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__GROW_UNSUPPORTED if the backing ORAM cannot grow, or the map is in an arena
+ */
+error_t position_map_grow(position_map *position_map, size_t num_blocks, size_t overflow_stash_size);
+
 /**
  * @brief Get the position of a block
  *
@@ -48,6 +97,29 @@ error_t position_map_get(const position_map *position_map, u64 block_id, u64* po
  */
 error_t position_map_read_then_set(position_map *position_map, u64 block_id, u64 position, u64 *prev_position);
 
+/**
+ * @brief The position map of an ORAM, for callers that drive the recursion levels themselves with
+ * `oram_function_access_at`. Still owned by the ORAM.
+ */
+position_map *oram_get_position_map(const oram *oram);
+
+/**
+ * @brief The ORAM that backs a position map, or NULL for a scan map. Still owned by the position map.
+ */
+oram *position_map_oram(const position_map *position_map);
+
+/**
+ * @brief For an ORAM-backed position map, the block of the backing ORAM that holds the position of `block_id`. The
+ * position is at `block_id % oram_block_size` in that block.
+ */
+u64 position_map_block_for_index(const position_map *position_map, u64 block_id);
+
+/**
+ * @brief Turn an entry read from the backing ORAM of a position map into a position. An entry that has never been
+ * set is replaced with a fresh random position.
+ */
+u64 position_map_resolve_position(const position_map *position_map, u64 stored_position);
+
 /**
  * @brief Number of position-map levels (including this level) needed to implement this position map. 
  * 
@@ -66,6 +138,9 @@ const oram_statistics* position_map_oram_statistics(position_map* position_map);
  */
 size_t position_map_size_bytes(size_t num_blocks, size_t stash_overflow_size);
 
+// Bytes of an arena that `position_map_create_with_config` takes with `config`, see `oram_arena_size_bytes`
+size_t position_map_arena_bytes(size_t num_blocks, size_t overflow_stash_size, const oram_config *config);
+
 #ifdef IS_TEST
 int private_position_map_tests();
 #endif // IS_TEST
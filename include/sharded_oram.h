@@ -0,0 +1,109 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_SHARDED_ORAM_H
+#define CDS_SHARDED_ORAM_H 1
+
+#include "util.h"
+#include "bucket.h"
+
+/**
+ * @brief An ORAM whose logical block space is partitioned across independent `oram` shards, each owned by its own
+ * worker thread. Block `b` lives in shard `b % num_shards`. Every logical access performs exactly one ORAM access in
+ * every shard - a real one in the shard that holds the block and a dummy one, to a random block, in the others - so
+ * the shard that holds a block is not revealed. Batches of requests are routed to the shards with oblivious sorts, so
+ * that every shard serves a padded batch of the same fixed size in parallel. A `sharded_oram` is not thread safe.
+ */
+typedef struct sharded_oram sharded_oram;
+
+/**
+ * @brief One request in a batch. `data` holds the block to write for a put and, after the batch, the previous
+ * contents of the block for both puts and gets. Whether a request is a put is not revealed.
+ */
+typedef struct
+{
+    u64 block_id;
+    bool is_put;
+    u64 data[BLOCK_DATA_SIZE_QWORDS];
+} sharded_oram_request;
+
+/**
+ * @brief Create a sharded ORAM with `num_shards` shards whose workers are not pinned.
+ *
+ * @param capacity_u64 The number of 64-bit integers the ORAM must hold. Actual capacity will usually be higher.
+ * @param num_shards Number of shards and worker threads.
+ * @param stash_overflow_size Size, in `block`s, of the overflow stash of each shard.
+ * @param getentropy entropy function used to randomize block positions and dummy accesses.
+ * @return sharded_oram* Must be destroyed using `sharded_oram_destroy`.
+ */
+sharded_oram *sharded_oram_create(size_t capacity_u64, size_t num_shards, size_t stash_overflow_size, entropy_func getentropy);
+
+/**
+ * @brief Create a NUMA-aware sharded ORAM with one shard per NUMA node that has CPUs. Each worker is pinned to the
+ * CPUs of its node and binds its memory policy to that node before it creates its shard, so the bucket store, stash
+ * and position map of a shard are allocated on the node that serves it. Falls back to a single unpinned shard if
+ * the topology cannot be read.
+ *
+ * @param capacity_u64 The number of 64-bit integers the ORAM must hold. Actual capacity will usually be higher.
+ * @param stash_overflow_size Size, in `block`s, of the overflow stash of each shard.
+ * @param getentropy entropy function used to randomize block positions and dummy accesses.
+ * @return sharded_oram* Must be destroyed using `sharded_oram_destroy`.
+ */
+sharded_oram *sharded_oram_create_numa(size_t capacity_u64, size_t stash_overflow_size, entropy_func getentropy);
+
+/**
+ * @brief Stop the workers and free all shards. Is a no-op if the input is null.
+ */
+void sharded_oram_destroy(sharded_oram *sharded_oram);
+
+size_t sharded_oram_num_shards(const sharded_oram *sharded_oram);
+
+/**
+ * @brief Number of blocks this ORAM holds. Every block is allocated.
+ */
+size_t sharded_oram_capacity_blocks(const sharded_oram *sharded_oram);
+
+/**
+ * @brief Padded batch size for each shard such that a batch of `num_requests` requests for uniformly distributed
+ * blocks overflows any one shard with probability below 2^-40. Never more than `num_requests`, which cannot overflow.
+ */
+size_t sharded_oram_shard_batch_size(size_t num_requests, size_t num_shards);
+
+/**
+ * @brief Serve a batch of requests. Requests are obliviously sorted into a padded batch of exactly `shard_batch_size`
+ * entries per shard, the shards serve their batches in parallel, and results are obliviously sorted back into
+ * request order. Requests for the same block are applied in batch order. The batch reveals only its size,
+ * `shard_batch_size`, and whether some shard would have received more than `shard_batch_size` requests.
+ *
+ * @param num_requests
+ * @param requests
+ * @param shard_batch_size Number of accesses each shard performs. `num_requests` never overflows; a smaller size,
+ *        e.g. from `sharded_oram_shard_batch_size`, trades a small overflow probability for throughput.
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__ACCESS_UNALLOCATED_BLOCK if a block id is out of range. No request is applied.
+ * @return err_SHARD__BATCH_OVERFLOW if some shard would receive more than `shard_batch_size` requests. No request is
+ *         applied.
+ */
+error_t sharded_oram_access_batch(sharded_oram *sharded_oram, size_t num_requests, sharded_oram_request requests[], size_t shard_batch_size);
+
+/**
+ * @brief Read a block of data.
+ *
+ * @param block_id ID of the block to read, less than `sharded_oram_capacity_blocks`.
+ * @param buf buffer of length `BLOCK_DATA_SIZE_QWORDS` where the result will be written.
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__ACCESS_UNALLOCATED_BLOCK if `block_id` is out of range
+ */
+error_t sharded_oram_get(sharded_oram *sharded_oram, u64 block_id, u64 buf[]);
+
+/**
+ * @brief Write a block of data.
+ *
+ * @param block_id ID of the block to write, less than `sharded_oram_capacity_blocks`.
+ * @param data buffer of length `BLOCK_DATA_SIZE_QWORDS` containing data to be written.
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__ACCESS_UNALLOCATED_BLOCK if `block_id` is out of range
+ */
+error_t sharded_oram_put(sharded_oram *sharded_oram, u64 block_id, const u64 data[]);
+
+#endif // CDS_SHARDED_ORAM_H
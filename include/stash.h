@@ -10,7 +10,7 @@
 #include "tree_path.h"
 
 // typedef struct stash stash;
-typedef u64 stash[8];
+typedef u64 stash[16];
 
 /**
  * @brief A `stash` is used internally by Path ORAM to cache blocks that are being moved
@@ -24,8 +24,45 @@ typedef u64 stash[8];
  * @return stash*
  */
 stash *stash_create(size_t path_length, size_t overflow_size);
+
+/**
+ * @brief Create a `stash` that also keeps the top `treetop_levels` levels of the tree resident in a dense array.
+ * Buckets on these levels are on every path, so they are served from this cache-resident treetop
+ * instead of the `bucket_store`. `stash_create(path_length, overflow_size)` is equivalent to a treetop of 0 levels
+ * and the default geometry.
+ *
+ * @param path_length Length of paths from leaf to root in the `bucket_store` associated with this `stash`'s `oram`.
+ * @param overflow_size Capacity, in `block`s, of the overflow stash.
+ * @param treetop_levels Number of levels, counted from the root, held in the treetop. At most `path_length`.
+ * @param geometry Geometry of the `bucket_store` associated with this stash. Blocks passed to and returned by the
+ *        stash are `bucket_geometry_block_qwords(geometry)` u64s.
+ *
+ * @return stash*
+ */
+stash *stash_create_with_treetop(size_t path_length, size_t overflow_size, size_t treetop_levels, const bucket_geometry *geometry);
+
+/**
+ * @brief Like `stash_create_with_treetop`, but the stash is allocated from `arena`, or from the heap if it is NULL, and
+ *        so are its path slots if `stash_enable_zero_copy` is called. It takes `stash_arena_bytes` of the arena. If
+ *        the overflow stash outgrows its capacity it moves to the heap.
+ */
+stash *stash_create_in(oram_arena *arena, size_t path_length, size_t overflow_size, size_t treetop_levels, const bucket_geometry *geometry);
+size_t stash_arena_bytes(size_t path_length, size_t overflow_size, size_t treetop_levels, const bucket_geometry *geometry, bool zero_copy);
 void stash_destroy(stash *stash);
 
+/**
+ * @brief Sort each path in place instead of staging it. `stash_add_path_bucket` and `stash_add_treetop_buckets` then
+ *        search the buckets where they are stored and `stash_build_path` moves blocks directly between their buckets and
+ *        the overflow, so the path is never copied into the stash nor back out of it: after `stash_build_path` the
+ *        path is already written, and `stash_path_blocks` and `stash_write_treetop_buckets` are not needed.
+ * @param stash 
+ */
+void stash_enable_zero_copy(stash *stash);
+bool stash_zero_copy(const stash *stash);
+
+size_t stash_treetop_levels(const stash *stash);
+size_t stash_blocks_per_bucket(const stash *stash);
+
 /**
  * @brief Loads a bucket from a `bucket_store` into the appropriate level of the `path_stash`. If the block with
  * the `target_id` is present in the bucket, it is obliviously swapped into the `target` block, leaving the space in the
@@ -38,7 +75,27 @@ void stash_destroy(stash *stash);
  * @param target Output buffer - if the block with ID `target_id` is present in the bucket, the block will be written here instead of 
  *               in the stash.
  */
-void stash_add_path_bucket(stash* stash, bucket_store* bucket_store, u64 bucket_id, u64 target_block_id, block target[static 1]);
+void stash_add_path_bucket(stash* stash, bucket_store* bucket_store, u64 bucket_id, u64 target_block_id, u64 *target);
+/**
+ * @brief Treetop counterpart of `stash_add_path_bucket` for the top `stash_treetop_levels(stash)` levels of `path`.
+ *        The treetop buckets are searched for `target_block_id` in place, then staged in the `path_stash` for
+ *        `stash_build_path`. Is a no-op for a stash without a treetop.
+ * 
+ * @param stash 
+ * @param path Path currently being accessed
+ * @param target_block_id ID of block being retrieved
+ * @param target Output buffer - if the block with ID `target_id` is present in a treetop bucket on `path`, it is
+ *               swapped into this buffer.
+ */
+void stash_add_treetop_buckets(stash* stash, const tree_path* path, u64 target_block_id, u64 *target);
+/**
+ * @brief Write the treetop levels of the last built path back into the treetop. Must be called after `stash_build_path`
+ *        for every access, in place of writing those levels to the `bucket_store`.
+ * 
+ * @param stash 
+ * @param path Path passed to the last call to `stash_build_path`
+ */
+void stash_write_treetop_buckets(stash* stash, const tree_path* path);
 /**
  * @brief Linearly scans `stash->overflow` and if it finds a block with ID equal to `target_block_id` it obliviously swaps 
  *        this block into `target`. Due to the precondition discussed below, this swap will always place an empty block in the
@@ -55,7 +112,7 @@ void stash_add_path_bucket(stash* stash, bucket_store* bucket_store, u64 bucket_
  * @param target Output buffer - if the block with ID `target_id` is present in `stash->overflow`, the block will be swapped into
  *               target, removing it from `stash->overflow`.
  */
-void stash_scan_overflow_for_target(stash* stash, u64 target_block_id, block target[static 1]);
+void stash_scan_overflow_for_target(stash* stash, u64 target_block_id, u64 *target);
 /**
  * @brief Adds a block to the overflow blocks for a stash.
  *        Precondition: there is no block with ID `new_block->id` anywhere in the stash - neither in `stash->path_stash` 
@@ -64,7 +121,7 @@ void stash_scan_overflow_for_target(stash* stash, u64 target_block_id, block tar
  * @param new_block The block to add to `stash->overflow`
  * @return error_t 
  */
-error_t stash_add_block(stash* stash, block* new_block);
+error_t stash_add_block(stash* stash, u64* new_block);
 
 /**
  * @brief Assigns all blocks in the stush to buckets on the current path or to the overflow stash. Performs
@@ -80,9 +137,9 @@ void stash_build_path(stash* stash, const tree_path* path);
  * @brief Get a read-only view of the blocks for the last built path in the stash.
  * 
  * @param stash 
- * @return const block* 
+ * @return const u64* the blocks of the path, leaf bucket first, each of the block size of the stash's geometry
  */
-const block* stash_path_blocks(const stash* stash);
+const u64* stash_path_blocks(const stash* stash);
 
 /**
  * @brief Clear all items from the stash
@@ -93,6 +150,37 @@ const block* stash_path_blocks(const stash* stash);
 error_t stash_clear(stash* stash);
 
 size_t stash_num_overflow_blocks(const stash* stash);
+size_t stash_overflow_capacity(const stash* stash);
+
+/**
+ * @brief Write the blocks a stash holds between accesses - the overflow and the treetop - to a snapshot file.
+ * 
+ * @param stash 
+ * @param file 
+ * @return error_t 
+ */
+error_t stash_snapshot(const stash* stash, FILE* file);
+
+/**
+ * @brief Create a stash from data written by `stash_snapshot`.
+ * 
+ * @param file 
+ * @param geometry Geometry the stash was created with
+ * @param result On success, the restored stash. Must be destroyed using `stash_destroy`.
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_INVALID if the file is truncated or inconsistent
+ */
+error_t stash_restore(FILE* file, const bucket_geometry* geometry, stash** result);
+
+/**
+ * @brief Make the stash fit a tree that grew by `levels` levels, see `bucket_store_grow`. The blocks it holds
+ *        between accesses keep their place, and their positions are renumbered with `tree_path_id_after_growth`.
+ *
+ * @param stash
+ * @param levels Number of levels added below the leaves
+ * @param geometry Geometry of the grown `bucket_store`
+ */
+void stash_grow(stash* stash, size_t levels, const bucket_geometry* geometry);
 
 size_t stash_size_bytes(size_t path_length, size_t overflow_size);
 
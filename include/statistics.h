@@ -40,4 +40,19 @@ typedef struct {
 
 } ohtable_statistics;
 
+typedef struct {
+    size_t num_items;
+    size_t capacity;
+    size_t stash_items;
+    size_t max_stash_items;
+    size_t stashed_count; // puts whose eviction chain ended with a record moved to the stash
+
+    // ORAM statistics
+    size_t oram_recursion_depth;
+    size_t oram_access_count;
+    size_t stash_overflow_count;
+    size_t max_stash_overflow_count;
+    size_t sum_stash_overflow_count;
+} cuckoo_map_statistics;
+
 #endif // _CDSI_STATISTICS_H
@@ -0,0 +1,29 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef _CDSI_TESTS_FS_H
+#define _CDSI_TESTS_FS_H
+
+// nftw is only declared if _GNU_SOURCE or _XOPEN_SOURCE is defined before the first system header
+#include <ftw.h>
+#include <stdio.h>
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/**
+ * @brief Remove a directory and everything below it, such as a snapshot written by a test.
+ *
+ * @return 0 if successful
+ */
+static inline int remove_tree(const char *dir)
+{
+    return nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+#endif // _CDSI_TESTS_FS_H
@@ -5,6 +5,7 @@
 #define CDS_PATH_ORAM_TREE_PATH_H 1
 
 #include "int_types.h"
+#include "arena.h"
 
 typedef u64 tree_path[];
 
@@ -22,6 +23,43 @@ tree_path *tree_path_create(u64 leaf, u64 root);
 void tree_path_destroy(tree_path *tp);
 void tree_path_update(tree_path *tp, u64 leaf);
 size_t tree_path_num_nodes(size_t num_levels);
+
+/**
+ * @brief A k-ary tree, for a power of two `branching` k, numbers its nodes like the binary tree: leaf `o` is `2 * o`
+ * and the node at offset `o` of `level` is `(2 * o + 1) * k^level - 1`, which is odd, in the middle of the leaves below
+ * it, and has exactly `level * log2(k)` trailing ones. For k = 2 this is the in-order numbering. The `_kary`
+ * functions are their binary counterparts for any such k; paths are still listed leaf first and end at the root,
+ * `k^(levels - 1) - 1`.
+ */
+tree_path *tree_path_create_kary(u64 leaf, u64 root, size_t branching);
+// `tree_path_create_kary` with the path allocated from `arena`, or from the heap if it is NULL. A path in an arena is
+// not destroyed.
+tree_path *tree_path_create_kary_in(oram_arena *arena, u64 leaf, u64 root, size_t branching);
+// Bytes of an arena that `tree_path_create_kary_in` takes
+size_t tree_path_arena_bytes(u64 root, size_t branching);
+void tree_path_update_kary(tree_path *tp, u64 leaf, size_t branching);
+size_t tree_path_level_kary(u64 val, size_t branching);
+// Range of the leaves below node `val`
+u64 tree_path_lower_bound_kary(u64 val, size_t branching);
+u64 tree_path_upper_bound_kary(u64 val, size_t branching);
+u64 tree_path_root(size_t num_levels, size_t branching);
+// Id that node `val` has once `levels` levels are added below the leaves, each leaf becoming the parent of `branching`
+// new leaves. The empty position UINT64_MAX maps to itself.
+u64 tree_path_id_after_growth(u64 val, size_t levels, size_t branching);
+
+/**
+ * @brief A tree with `num_leaves` leaves, not necessarily a power of `branching`, is the full tree of
+ * `tree_path_num_levels(num_leaves, branching)` levels with every leaf at or past `num_leaves` pruned, together with
+ * every internal node that has no remaining leaf below it. Node ids are those of the full tree, so paths to the
+ * remaining leaves are unchanged.
+ */
+size_t tree_path_num_levels(size_t num_leaves, size_t branching);
+// Number of nodes of a pruned tree with `num_leaves` leaves on `level`, where level 0 holds the leaves. They are the
+// nodes with the lowest offsets on that level.
+size_t tree_path_num_nodes_on_level(size_t num_leaves, size_t branching, size_t level);
+// Number of nodes of a pruned tree with `num_leaves` leaves. For a binary tree and a power of two this is
+// `tree_path_num_nodes(tree_path_num_levels(num_leaves, 2))`.
+size_t tree_path_num_nodes_pruned(size_t num_leaves, size_t branching);
 u64 tree_path_lower_bound(u64 val);
 u64 tree_path_upper_bound(u64 val);
 size_t tree_path_level(u64 val);
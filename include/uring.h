@@ -0,0 +1,61 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#ifndef CDS_PATH_ORAM_URING_H
+#define CDS_PATH_ORAM_URING_H 1
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "util.h"
+
+/**
+ * @brief A minimal io_uring used to issue batches of positioned reads and writes with a single system call.
+ * It talks to the kernel directly so that we do not depend on liburing. A `uring` is not thread safe.
+ */
+typedef struct uring uring;
+
+/**
+ * @brief Create an io_uring with room for `entries` requests in flight.
+ *
+ * @param entries
+ * @return uring* Must be destroyed using `uring_destroy`.
+ */
+uring *uring_create(size_t entries);
+
+/**
+ * @brief Wait for all requests in flight, then free the ring. Is a no-op if the input is null.
+ */
+void uring_destroy(uring *ring);
+
+/**
+ * @brief Queue a read or write of `len` bytes at `offset` in `fd`. Nothing is sent to the kernel until
+ *        `uring_submit`. At most `entries` requests may be queued or in flight.
+ *
+ * @param ring
+ * @param write true for a write from `buf`, false for a read into `buf`
+ * @param fd
+ * @param buf Must stay valid until the request completes.
+ * @param len
+ * @param offset
+ */
+void uring_queue_rw(uring *ring, bool write, int fd, void *buf, size_t len, off_t offset);
+
+/**
+ * @brief Submit all queued requests with one system call, without waiting for them.
+ *
+ * @param ring
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__STORAGE_IO if the kernel rejected the submission
+ */
+error_t uring_submit(uring *ring);
+
+/**
+ * @brief Submit all queued requests and wait until every request in flight has completed.
+ *
+ * @param ring
+ * @return err_SUCCESS if every request transferred all of its bytes
+ * @return err_ORAM__STORAGE_IO otherwise
+ */
+error_t uring_wait_all(uring *ring);
+
+#endif // CDS_PATH_ORAM_URING_H
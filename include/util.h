@@ -112,6 +112,42 @@ static inline u64 muluh64(u64 a, u64 b) {
 
 }
 
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline void sip_round(u64 v[4]) {
+    v[0] += v[1]; v[1] = SIP_ROTL(v[1], 13); v[1] ^= v[0]; v[0] = SIP_ROTL(v[0], 32);
+    v[2] += v[3]; v[3] = SIP_ROTL(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = SIP_ROTL(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = SIP_ROTL(v[1], 17); v[1] ^= v[2]; v[2] = SIP_ROTL(v[2], 32);
+}
+
+/**
+ * @brief SipHash-2-4 of the 8 bytes of `m`. A keyed hash, for placing records by key where the keys may be chosen by
+ * an adversary. Constant time.
+ *
+ * @param salt 128-bit key of the hash
+ * @param m
+ * @return u64
+ */
+static inline u64 siphash_u64(const u64 salt[2], u64 m) {
+    u64 v[4] = {salt[0] ^ 0x736f6d6570736575ULL, salt[1] ^ 0x646f72616e646f6dULL,
+                salt[0] ^ 0x6c7967656e657261ULL, salt[1] ^ 0x7465646279746573ULL};
+    u64 b = 8ULL << 56;
+    v[3] ^= m;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= m;
+    v[3] ^= b;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= b;
+    v[2] ^= 0xff;
+    for (size_t i = 0; i < 4; ++i) {
+        sip_round(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
 /**
  * @brief Constant-time division method of Granlund and Montgomery,
  * "Division by Invariant Integers using Multiplication" (https://gmplib.org/~tege/divcnst-pldi94.pdf).
@@ -144,4 +180,35 @@ static inline u64 ct_mod(u64 n, u64 d, u64 m_prime, size_t shift1, size_t shift2
     return n - q*d;
 }
 
+/**
+ * @brief Write raw bytes to a snapshot file. Snapshots are only restored on the machine that wrote them, so values
+ * are stored in native byte order.
+ *
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_IO if the write failed
+ */
+static inline error_t snapshot_write(FILE *file, const void *data, size_t size) {
+    // an empty region may have a NULL pointer, which stdio does not accept
+    // Acceptable if: not executed in an oram_access
+    if (size == 0) {
+        return err_SUCCESS;
+    }
+    return fwrite(data, 1, size, file) == size ? err_SUCCESS : err_ORAM__SNAPSHOT_IO;
+}
+
+/**
+ * @brief Read raw bytes written by `snapshot_write`.
+ *
+ * @return err_SUCCESS if successful
+ * @return err_ORAM__SNAPSHOT_INVALID if the file ended early
+ */
+static inline error_t snapshot_read(FILE *file, void *data, size_t size) {
+    // as in `snapshot_write`
+    // Acceptable if: not executed in an oram_access
+    if (size == 0) {
+        return err_SUCCESS;
+    }
+    return fread(data, 1, size, file) == size ? err_SUCCESS : err_ORAM__SNAPSHOT_INVALID;
+}
+
 #endif // LIBORAM_UTIL_H
@@ -1,63 +1,752 @@
 // Copyright 2022 Signal Messenger, LLC
 // SPDX-License-Identifier: AGPL-3.0-only
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../include/tree_path.h"
 #include "../include/bucket.h"
 #include "../include/util.h"
+#include "../include/uring.h"
 
 #define BUCKET_STORE_NUM_LEVELS(b)  ((b)[0])
 #define BUCKET_STORE_SIZE_BYTES(b)  ((b)[1])
 #define BUCKET_STORE_DATA(b)        ((b)[2])
+#define BUCKET_STORE_EPOCH(b)       ((b)[3])
+#define BUCKET_STORE_PATH(b)        ((b)[4])
+#define BUCKET_STORE_DIRTY(b)       ((b)[5])
+#define BUCKET_STORE_DISK_LEVELS(b) ((b)[6])
+#define BUCKET_STORE_DISK_FD(b)     ((b)[7])
+#define BUCKET_STORE_RING(b)        ((b)[8])
+#define BUCKET_STORE_STAGING(b)     ((b)[9])
+#define BUCKET_STORE_BUCKET_SIZE(b)       ((b)[10])
+#define BUCKET_STORE_BLOCKS_PER_BUCKET(b) ((b)[11])
+#define BUCKET_STORE_BLOCK_DATA_QWORDS(b) ((b)[12])
+#define BUCKET_STORE_NUM_LEAVES(b)        ((b)[13])
+#define BUCKET_STORE_LEVEL_OFFSETS(b)     ((b)[14])
+#define BUCKET_STORE_BRANCHING(b)         ((b)[15])
+#define BUCKET_STORE_LEAF_LEVELS(b)            ((b)[16])
+#define BUCKET_STORE_LEAF_BLOCKS_PER_BUCKET(b) ((b)[17])
+#define BUCKET_STORE_LEAF_BUCKET_SIZE(b)       ((b)[18])
+#define BUCKET_STORE_LEAF_SLOTS(b)             ((b)[19])
+#define BUCKET_STORE_GROWTH_SOURCE(b)          ((b)[20])
+#define BUCKET_STORE_GROWTH_LEVELS(b)          ((b)[21])
+#define BUCKET_STORE_GROWTH_CURSOR(b)          ((b)[22])
+#define BUCKET_STORE_GROWTH_MOVED(b)           ((b)[23])
+#define BUCKET_STORE_ARENA(b)                  ((b)[24])
 /*
 struct bucket_store
 {
     size_t num_levels;
     size_t size_bytes;
     u8 *data;
+    // Buckets whose generation differs from this are read as empty. `bucket_store_clear` increments it.
+    // It starts at 1 so that an all-zero bucket is empty.
+    u64 epoch;
+    // Path of the file mapped at `data` for a file-backed store, NULL for an anonymous one.
+    char *path;
+    // One bit per bucket, set when the bucket is written and cleared when it is persisted by a snapshot or checkpoint.
+    u64 *dirty;
+
+    // A tiered store keeps the lowest `disk_levels` levels in the file `disk_fd` instead of in `data`. The buckets of
+    // the current path on those levels are read into and written from `staging`, one bucket per level, in batches
+    // on `ring`.
+    size_t disk_levels;
+    int disk_fd;
+    uring *ring;
+    u8 *staging;
+
+    // The geometry. The fields above are laid out for the Jasmin implementation, which only supports
+    // `BUCKET_GEOMETRY_DEFAULT`.
+    size_t bucket_size;
+    size_t blocks_per_bucket;
+    size_t block_data_qwords;
+
+    // A pruned tree, whose number of leaves is not a power of the branching, only stores the nodes that have a remaining leaf
+    // below them: level by level, leaves first, each level starting at `level_offsets[level]`. A full tree stores
+    // bucket `i` at slot `i`, as the Jasmin implementation expects, and has no `level_offsets`.
+    size_t num_leaves;
+    size_t *level_offsets;
+    // Children per internal bucket. Trees that are not binary always store their buckets level by level.
+    size_t branching;
+
+    // Buckets on the bottom `leaf_levels` levels hold `leaf_blocks_per_bucket` blocks in `leaf_bucket_size` bytes.
+    // Such a tree is also stored level by level, so these buckets are the first `leaf_slots` slots and every other
+    // slot is `bucket_size` bytes. Without leaf levels `leaf_slots` is 0 and every slot is `bucket_size` bytes.
+    size_t leaf_levels;
+    size_t leaf_blocks_per_bucket;
+    size_t leaf_bucket_size;
+    size_t leaf_slots;
+
+    // A store grown by `bucket_store_grow` whose buckets have not all moved yet: `growth_source` is the store before
+    // it grew, whose buckets move `growth_levels` levels up into this one. The slots of the source below
+    // `growth_cursor`, and those with their bit set in `growth_moved`, have moved. NULL once every bucket has moved.
+    bucket_store *growth_source;
+    size_t growth_levels;
+    size_t growth_cursor;
+    u64 *growth_moved;
 };
 */
 
+// Each bucket records the epoch it was last written in, in the bytes following its blocks.
+// A bucket from an older epoch is stale and reads as a bucket of empty blocks.
+#define BUCKET_GENERATION_OFFSET (BLOCKS_PER_BUCKET * sizeof(block))
+COMPILE_TIME_ASSERT(BUCKET_GENERATION_OFFSET + sizeof(u64) <= ENCRYPTED_BUCKET_SIZE);
+// jasmin/consts.jinc computes the offset from its DECRYPTED_BLOCK_SIZE, which is rounded down to whole u64s
+COMPILE_TIME_ASSERT(sizeof(block) == DECRYPTED_BLOCK_SIZE_QWORDS * 8);
+
+// Buckets of at least this size are backed by transparent huge pages.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static inline size_t block_bytes(const bucket_store *bucket_store) {
+    return (BLOCK_HEADER_QWORDS + BUCKET_STORE_BLOCK_DATA_QWORDS(*bucket_store)) * sizeof(u64);
+}
+
+// Bytes of the blocks of the bucket in `slot`
+static inline size_t bucket_blocks_bytes(const bucket_store *bucket_store, u64 slot) {
+    // Acceptable if: the slot of a bucket on the path is public
+    if (slot < BUCKET_STORE_LEAF_SLOTS(*bucket_store)) {
+        return BUCKET_STORE_LEAF_BLOCKS_PER_BUCKET(*bucket_store) * block_bytes(bucket_store);
+    }
+    return BUCKET_STORE_BLOCKS_PER_BUCKET(*bucket_store) * block_bytes(bucket_store);
+}
+
+// The generation follows the blocks, wherever the geometry puts their end: for the default geometry this is
+// `BUCKET_GENERATION_OFFSET`, where the Jasmin implementation expects it.
+static inline u64* bucket_generation(const bucket_store *bucket_store, u64 slot, u8 *bucket) {
+    return (u64*)(bucket + bucket_blocks_bytes(bucket_store, slot));
+}
+
+bool bucket_geometry_is_valid(const bucket_geometry *geometry)
+{
+    return geometry->blocks_per_bucket > 0 && geometry->block_data_qwords > 0 && geometry->bucket_size % 64 == 0
+        && geometry->branching >= 2 && geometry->branching <= BUCKET_MAX_BRANCHING && (geometry->branching & (geometry->branching - 1)) == 0
+        && (geometry->leaf_levels == 0 || (geometry->leaf_blocks_per_bucket > 0 && geometry->leaf_blocks_per_bucket <= geometry->blocks_per_bucket))
+        // bounds that keep the product below from overflowing
+        && geometry->blocks_per_bucket <= geometry->bucket_size / sizeof(u64) && geometry->block_data_qwords <= geometry->bucket_size / sizeof(u64)
+        && geometry->blocks_per_bucket * bucket_geometry_block_qwords(geometry) * sizeof(u64) + sizeof(u64) <= geometry->bucket_size;
+}
+
+bucket_geometry bucket_geometry_create(size_t bucket_size, size_t blocks_per_bucket, size_t block_data_bytes)
+{
+    CHECK(block_data_bytes % sizeof(u64) == 0);
+    bucket_geometry geometry = {
+        .bucket_size = bucket_size,
+        .blocks_per_bucket = blocks_per_bucket > 0 ? blocks_per_bucket : BLOCKS_PER_BUCKET,
+        .block_data_qwords = block_data_bytes / sizeof(u64),
+        .branching = 2};
+    // Acceptable if: not executed in oram_access
+    if (bucket_size == 0 && block_data_bytes == 0)
+    {
+        geometry.bucket_size = ENCRYPTED_BUCKET_SIZE;
+    }
+    else if (bucket_size == 0)
+    {
+        size_t used = geometry.blocks_per_bucket * bucket_geometry_block_qwords(&geometry) * sizeof(u64) + sizeof(u64);
+        geometry.bucket_size = (used + 63) / 64 * 64;
+    }
+    // Acceptable if: not executed in oram_access
+    if (block_data_bytes == 0)
+    {
+        // For the default bucket this is `BLOCK_DATA_SIZE_QWORDS`.
+        size_t block_qwords = (geometry.bucket_size - sizeof(u64)) / geometry.blocks_per_bucket / sizeof(u64);
+        geometry.block_data_qwords = block_qwords > BLOCK_HEADER_QWORDS ? block_qwords - BLOCK_HEADER_QWORDS : 0;
+    }
+    CHECK(bucket_geometry_is_valid(&geometry));
+    return geometry;
+}
+
+size_t bucket_geometry_level_bucket_size(const bucket_geometry *geometry, size_t level)
+{
+    size_t blocks = bucket_geometry_level_blocks(geometry, level);
+    // Acceptable if: not executed in oram_access
+    if (blocks == geometry->blocks_per_bucket)
+    {
+        return geometry->bucket_size;
+    }
+    size_t used = blocks * bucket_geometry_block_qwords(geometry) * sizeof(u64) + sizeof(u64);
+    return (used + 63) / 64 * 64;
+}
+
+size_t bucket_tree_size_bytes(size_t num_leaves, const bucket_geometry *geometry)
+{
+    size_t num_levels = tree_path_num_levels(num_leaves, geometry->branching);
+    size_t result = 0;
+    for (size_t level = 0; level < num_levels; ++level)
+    {
+        result += tree_path_num_nodes_on_level(num_leaves, geometry->branching, level) * bucket_geometry_level_bucket_size(geometry, level);
+    }
+    return result;
+}
+
+static size_t dirty_bitmap_words(size_t num_buckets)
+{
+    return num_buckets / 64 + 1;
+}
+
+static inline size_t bucket_store_num_buckets(const bucket_store *bucket_store)
+{
+    size_t leaf_slots = BUCKET_STORE_LEAF_SLOTS(*bucket_store);
+    size_t leaf_bytes = leaf_slots * BUCKET_STORE_LEAF_BUCKET_SIZE(*bucket_store);
+    return leaf_slots + (BUCKET_STORE_SIZE_BYTES(*bucket_store) - leaf_bytes) / BUCKET_STORE_BUCKET_SIZE(*bucket_store);
+}
+
+// Where the bucket in `slot` starts in `data`. Slot `bucket_store_num_buckets` is the end of the store.
+static inline size_t bucket_slot_offset(const bucket_store *bucket_store, u64 slot)
+{
+    size_t leaf_slots = BUCKET_STORE_LEAF_SLOTS(*bucket_store);
+    // Acceptable if: the slot of a bucket on the path is public
+    if (slot < leaf_slots)
+    {
+        return slot * BUCKET_STORE_LEAF_BUCKET_SIZE(*bucket_store);
+    }
+    return leaf_slots * BUCKET_STORE_LEAF_BUCKET_SIZE(*bucket_store) + (slot - leaf_slots) * BUCKET_STORE_BUCKET_SIZE(*bucket_store);
+}
+
+// Bytes of the bucket in `slot`
+static inline size_t bucket_slot_size(const bucket_store *bucket_store, u64 slot)
+{
+    return slot < BUCKET_STORE_LEAF_SLOTS(*bucket_store) ? BUCKET_STORE_LEAF_BUCKET_SIZE(*bucket_store) : BUCKET_STORE_BUCKET_SIZE(*bucket_store);
+}
+
+// Where the bucket is stored in `data`, in buckets
+static inline u64 bucket_slot(const bucket_store *bucket_store, u64 bucket_id)
+{
+    const size_t *level_offsets = (size_t*)BUCKET_STORE_LEVEL_OFFSETS(*bucket_store);
+    // Acceptable if: whether the tree is pruned is public
+    if (level_offsets == NULL)
+    {
+        return bucket_id;
+    }
+    size_t branching = BUCKET_STORE_BRANCHING(*bucket_store);
+    size_t level = tree_path_level_kary(bucket_id, branching);
+    // the offset of the node on its level, see `tree_path_create_kary`
+    return level_offsets[level] + (bucket_id >> (level * __builtin_ctzll(branching) + 1));
+}
+
+// Id of the bucket in `slot`, the inverse of `bucket_slot`
+static u64 bucket_slot_id(const bucket_store *bucket_store, u64 slot)
+{
+    const size_t *level_offsets = (size_t*)BUCKET_STORE_LEVEL_OFFSETS(*bucket_store);
+    // Acceptable if: whether the tree is pruned is public
+    if (level_offsets == NULL)
+    {
+        return slot;
+    }
+    size_t level = 0;
+    // Acceptable if: not executed in oram_access
+    while (level + 1 < BUCKET_STORE_NUM_LEVELS(*bucket_store) && level_offsets[level + 1] <= slot)
+    {
+        ++level;
+    }
+    return ((2 * (slot - level_offsets[level]) + 1) << (level * __builtin_ctzll(BUCKET_STORE_BRANCHING(*bucket_store)))) - 1;
+}
+
+// `path` is the backing file of `data`, or NULL if `data` is anonymous memory. The store is allocated from `arena`
+// unless it is NULL.
+static bucket_store *bucket_store_for_mapping(oram_arena *arena, size_t num_leaves, const bucket_geometry *geometry, u8 *data, u64 epoch, const char *path)
+{
+    size_t branching = geometry->branching;
+    size_t num_levels = tree_path_num_levels(num_leaves, branching);
+    size_t num_buckets = tree_path_num_nodes_pruned(num_leaves, branching);
+    size_t leaf_levels = geometry->leaf_levels < num_levels ? geometry->leaf_levels : num_levels;
+    // the largest id, 2 * (num_leaves - 1), fits in a u64
+    CHECK((num_levels - 1) * __builtin_ctzll(branching) < 63);
+    bucket_store *bucket_store = oram_arena_calloc(arena, 1, sizeof(*bucket_store));
+    BUCKET_STORE_ARENA(*bucket_store) = arena;
+    // Acceptable if: not executed in oram_access
+    if (path)
+    {
+        CHECK(BUCKET_STORE_PATH(*bucket_store) = strdup(path));
+    }
+    // Acceptable if: not executed in oram_access
+    if (branching != 2 || leaf_levels > 0 || num_buckets != tree_path_num_nodes(num_levels))
+    {
+        size_t *level_offsets = oram_arena_calloc(arena, num_levels, sizeof(size_t));
+        for (size_t level = 1; level < num_levels; ++level)
+        {
+            level_offsets[level] = level_offsets[level - 1] + tree_path_num_nodes_on_level(num_leaves, branching, level - 1);
+        }
+        BUCKET_STORE_LEVEL_OFFSETS(*bucket_store) = level_offsets;
+        BUCKET_STORE_LEAF_SLOTS(*bucket_store) = leaf_levels < num_levels ? level_offsets[leaf_levels] : num_buckets;
+    }
+    BUCKET_STORE_DIRTY(*bucket_store) = oram_arena_calloc(arena, dirty_bitmap_words(num_buckets), sizeof(u64));
+    BUCKET_STORE_DATA(*bucket_store) = data;
+    BUCKET_STORE_SIZE_BYTES(*bucket_store) = bucket_tree_size_bytes(num_leaves, geometry);
+    BUCKET_STORE_NUM_LEVELS(*bucket_store) = num_levels;
+    BUCKET_STORE_NUM_LEAVES(*bucket_store) = num_leaves;
+    BUCKET_STORE_BRANCHING(*bucket_store) = branching;
+    BUCKET_STORE_EPOCH(*bucket_store) = epoch;
+    BUCKET_STORE_BUCKET_SIZE(*bucket_store) = geometry->bucket_size;
+    BUCKET_STORE_BLOCKS_PER_BUCKET(*bucket_store) = geometry->blocks_per_bucket;
+    BUCKET_STORE_BLOCK_DATA_QWORDS(*bucket_store) = geometry->block_data_qwords;
+    BUCKET_STORE_LEAF_LEVELS(*bucket_store) = geometry->leaf_levels;
+    BUCKET_STORE_LEAF_BLOCKS_PER_BUCKET(*bucket_store) = geometry->leaf_blocks_per_bucket;
+    BUCKET_STORE_LEAF_BUCKET_SIZE(*bucket_store) = bucket_geometry_level_bucket_size(geometry, 0);
+    return bucket_store;
+}
+
 // Create a path ORAM bucket store with capacity for a tree with `num_levels` levels,
 // i.e. 2^num_levels - 1 tree nodes and 2^(num_levels - 1) leaf nodes/pathORAM positions.
 bucket_store *bucket_store_create(size_t num_levels)
 {
-    size_t num_buckets = tree_path_num_nodes(num_levels);
-    size_t size_bytes = num_buckets * ENCRYPTED_BUCKET_SIZE;
+    return bucket_store_create_with_geometry((size_t)1 << (num_levels - 1), &BUCKET_GEOMETRY_DEFAULT);
+}
 
-    u8 *data;
-    CHECK(data = malloc(size_bytes));
-    bucket_store *bucket_store;
-    CHECK(bucket_store = calloc(1, sizeof(*bucket_store)));
+bucket_store *bucket_store_create_with_geometry(size_t num_leaves, const bucket_geometry *geometry)
+{
+    CHECK(bucket_geometry_is_valid(geometry));
+    CHECK(num_leaves > 0);
+    size_t size_bytes = bucket_tree_size_bytes(num_leaves, geometry);
 
-    memset(data, 255, size_bytes);
-    BUCKET_STORE_DATA(*bucket_store) = data;
-    BUCKET_STORE_SIZE_BYTES(*bucket_store) = size_bytes;
-    BUCKET_STORE_NUM_LEVELS(*bucket_store) = num_levels;
+    // Fresh anonymous memory reads as zeros, i.e. every bucket has generation 0 and is stale in the
+    // first epoch. We never need to touch it here: pages are only committed when a bucket is first written.
+    u8 *data = mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    CHECK(data != MAP_FAILED);
+    // Acceptable if: not executed in oram_access
+    if (geometry->bucket_size >= HUGE_PAGE_SIZE)
+    {
+        // Every access touches all of a bucket, so a huge page is never faulted in for a few bytes, and a path then
+        // needs one TLB entry per level instead of one per 4 KB. Only a hint: it is fine if THP is disabled.
+        madvise(data, size_bytes, MADV_HUGEPAGE);
+    }
+    return bucket_store_for_mapping(NULL, num_leaves, geometry, data, 1, NULL);
+}
+
+bucket_store *bucket_store_create_in(oram_arena *arena, size_t num_leaves, const bucket_geometry *geometry)
+{
+    // Acceptable if: not executed in oram_access
+    if (arena == NULL)
+    {
+        return bucket_store_create_with_geometry(num_leaves, geometry);
+    }
+    CHECK(bucket_geometry_is_valid(geometry));
+    CHECK(num_leaves > 0);
+    // arena memory is zeroed, so like fresh anonymous memory every bucket starts with generation 0
+    u8 *data = oram_arena_alloc(arena, bucket_tree_size_bytes(num_leaves, geometry));
+    return bucket_store_for_mapping(arena, num_leaves, geometry, data, 1, NULL);
+}
+
+size_t bucket_store_arena_bytes(size_t num_leaves, const bucket_geometry *geometry)
+{
+    size_t branching = geometry->branching;
+    size_t num_levels = tree_path_num_levels(num_leaves, branching);
+    size_t num_buckets = tree_path_num_nodes_pruned(num_leaves, branching);
+    size_t bytes = oram_arena_bytes(sizeof(bucket_store))
+                   + oram_arena_bytes(dirty_bitmap_words(num_buckets) * sizeof(u64))
+                   + oram_arena_bytes(bucket_tree_size_bytes(num_leaves, geometry));
+    // Acceptable if: not executed in oram_access
+    if (branching != 2 || geometry->leaf_levels > 0 || num_buckets != tree_path_num_nodes(num_levels))
+    {
+        bytes += oram_arena_bytes(num_levels * sizeof(size_t));
+    }
+    return bytes;
+}
+
+// Map `size_bytes` of the file at `path` shared. If `create` is set the file is created, or truncated, and then extended
+// to `size_bytes` with a hole that reads as zeros. Otherwise the file must already have exactly this size.
+static u8 *map_bucket_file(const char *path, size_t size_bytes, bool create)
+{
+    int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    // Acceptable if: not executed in oram_access
+    if (fd < 0)
+    {
+        return MAP_FAILED;
+    }
+    struct stat st;
+    bool sized = create ? ftruncate(fd, size_bytes) == 0 : (fstat(fd, &st) == 0 && (size_t)st.st_size == size_bytes);
+    u8 *data = sized ? mmap(NULL, size_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0) : MAP_FAILED;
+    // the mapping keeps its own reference to the file
+    close(fd);
+    return data;
+}
+
+bucket_store *bucket_store_create_tiered(size_t num_leaves, const bucket_geometry *geometry, size_t memory_levels, const char *path)
+{
+    CHECK(geometry->bucket_size % 4096 == 0 && bucket_geometry_level_bucket_size(geometry, 0) % 4096 == 0);
+    bucket_store *bucket_store = bucket_store_create_with_geometry(num_leaves, geometry);
+    size_t num_levels = BUCKET_STORE_NUM_LEVELS(*bucket_store);
+    size_t disk_levels = memory_levels < num_levels ? num_levels - memory_levels : 0;
+    // Acceptable if: not executed in oram_access
+    if (disk_levels == 0)
+    {
+        return bucket_store;
+    }
+
+    // Direct I/O keeps the disk levels out of the page cache, which would otherwise grow back to the size of the tree.
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0600);
+    // Acceptable if: not executed in oram_access
+    if (fd < 0)
+    {
+        // e.g. tmpfs does not support O_DIRECT
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    }
+    CHECK(fd >= 0);
+    // The file is indexed like `data`. Slots of buckets on the memory levels are holes and take no space, and every
+    // other bucket reads as zeros, i.e. generation 0, until it is first written.
+    CHECK(ftruncate(fd, BUCKET_STORE_SIZE_BYTES(*bucket_store)) == 0);
+    u8 *staging = mmap(NULL, disk_levels * geometry->bucket_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(staging != MAP_FAILED);
+
+    BUCKET_STORE_DISK_LEVELS(*bucket_store) = disk_levels;
+    BUCKET_STORE_DISK_FD(*bucket_store) = fd;
+    BUCKET_STORE_RING(*bucket_store) = uring_create(disk_levels);
+    BUCKET_STORE_STAGING(*bucket_store) = staging;
     return bucket_store;
 }
+
+bucket_store *bucket_store_create_file_backed(size_t num_leaves, const bucket_geometry *geometry, const char *path)
+{
+    CHECK(bucket_geometry_is_valid(geometry));
+    CHECK(num_leaves > 0);
+    size_t size_bytes = bucket_tree_size_bytes(num_leaves, geometry);
+    // A new file is one hole, so like anonymous memory every bucket starts with generation 0 and reads as empty.
+    u8 *data = map_bucket_file(path, size_bytes, true);
+    CHECK(data != MAP_FAILED);
+    return bucket_store_for_mapping(NULL, num_leaves, geometry, data, 1, path);
+}
+
+error_t bucket_store_open_file_backed(size_t num_leaves, const bucket_geometry *geometry, u64 epoch, const char *path, bucket_store **result)
+{
+    // Acceptable if: not executed in oram_access
+    if (!bucket_geometry_is_valid(geometry) || num_leaves == 0 || num_leaves > ((size_t)1 << 62))
+    {
+        return err_ORAM__SNAPSHOT_INVALID;
+    }
+    size_t size_bytes = bucket_tree_size_bytes(num_leaves, geometry);
+    u8 *data = map_bucket_file(path, size_bytes, false);
+    // Acceptable if: not executed in oram_access
+    if (data == MAP_FAILED)
+    {
+        return access(path, F_OK) != 0 ? err_ORAM__SNAPSHOT_IO : err_ORAM__SNAPSHOT_INVALID;
+    }
+    *result = bucket_store_for_mapping(NULL, num_leaves, geometry, data, epoch, path);
+    return err_SUCCESS;
+}
+
+static void bucket_store_end_growth(bucket_store *grown);
+
 void bucket_store_destroy(bucket_store *bucket_store)
 {
     // Acceptable if: not executed in oram_access
     if (bucket_store)
     {
-        free(BUCKET_STORE_DATA(*bucket_store));
-        free(bucket_store);
+        bucket_store_end_growth(bucket_store);
+        oram_arena *arena = (oram_arena*)BUCKET_STORE_ARENA(*bucket_store);
+        // Acceptable if: not executed in oram_access
+        if (!oram_arena_owns(arena, (u8*)BUCKET_STORE_DATA(*bucket_store)))
+        {
+            munmap(BUCKET_STORE_DATA(*bucket_store), BUCKET_STORE_SIZE_BYTES(*bucket_store));
+        }
+        free(BUCKET_STORE_PATH(*bucket_store));
+        oram_arena_free(arena, (u64*)BUCKET_STORE_DIRTY(*bucket_store));
+        oram_arena_free(arena, (size_t*)BUCKET_STORE_LEVEL_OFFSETS(*bucket_store));
+        // Acceptable if: not executed in oram_access
+        if (BUCKET_STORE_DISK_LEVELS(*bucket_store) > 0)
+        {
+            uring_destroy(BUCKET_STORE_RING(*bucket_store));
+            close(BUCKET_STORE_DISK_FD(*bucket_store));
+            munmap(BUCKET_STORE_STAGING(*bucket_store), BUCKET_STORE_DISK_LEVELS(*bucket_store) * BUCKET_STORE_BUCKET_SIZE(*bucket_store));
+        }
+        oram_arena_free(arena, bucket_store);
+    }
+}
+
+u64 bucket_store_epoch(const bucket_store *bucket_store)
+{
+    return BUCKET_STORE_EPOCH(*bucket_store);
+}
+
+const char *bucket_store_path(const bucket_store *bucket_store)
+{
+    return BUCKET_STORE_PATH(*bucket_store);
+}
+
+static bool bucket_store_is_backed_by(const bucket_store *bucket_store, const char *path)
+{
+    return BUCKET_STORE_PATH(*bucket_store) && strcmp(BUCKET_STORE_PATH(*bucket_store), path) == 0;
+}
+
+// The dirty bits, like the snapshot and checkpoint loops below, are indexed by slot
+static bool bucket_is_dirty(const bucket_store *bucket_store, u64 slot)
+{
+    return (((u64*)BUCKET_STORE_DIRTY(*bucket_store))[slot / 64] >> (slot % 64)) & 1;
+}
+
+static inline void bucket_mark_dirty(bucket_store *bucket_store, u64 slot)
+{
+    ((u64*)BUCKET_STORE_DIRTY(*bucket_store))[slot / 64] |= 1ULL << (slot % 64);
+}
+
+static void bucket_store_clear_dirty(bucket_store *bucket_store)
+{
+    memset((u64*)BUCKET_STORE_DIRTY(*bucket_store), 0, dirty_bitmap_words(bucket_store_num_buckets(bucket_store)) * sizeof(u64));
+}
+
+// Write the buckets in slots [first, first + count) to the same offsets in `fd` with as few system calls as the kernel
+// allows.
+static error_t write_bucket_run(int fd, const bucket_store *bucket_store, u64 first, size_t count)
+{
+    const u8 *data = BUCKET_STORE_DATA(*bucket_store);
+    size_t offset = bucket_slot_offset(bucket_store, first);
+    size_t end = bucket_slot_offset(bucket_store, first + count);
+    while (offset < end)
+    {
+        ssize_t written = pwrite(fd, data + offset, end - offset, offset);
+        // Acceptable if: not executed in oram_access
+        if (written <= 0)
+        {
+            return err_ORAM__SNAPSHOT_IO;
+        }
+        offset += written;
     }
+    return err_SUCCESS;
+}
+
+static error_t sync_and_close(int fd, error_t err)
+{
+    // Acceptable if: not executed in oram_access
+    if (err == err_SUCCESS && fsync(fd) != 0)
+    {
+        err = err_ORAM__SNAPSHOT_IO;
+    }
+    close(fd);
+    return err;
+}
+
+static void bucket_store_finish_growth(bucket_store *grown);
+
+error_t bucket_store_snapshot(bucket_store *bucket_store, const char *path, size_t *bytes_written)
+{
+    bucket_store_finish_growth(bucket_store);
+    u8 *data = BUCKET_STORE_DATA(*bucket_store);
+    size_t size_bytes = BUCKET_STORE_SIZE_BYTES(*bucket_store);
+    size_t num_buckets = bucket_store_num_buckets(bucket_store);
+    *bytes_written = 0;
+    // Acceptable if: not executed in oram_access
+    if (BUCKET_STORE_DISK_LEVELS(*bucket_store) > 0)
+    {
+        return err_ORAM__SNAPSHOT_UNSUPPORTED;
+    }
+    // Acceptable if: not executed in oram_access
+    if (bucket_store_is_backed_by(bucket_store, path))
+    {
+        // the store already lives in this file, we only need to flush it
+        RETURN_IF_ERROR(msync(data, size_bytes, MS_SYNC) == 0 ? err_SUCCESS : err_ORAM__SNAPSHOT_IO);
+        bucket_store_clear_dirty(bucket_store);
+        return err_SUCCESS;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    // Acceptable if: not executed in oram_access
+    if (fd < 0)
+    {
+        return err_ORAM__SNAPSHOT_IO;
+    }
+    error_t err = ftruncate(fd, size_bytes) == 0 ? err_SUCCESS : err_ORAM__SNAPSHOT_IO;
+    // Buckets that were never written have generation 0 and read as zeros from the hole we leave for them. Skipping
+    // them keeps the file as sparse as the store.
+    for (u64 slot = 0; slot < num_buckets && err == err_SUCCESS; ++slot)
+    {
+        // Acceptable if: not executed in oram_access
+        if (*bucket_generation(bucket_store, slot, data + bucket_slot_offset(bucket_store, slot)) != 0)
+        {
+            err = write_bucket_run(fd, bucket_store, slot, 1);
+            *bytes_written += bucket_slot_size(bucket_store, slot);
+        }
+    }
+    RETURN_IF_ERROR(sync_and_close(fd, err));
+    bucket_store_clear_dirty(bucket_store);
+    return err_SUCCESS;
+}
+
+error_t bucket_store_checkpoint(bucket_store *bucket_store, const char *path, size_t *bytes_written)
+{
+    bucket_store_finish_growth(bucket_store);
+    const u64 *dirty = (u64*)BUCKET_STORE_DIRTY(*bucket_store);
+    size_t num_buckets = bucket_store_num_buckets(bucket_store);
+    *bytes_written = 0;
+    // Acceptable if: not executed in oram_access
+    if (BUCKET_STORE_DISK_LEVELS(*bucket_store) > 0)
+    {
+        return err_ORAM__SNAPSHOT_UNSUPPORTED;
+    }
+    // Acceptable if: not executed in oram_access
+    if (bucket_store_is_backed_by(bucket_store, path))
+    {
+        // The kernel tracks dirty pages of the mapping itself and writes back exactly those.
+        for (u64 slot = 0; slot < num_buckets; ++slot)
+        {
+            *bytes_written += bucket_is_dirty(bucket_store, slot) ? bucket_slot_size(bucket_store, slot) : 0;
+        }
+        return bucket_store_snapshot(bucket_store, path, &(size_t){0});
+    }
+
+    int fd = open(path, O_WRONLY);
+    // Acceptable if: not executed in oram_access
+    if (fd < 0)
+    {
+        return err_ORAM__SNAPSHOT_IO;
+    }
+    error_t err = err_SUCCESS;
+    // Write maximal runs of adjacent dirty buckets, in file order, each with a single write. The top of the tree
+    // is on every path, so after many accesses the upper levels coalesce into a few long sequential writes.
+    u64 slot = 0;
+    while (slot < num_buckets && err == err_SUCCESS)
+    {
+        u64 word = dirty[slot / 64] >> (slot % 64);
+        // Acceptable if: not executed in oram_access
+        if (word == 0)
+        {
+            slot = (slot / 64 + 1) * 64;
+            continue;
+        }
+        slot += __builtin_ctzll(word);
+        u64 run_start = slot;
+        while (slot < num_buckets && bucket_is_dirty(bucket_store, slot))
+        {
+            ++slot;
+        }
+        err = write_bucket_run(fd, bucket_store, run_start, slot - run_start);
+        *bytes_written += bucket_slot_offset(bucket_store, slot) - bucket_slot_offset(bucket_store, run_start);
+    }
+    RETURN_IF_ERROR(sync_and_close(fd, err));
+    bucket_store_clear_dirty(bucket_store);
+    return err_SUCCESS;
 }
 
 void bucket_store_clear(bucket_store *bucket_store)
 {
-    memset(BUCKET_STORE_DATA(*bucket_store), 255, BUCKET_STORE_SIZE_BYTES(*bucket_store));
+    // Starting a new epoch makes every bucket stale, so this is O(1) regardless of the size of the store.
+    // A bucket only holds blocks again once it is rewritten in the new epoch. The buckets a growing store has
+    // not moved yet would be stale too, so there is nothing left to move.
+    bucket_store_end_growth(bucket_store);
+    ++BUCKET_STORE_EPOCH(*bucket_store);
+    CHECK(BUCKET_STORE_EPOCH(*bucket_store) != UINT64_MAX);
+}
+
+// Move the bucket in `slot` of the growth source to its node in the grown tree, unless it has moved already.
+static void bucket_store_move_bucket(bucket_store *grown, u64 slot)
+{
+    bucket_store *source = (bucket_store*)BUCKET_STORE_GROWTH_SOURCE(*grown);
+    u64 *moved = (u64*)BUCKET_STORE_GROWTH_MOVED(*grown);
+    // Acceptable if: the buckets moved so far only depend on the public sequence of paths
+    if ((moved[slot / 64] >> (slot % 64)) & 1)
+    {
+        return;
+    }
+    moved[slot / 64] |= 1ULL << (slot % 64);
+    const u8 *source_bucket = (u8*)BUCKET_STORE_DATA(*source) + bucket_slot_offset(source, slot);
+    // Acceptable if: whether a bucket was written since the last clear only depends on the public sequence of paths
+    if (*bucket_generation(source, slot, (u8*)source_bucket) != BUCKET_STORE_EPOCH(*source))
+    {
+        return;
+    }
+    size_t levels = BUCKET_STORE_GROWTH_LEVELS(*grown);
+    size_t branching = BUCKET_STORE_BRANCHING(*grown);
+    u64 grown_slot = bucket_slot(grown, tree_path_id_after_growth(bucket_slot_id(source, slot), levels, branching));
+    u8 *bucket = (u8*)BUCKET_STORE_DATA(*grown) + bucket_slot_offset(grown, grown_slot);
+    size_t source_bytes = bucket_blocks_bytes(source, slot);
+    size_t grown_bytes = bucket_blocks_bytes(grown, grown_slot);
+    memcpy(bucket, source_bucket, source_bytes);
+    // a bucket from a leaf level may move to a level that holds more blocks
+    memset(bucket + source_bytes, 255, grown_bytes - source_bytes);
+    for (size_t offset = 0; offset < grown_bytes; offset += block_bytes(grown))
+    {
+        // the position of an empty block, UINT64_MAX, is unchanged
+        u64 *block = (u64*)(bucket + offset);
+        BLOCK_POSITION(block) = tree_path_id_after_growth(BLOCK_POSITION(block), levels, branching);
+    }
+    *bucket_generation(grown, grown_slot, bucket) = BUCKET_STORE_EPOCH(*grown);
+    bucket_mark_dirty(grown, grown_slot);
+}
+
+static void bucket_store_end_growth(bucket_store *grown)
+{
+    bucket_store_destroy((bucket_store*)BUCKET_STORE_GROWTH_SOURCE(*grown));
+    free((u64*)BUCKET_STORE_GROWTH_MOVED(*grown));
+    BUCKET_STORE_GROWTH_SOURCE(*grown) = 0;
+    BUCKET_STORE_GROWTH_MOVED(*grown) = 0;
+    BUCKET_STORE_GROWTH_LEVELS(*grown) = 0;
+    BUCKET_STORE_GROWTH_CURSOR(*grown) = 0;
+}
+
+// Move the next `count` buckets of the growth source in slot order, and release it once every bucket has moved.
+static void bucket_store_move_buckets(bucket_store *grown, size_t count)
+{
+    size_t num_buckets = bucket_store_num_buckets((bucket_store*)BUCKET_STORE_GROWTH_SOURCE(*grown));
+    size_t cursor = BUCKET_STORE_GROWTH_CURSOR(*grown);
+    size_t end = count < num_buckets - cursor ? cursor + count : num_buckets;
+    for (; cursor < end; ++cursor)
+    {
+        bucket_store_move_bucket(grown, cursor);
+    }
+    BUCKET_STORE_GROWTH_CURSOR(*grown) = cursor;
+    // Acceptable if: the number of accesses since the store grew is public
+    if (cursor == num_buckets)
+    {
+        bucket_store_end_growth(grown);
+    }
+}
+
+static void bucket_store_finish_growth(bucket_store *grown)
+{
+    // Acceptable if: not executed in oram_access
+    if (BUCKET_STORE_GROWTH_SOURCE(*grown))
+    {
+        bucket_store_move_buckets(grown, SIZE_MAX);
+    }
+}
+
+// The buckets of `path` first, wherever they are in the source: the new leaves have no bucket there. Then the next
+// buckets in slot order, as many as the path has.
+static void bucket_store_move_path(bucket_store *grown, const tree_path *path)
+{
+    const bucket_store *source = (bucket_store*)BUCKET_STORE_GROWTH_SOURCE(*grown);
+    size_t shift = BUCKET_STORE_GROWTH_LEVELS(*grown) * __builtin_ctzll(BUCKET_STORE_BRANCHING(*grown));
+    for (size_t level = BUCKET_STORE_GROWTH_LEVELS(*grown); level < TREE_PATH_LENGTH(*path); ++level)
+    {
+        bucket_store_move_bucket(grown, bucket_slot(source, ((TREE_PATH_VALUES(*path)[level] + 1) >> shift) - 1));
+    }
+    bucket_store_move_buckets(grown, TREE_PATH_LENGTH(*path));
+}
+
+error_t bucket_store_grow(bucket_store *bucket_store, size_t levels)
+{
+    size_t bits = levels * __builtin_ctzll(BUCKET_STORE_BRANCHING(*bucket_store));
+    CHECK(levels > 0 && BUCKET_STORE_NUM_LEVELS(*bucket_store) + levels <= 64 && (BUCKET_STORE_NUM_LEAVES(*bucket_store) << bits) >> bits == BUCKET_STORE_NUM_LEAVES(*bucket_store));
+    // Acceptable if: not executed in oram_access
+    if (BUCKET_STORE_PATH(*bucket_store) || BUCKET_STORE_DISK_LEVELS(*bucket_store) > 0 || BUCKET_STORE_ARENA(*bucket_store))
+    {
+        return err_ORAM__GROW_UNSUPPORTED;
+    }
+    // the tree grows from one whose buckets have all moved
+    bucket_store_finish_growth(bucket_store);
+
+    bucket_geometry geometry = bucket_store_geometry(bucket_store);
+    // `bucket_store` takes the contents of the grown store and `source` those of the store it grew from
+    void *source = bucket_store_create_with_geometry(BUCKET_STORE_NUM_LEAVES(*bucket_store) << bits, &geometry);
+    u64 fields[sizeof(*bucket_store) / sizeof(u64)];
+    memcpy(fields, source, sizeof(fields));
+    memcpy(source, bucket_store, sizeof(fields));
+    memcpy(bucket_store, fields, sizeof(fields));
+    BUCKET_STORE_EPOCH(*bucket_store) = BUCKET_STORE_EPOCH((u64*)source);
+    BUCKET_STORE_GROWTH_SOURCE(*bucket_store) = source;
+    BUCKET_STORE_GROWTH_LEVELS(*bucket_store) = levels;
+    CHECK(BUCKET_STORE_GROWTH_MOVED(*bucket_store) = calloc(dirty_bitmap_words(bucket_store_num_buckets(source)), sizeof(u64)));
+    return err_SUCCESS;
 }
 
 u64 bucket_store_root(const bucket_store *bucket_store)
 {
-    return (1ULL << (BUCKET_STORE_NUM_LEVELS(*bucket_store) - 1)) - 1;
+    return tree_path_root(BUCKET_STORE_NUM_LEVELS(*bucket_store), BUCKET_STORE_BRANCHING(*bucket_store));
 }
 
 size_t bucket_store_num_levels(const bucket_store *bucket_store)
@@ -65,34 +754,154 @@ size_t bucket_store_num_levels(const bucket_store *bucket_store)
     return BUCKET_STORE_NUM_LEVELS(*bucket_store);
 }
 
+bucket_geometry bucket_store_geometry(const bucket_store *bucket_store)
+{
+    return (bucket_geometry){
+        .bucket_size = BUCKET_STORE_BUCKET_SIZE(*bucket_store),
+        .blocks_per_bucket = BUCKET_STORE_BLOCKS_PER_BUCKET(*bucket_store),
+        .block_data_qwords = BUCKET_STORE_BLOCK_DATA_QWORDS(*bucket_store),
+        .branching = BUCKET_STORE_BRANCHING(*bucket_store),
+        .leaf_levels = BUCKET_STORE_LEAF_LEVELS(*bucket_store),
+        .leaf_blocks_per_bucket = BUCKET_STORE_LEAF_BLOCKS_PER_BUCKET(*bucket_store)};
+}
+
 size_t bucket_store_capacity_bytes(const bucket_store *bucket_store)
 {
-    return BLOCK_DATA_SIZE_BYTES * (1ULL << (BUCKET_STORE_NUM_LEVELS(*bucket_store) - 1));
+    return BUCKET_STORE_BLOCK_DATA_QWORDS(*bucket_store) * sizeof(u64) * BUCKET_STORE_NUM_LEAVES(*bucket_store);
 }
 
 size_t bucket_store_num_leaves(const bucket_store *bucket_store)
 {
-    return 1ULL << (BUCKET_STORE_NUM_LEVELS(*bucket_store) - 1);
+    return BUCKET_STORE_NUM_LEAVES(*bucket_store);
 }
 
-void bucket_store_read_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, block bucket_data[BLOCKS_PER_BUCKET])
+size_t bucket_store_size_bytes(const bucket_store *bucket_store)
 {
-    CHECK(bucket_id < tree_path_num_nodes(BUCKET_STORE_NUM_LEVELS(*bucket_store)));
-    size_t offset = bucket_id * ENCRYPTED_BUCKET_SIZE;
-    u8 *encrypted_bucket = BUCKET_STORE_DATA(*bucket_store) + offset;
-    memcpy(bucket_data, encrypted_bucket, BLOCKS_PER_BUCKET * sizeof(block));
+    return BUCKET_STORE_SIZE_BYTES(*bucket_store);
 }
 
-void bucket_store_write_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, const block bucket_data[BLOCKS_PER_BUCKET]) {
-    size_t offset = bucket_id * ENCRYPTED_BUCKET_SIZE;
-    u8 *encrypted_bucket_start = BUCKET_STORE_DATA(*bucket_store) + offset;
-    memcpy(encrypted_bucket_start, bucket_data,  BLOCKS_PER_BUCKET * sizeof(block));
+// Where the bucket is held in memory: in `data`, or in the staging slot for its level if it is on a disk level.
+static inline u8 *bucket_location(bucket_store *bucket_store, u64 bucket_id)
+{
+    size_t level = tree_path_level_kary(bucket_id, BUCKET_STORE_BRANCHING(*bucket_store));
+    // Acceptable if: the level of a bucket on the path is public
+    if (level < BUCKET_STORE_DISK_LEVELS(*bucket_store))
+    {
+        return (u8*)BUCKET_STORE_STAGING(*bucket_store) + level * BUCKET_STORE_BUCKET_SIZE(*bucket_store);
+    }
+    return (u8*)BUCKET_STORE_DATA(*bucket_store) + bucket_slot_offset(bucket_store, bucket_slot(bucket_store, bucket_id));
 }
 
+error_t bucket_store_fetch_path(bucket_store *bucket_store, const tree_path *path)
+{
+    size_t disk_levels = BUCKET_STORE_DISK_LEVELS(*bucket_store);
+    uring *ring = BUCKET_STORE_RING(*bucket_store);
+    size_t bucket_size = BUCKET_STORE_BUCKET_SIZE(*bucket_store);
+    // Acceptable if: whether the store is growing only depends on the number of accesses since it grew
+    if (BUCKET_STORE_GROWTH_SOURCE(*bucket_store))
+    {
+        bucket_store_move_path(bucket_store, path);
+    }
+    // Acceptable if: whether the store is tiered does not depend on the access
+    if (disk_levels == 0)
+    {
+        return err_SUCCESS;
+    }
+    // The write-back of the previous path may still be in flight. It must land before we read the same buckets, and
+    // before we reuse the staging slots.
+    RETURN_IF_ERROR(uring_wait_all(ring));
+    for (size_t level = 0; level < disk_levels; ++level)
+    {
+        u64 slot = bucket_slot(bucket_store, TREE_PATH_VALUES(*path)[level]);
+        uring_queue_rw(ring, false, BUCKET_STORE_DISK_FD(*bucket_store), (u8*)BUCKET_STORE_STAGING(*bucket_store) + level * bucket_size,
+            bucket_slot_size(bucket_store, slot), bucket_slot_offset(bucket_store, slot));
+    }
+    return uring_wait_all(ring);
+}
+
+error_t bucket_store_flush_path(bucket_store *bucket_store, const tree_path *path)
+{
+    size_t disk_levels = BUCKET_STORE_DISK_LEVELS(*bucket_store);
+    uring *ring = BUCKET_STORE_RING(*bucket_store);
+    size_t bucket_size = BUCKET_STORE_BUCKET_SIZE(*bucket_store);
+    // Acceptable if: whether the store is tiered does not depend on the access
+    if (disk_levels == 0)
+    {
+        return err_SUCCESS;
+    }
+    for (size_t level = 0; level < disk_levels; ++level)
+    {
+        u64 slot = bucket_slot(bucket_store, TREE_PATH_VALUES(*path)[level]);
+        uring_queue_rw(ring, true, BUCKET_STORE_DISK_FD(*bucket_store), (u8*)BUCKET_STORE_STAGING(*bucket_store) + level * bucket_size,
+            bucket_slot_size(bucket_store, slot), bucket_slot_offset(bucket_store, slot));
+    }
+    // Do not wait: the writes complete while the next access looks up its position. `bucket_store_fetch_path` waits.
+    return uring_submit(ring);
+}
 
-size_t bucket_store_block_data_size(bucket_store *bucket_store)
+void bucket_store_prefetch_bucket(bucket_store *bucket_store, u64 bucket_id)
 {
-    return BLOCK_DATA_SIZE_QWORDS;
+    const u8 *encrypted_bucket = bucket_location(bucket_store, bucket_id);
+    // the blocks and the generation, not the padding after them
+    size_t used_bytes = bucket_blocks_bytes(bucket_store, bucket_slot(bucket_store, bucket_id)) + sizeof(u64);
+    for (size_t offset = 0; offset < used_bytes; offset += 64)
+    {
+        // the bucket is written back after it is read
+        __builtin_prefetch(encrypted_bucket + offset, 1, 3);
+    }
+}
+
+void bucket_store_prefetch_path(bucket_store *bucket_store, const tree_path *path, size_t num_levels)
+{
+    for (size_t level = 0; level < num_levels; ++level)
+    {
+        // one line per bucket starts its page walk and DRAM access; the hardware prefetcher follows the rest
+        __builtin_prefetch(bucket_location(bucket_store, TREE_PATH_VALUES(*path)[level]), 1, 3);
+    }
+}
+
+void bucket_store_read_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, u64 *bucket_data)
+{
+    u64 slot = bucket_slot(bucket_store, bucket_id);
+    CHECK(slot < bucket_store_num_buckets(bucket_store));
+    u8 *encrypted_bucket = bucket_location(bucket_store, bucket_id);
+    size_t blocks_bytes = bucket_blocks_bytes(bucket_store, slot);
+    // Acceptable if: whether a bucket was written since the last clear only depends on the public sequence of paths
+    if (*bucket_generation(bucket_store, slot, encrypted_bucket) == BUCKET_STORE_EPOCH(*bucket_store)) {
+        memcpy(bucket_data, encrypted_bucket, blocks_bytes);
+    } else {
+        memset(bucket_data, 255, blocks_bytes);
+    }
+    // a bucket with fewer blocks reads as a full one whose last blocks are empty
+    memset((u8*)bucket_data + blocks_bytes, 255, BUCKET_STORE_BLOCKS_PER_BUCKET(*bucket_store) * block_bytes(bucket_store) - blocks_bytes);
+}
+
+void bucket_store_write_bucket_blocks(bucket_store *bucket_store, u64 bucket_id, const u64 *bucket_data) {
+    u64 slot = bucket_slot(bucket_store, bucket_id);
+    u8 *encrypted_bucket_start = bucket_location(bucket_store, bucket_id);
+    memcpy(encrypted_bucket_start, bucket_data, bucket_blocks_bytes(bucket_store, slot));
+    *bucket_generation(bucket_store, slot, encrypted_bucket_start) = BUCKET_STORE_EPOCH(*bucket_store);
+    // the written buckets are the public path, so tracking them leaks nothing
+    bucket_mark_dirty(bucket_store, slot);
+}
+
+u64 *bucket_store_open_bucket(bucket_store *bucket_store, u64 bucket_id)
+{
+    u64 slot = bucket_slot(bucket_store, bucket_id);
+    CHECK(slot < bucket_store_num_buckets(bucket_store));
+    u8 *encrypted_bucket = bucket_location(bucket_store, bucket_id);
+    // Acceptable if: whether a bucket was written since the last clear only depends on the public sequence of paths
+    if (*bucket_generation(bucket_store, slot, encrypted_bucket) != BUCKET_STORE_EPOCH(*bucket_store)) {
+        memset(encrypted_bucket, 255, bucket_blocks_bytes(bucket_store, slot));
+        *bucket_generation(bucket_store, slot, encrypted_bucket) = BUCKET_STORE_EPOCH(*bucket_store);
+    }
+    bucket_mark_dirty(bucket_store, slot);
+    return (u64*)encrypted_bucket;
+}
+
+size_t bucket_store_block_data_size(const bucket_store *bucket_store)
+{
+    return BUCKET_STORE_BLOCK_DATA_QWORDS(*bucket_store);
 }
 
 bool block_is_empty(block block)
@@ -105,9 +914,190 @@ bool block_is_empty(block block)
 #include <time.h>
 #include "../include/tests.h"
 
-// Planning to add tests here when using pruned trees and variable branching
+// Every bucket on a path to a remaining leaf of a pruned or k-ary tree has its own slot, and the slots fill the store.
+int test_pruned_bucket_slots(size_t num_leaves, size_t branching)
+{
+    bucket_geometry geometry = BUCKET_GEOMETRY_DEFAULT;
+    geometry.branching = branching;
+    bucket_store *bucket_store = bucket_store_create_with_geometry(num_leaves, &geometry);
+    size_t num_buckets = bucket_store_num_buckets(bucket_store);
+    TEST_ASSERT(num_buckets == tree_path_num_nodes_pruned(num_leaves, branching));
+    TEST_ASSERT(bucket_store_num_levels(bucket_store) == tree_path_num_levels(num_leaves, branching));
+    TEST_ASSERT(bucket_store_size_bytes(bucket_store) == num_buckets * ENCRYPTED_BUCKET_SIZE);
+    u64 *slot_owner;
+    CHECK(slot_owner = malloc(num_buckets * sizeof(u64)));
+    memset(slot_owner, 255, num_buckets * sizeof(u64));
+
+    tree_path *path = tree_path_create_kary(0, bucket_store_root(bucket_store), branching);
+    for (u64 leaf = 0; leaf < num_leaves; ++leaf)
+    {
+        tree_path_update_kary(path, leaf * 2, branching);
+        for (size_t i = 0; i < TREE_PATH_LENGTH(*path); ++i)
+        {
+            u64 bucket_id = TREE_PATH_VALUES(*path)[i];
+            u64 slot = bucket_slot(bucket_store, bucket_id);
+            TEST_ASSERT(slot < num_buckets);
+            TEST_ASSERT(slot_owner[slot] == UINT64_MAX || slot_owner[slot] == bucket_id);
+            slot_owner[slot] = bucket_id;
+        }
+    }
+    for (size_t slot = 0; slot < num_buckets; ++slot)
+    {
+        TEST_ASSERT(slot_owner[slot] != UINT64_MAX);
+    }
+    tree_path_destroy(path);
+    free(slot_owner);
+    bucket_store_destroy(bucket_store);
+    return err_SUCCESS;
+}
+
+// Buckets on the leaf levels hold fewer blocks in smaller slots. Write every bucket, then read every bucket back: the
+// slots must not overlap, and the blocks the leaf buckets do not hold read as empty.
+int test_leaf_level_buckets(size_t num_leaves, size_t branching, size_t leaf_levels)
+{
+    bucket_geometry geometry = bucket_geometry_create(0, 4, 256);
+    geometry.branching = branching;
+    geometry.leaf_levels = leaf_levels;
+    geometry.leaf_blocks_per_bucket = 2;
+    TEST_ASSERT(bucket_geometry_is_valid(&geometry));
+    bucket_store *bucket_store = bucket_store_create_with_geometry(num_leaves, &geometry);
+    TEST_ASSERT(bucket_store_size_bytes(bucket_store) == bucket_tree_size_bytes(num_leaves, &geometry));
+    TEST_ASSERT(bucket_store_size_bytes(bucket_store) < tree_path_num_nodes_pruned(num_leaves, branching) * geometry.bucket_size);
+    size_t block_qwords = bucket_geometry_block_qwords(&geometry);
+    u64 *bucket_data;
+    CHECK(bucket_data = malloc(geometry.blocks_per_bucket * block_qwords * sizeof(u64)));
+
+    tree_path *path = tree_path_create_kary(0, bucket_store_root(bucket_store), branching);
+    for (size_t pass = 0; pass < 2; ++pass)
+    {
+        for (u64 leaf = 0; leaf < num_leaves; ++leaf)
+        {
+            tree_path_update_kary(path, leaf * 2, branching);
+            for (size_t level = 0; level < TREE_PATH_LENGTH(*path); ++level)
+            {
+                u64 bucket_id = TREE_PATH_VALUES(*path)[level];
+                size_t level_blocks = bucket_geometry_level_blocks(&geometry, level);
+                // Acceptable if: test code
+                if (pass == 0)
+                {
+                    memset(bucket_data, 255, geometry.blocks_per_bucket * block_qwords * sizeof(u64));
+                    for (size_t b = 0; b < level_blocks; ++b)
+                    {
+                        BLOCK_ID(bucket_data + b * block_qwords) = bucket_id;
+                        BLOCK_DATA(bucket_data + b * block_qwords)[geometry.block_data_qwords - 1] = b;
+                    }
+                    bucket_store_write_bucket_blocks(bucket_store, bucket_id, bucket_data);
+                    continue;
+                }
+                memset(bucket_data, 0, geometry.blocks_per_bucket * block_qwords * sizeof(u64));
+                bucket_store_read_bucket_blocks(bucket_store, bucket_id, bucket_data);
+                for (size_t b = 0; b < geometry.blocks_per_bucket; ++b)
+                {
+                    TEST_ASSERT(BLOCK_ID(bucket_data + b * block_qwords) == (b < level_blocks ? bucket_id : EMPTY_BLOCK_ID));
+                    TEST_ASSERT(BLOCK_DATA(bucket_data + b * block_qwords)[geometry.block_data_qwords - 1] == (b < level_blocks ? b : UINT64_MAX));
+                }
+            }
+        }
+    }
+    tree_path_destroy(path);
+    free(bucket_data);
+    bucket_store_destroy(bucket_store);
+    return err_SUCCESS;
+}
+
+// Write every bucket, grow the tree by `levels` levels and read every path of the grown tree: each bucket is found
+// `levels` levels up with the positions of its blocks renumbered, and the new leaf levels are empty.
+int test_grow_bucket_store(size_t num_leaves, size_t branching, size_t leaf_levels, size_t levels)
+{
+    bucket_geometry geometry = bucket_geometry_create(0, 4, 256);
+    geometry.branching = branching;
+    geometry.leaf_levels = leaf_levels;
+    geometry.leaf_blocks_per_bucket = 2;
+    bucket_store *bucket_store = bucket_store_create_with_geometry(num_leaves, &geometry);
+    size_t block_qwords = bucket_geometry_block_qwords(&geometry);
+    u64 *bucket_data;
+    CHECK(bucket_data = malloc(geometry.blocks_per_bucket * block_qwords * sizeof(u64)));
+
+    tree_path *path = tree_path_create_kary(0, bucket_store_root(bucket_store), branching);
+    for (u64 leaf = 0; leaf < num_leaves; ++leaf)
+    {
+        tree_path_update_kary(path, leaf * 2, branching);
+        for (size_t level = 0; level < TREE_PATH_LENGTH(*path); ++level)
+        {
+            u64 bucket_id = TREE_PATH_VALUES(*path)[level];
+            memset(bucket_data, 255, geometry.blocks_per_bucket * block_qwords * sizeof(u64));
+            for (size_t b = 0; b < bucket_geometry_level_blocks(&geometry, level); ++b)
+            {
+                BLOCK_ID(bucket_data + b * block_qwords) = bucket_id;
+                BLOCK_POSITION(bucket_data + b * block_qwords) = bucket_id;
+                BLOCK_DATA(bucket_data + b * block_qwords)[0] = b;
+            }
+            bucket_store_write_bucket_blocks(bucket_store, bucket_id, bucket_data);
+        }
+    }
+    tree_path_destroy(path);
+
+    TEST_ERR(bucket_store_grow(bucket_store, levels));
+    size_t grown_leaves = bucket_store_num_leaves(bucket_store);
+    TEST_ASSERT(grown_leaves == num_leaves << (levels * __builtin_ctzll(branching)));
+    TEST_ASSERT(bucket_store_num_levels(bucket_store) == tree_path_num_levels(num_leaves, branching) + levels);
+    // the paths are read from the last leaf so that most buckets move with a path rather than in slot order
+    path = tree_path_create_kary(0, bucket_store_root(bucket_store), branching);
+    for (u64 leaf = grown_leaves; leaf-- > 0;)
+    {
+        tree_path_update_kary(path, leaf * 2, branching);
+        TEST_ERR(bucket_store_fetch_path(bucket_store, path));
+        for (size_t level = 0; level < TREE_PATH_LENGTH(*path); ++level)
+        {
+            u64 bucket_id = TREE_PATH_VALUES(*path)[level];
+            u64 source_id = ((bucket_id + 1) >> (levels * __builtin_ctzll(branching))) - 1;
+            size_t source_blocks = level < levels ? 0 : bucket_geometry_level_blocks(&geometry, level - levels);
+            bucket_store_read_bucket_blocks(bucket_store, bucket_id, bucket_data);
+            for (size_t b = 0; b < bucket_geometry_level_blocks(&geometry, level); ++b)
+            {
+                const u64 *block = bucket_data + b * block_qwords;
+                TEST_ASSERT(BLOCK_ID(block) == (b < source_blocks ? source_id : EMPTY_BLOCK_ID));
+                TEST_ASSERT(BLOCK_POSITION(block) == (b < source_blocks ? bucket_id : UINT64_MAX));
+                TEST_ASSERT(BLOCK_DATA(block)[0] == (b < source_blocks ? b : UINT64_MAX));
+            }
+        }
+    }
+    TEST_ASSERT(BUCKET_STORE_GROWTH_SOURCE(*bucket_store) == 0);
+
+    // a clear while the store is growing leaves nothing to move
+    TEST_ERR(bucket_store_grow(bucket_store, 1));
+    bucket_store_clear(bucket_store);
+    TEST_ASSERT(BUCKET_STORE_GROWTH_SOURCE(*bucket_store) == 0);
+    tree_path_destroy(path);
+    path = tree_path_create_kary(0, bucket_store_root(bucket_store), branching);
+    TEST_ERR(bucket_store_fetch_path(bucket_store, path));
+    bucket_store_read_bucket_blocks(bucket_store, bucket_store_root(bucket_store), bucket_data);
+    TEST_ASSERT(BLOCK_ID(bucket_data) == EMPTY_BLOCK_ID);
+
+    tree_path_destroy(path);
+    free(bucket_data);
+    bucket_store_destroy(bucket_store);
+    return err_SUCCESS;
+}
+
 void private_bucket_store_tests()
 {
-    printf("TEST private bucket store functions");
+    printf("TEST private bucket store functions\n");
+    RUN_TEST(test_pruned_bucket_slots(1, 2));
+    RUN_TEST(test_pruned_bucket_slots(5, 2));
+    RUN_TEST(test_pruned_bucket_slots(1024, 2));
+    RUN_TEST(test_pruned_bucket_slots(1025, 2));
+    RUN_TEST(test_pruned_bucket_slots(1500, 2));
+    RUN_TEST(test_pruned_bucket_slots(1024, 4));
+    RUN_TEST(test_pruned_bucket_slots(1500, 8));
+    RUN_TEST(test_pruned_bucket_slots(4096, 64));
+    RUN_TEST(test_leaf_level_buckets(1024, 2, 1));
+    RUN_TEST(test_leaf_level_buckets(1500, 2, 3));
+    RUN_TEST(test_leaf_level_buckets(1500, 4, 2));
+    RUN_TEST(test_leaf_level_buckets(5, 2, 64));
+    RUN_TEST(test_grow_bucket_store(1024, 2, 0, 1));
+    RUN_TEST(test_grow_bucket_store(1500, 2, 3, 2));
+    RUN_TEST(test_grow_bucket_store(100, 4, 1, 1));
+    RUN_TEST(test_grow_bucket_store(5, 8, 64, 3));
 }
 #endif
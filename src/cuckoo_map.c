@@ -0,0 +1,349 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/cuckoo_map.h"
+#include "../include/path_oram.h"
+#include "../include/bucket.h"
+
+struct cuckoo_map
+{
+    oram *oram;
+    // table `t` is blocks `base_block_id + t * table_blocks` to `base_block_id + (t + 1) * table_blocks - 1` of the ORAM
+    u64 base_block_id;
+    size_t table_blocks;
+    size_t record_qwords;
+    size_t slots_per_block;
+    size_t max_evictions;
+
+    size_t capacity;
+    size_t num_items;
+
+    // `stash_size` records, empty ones keyed `CUCKOO_MAP_EMPTY_KEY`
+    u64 *stash;
+    size_t stash_size;
+    size_t stash_items;
+    size_t max_stash_items;
+    size_t stashed_count;
+
+    // SipHash keys of the hashes of record keys, one per table
+    u64 salt[2][2];
+    // state of the generator of the slots of evicted records
+    u64 rng_state;
+    // the record carried along the eviction chain of a put
+    u64 *carried;
+    cuckoo_map_statistics statistics;
+};
+
+// Block of `key` in table `table`, by multiplication rather than division, which is not constant time
+static u64 table_block(const cuckoo_map *map, size_t table, u64 key)
+{
+    return map->base_block_id + table * map->table_blocks + muluh64(siphash_u64(map->salt[table], key), map->table_blocks);
+}
+
+// splitmix64. Evictions need not be unpredictable, only independent of the keys.
+static u64 next_random(cuckoo_map *map)
+{
+    u64 z = (map->rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+cuckoo_map *cuckoo_map_create(size_t capacity, size_t record_size_qwords, const cuckoo_map_config *config,
+                              size_t stash_overflow_size, entropy_func getentropy)
+{
+    cuckoo_map_config defaults = {0};
+    config = config ? config : &defaults;
+    double load_factor = config->load_factor > 0 ? config->load_factor : CUCKOO_MAP_DEFAULT_LOAD_FACTOR;
+    CHECK(capacity > 0);
+    CHECK(record_size_qwords > 0 && record_size_qwords <= BLOCK_DATA_SIZE_QWORDS); // Acceptable &&: not executed in a cuckoo_map access
+    CHECK(load_factor <= 0.95);
+    cuckoo_map *result;
+    CHECK(result = calloc(1, sizeof(*result)));
+    result->record_qwords = record_size_qwords;
+    result->slots_per_block = BLOCK_DATA_SIZE_QWORDS / record_size_qwords;
+    result->max_evictions = config->max_evictions > 0 ? config->max_evictions : CUCKOO_MAP_DEFAULT_MAX_EVICTIONS;
+    result->stash_size = config->stash_size > 0 ? config->stash_size : CUCKOO_MAP_DEFAULT_STASH_SIZE;
+    size_t slots = (size_t)(capacity / load_factor) + 1;
+    size_t slots_per_table = (slots + 1) / 2;
+    result->table_blocks = (slots_per_table + result->slots_per_block - 1) / result->slots_per_block;
+    result->capacity = capacity;
+
+    result->oram = oram_create(2 * result->table_blocks * BLOCK_DATA_SIZE_QWORDS, stash_overflow_size, getentropy);
+    CHECK(oram_block_size(result->oram) == BLOCK_DATA_SIZE_QWORDS);
+    // Blocks that were never written read as all ones, i.e. every slot starts empty.
+    result->base_block_id = oram_allocate_contiguous(result->oram, 2 * result->table_blocks);
+    CHECK(getentropy(result->salt, sizeof(result->salt)) == 0);
+    CHECK(getentropy(&result->rng_state, sizeof(result->rng_state)) == 0);
+    CHECK(result->carried = calloc(record_size_qwords, sizeof(u64)));
+    CHECK(result->stash = malloc(result->stash_size * record_size_qwords * sizeof(u64)));
+    memset(result->stash, 255, result->stash_size * record_size_qwords * sizeof(u64));
+    return result;
+}
+
+void cuckoo_map_destroy(cuckoo_map *map)
+{
+    // Acceptable if: not executed in a cuckoo_map access
+    if (map)
+    {
+        oram_destroy(map->oram);
+        free(map->stash);
+        free(map->carried);
+        free(map);
+    }
+}
+
+typedef struct
+{
+    const cuckoo_map *map;
+    u64 key;
+    // written over the record of `key` if not NULL
+    const u64 *update;
+    // receives the record of `key` if not NULL
+    u64 *record;
+    // the record of `key` is emptied if set
+    bool remove;
+
+    u64 found;
+    // whether the record of `key` is in the stash
+    u64 in_stash;
+    // table of the block being accessed, and the number of empty slots of the block of `key` in each table
+    size_t table;
+    u64 empty_slots[2];
+} find_args;
+
+// Look for the record of a key in `num_slots` consecutive records: a block of one of its tables, or the stash.
+static void find_in_slots(find_args *args, u64 *slots, size_t num_slots)
+{
+    size_t record_qwords = args->map->record_qwords;
+    u64 empty_record = CUCKOO_MAP_EMPTY_KEY;
+    for (size_t i = 0; i < num_slots; ++i)
+    {
+        u64 *slot = slots + i * record_qwords;
+        bool match = (slot[0] != CUCKOO_MAP_EMPTY_KEY) & (slot[0] == args->key);
+        args->found |= match;
+
+        // Acceptable if: the kind of operation is public
+        if (args->record)
+        {
+            for (size_t j = 0; j < record_qwords; ++j)
+            {
+                cond_obv_cpy_u64(match, args->record + j, slot + j);
+            }
+        }
+        // Acceptable if: the kind of operation is public
+        if (args->update)
+        {
+            for (size_t j = 0; j < record_qwords; ++j)
+            {
+                cond_obv_cpy_u64(match, slot + j, args->update + j);
+            }
+        }
+        // Acceptable if: the kind of operation is public
+        if (args->remove)
+        {
+            for (size_t j = 0; j < record_qwords; ++j)
+            {
+                cond_obv_cpy_u64(match, slot + j, &empty_record);
+            }
+        }
+    }
+}
+
+static error_t find_accessor(u64 *block, void *vargs)
+{
+    find_args *args = vargs;
+    const cuckoo_map *map = args->map;
+    for (size_t i = 0; i < map->slots_per_block; ++i)
+    {
+        args->empty_slots[args->table] += block[i * map->record_qwords] == CUCKOO_MAP_EMPTY_KEY;
+    }
+    find_in_slots(args, block, map->slots_per_block);
+    return err_SUCCESS;
+}
+
+// Access both blocks of `args->key`, then scan the stash.
+static error_t find(cuckoo_map *map, find_args *args)
+{
+    args->map = map;
+    for (size_t table = 0; table < 2; ++table)
+    {
+        args->table = table;
+        RETURN_IF_ERROR(oram_function_access(map->oram, table_block(map, table, args->key), find_accessor, args));
+    }
+    u64 in_tables = args->found;
+    find_in_slots(args, map->stash, map->stash_size);
+    args->in_stash = args->found & !in_tables;
+    return err_SUCCESS;
+}
+
+typedef struct
+{
+    const cuckoo_map *map;
+    // slot whose record is evicted if the block has no empty slot
+    u64 victim;
+    // the carried record passes this block by
+    u64 skip;
+} insert_args;
+
+// One step of the eviction chain: the carried record takes the first empty slot of the block, or else the slot of the
+// victim, whose record is carried on. Once the carried record is empty nothing moves.
+static error_t insert_accessor(u64 *block, void *vargs)
+{
+    insert_args *args = vargs;
+    const cuckoo_map *map = args->map;
+    u64 *carried = map->carried;
+    bool active = (carried[0] != CUCKOO_MAP_EMPTY_KEY) & !args->skip;
+    bool has_empty = false;
+    u64 first_empty = 0;
+    for (size_t i = 0; i < map->slots_per_block; ++i)
+    {
+        bool empty = block[i * map->record_qwords] == CUCKOO_MAP_EMPTY_KEY;
+        first_empty = U64_TERNARY(empty & !has_empty, i, first_empty);
+        has_empty |= empty;
+    }
+    u64 target = U64_TERNARY(has_empty, first_empty, args->victim);
+    for (size_t i = 0; i < map->slots_per_block; ++i)
+    {
+        u64 *slot = block + i * map->record_qwords;
+        bool swap = active & (i == target);
+        for (size_t j = 0; j < map->record_qwords; ++j)
+        {
+            cond_obv_swap_u64(swap, slot + j, carried + j);
+        }
+    }
+    return err_SUCCESS;
+}
+
+// Move the first record of the stash into the empty carried record if `take`. Returns whether a record moved.
+static bool stash_take(cuckoo_map *map, bool take)
+{
+    bool taken = false;
+    for (size_t i = 0; i < map->stash_size; ++i)
+    {
+        u64 *slot = map->stash + i * map->record_qwords;
+        bool move = take & !taken & (slot[0] != CUCKOO_MAP_EMPTY_KEY);
+        for (size_t j = 0; j < map->record_qwords; ++j)
+        {
+            cond_obv_swap_u64(move, slot + j, map->carried + j);
+        }
+        taken |= move;
+    }
+    return taken;
+}
+
+// Move the carried record, if it is not empty, into the first empty slot of the stash. Returns whether it moved.
+static bool stash_place(cuckoo_map *map)
+{
+    bool placed = false;
+    bool active = map->carried[0] != CUCKOO_MAP_EMPTY_KEY;
+    for (size_t i = 0; i < map->stash_size; ++i)
+    {
+        u64 *slot = map->stash + i * map->record_qwords;
+        bool move = active & !placed & (slot[0] == CUCKOO_MAP_EMPTY_KEY);
+        for (size_t j = 0; j < map->record_qwords; ++j)
+        {
+            cond_obv_swap_u64(move, slot + j, map->carried + j);
+        }
+        placed |= move;
+    }
+    return placed;
+}
+
+error_t cuckoo_map_get(cuckoo_map *map, u64 key, u64 *record)
+{
+    memset(record, 255, map->record_qwords * sizeof(u64));
+    find_args args = {.key = key, .record = record};
+    RETURN_IF_ERROR(find(map, &args));
+    // Acceptable if: the result is returned to the caller
+    return args.found ? err_SUCCESS : err_OHTABLE__GET__FAILURE;
+}
+
+error_t cuckoo_map_put(cuckoo_map *map, const u64 *record)
+{
+    // Acceptable if: depends only on the record, and is returned to the caller
+    if (record[0] == CUCKOO_MAP_EMPTY_KEY)
+    {
+        return err_OHTABLE__PUT__FAILURE;
+    }
+    // A present record is replaced where it is found. Otherwise the record is inserted if there is room: whatever the
+    // chain leaves carried must fit in the stash.
+    find_args found = {.key = record[0], .update = record};
+    RETURN_IF_ERROR(find(map, &found));
+    bool insert = (found.found == 0) & (map->num_items < map->capacity) & (map->stash_items < map->stash_size);
+
+    // The chain is made whether or not there is anything to insert. When there is not, it carries a record of the
+    // stash back to the tables, if there is one.
+    memset(map->carried, 255, map->record_qwords * sizeof(u64));
+    for (size_t j = 0; j < map->record_qwords; ++j)
+    {
+        cond_obv_cpy_u64(insert, map->carried + j, record + j);
+    }
+    bool taken = stash_take(map, !insert);
+    // A new record goes to the block of its key with more empty slots, which keeps the tables balanced: if that is the
+    // block in the second table, the first step passes it on there.
+    insert_args args = {.map = map};
+    for (size_t step = 0; step < map->max_evictions; ++step)
+    {
+        args.victim = muluh64(next_random(map), map->slots_per_block);
+        args.skip = (step == 0) & insert & (found.empty_slots[1] > found.empty_slots[0]);
+        u64 block = table_block(map, step & 1, map->carried[0]);
+        RETURN_IF_ERROR(oram_function_access(map->oram, block, insert_accessor, &args));
+    }
+    bool stashed = stash_place(map);
+    // the carried record does not stay in memory
+    memset(map->carried, 255, map->record_qwords * sizeof(u64));
+
+    map->num_items += insert;
+    map->stash_items = map->stash_items + stashed - taken;
+    map->max_stash_items = U64_TERNARY(map->stash_items > map->max_stash_items, map->stash_items, map->max_stash_items);
+    map->stashed_count += stashed;
+    // Acceptable if: the result is returned to the caller
+    return found.found | insert ? err_SUCCESS : err_OHTABLE__TABLE_FULL;
+}
+
+error_t cuckoo_map_remove(cuckoo_map *map, u64 key)
+{
+    find_args args = {.key = key, .remove = true};
+    RETURN_IF_ERROR(find(map, &args));
+    map->stash_items -= args.in_stash;
+    map->num_items -= args.found;
+    // Acceptable if: the result is returned to the caller
+    return args.found ? err_SUCCESS : err_OHTABLE__GET__FAILURE;
+}
+
+size_t cuckoo_map_capacity(const cuckoo_map *map)
+{
+    return map->capacity;
+}
+
+size_t cuckoo_map_num_items(const cuckoo_map *map)
+{
+    return map->num_items;
+}
+
+size_t cuckoo_map_record_size(const cuckoo_map *map)
+{
+    return map->record_qwords;
+}
+
+const cuckoo_map_statistics *cuckoo_map_report_statistics(cuckoo_map *map)
+{
+    const oram_statistics *oram_statistics = oram_report_statistics(map->oram);
+    map->statistics = (cuckoo_map_statistics){
+        .num_items = map->num_items,
+        .capacity = map->capacity,
+        .stash_items = map->stash_items,
+        .max_stash_items = map->max_stash_items,
+        .stashed_count = map->stashed_count,
+        .oram_recursion_depth = oram_statistics->recursion_depth,
+        .oram_access_count = oram_statistics->access_count,
+        .stash_overflow_count = oram_statistics->stash_overflow_count,
+        .max_stash_overflow_count = oram_statistics->max_stash_overflow_count,
+        .sum_stash_overflow_count = oram_statistics->sum_stash_overflow_count,
+    };
+    return &map->statistics;
+}
@@ -0,0 +1,339 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/ohtable.h"
+#include "../include/path_oram.h"
+#include "../include/bucket.h"
+
+struct ohtable
+{
+    oram *oram;
+    // the table is blocks `base_block_id` to `base_block_id + num_blocks - 1` of the ORAM
+    u64 base_block_id;
+    size_t num_blocks;
+    size_t probe_blocks;
+    size_t record_qwords;
+    size_t slots_per_block;
+    size_t num_slots;
+
+    size_t capacity;
+    size_t num_items;
+    size_t max_trace_length;
+    size_t total_displacement;
+
+    // SipHash key of the hash of record keys
+    u64 salt[2];
+    // the record carried along the window by a put or a remove
+    u64 *carried;
+    ohtable_statistics statistics;
+};
+
+// Index of the home block of `key`, by multiplication rather than division, which is not constant time
+static u64 home_block(const ohtable *ohtable, u64 key)
+{
+    return muluh64(siphash_u64(ohtable->salt, key), ohtable->num_blocks);
+}
+
+// Distance of slot `slot` from the first slot of the home block of `key`, around the end of the table
+static u64 displacement(const ohtable *ohtable, u64 slot, u64 key)
+{
+    u64 home_slot = home_block(ohtable, key) * ohtable->slots_per_block;
+    return slot - home_slot + U64_TERNARY(slot < home_slot, ohtable->num_slots, 0);
+}
+
+// Index of block `step` of the window that starts at `home`, around the end of the table
+static u64 window_block(const ohtable *ohtable, u64 home, size_t step)
+{
+    u64 block = home + step;
+    return block - U64_TERNARY(block >= ohtable->num_blocks, ohtable->num_blocks, 0);
+}
+
+ohtable *ohtable_create(size_t capacity, size_t record_size_qwords, size_t probe_blocks, size_t stash_overflow_size, entropy_func getentropy)
+{
+    CHECK(capacity > 0);
+    CHECK(record_size_qwords > 0 && record_size_qwords <= BLOCK_DATA_SIZE_QWORDS); // Acceptable &&: not executed in an ohtable access
+    ohtable *result;
+    CHECK(result = calloc(1, sizeof(*result)));
+    result->probe_blocks = probe_blocks > 0 ? probe_blocks : OHTABLE_DEFAULT_PROBE_BLOCKS;
+    result->record_qwords = record_size_qwords;
+    result->slots_per_block = BLOCK_DATA_SIZE_QWORDS / record_size_qwords;
+    // Twice as many slots as records. A window then holds about half as many records as it has slots when the table
+    // is full, and runs out of slots with a probability that falls exponentially with its length.
+    size_t slots = 2 * capacity;
+    size_t num_blocks = (slots + result->slots_per_block - 1) / result->slots_per_block;
+    // a window never overlaps itself
+    result->num_blocks = num_blocks > result->probe_blocks ? num_blocks : result->probe_blocks;
+    result->num_slots = result->num_blocks * result->slots_per_block;
+    result->capacity = capacity;
+
+    result->oram = oram_create(result->num_blocks * BLOCK_DATA_SIZE_QWORDS, stash_overflow_size, getentropy);
+    CHECK(oram_block_size(result->oram) == BLOCK_DATA_SIZE_QWORDS);
+    // Blocks that were never written read as all ones, i.e. every slot starts empty.
+    result->base_block_id = oram_allocate_contiguous(result->oram, result->num_blocks);
+    CHECK(getentropy(result->salt, sizeof(result->salt)) == 0);
+    CHECK(result->carried = calloc(record_size_qwords, sizeof(u64)));
+    return result;
+}
+
+void ohtable_destroy(ohtable *ohtable)
+{
+    // Acceptable if: not executed in an ohtable access
+    if (ohtable)
+    {
+        oram_destroy(ohtable->oram);
+        free(ohtable->carried);
+        free(ohtable);
+    }
+}
+
+typedef struct
+{
+    const ohtable *ohtable;
+    // first slot of the block and its offset in the window
+    u64 first_slot;
+    u64 first_offset;
+    u64 key;
+    // written over the record of `key` if not NULL
+    const u64 *update;
+    // receives the record of `key` if not NULL
+    u64 *record;
+
+    u64 found;
+    // offset and displacement of the record of `key`
+    u64 found_offset;
+    u64 found_displacement;
+    // offset of the first slot after the record of `key` that is empty or holds a record at the start of its home
+    // block, or the window length
+    u64 run_end;
+    u64 has_empty;
+} find_args;
+
+// Look for the record of a key in a block of its window.
+static error_t find_accessor(u64 *block, void *vargs)
+{
+    find_args *args = vargs;
+    const ohtable *ohtable = args->ohtable;
+    u64 window_slots = ohtable->probe_blocks * ohtable->slots_per_block;
+    for (size_t i = 0; i < ohtable->slots_per_block; ++i)
+    {
+        u64 *slot = block + i * ohtable->record_qwords;
+        u64 offset = args->first_offset + i;
+        bool empty = slot[0] == OHTABLE_EMPTY_KEY;
+        u64 d = displacement(ohtable, args->first_slot + i, slot[0]);
+        bool match = !empty & (slot[0] == args->key);
+
+        bool run_ends = args->found & (args->run_end == window_slots) & (empty | (d == 0));
+        args->run_end = U64_TERNARY(run_ends, offset, args->run_end);
+        args->found_offset = U64_TERNARY(match, offset, args->found_offset);
+        args->found_displacement = U64_TERNARY(match, d, args->found_displacement);
+        args->found |= match;
+        args->has_empty |= empty;
+
+        // Acceptable if: the kind of operation is public
+        if (args->record)
+        {
+            for (size_t j = 0; j < ohtable->record_qwords; ++j)
+            {
+                cond_obv_cpy_u64(match, args->record + j, slot + j);
+            }
+        }
+        // Acceptable if: the kind of operation is public
+        if (args->update)
+        {
+            for (size_t j = 0; j < ohtable->record_qwords; ++j)
+            {
+                cond_obv_cpy_u64(match, slot + j, args->update + j);
+            }
+        }
+    }
+    return err_SUCCESS;
+}
+
+typedef struct
+{
+    const ohtable *ohtable;
+    u64 first_slot;
+    u64 first_offset;
+    // displacement the carried record would have in the next slot
+    u64 carried_displacement;
+    // offset of the empty slot that ended the chain
+    u64 trace;
+} insert_args;
+
+// Robin-hood insertion: the carried record takes the first slot that is empty or whose record is closer to its home,
+// and that record is carried on. The chain ends at the first empty slot. Once it has, the carried record is empty and
+// nothing moves.
+static error_t insert_accessor(u64 *block, void *vargs)
+{
+    insert_args *args = vargs;
+    const ohtable *ohtable = args->ohtable;
+    u64 *carried = ohtable->carried;
+    for (size_t i = 0; i < ohtable->slots_per_block; ++i)
+    {
+        u64 *slot = block + i * ohtable->record_qwords;
+        bool active = carried[0] != OHTABLE_EMPTY_KEY;
+        bool empty = slot[0] == OHTABLE_EMPTY_KEY;
+        u64 d = displacement(ohtable, args->first_slot + i, slot[0]);
+        bool swap = active & (empty | (d < args->carried_displacement));
+        args->trace = U64_TERNARY(swap & empty, (args->first_offset + i), args->trace);
+        for (size_t j = 0; j < ohtable->record_qwords; ++j)
+        {
+            cond_obv_swap_u64(swap, slot + j, carried + j);
+        }
+        args->carried_displacement = U64_TERNARY(swap, d, args->carried_displacement) + 1;
+    }
+    return err_SUCCESS;
+}
+
+typedef struct
+{
+    const ohtable *ohtable;
+    u64 first_offset;
+    // slots `start` to `end - 1` of the window move back by one if `enabled`
+    u64 start;
+    u64 end;
+    u64 enabled;
+} shift_args;
+
+// Backward-shift deletion, visiting the window from its end: every slot of the run takes the record carried from the
+// slot after it, the last one an empty record, and the removed record is carried out of the first.
+static error_t shift_accessor(u64 *block, void *vargs)
+{
+    shift_args *args = vargs;
+    const ohtable *ohtable = args->ohtable;
+    u64 *carried = ohtable->carried;
+    for (size_t i = ohtable->slots_per_block; i-- > 0;)
+    {
+        u64 *slot = block + i * ohtable->record_qwords;
+        u64 offset = args->first_offset + i;
+        bool in_run = args->enabled & (offset >= args->start) & (offset < args->end);
+        for (size_t j = 0; j < ohtable->record_qwords; ++j)
+        {
+            cond_obv_swap_u64(in_run, slot + j, carried + j);
+        }
+    }
+    return err_SUCCESS;
+}
+
+// Probe the window of `args->key`, which starts at block `home`.
+static error_t find(ohtable *ohtable, u64 home, find_args *args)
+{
+    args->ohtable = ohtable;
+    args->run_end = ohtable->probe_blocks * ohtable->slots_per_block;
+    for (size_t step = 0; step < ohtable->probe_blocks; ++step)
+    {
+        u64 block = window_block(ohtable, home, step);
+        args->first_slot = block * ohtable->slots_per_block;
+        args->first_offset = step * ohtable->slots_per_block;
+        RETURN_IF_ERROR(oram_function_access(ohtable->oram, ohtable->base_block_id + block, find_accessor, args));
+    }
+    return err_SUCCESS;
+}
+
+error_t ohtable_get(ohtable *ohtable, u64 key, u64 *record)
+{
+    memset(record, 255, ohtable->record_qwords * sizeof(u64));
+    find_args args = {.key = key, .record = record};
+    RETURN_IF_ERROR(find(ohtable, home_block(ohtable, key), &args));
+    // Acceptable if: the result is returned to the caller
+    return args.found ? err_SUCCESS : err_OHTABLE__GET__FAILURE;
+}
+
+error_t ohtable_put(ohtable *ohtable, const u64 *record)
+{
+    // Acceptable if: depends only on the record, and is returned to the caller
+    if (record[0] == OHTABLE_EMPTY_KEY)
+    {
+        return err_OHTABLE__ROBIN_HOOD_UPSERT__RECORD_EMPTY;
+    }
+    // A present record is replaced while the window is probed. Otherwise the record is inserted if there is room.
+    u64 home = home_block(ohtable, record[0]);
+    find_args found = {.key = record[0], .update = record};
+    RETURN_IF_ERROR(find(ohtable, home, &found));
+    bool insert = (found.found == 0) & (found.has_empty != 0) & (ohtable->num_items < ohtable->capacity);
+
+    // The insertion pass is made whether or not there is anything to insert.
+    memset(ohtable->carried, 255, ohtable->record_qwords * sizeof(u64));
+    for (size_t j = 0; j < ohtable->record_qwords; ++j)
+    {
+        cond_obv_cpy_u64(insert, ohtable->carried + j, record + j);
+    }
+    insert_args args = {.ohtable = ohtable};
+    for (size_t step = 0; step < ohtable->probe_blocks; ++step)
+    {
+        u64 block = window_block(ohtable, home, step);
+        args.first_slot = block * ohtable->slots_per_block;
+        args.first_offset = step * ohtable->slots_per_block;
+        RETURN_IF_ERROR(oram_function_access(ohtable->oram, ohtable->base_block_id + block, insert_accessor, &args));
+    }
+    // each step of the chain moved a record one slot further from its home
+    ohtable->num_items += insert;
+    ohtable->total_displacement += U64_TERNARY(insert, args.trace, 0);
+    ohtable->max_trace_length = U64_TERNARY(insert & (args.trace > ohtable->max_trace_length), args.trace, ohtable->max_trace_length);
+    // Acceptable if: the result is returned to the caller
+    return found.found | insert ? err_SUCCESS : err_OHTABLE__TABLE_FULL;
+}
+
+error_t ohtable_remove(ohtable *ohtable, u64 key)
+{
+    u64 home = home_block(ohtable, key);
+    find_args found = {.key = key};
+    RETURN_IF_ERROR(find(ohtable, home, &found));
+
+    memset(ohtable->carried, 255, ohtable->record_qwords * sizeof(u64));
+    shift_args args = {.ohtable = ohtable, .start = found.found_offset, .end = found.run_end, .enabled = found.found};
+    for (size_t step = ohtable->probe_blocks; step-- > 0;)
+    {
+        u64 block = window_block(ohtable, home, step);
+        args.first_offset = step * ohtable->slots_per_block;
+        RETURN_IF_ERROR(oram_function_access(ohtable->oram, ohtable->base_block_id + block, shift_accessor, &args));
+    }
+    // the removed record does not stay in memory
+    memset(ohtable->carried, 255, ohtable->record_qwords * sizeof(u64));
+    // the records after it in the run each moved one slot closer to their home
+    ohtable->num_items -= found.found;
+    u64 removed_displacement = found.found_displacement + found.run_end - found.found_offset - 1;
+    ohtable->total_displacement -= U64_TERNARY(found.found, removed_displacement, 0);
+    // Acceptable if: the result is returned to the caller
+    return found.found ? err_SUCCESS : err_OHTABLE__GET__FAILURE;
+}
+
+size_t ohtable_capacity(const ohtable *ohtable)
+{
+    return ohtable->capacity;
+}
+
+size_t ohtable_num_items(const ohtable *ohtable)
+{
+    return ohtable->num_items;
+}
+
+size_t ohtable_record_size(const ohtable *ohtable)
+{
+    return ohtable->record_qwords;
+}
+
+const ohtable_statistics *ohtable_report_statistics(ohtable *ohtable)
+{
+    const oram_statistics *oram_statistics = oram_report_statistics(ohtable->oram);
+    ohtable->statistics = (ohtable_statistics){
+        .max_trace_length = ohtable->max_trace_length,
+        .total_displacement = ohtable->total_displacement,
+        .num_items = ohtable->num_items,
+        .capacity = ohtable->capacity,
+        .oram_recursion_depth = oram_statistics->recursion_depth,
+        .oram_access_count = oram_statistics->access_count,
+        .stash_overflow_count = oram_statistics->stash_overflow_count,
+        .max_stash_overflow_count = oram_statistics->max_stash_overflow_count,
+        .sum_stash_overflow_count = oram_statistics->sum_stash_overflow_count,
+        .stash_overflow_ema10k = oram_statistics->stash_overflow_ema10k,
+        .posmap_stash_overflow_count = oram_statistics->posmap_stash_overflow_count,
+        .posmap_max_stash_overflow_count = oram_statistics->posmap_max_stash_overflow_count,
+        .posmap_sum_stash_overflow_count = oram_statistics->posmap_sum_stash_overflow_count,
+        .posmap_stash_overflow_ema10k = oram_statistics->posmap_stash_overflow_ema10k,
+    };
+    return &ohtable->statistics;
+}
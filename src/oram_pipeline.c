@@ -0,0 +1,268 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/oram_pipeline.h"
+#include "../include/position_map.h"
+#include "../include/bucket.h"
+
+// Level 0 is the data ORAM and level i + 1 is the ORAM that backs the position map of level i. The position map of
+// the deepest level is a scan map. Stage i serves level i.
+typedef struct
+{
+    // id of the block at each level
+    u64 block_ids[ORAM_PIPELINE_MAX_STAGES];
+    // leaf of the block after this request, chosen and stored by the level below
+    u64 new_positions[ORAM_PIPELINE_MAX_STAGES];
+    // current leaf of the block at the next level to be served
+    u64 position;
+    accessor_func accessor;
+    void *accessor_args;
+    error_t err;
+} pipeline_request;
+
+typedef struct
+{
+    oram_pipeline *pipeline;
+    size_t level;
+} pipeline_stage;
+
+struct oram_pipeline
+{
+    size_t num_stages;
+    oram *levels[ORAM_PIPELINE_MAX_STAGES];
+    position_map *position_maps[ORAM_PIPELINE_MAX_STAGES];
+
+    pthread_t threads[ORAM_PIPELINE_MAX_STAGES];
+    pipeline_stage stages[ORAM_PIPELINE_MAX_STAGES];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+
+    // requests in flight, indexed by sequence number modulo `depth`
+    pipeline_request *ring;
+    size_t depth;
+    u64 submitted;
+    // number of requests each stage has finished
+    u64 progress[ORAM_PIPELINE_MAX_STAGES];
+    // first error since the last drain
+    error_t err;
+};
+
+typedef struct
+{
+    size_t block_size;
+    size_t index;
+    u64 position;
+    u64 prev_position;
+} position_entry_args;
+
+// Swaps one entry of a position map block, like `oram_put_partial`, touching every entry so the index is not revealed.
+static error_t position_entry_accessor(u64 *block_data, void *args)
+{
+    position_entry_args *entry = args;
+    for (size_t i = 0; i < entry->block_size; ++i)
+    {
+        bool cond = i == entry->index;
+        cond_obv_cpy_u64(cond, &entry->prev_position, block_data + i);
+        cond_obv_cpy_u64(cond, block_data + i, &entry->position);
+    }
+    return err_SUCCESS;
+}
+
+static error_t pipeline_serve(oram_pipeline *pipeline, size_t level, pipeline_request *request)
+{
+    // Acceptable if: not executed in an oram_access
+    if (level == pipeline->num_stages - 1)
+    {
+        request->new_positions[level] = oram_random_position(pipeline->levels[level]);
+        RETURN_IF_ERROR(position_map_read_then_set(pipeline->position_maps[level], request->block_ids[level], request->new_positions[level], &request->position));
+    }
+
+    // Acceptable if: the level is public
+    if (level == 0)
+    {
+        return oram_function_access_at(pipeline->levels[0], request->block_ids[0], request->position, request->new_positions[0], request->accessor, request->accessor_args);
+    }
+
+    // store the new leaf of the block one level up, and read its current one
+    request->new_positions[level - 1] = oram_random_position(pipeline->levels[level - 1]);
+    position_entry_args entry = {
+        .block_size = oram_block_size(pipeline->levels[level]),
+        .index = request->block_ids[level - 1] % oram_block_size(pipeline->levels[level]),
+        .position = request->new_positions[level - 1]};
+    RETURN_IF_ERROR(oram_function_access_at(pipeline->levels[level], request->block_ids[level], request->position, request->new_positions[level], position_entry_accessor, &entry));
+    request->position = position_map_resolve_position(pipeline->position_maps[level - 1], entry.prev_position);
+    return err_SUCCESS;
+}
+
+static void *pipeline_stage_worker(void *arg)
+{
+    pipeline_stage *stage = arg;
+    oram_pipeline *pipeline = stage->pipeline;
+    size_t level = stage->level;
+    // the deepest stage takes new requests, every other stage takes them from the stage below
+    const u64 *upstream = level == pipeline->num_stages - 1 ? &pipeline->submitted : &pipeline->progress[level + 1];
+
+    for (u64 seq = 0;; ++seq)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        while (!pipeline->stop && *upstream <= seq)
+        {
+            pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+        }
+        // Acceptable if: not executed in an oram_access
+        if (*upstream <= seq)
+        {
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+
+        pipeline_request *request = &pipeline->ring[seq % pipeline->depth];
+        // a request that failed at a deeper level has no leaf for this one
+        // Acceptable if: failure is a bug that leaks more than the timing here
+        if (request->err == err_SUCCESS)
+        {
+            request->err = pipeline_serve(pipeline, level, request);
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        // Acceptable if: failure is a bug that leaks more than the timing here
+        if (level == 0 && pipeline->err == err_SUCCESS)
+        {
+            pipeline->err = request->err;
+        }
+        pipeline->progress[level] = seq + 1;
+        pthread_cond_broadcast(&pipeline->cond);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    return NULL;
+}
+
+oram_pipeline *oram_pipeline_create(oram *oram, size_t depth)
+{
+    CHECK(depth > 0);
+    oram_pipeline *pipeline;
+    CHECK(pipeline = calloc(1, sizeof(*pipeline)));
+    pipeline->depth = depth;
+    CHECK(pipeline->ring = calloc(depth, sizeof(*pipeline->ring)));
+
+    // walk the recursion down to the scan map
+    while (oram)
+    {
+        CHECK(pipeline->num_stages < ORAM_PIPELINE_MAX_STAGES);
+        pipeline->levels[pipeline->num_stages] = oram;
+        pipeline->position_maps[pipeline->num_stages] = oram_get_position_map(oram);
+        oram = position_map_oram(pipeline->position_maps[pipeline->num_stages]);
+        ++pipeline->num_stages;
+    }
+
+    CHECK(pthread_mutex_init(&pipeline->lock, NULL) == 0);
+    CHECK(pthread_cond_init(&pipeline->cond, NULL) == 0);
+    for (size_t level = 0; level < pipeline->num_stages; ++level)
+    {
+        pipeline->stages[level].pipeline = pipeline;
+        pipeline->stages[level].level = level;
+        CHECK(pthread_create(&pipeline->threads[level], NULL, pipeline_stage_worker, &pipeline->stages[level]) == 0);
+    }
+    return pipeline;
+}
+
+void oram_pipeline_destroy(oram_pipeline *pipeline)
+{
+    // Acceptable if: not executed in an oram_access
+    if (pipeline)
+    {
+        oram_pipeline_drain(pipeline);
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->stop = true;
+        pthread_cond_broadcast(&pipeline->cond);
+        pthread_mutex_unlock(&pipeline->lock);
+        for (size_t level = 0; level < pipeline->num_stages; ++level)
+        {
+            pthread_join(pipeline->threads[level], NULL);
+        }
+        pthread_cond_destroy(&pipeline->cond);
+        pthread_mutex_destroy(&pipeline->lock);
+        free(pipeline->ring);
+        free(pipeline);
+    }
+}
+
+size_t oram_pipeline_num_stages(const oram_pipeline *pipeline)
+{
+    return pipeline->num_stages;
+}
+
+void oram_pipeline_submit(oram_pipeline *pipeline, u64 block_id, accessor_func accessor, void *accessor_args)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->submitted - pipeline->progress[0] >= pipeline->depth)
+    {
+        pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+
+    // the slot is free: the data stage has finished the request that used it last
+    pipeline_request *request = &pipeline->ring[pipeline->submitted % pipeline->depth];
+    memset(request, 0, sizeof(*request));
+    request->accessor = accessor;
+    request->accessor_args = accessor_args;
+    request->block_ids[0] = block_id;
+    // `oram_function_access` rejects an unallocated block before its position map lookup, so no level may access it
+    // Acceptable if: block_id is public (same check as oram_function_access)
+    if (!oram_block_allocated(pipeline->levels[0], block_id))
+    {
+        request->err = err_ORAM__ACCESS_UNALLOCATED_BLOCK;
+    }
+    for (size_t level = 1; level < pipeline->num_stages; ++level)
+    {
+        request->block_ids[level] = position_map_block_for_index(pipeline->position_maps[level - 1], request->block_ids[level - 1]);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    ++pipeline->submitted;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static error_t copy_out_accessor(u64 *block_data, void *args)
+{
+    memcpy(args, block_data, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+static error_t copy_in_accessor(u64 *block_data, void *args)
+{
+    memcpy(block_data, args, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+void oram_pipeline_get(oram_pipeline *pipeline, u64 block_id, u64 buf[])
+{
+    CHECK(oram_block_size(pipeline->levels[0]) == BLOCK_DATA_SIZE_QWORDS);
+    oram_pipeline_submit(pipeline, block_id, copy_out_accessor, buf);
+}
+
+void oram_pipeline_put(oram_pipeline *pipeline, u64 block_id, const u64 data[])
+{
+    CHECK(oram_block_size(pipeline->levels[0]) == BLOCK_DATA_SIZE_QWORDS);
+    oram_pipeline_submit(pipeline, block_id, copy_in_accessor, (void *)data);
+}
+
+error_t oram_pipeline_drain(oram_pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->progress[0] < pipeline->submitted)
+    {
+        pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+    }
+    error_t err = pipeline->err;
+    pipeline->err = err_SUCCESS;
+    pthread_mutex_unlock(&pipeline->lock);
+    return err;
+}
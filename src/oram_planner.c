@@ -0,0 +1,474 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/oram_planner.h"
+#include "../include/path_oram.h"
+#include "../include/position_map.h"
+#include "../include/bucket.h"
+#include "../include/stash.h"
+#include "../include/tree_path.h"
+#include "../include/statistics.h"
+
+// The stash size of a Path ORAM depends on Z and the load factor, and very little on the size of the tree.
+#define SIMULATION_LEAVES (1 << 12)
+#define SIMULATION_ACCESSES (1 << 16)
+// Configurations whose simulated stash exceeds this are not planned: their stash is not bounded.
+#define MAX_PLANNED_STASH_OVERFLOW 512
+// Accesses timed for each configuration by `oram_cost_model_calibrate`
+#define CALIBRATION_ACCESSES 2000
+
+static const size_t block_sizes[] = {256, 512, 1024, BLOCK_DATA_SIZE_BYTES, 2048, 4096};
+static const size_t posmap_block_sizes[] = {256, 512, BLOCK_DATA_SIZE_BYTES};
+static const size_t scan_thresholds[] = {1 << 10, 1 << 12, SCAN_THRESHOLD};
+static const double load_factors[] = {1.0, 1.5, 2.0, 2.5, 3.0};
+// The stash of Z = 2 grows with the height of the tree, past what a simulation of a practical size shows
+#define MIN_BLOCKS_PER_BUCKET 3
+#define MAX_BLOCKS_PER_BUCKET 6
+#define NUM_BLOCKS_PER_BUCKET (MAX_BLOCKS_PER_BUCKET - MIN_BLOCKS_PER_BUCKET + 1)
+#define NUM_LOAD_FACTORS (sizeof(load_factors) / sizeof(load_factors[0]))
+// Position map ORAMs have the default load factor, `load_factors[POSMAP_LOAD_FACTOR]`
+#define POSMAP_LOAD_FACTOR 2
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+// The features of an access that the cost model weighs, in the order of the fields of `oram_cost_model`
+typedef enum {
+    feature_bytes,
+    feature_sort_bytes,
+    feature_assignments,
+    feature_levels,
+    num_features
+} cost_feature;
+
+typedef struct {
+    double features[num_features];
+    size_t size_bytes;
+    size_t recursion_depth;
+    size_t access_bytes;
+} plan_cost;
+
+// The simulation needs statistically good randomness, not secret randomness, and far more of it than an access.
+static u64 splitmix64(u64 *state)
+{
+    u64 z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Evict the stash onto the path to `leaf` as Path ORAM does, each block as deep as it can go. A block can go as
+// deep as the height at which its path meets this one, and blocks that can go to a height can also go to any bucket
+// above it, so filling buckets from the leaf up with the blocks sorted by that height places the most blocks.
+static void simulate_eviction(u32 *stash, size_t *stash_size, u32 *sorted, u32 *buckets, u8 *occupancy, const u32 *leaves,
+                              size_t num_leaves, size_t num_levels, size_t blocks_per_bucket, u32 leaf)
+{
+    size_t counts[64 + 1] = {0};
+    for (size_t i = 0; i < *stash_size; ++i) {
+        counts[ceil_log2((size_t)(leaves[stash[i]] ^ leaf) + 1)]++;
+    }
+    size_t starts[64 + 1];
+    size_t start = 0;
+    for (size_t h = 0; h <= num_levels; ++h) {
+        starts[h] = start;
+        start += counts[h];
+    }
+    for (size_t i = 0; i < *stash_size; ++i) {
+        sorted[starts[ceil_log2((size_t)(leaves[stash[i]] ^ leaf) + 1)]++] = stash[i];
+    }
+
+    size_t placed = 0;
+    size_t eligible = 0;
+    for (size_t h = 0; h < num_levels; ++h) {
+        eligible += counts[h];
+        size_t node = (num_leaves + leaf) >> h;
+        while (occupancy[node] < blocks_per_bucket && placed < eligible) {
+            buckets[node * blocks_per_bucket + occupancy[node]++] = sorted[placed++];
+        }
+    }
+    *stash_size -= placed;
+    memcpy(stash, sorted + placed, *stash_size * sizeof(*stash));
+}
+
+oram_stash_simulation oram_simulate_stash(size_t num_leaves, size_t blocks_per_bucket, double load_factor, size_t num_accesses, entropy_func getentropy)
+{
+    CHECK(num_leaves > 0 && (num_leaves & (num_leaves - 1)) == 0 && num_leaves <= UINT32_MAX / 4);
+    CHECK(blocks_per_bucket > 0 && blocks_per_bucket <= UINT8_MAX);
+    CHECK(load_factor >= 1.0 && load_factor <= 3.0); // Acceptable &&: not executed in an oram_access
+    size_t num_blocks = num_leaves * load_factor;
+    size_t num_levels = floor_log2(num_leaves) + 1;
+    u64 state;
+    CHECK(getentropy(&state, sizeof(state)) == 0);
+
+    // buckets are numbered as in a heap, from 1 at the root to 2 * num_leaves - 1 at the last leaf
+    u32 *leaves, *buckets, *stash, *sorted;
+    u8 *occupancy;
+    CHECK(leaves = calloc(num_blocks, sizeof(*leaves)));
+    CHECK(buckets = calloc(2 * num_leaves * blocks_per_bucket, sizeof(*buckets)));
+    CHECK(occupancy = calloc(2 * num_leaves, sizeof(*occupancy)));
+    CHECK(stash = calloc(num_blocks, sizeof(*stash)));
+    CHECK(sorted = calloc(num_blocks, sizeof(*sorted)));
+
+    // Start with every block in the stash, evict it along its own path, then let the first pass of accesses bring the
+    // tree to its steady state before measuring.
+    size_t stash_size = 0;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        leaves[b] = splitmix64(&state) & (num_leaves - 1);
+        stash[stash_size++] = b;
+        simulate_eviction(stash, &stash_size, sorted, buckets, occupancy, leaves, num_leaves, num_levels, blocks_per_bucket, leaves[b]);
+    }
+
+    oram_stash_simulation result = {0};
+    double sum_overflow = 0;
+    for (size_t i = 0; i < num_blocks + num_accesses; ++i) {
+        u32 block_id = splitmix64(&state) % num_blocks;
+        u32 leaf = leaves[block_id];
+        for (size_t h = 0; h < num_levels; ++h) {
+            size_t node = (num_leaves + leaf) >> h;
+            memcpy(stash + stash_size, buckets + node * blocks_per_bucket, occupancy[node] * sizeof(*stash));
+            stash_size += occupancy[node];
+            occupancy[node] = 0;
+        }
+        leaves[block_id] = splitmix64(&state) & (num_leaves - 1);
+        simulate_eviction(stash, &stash_size, sorted, buckets, occupancy, leaves, num_leaves, num_levels, blocks_per_bucket, leaf);
+        // Acceptable if: not executed in an oram_access
+        if (i >= num_blocks) {
+            sum_overflow += stash_size;
+            result.max_overflow = max(result.max_overflow, stash_size);
+        }
+    }
+    result.mean_overflow = num_accesses > 0 ? sum_overflow / num_accesses : 0;
+
+    free(leaves);
+    free(buckets);
+    free(occupancy);
+    free(stash);
+    free(sorted);
+    return result;
+}
+
+// Compare-exchanges of the odd-even merge sort of `n` blocks done by `stash_build_path`
+static size_t sort_compare_exchanges(size_t n)
+{
+    size_t result = 0;
+    for (size_t p = 1; p < n; p <<= 1) {
+        for (size_t k = p; k >= 1; k >>= 1) {
+            for (size_t j = k % p; j + k < n; j += 2 * k) {
+                for (size_t i = 0; i < k && i + j + k < n; ++i) {
+                    result += ((i + j) / (p * 2)) == ((i + j + k) / (p * 2));
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Add one ORAM of `num_blocks` blocks, without its position map, as `_create` builds it
+static void plan_cost_add_oram(plan_cost *cost, size_t num_blocks, const bucket_geometry *geometry, double load_factor,
+                               size_t stash_overflow_size, double mean_overflow)
+{
+    size_t num_leaves = oram_num_leaves_for_blocks(num_blocks, load_factor);
+    size_t num_levels = tree_path_num_levels(num_leaves, 2);
+    size_t block_bytes = bucket_geometry_block_qwords(geometry) * sizeof(u64);
+    size_t path_blocks = geometry->blocks_per_bucket * num_levels;
+    size_t path_bytes = num_levels * geometry->bucket_size;
+
+    // the oram, its bucket tree, its stash with the bucket assignment of each block, and its path
+    cost->size_bytes += sizeof(oram) + bucket_tree_size_bytes(num_leaves, geometry) + sizeof(stash) +
+                        (path_blocks + stash_overflow_size) * (block_bytes + sizeof(u64)) + 2 * num_levels * sizeof(u64);
+    cost->access_bytes += 2 * path_bytes;
+    // the path is read and written, and the accessed block is copied into the first free block of the overflow
+    cost->features[feature_bytes] += 2 * path_bytes + stash_overflow_size * block_bytes;
+    size_t stash_blocks = path_blocks + (size_t)ceil(mean_overflow);
+    cost->features[feature_sort_bytes] += 2.0 * block_bytes * sort_compare_exchanges(stash_blocks);
+    cost->features[feature_assignments] += stash_blocks * num_levels;
+    cost->features[feature_levels] += 1;
+}
+
+// Predict the size and the work of an access of the ORAM `oram_create_from_plan` creates
+static plan_cost plan_evaluate(const oram_plan *plan, double mean_overflow, double posmap_mean_overflow)
+{
+    plan_cost cost = {0};
+    bucket_geometry geometry = bucket_geometry_create(0, plan->blocks_per_bucket, plan->block_size_bytes);
+    size_t num_blocks = plan->capacity_u64 / geometry.block_data_qwords + (plan->capacity_u64 % geometry.block_data_qwords == 0 ? 0 : 1);
+    plan_cost_add_oram(&cost, num_blocks, &geometry, plan->load_factor, plan->stash_overflow_size, mean_overflow);
+
+    // each position map holds an entry for every block of the ORAM above it
+    bucket_geometry posmap_geometry = bucket_geometry_create(0, plan->posmap_level.blocks_per_bucket, plan->posmap_level.block_size_bytes);
+    size_t entries = num_blocks;
+    while (entries > plan->scan_threshold) {
+        size_t posmap_blocks = entries / posmap_geometry.block_data_qwords + (entries % posmap_geometry.block_data_qwords == 0 ? 0 : 1);
+        plan_cost_add_oram(&cost, posmap_blocks, &posmap_geometry, load_factors[POSMAP_LOAD_FACTOR], plan->posmap_level.stash_overflow_size, posmap_mean_overflow);
+        cost.size_bytes += sizeof(position_map);
+        cost.recursion_depth++;
+        entries = posmap_blocks;
+    }
+    // the scan map is read and written in full
+    cost.size_bytes += sizeof(position_map) + entries * sizeof(u64);
+    cost.recursion_depth++;
+    cost.access_bytes += 2 * entries * sizeof(u64);
+    cost.features[feature_bytes] += 2 * entries * sizeof(u64);
+    cost.features[feature_levels] += 1;
+    return cost;
+}
+
+static double plan_cost_ns(const plan_cost *cost, const oram_cost_model *model)
+{
+    return model->ns_per_byte * cost->features[feature_bytes] + model->ns_per_sort_byte * cost->features[feature_sort_bytes]
+        + model->ns_per_assignment * cost->features[feature_assignments] + model->ns_per_level * cost->features[feature_levels];
+}
+
+// Room for the largest stash the simulation saw
+static size_t planned_stash_overflow_size(const oram_stash_simulation *simulation)
+{
+    return max(simulation->max_overflow, (size_t)1);
+}
+
+// Simulations are run on demand and reused for every configuration with the same Z and load factor
+typedef struct {
+    oram_stash_simulation results[NUM_BLOCKS_PER_BUCKET][NUM_LOAD_FACTORS];
+    bool done[NUM_BLOCKS_PER_BUCKET][NUM_LOAD_FACTORS];
+    size_t num_leaves;
+    entropy_func getentropy;
+} stash_simulations;
+
+// Simulate trees of up to `SIMULATION_LEAVES` leaves, or as many as an ORAM of `num_blocks` blocks has: the stash of a
+// small Z grows with the height of the tree.
+static stash_simulations *stash_simulations_create(size_t num_blocks, entropy_func getentropy)
+{
+    stash_simulations *simulations;
+    CHECK(simulations = calloc(1, sizeof(*simulations)));
+    simulations->num_leaves = (size_t)1 << ceil_log2(num_blocks / 2 + 1);
+    simulations->num_leaves = simulations->num_leaves < SIMULATION_LEAVES ? simulations->num_leaves : SIMULATION_LEAVES;
+    simulations->getentropy = getentropy;
+    return simulations;
+}
+
+static const oram_stash_simulation *stash_simulation(stash_simulations *simulations, size_t blocks_per_bucket, size_t load_factor_index)
+{
+    size_t z = blocks_per_bucket - MIN_BLOCKS_PER_BUCKET;
+    // Acceptable if: not executed in an oram_access
+    if (!simulations->done[z][load_factor_index]) {
+        simulations->results[z][load_factor_index] = oram_simulate_stash(simulations->num_leaves, blocks_per_bucket,
+            load_factors[load_factor_index], SIMULATION_ACCESSES, simulations->getentropy);
+        simulations->done[z][load_factor_index] = true;
+    }
+    return &simulations->results[z][load_factor_index];
+}
+
+error_t oram_plan_create(size_t capacity_u64, size_t budget_bytes, size_t block_size_bytes, const oram_cost_model *model, entropy_func getentropy, oram_plan *plan)
+{
+    CHECK(capacity_u64 > 0);
+    // the largest blocks give the smallest tree
+    stash_simulations *simulations = stash_simulations_create(capacity_u64 / (block_size_bytes > 0 ? block_size_bytes : 4096) * sizeof(u64), getentropy);
+    const size_t *candidate_block_sizes = block_size_bytes > 0 ? &block_size_bytes : block_sizes;
+    size_t num_block_sizes = block_size_bytes > 0 ? 1 : ARRAY_LEN(block_sizes);
+
+    bool found = false;
+    for (size_t b = 0; b < num_block_sizes; ++b) {
+        for (size_t z = MIN_BLOCKS_PER_BUCKET; z <= MAX_BLOCKS_PER_BUCKET; ++z) {
+            for (size_t lf = 0; lf < NUM_LOAD_FACTORS; ++lf) {
+                const oram_stash_simulation *data_stash = stash_simulation(simulations, z, lf);
+                // Acceptable if: not executed in an oram_access
+                if (data_stash->max_overflow > MAX_PLANNED_STASH_OVERFLOW) {
+                    continue;
+                }
+                for (size_t pb = 0; pb < ARRAY_LEN(posmap_block_sizes); ++pb) {
+                    for (size_t pz = MIN_BLOCKS_PER_BUCKET; pz <= MAX_BLOCKS_PER_BUCKET; ++pz) {
+                        const oram_stash_simulation *posmap_stash = stash_simulation(simulations, pz, POSMAP_LOAD_FACTOR);
+                        // Acceptable if: not executed in an oram_access
+                        if (posmap_stash->max_overflow > MAX_PLANNED_STASH_OVERFLOW) {
+                            continue;
+                        }
+                        for (size_t t = 0; t < ARRAY_LEN(scan_thresholds); ++t) {
+                            oram_plan candidate = {
+                                .capacity_u64 = capacity_u64,
+                                .stash_overflow_size = planned_stash_overflow_size(data_stash),
+                                .blocks_per_bucket = z,
+                                .block_size_bytes = candidate_block_sizes[b],
+                                .load_factor = load_factors[lf],
+                                .scan_threshold = scan_thresholds[t],
+                                .posmap_level = {
+                                    .blocks_per_bucket = pz,
+                                    .block_size_bytes = posmap_block_sizes[pb],
+                                    .stash_overflow_size = planned_stash_overflow_size(posmap_stash)}};
+                            plan_cost cost = plan_evaluate(&candidate, data_stash->mean_overflow, posmap_stash->mean_overflow);
+                            candidate.size_bytes = cost.size_bytes;
+                            candidate.recursion_depth = cost.recursion_depth;
+                            candidate.access_bytes = cost.access_bytes;
+                            candidate.accesses_per_second = 1e9 / plan_cost_ns(&cost, model);
+                            // Acceptable if: not executed in an oram_access
+                            if (candidate.size_bytes <= budget_bytes && (!found || candidate.accesses_per_second > plan->accesses_per_second)) {
+                                *plan = candidate;
+                                found = true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(simulations);
+    return found ? err_SUCCESS : err_ORAM__PLAN_INFEASIBLE;
+}
+
+oram *oram_create_from_plan(const oram_plan *plan, entropy_func getentropy)
+{
+    oram_config config = {
+        .blocks_per_bucket = plan->blocks_per_bucket,
+        .block_size_bytes = plan->block_size_bytes,
+        .load_factor = plan->load_factor,
+        .scan_threshold = plan->scan_threshold,
+        .posmap_levels = &plan->posmap_level,
+        .num_posmap_levels = 1};
+    return oram_create_with_config(plan->capacity_u64, plan->stash_overflow_size, &config, getentropy);
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Least squares fit of `coefficients` to `num_samples` rows of `features` and `ns`, with every coefficient
+// non-negative: a coefficient that comes out negative is fixed at 0 and the others are fit again.
+static void fit_non_negative(size_t num_samples, const double features[][num_features], const double *ns, double coefficients[num_features])
+{
+    bool active[num_features];
+    double scale[num_features];
+    for (size_t f = 0; f < num_features; ++f) {
+        active[f] = true;
+        scale[f] = 0;
+        for (size_t s = 0; s < num_samples; ++s) {
+            scale[f] = fmax(scale[f], features[s][f]);
+        }
+    }
+    for (size_t round = 0; round < num_features; ++round) {
+        // normal equations of the active features, scaled to [0, 1] so that they are well conditioned
+        double a[num_features][num_features + 1];
+        memset(a, 0, sizeof(a));
+        for (size_t i = 0; i < num_features; ++i) {
+            for (size_t s = 0; s < num_samples; ++s) {
+                double xi = active[i] && scale[i] > 0 ? features[s][i] / scale[i] : 0;
+                for (size_t j = 0; j < num_features; ++j) {
+                    double xj = active[j] && scale[j] > 0 ? features[s][j] / scale[j] : 0;
+                    a[i][j] += xi * xj;
+                }
+                a[i][num_features] += xi * ns[s];
+            }
+            // an inactive feature solves to 0
+            a[i][i] += active[i] && scale[i] > 0 ? 0 : 1;
+        }
+        // Gauss-Jordan elimination with partial pivoting
+        for (size_t col = 0; col < num_features; ++col) {
+            size_t pivot = col;
+            for (size_t r = col + 1; r < num_features; ++r) {
+                pivot = fabs(a[r][col]) > fabs(a[pivot][col]) ? r : pivot;
+            }
+            for (size_t c = 0; c <= num_features; ++c) {
+                double tmp = a[col][c];
+                a[col][c] = a[pivot][c];
+                a[pivot][c] = tmp;
+            }
+            // Acceptable if: not executed in an oram_access
+            if (fabs(a[col][col]) < 1e-12) {
+                // the samples do not determine this feature
+                a[col][col] = 1;
+                memset(&a[col][col + 1], 0, (num_features - col) * sizeof(double));
+            }
+            for (size_t r = 0; r < num_features; ++r) {
+                double factor = r == col ? 0 : a[r][col] / a[col][col];
+                for (size_t c = col; c <= num_features; ++c) {
+                    a[r][c] -= factor * a[col][c];
+                }
+            }
+        }
+        bool negative = false;
+        for (size_t f = 0; f < num_features; ++f) {
+            coefficients[f] = active[f] && scale[f] > 0 ? a[f][num_features] / a[f][f] / scale[f] : 0;
+            // Acceptable if: not executed in an oram_access
+            if (coefficients[f] < 0) {
+                active[f] = false;
+                negative = true;
+            }
+        }
+        // Acceptable if: not executed in an oram_access
+        if (!negative) {
+            return;
+        }
+    }
+    for (size_t f = 0; f < num_features; ++f) {
+        coefficients[f] = fmax(coefficients[f], 0);
+    }
+}
+
+void oram_cost_model_calibrate(oram_cost_model *model, size_t capacity_u64, entropy_func getentropy)
+{
+    // Block sizes and Z set the bytes and the sort, and the scan thresholds set the number of recursion levels.
+    static const size_t calibration_block_sizes[] = {256, BLOCK_DATA_SIZE_BYTES, 4096};
+    static const size_t calibration_blocks_per_bucket[] = {3, 6};
+    static const size_t calibration_scan_thresholds[] = {256, SCAN_THRESHOLD};
+    size_t num_samples = ARRAY_LEN(calibration_block_sizes) * ARRAY_LEN(calibration_blocks_per_bucket) * ARRAY_LEN(calibration_scan_thresholds);
+    double features[num_samples][num_features];
+    double ns[num_samples];
+
+    stash_simulations *simulations = stash_simulations_create(capacity_u64 / calibration_block_sizes[0] * sizeof(u64), getentropy);
+    u64 state;
+    CHECK(getentropy(&state, sizeof(state)) == 0);
+    size_t sample = 0;
+    for (size_t b = 0; b < ARRAY_LEN(calibration_block_sizes); ++b) {
+        for (size_t z = 0; z < ARRAY_LEN(calibration_blocks_per_bucket); ++z) {
+            for (size_t t = 0; t < ARRAY_LEN(calibration_scan_thresholds); ++t) {
+                const oram_stash_simulation *simulation = stash_simulation(simulations, calibration_blocks_per_bucket[z], POSMAP_LOAD_FACTOR);
+                oram_plan plan = {
+                    .capacity_u64 = capacity_u64,
+                    .stash_overflow_size = planned_stash_overflow_size(simulation),
+                    .blocks_per_bucket = calibration_blocks_per_bucket[z],
+                    .block_size_bytes = calibration_block_sizes[b],
+                    .load_factor = load_factors[POSMAP_LOAD_FACTOR],
+                    .scan_threshold = calibration_scan_thresholds[t],
+                    .posmap_level = {
+                        .blocks_per_bucket = calibration_blocks_per_bucket[z],
+                        .block_size_bytes = calibration_block_sizes[0],
+                        .stash_overflow_size = planned_stash_overflow_size(simulation)}};
+                oram *oram = oram_create_from_plan(&plan, getentropy);
+                size_t num_blocks = oram_capacity_blocks(oram);
+                oram_allocate_contiguous(oram, num_blocks);
+                u64 *buf;
+                CHECK(buf = calloc(oram_block_size(oram), sizeof(u64)));
+                // write every block, then read as many, so that the stashes are near their steady state
+                for (size_t i = 0; i < 2 * num_blocks; ++i) {
+                    CHECK(oram_put(oram, i < num_blocks ? i : splitmix64(&state) % num_blocks, buf) == err_SUCCESS);
+                }
+                oram_statistics before = *oram_report_statistics(oram);
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (size_t i = 0; i < CALIBRATION_ACCESSES; ++i) {
+                    CHECK(oram_get(oram, splitmix64(&state) % num_blocks, buf) == err_SUCCESS);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                ns[sample] = elapsed_ns(&start, &end) / CALIBRATION_ACCESSES;
+
+                // the work is that of the stashes the accesses saw
+                const oram_statistics *after = oram_report_statistics(oram);
+                double mean_overflow = (double)(after->sum_stash_overflow_count - before.sum_stash_overflow_count) / CALIBRATION_ACCESSES;
+                double posmap_mean_overflow = (double)(after->posmap_sum_stash_overflow_count - before.posmap_sum_stash_overflow_count) / CALIBRATION_ACCESSES;
+                plan_cost cost = plan_evaluate(&plan, mean_overflow, posmap_mean_overflow);
+                memcpy(features[sample++], cost.features, sizeof(cost.features));
+                free(buf);
+                oram_destroy(oram);
+            }
+        }
+    }
+    free(simulations);
+
+    double coefficients[num_features];
+    fit_non_negative(num_samples, features, ns, coefficients);
+    model->ns_per_byte = coefficients[feature_bytes];
+    model->ns_per_sort_byte = coefficients[feature_sort_bytes];
+    model->ns_per_assignment = coefficients[feature_assignments];
+    model->ns_per_level = coefficients[feature_levels];
+}
@@ -0,0 +1,305 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../include/oram_queue.h"
+
+#define FUTURE_PENDING 0
+#define FUTURE_DONE 1
+#define FUTURE_WAITING 2
+
+// One slot of the submission ring. `sequence` tells producers and the consumer whose turn it is, as in Vyukov's
+// bounded queue: a slot at ring position `pos` is free for the producer of `pos` when `sequence == pos`, and holds a
+// request for the consumer when `sequence == pos + 1`.
+typedef struct
+{
+    u64 sequence;
+    u64 block_id;
+    accessor_func accessor;
+    void *accessor_args;
+    oram_completion_func completion;
+    void *completion_args;
+    oram_future *future;
+} queue_slot;
+
+struct oram_queue
+{
+    oram *oram;
+    queue_slot *slots;
+    size_t mask;
+    size_t batch_size;
+    pthread_t worker;
+
+    // Producers and the consumer work on different cache lines.
+    _Alignas(64) u64 tail;
+    // number of producers between their check of `closed` and the end of their enqueue
+    u64 submitters;
+    bool closed;
+
+    _Alignas(64) u64 head;
+    // futex the worker sleeps on while the ring is empty
+    u32 doorbell;
+    bool sleeping;
+};
+
+static void futex_wait(u32 *addr, u32 expected)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(u32 *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static bool queue_try_push(oram_queue *queue, const queue_slot *request)
+{
+    u64 pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    queue_slot *slot;
+    for (;;)
+    {
+        slot = &queue->slots[pos & queue->mask];
+        u64 sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(sequence - pos);
+        // Acceptable if: not executed in an oram_access
+        if (diff == 0)
+        {
+            // Acceptable if: not executed in an oram_access
+            if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // the consumer has not freed this slot yet: the ring is full
+            return false;
+        }
+        else
+        {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->block_id = request->block_id;
+    slot->accessor = request->accessor;
+    slot->accessor_args = request->accessor_args;
+    slot->completion = request->completion;
+    slot->completion_args = request->completion_args;
+    slot->future = request->future;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Single consumer: only the worker calls this.
+static bool queue_try_pop(oram_queue *queue, queue_slot *request)
+{
+    u64 pos = queue->head;
+    queue_slot *slot = &queue->slots[pos & queue->mask];
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+    {
+        return false;
+    }
+    *request = *slot;
+    // free the slot for the producer one lap later
+    __atomic_store_n(&slot->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    queue->head = pos + 1;
+    return true;
+}
+
+static void complete_future(oram_future *future, error_t err)
+{
+    future->err = err;
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_exchange_n(&future->state, FUTURE_DONE, __ATOMIC_RELEASE) == FUTURE_WAITING)
+    {
+        futex_wake(&future->state);
+    }
+}
+
+static void *queue_worker(void *arg)
+{
+    oram_queue *queue = arg;
+    queue_slot *batch;
+    CHECK(batch = calloc(queue->batch_size, sizeof(*batch)));
+    error_t *errs;
+    CHECK(errs = calloc(queue->batch_size, sizeof(*errs)));
+
+    for (;;)
+    {
+        size_t count = 0;
+        while (count < queue->batch_size && queue_try_pop(queue, &batch[count]))
+        {
+            ++count;
+        }
+
+        // Acceptable if: not executed in an oram_access
+        if (count == 0)
+        {
+            u32 doorbell = __atomic_load_n(&queue->doorbell, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&queue->sleeping, true, __ATOMIC_SEQ_CST);
+            // a producer that enqueued before seeing `sleeping` is seen here, and one that enqueues after rings
+            bool empty = __atomic_load_n(&queue->slots[queue->head & queue->mask].sequence, __ATOMIC_SEQ_CST) != queue->head + 1;
+            bool done = __atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST) && __atomic_load_n(&queue->submitters, __ATOMIC_SEQ_CST) == 0;
+            // Acceptable if: not executed in an oram_access
+            if (empty && done)
+            {
+                break;
+            }
+            // Acceptable if: not executed in an oram_access
+            if (empty)
+            {
+                futex_wait(&queue->doorbell, doorbell);
+            }
+            __atomic_store_n(&queue->sleeping, false, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            errs[i] = oram_function_access(queue->oram, batch[i].block_id, batch[i].accessor, batch[i].accessor_args);
+        }
+        // completions after the batch, so waking submitters does not slow down the accesses
+        for (size_t i = 0; i < count; ++i)
+        {
+            // Acceptable if: not executed in an oram_access
+            if (batch[i].completion)
+            {
+                batch[i].completion(errs[i], batch[i].completion_args);
+            }
+            // Acceptable if: not executed in an oram_access
+            if (batch[i].future)
+            {
+                complete_future(batch[i].future, errs[i]);
+            }
+        }
+    }
+    free(errs);
+    free(batch);
+    return NULL;
+}
+
+oram_queue *oram_queue_create(oram *oram, size_t capacity, size_t batch_size)
+{
+    CHECK(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    CHECK(batch_size > 0);
+    oram_queue *queue;
+    CHECK(queue = aligned_alloc(64, (sizeof(*queue) + 63) / 64 * 64));
+    memset(queue, 0, sizeof(*queue));
+    queue->oram = oram;
+    queue->mask = capacity - 1;
+    queue->batch_size = batch_size;
+    CHECK(queue->slots = calloc(capacity, sizeof(*queue->slots)));
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        queue->slots[i].sequence = i;
+    }
+    CHECK(pthread_create(&queue->worker, NULL, queue_worker, queue) == 0);
+    return queue;
+}
+
+static void ring_doorbell(oram_queue *queue)
+{
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&queue->sleeping, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_add(&queue->doorbell, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&queue->doorbell);
+    }
+}
+
+void oram_queue_close(oram_queue *queue)
+{
+    __atomic_store_n(&queue->closed, true, __ATOMIC_SEQ_CST);
+    ring_doorbell(queue);
+}
+
+void oram_queue_destroy(oram_queue *queue)
+{
+    // Acceptable if: not executed in an oram_access
+    if (queue)
+    {
+        oram_queue_close(queue);
+        pthread_join(queue->worker, NULL);
+        free(queue->slots);
+        free(queue);
+    }
+}
+
+static error_t queue_submit(oram_queue *queue, const queue_slot *request)
+{
+    __atomic_fetch_add(&queue->submitters, 1, __ATOMIC_SEQ_CST);
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_sub(&queue->submitters, 1, __ATOMIC_SEQ_CST);
+        ring_doorbell(queue);
+        return err_QUEUE__CLOSED;
+    }
+    // A future is only reset once its request is accepted, so that a rejected one keeps its state.
+    // Acceptable if: not executed in an oram_access
+    if (request->future)
+    {
+        request->future->state = FUTURE_PENDING;
+        request->future->err = err_SUCCESS;
+    }
+    while (!queue_try_push(queue, request))
+    {
+        // the worker is behind; let it run
+        ring_doorbell(queue);
+        sched_yield();
+    }
+    __atomic_fetch_sub(&queue->submitters, 1, __ATOMIC_SEQ_CST);
+    ring_doorbell(queue);
+    return err_SUCCESS;
+}
+
+error_t oram_queue_submit(oram_queue *queue, u64 block_id, accessor_func accessor, void *accessor_args, oram_completion_func completion, void *completion_args)
+{
+    queue_slot request = {
+        .block_id = block_id,
+        .accessor = accessor,
+        .accessor_args = accessor_args,
+        .completion = completion,
+        .completion_args = completion_args};
+    return queue_submit(queue, &request);
+}
+
+error_t oram_queue_submit_future(oram_queue *queue, u64 block_id, accessor_func accessor, void *accessor_args, oram_future *future)
+{
+    queue_slot request = {
+        .block_id = block_id,
+        .accessor = accessor,
+        .accessor_args = accessor_args,
+        .future = future};
+    return queue_submit(queue, &request);
+}
+
+bool oram_future_done(const oram_future *future)
+{
+    return __atomic_load_n(&future->state, __ATOMIC_ACQUIRE) == FUTURE_DONE;
+}
+
+error_t oram_future_wait(oram_future *future)
+{
+    u32 state = __atomic_load_n(&future->state, __ATOMIC_ACQUIRE);
+    while (state != FUTURE_DONE)
+    {
+        // announce the waiter so the worker knows to wake it
+        // Acceptable if: not executed in an oram_access
+        if (state == FUTURE_WAITING || __atomic_compare_exchange_n(&future->state, &state, FUTURE_WAITING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            futex_wait(&future->state, FUTURE_WAITING);
+        }
+        state = __atomic_load_n(&future->state, __ATOMIC_ACQUIRE);
+    }
+    return future->err;
+}
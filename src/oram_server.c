@@ -0,0 +1,502 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+// for memfd_create and file seals
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <linux/futex.h>
+
+#include "../include/oram_server.h"
+#include "../include/bucket.h"
+
+#define SERVER_MAGIC 0x6f72616d73727631ul // "oramsrv1"
+
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_SUBMITTED 2
+#define SLOT_WAITING 3
+#define SLOT_DONE 4
+
+// How long a stopping server keeps serving requests that clients were still pushing when it stopped
+#define SERVER_DRAIN_TIMEOUT_NS 100000000ul
+// Longest sleep of a stopping server, which cannot rely on clients to ring the doorbell
+#define SERVER_DRAIN_POLL_NS 1000000ul
+
+// The shared region is a header, the submission ring and the slots, each starting on a cache line. Everything in it
+// can be written by clients, so the server only trusts what it validates.
+typedef struct
+{
+    u64 magic;
+    u64 num_slots;
+    u64 region_size;
+    u64 capacity_blocks;
+
+    // written by clients
+    _Alignas(64) u64 tail;
+    // number of clients between their check of `closed` and the end of their enqueue
+    u64 submitters;
+    u32 closed;
+    // futex for clients waiting on a free slot
+    u32 released;
+    u32 release_waiters;
+
+    // written by the server
+    _Alignas(64) u64 head;
+    // futex the server sleeps on while the ring is empty
+    u32 doorbell;
+    u32 sleeping;
+} server_header;
+
+// Ring of slot indices. As in `oram_queue`, `sequence` is `pos` when the cell is free for the producer of `pos` and
+// `pos + 1` when it holds a slot for the server.
+typedef struct
+{
+    u64 sequence;
+    u64 slot;
+} ring_cell;
+
+typedef struct
+{
+    u32 state;
+    u32 pad;
+    u64 block_id;
+    u64 write;
+    u64 err;
+    _Alignas(64) u64 data[BLOCK_DATA_SIZE_QWORDS];
+} server_slot;
+
+typedef struct
+{
+    server_header *header;
+    ring_cell *ring;
+    server_slot *slots;
+    // private copies of the geometry in the header
+    size_t num_slots;
+    size_t size;
+} server_region;
+
+struct oram_server
+{
+    oram *oram;
+    int fd;
+    size_t batch_size;
+    server_region region;
+    pthread_t thread;
+    // set by `oram_server_destroy`. Unlike `closed` in the header it is out of reach of clients, so they cannot keep
+    // the thread running.
+    u32 stopping;
+};
+
+struct oram_client
+{
+    server_region region;
+    // where the next search for a free slot starts
+    size_t next_slot;
+};
+
+static void futex_wait(u32 *addr, u32 expected)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wait_ns(u32 *addr, u32 expected, u64 timeout_ns)
+{
+    struct timespec timeout = {.tv_sec = timeout_ns / 1000000000ul, .tv_nsec = timeout_ns % 1000000000ul};
+    syscall(SYS_futex, addr, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static u64 monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ul + (u64)now.tv_nsec;
+}
+
+static void futex_wake(u32 *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static size_t ring_offset()
+{
+    return (sizeof(server_header) + 63) / 64 * 64;
+}
+
+static size_t slots_offset(size_t num_slots)
+{
+    return (ring_offset() + num_slots * sizeof(ring_cell) + 63) / 64 * 64;
+}
+
+static size_t region_size(size_t num_slots)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = slots_offset(num_slots) + num_slots * sizeof(server_slot);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+static void region_init(server_region *region, void *base, size_t num_slots, size_t size)
+{
+    region->header = base;
+    region->ring = (ring_cell *)((u8 *)base + ring_offset());
+    region->slots = (server_slot *)((u8 *)base + slots_offset(num_slots));
+    region->num_slots = num_slots;
+    region->size = size;
+}
+
+static void ring_doorbell(server_header *header)
+{
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&header->sleeping, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_add(&header->doorbell, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&header->doorbell);
+    }
+}
+
+// Every request in flight owns its slot, so at most `num_slots` indices are in the ring and a push never waits.
+static void ring_push(server_region *region, u64 slot_index)
+{
+    server_header *header = region->header;
+    u64 mask = region->num_slots - 1;
+    u64 pos = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+    ring_cell *cell;
+    for (;;)
+    {
+        cell = &region->ring[pos & mask];
+        u64 sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        // Acceptable if: not executed in an oram_access
+        if (sequence == pos && __atomic_compare_exchange_n(&header->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+        // Acceptable if: not executed in an oram_access
+        if (sequence != pos)
+        {
+            pos = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+        }
+    }
+    cell->slot = slot_index;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+static bool ring_try_pop(server_region *region, u64 *slot_index)
+{
+    server_header *header = region->header;
+    u64 mask = region->num_slots - 1;
+    u64 pos = header->head;
+    ring_cell *cell = &region->ring[pos & mask];
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != pos + 1)
+    {
+        return false;
+    }
+    *slot_index = cell->slot;
+    __atomic_store_n(&cell->sequence, pos + mask + 1, __ATOMIC_RELEASE);
+    header->head = pos + 1;
+    return true;
+}
+
+// Swaps the block with the slot payload, or only reads it, depending on `write`, in place in the shared region.
+static error_t slot_accessor(u64 *block_data, void *args)
+{
+    server_slot *slot = args;
+    bool write = slot->write != 0;
+    for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+    {
+        u64 prev = block_data[i];
+        cond_obv_cpy_u64(write, block_data + i, slot->data + i);
+        slot->data[i] = prev;
+    }
+    return err_SUCCESS;
+}
+
+static void complete_slot(server_slot *slot, error_t err)
+{
+    slot->err = err;
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_exchange_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE) == SLOT_WAITING)
+    {
+        futex_wake(&slot->state);
+    }
+}
+
+static void *server_thread(void *arg)
+{
+    oram_server *server = arg;
+    server_region *region = &server->region;
+    server_header *header = region->header;
+    u64 *batch;
+    CHECK(batch = calloc(server->batch_size, sizeof(*batch)));
+    error_t *errs;
+    CHECK(errs = calloc(server->batch_size, sizeof(*errs)));
+    // 0 until the server is stopping
+    u64 drain_deadline = 0;
+
+    for (;;)
+    {
+        // Acceptable if: not executed in an oram_access
+        if (drain_deadline == 0 && __atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE))
+        {
+            drain_deadline = monotonic_ns() + SERVER_DRAIN_TIMEOUT_NS;
+        }
+        // `submitters` and the ring are written by clients, so a client that dies mid-submission or keeps pushing
+        // after `closed` cannot hold the server past the deadline
+        // Acceptable if: not executed in an oram_access
+        if (drain_deadline != 0 && monotonic_ns() >= drain_deadline)
+        {
+            break;
+        }
+
+        size_t count = 0;
+        while (count < server->batch_size && ring_try_pop(region, &batch[count]))
+        {
+            // a misbehaving client cannot make the server touch memory outside the region
+            // Acceptable if: not executed in an oram_access
+            if (batch[count] < region->num_slots)
+            {
+                ++count;
+            }
+        }
+
+        // Acceptable if: not executed in an oram_access
+        if (count == 0)
+        {
+            u32 doorbell = __atomic_load_n(&header->doorbell, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&header->sleeping, 1, __ATOMIC_SEQ_CST);
+            bool empty = __atomic_load_n(&region->ring[header->head & (region->num_slots - 1)].sequence, __ATOMIC_SEQ_CST) != header->head + 1;
+            // once stopping, the server is done when no client is still between its check of `closed` and its push
+            bool done = drain_deadline != 0 && __atomic_load_n(&header->submitters, __ATOMIC_SEQ_CST) == 0;
+            // Acceptable if: not executed in an oram_access
+            if (empty && done)
+            {
+                break;
+            }
+            // Acceptable if: not executed in an oram_access
+            if (empty && drain_deadline != 0)
+            {
+                futex_wait_ns(&header->doorbell, doorbell, SERVER_DRAIN_POLL_NS);
+            }
+            // Acceptable if: not executed in an oram_access
+            else if (empty)
+            {
+                futex_wait(&header->doorbell, doorbell);
+            }
+            __atomic_store_n(&header->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            server_slot *slot = &region->slots[batch[i]];
+            errs[i] = oram_function_access(server->oram, slot->block_id, slot_accessor, slot);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            complete_slot(&region->slots[batch[i]], errs[i]);
+        }
+    }
+    free(errs);
+    free(batch);
+    return NULL;
+}
+
+oram_server *oram_server_create(oram *oram, size_t num_slots, size_t batch_size)
+{
+    CHECK(num_slots > 0 && (num_slots & (num_slots - 1)) == 0);
+    CHECK(batch_size > 0);
+    // slots are sized for the default block
+    CHECK(oram_block_size(oram) == BLOCK_DATA_SIZE_QWORDS);
+    oram_server *server;
+    CHECK(server = calloc(1, sizeof(*server)));
+    server->oram = oram;
+    server->batch_size = batch_size;
+
+    size_t size = region_size(num_slots);
+    CHECK((server->fd = memfd_create("oram_server", MFD_CLOEXEC | MFD_ALLOW_SEALING)) >= 0);
+    CHECK(ftruncate(server->fd, size) == 0);
+    // clients cannot resize the region under the server
+    CHECK(fcntl(server->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0);
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, server->fd, 0);
+    CHECK(base != MAP_FAILED);
+
+    server_header *header = base;
+    header->num_slots = num_slots;
+    header->region_size = size;
+    header->capacity_blocks = oram_capacity_blocks(oram);
+    region_init(&server->region, base, num_slots, size);
+    for (size_t i = 0; i < num_slots; ++i)
+    {
+        server->region.ring[i].sequence = i;
+    }
+    __atomic_store_n(&header->magic, SERVER_MAGIC, __ATOMIC_RELEASE);
+
+    CHECK(pthread_create(&server->thread, NULL, server_thread, server) == 0);
+    return server;
+}
+
+void oram_server_destroy(oram_server *server)
+{
+    // Acceptable if: not executed in an oram_access
+    if (server)
+    {
+        server_header *header = server->region.header;
+        __atomic_store_n(&header->closed, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE);
+        // wake the server whether or not `sleeping` says it sleeps, since clients can clear it
+        __atomic_fetch_add(&header->doorbell, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&header->doorbell);
+        // clients waiting for a slot see `closed`
+        __atomic_fetch_add(&header->released, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&header->released);
+        pthread_join(server->thread, NULL);
+        munmap(header, server->region.size);
+        close(server->fd);
+        free(server);
+    }
+}
+
+int oram_server_fd(const oram_server *server)
+{
+    return server->fd;
+}
+
+error_t oram_client_attach(int fd, oram_client **client)
+{
+    struct stat st;
+    ASSERT_ERR(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(server_header), err_SERVER__ATTACH);
+    void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_ERR(base != MAP_FAILED, err_SERVER__ATTACH);
+    server_header *header = base;
+    bool valid = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == SERVER_MAGIC
+                 && header->num_slots > 0 && (header->num_slots & (header->num_slots - 1)) == 0
+                 && header->region_size == (u64)st.st_size && region_size(header->num_slots) == header->region_size;
+    // Acceptable if: not executed in an oram_access
+    if (!valid)
+    {
+        munmap(base, st.st_size);
+        return err_SERVER__ATTACH;
+    }
+    CHECK(*client = calloc(1, sizeof(**client)));
+    region_init(&(*client)->region, base, header->num_slots, st.st_size);
+    return err_SUCCESS;
+}
+
+void oram_client_detach(oram_client *client)
+{
+    // Acceptable if: not executed in an oram_access
+    if (client)
+    {
+        munmap(client->region.header, client->region.size);
+        free(client);
+    }
+}
+
+size_t oram_client_capacity_blocks(const oram_client *client)
+{
+    return client->region.header->capacity_blocks;
+}
+
+error_t oram_client_acquire(oram_client *client, oram_client_slot *slot)
+{
+    server_header *header = client->region.header;
+    size_t num_slots = client->region.num_slots;
+    for (;;)
+    {
+        u32 released = __atomic_load_n(&header->released, __ATOMIC_SEQ_CST);
+        ASSERT_ERR(!__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST), err_QUEUE__CLOSED);
+        for (size_t i = 0; i < num_slots; ++i)
+        {
+            size_t index = (client->next_slot + i) & (num_slots - 1);
+            u32 expected = SLOT_FREE;
+            // Acceptable if: not executed in an oram_access
+            if (__atomic_compare_exchange_n(&client->region.slots[index].state, &expected, SLOT_CLAIMED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                client->next_slot = index + 1;
+                slot->index = index;
+                slot->data = client->region.slots[index].data;
+                return err_SUCCESS;
+            }
+        }
+        // every slot is in use: wait for a release
+        __atomic_fetch_add(&header->release_waiters, 1, __ATOMIC_SEQ_CST);
+        futex_wait(&header->released, released);
+        __atomic_fetch_sub(&header->release_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void oram_client_release(oram_client *client, oram_client_slot *slot)
+{
+    server_header *header = client->region.header;
+    __atomic_store_n(&client->region.slots[slot->index].state, SLOT_FREE, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&header->released, 1, __ATOMIC_SEQ_CST);
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&header->release_waiters, __ATOMIC_SEQ_CST) > 0)
+    {
+        futex_wake(&header->released);
+    }
+}
+
+error_t oram_client_access(oram_client *client, oram_client_slot *slot, u64 block_id, bool write)
+{
+    server_header *header = client->region.header;
+    server_slot *s = &client->region.slots[slot->index];
+    s->block_id = block_id;
+    s->write = write;
+
+    __atomic_fetch_add(&header->submitters, 1, __ATOMIC_SEQ_CST);
+    // Acceptable if: not executed in an oram_access
+    if (__atomic_load_n(&header->closed, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_sub(&header->submitters, 1, __ATOMIC_SEQ_CST);
+        ring_doorbell(header);
+        return err_QUEUE__CLOSED;
+    }
+    __atomic_store_n(&s->state, SLOT_SUBMITTED, __ATOMIC_RELEASE);
+    ring_push(&client->region, slot->index);
+    __atomic_fetch_sub(&header->submitters, 1, __ATOMIC_SEQ_CST);
+    ring_doorbell(header);
+
+    u32 state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    while (state != SLOT_DONE)
+    {
+        // Acceptable if: not executed in an oram_access
+        if (state == SLOT_WAITING || __atomic_compare_exchange_n(&s->state, &state, SLOT_WAITING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            futex_wait(&s->state, SLOT_WAITING);
+        }
+        state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    }
+    // the slot stays claimed until it is released
+    __atomic_store_n(&s->state, SLOT_CLAIMED, __ATOMIC_RELAXED);
+    return s->err;
+}
+
+error_t oram_client_get(oram_client *client, u64 block_id, u64 buf[])
+{
+    oram_client_slot slot;
+    RETURN_IF_ERROR(oram_client_acquire(client, &slot));
+    error_t err = oram_client_access(client, &slot, block_id, false);
+    memcpy(buf, slot.data, BLOCK_DATA_SIZE_BYTES);
+    oram_client_release(client, &slot);
+    return err;
+}
+
+error_t oram_client_put(oram_client *client, u64 block_id, const u64 data[])
+{
+    oram_client_slot slot;
+    RETURN_IF_ERROR(oram_client_acquire(client, &slot));
+    memcpy(slot.data, data, BLOCK_DATA_SIZE_BYTES);
+    error_t err = oram_client_access(client, &slot, block_id, true);
+    oram_client_release(client, &slot);
+    return err;
+}
@@ -6,6 +6,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../include/bucket.h"
 #include "../include/tree_path.h"
@@ -23,6 +27,17 @@
 #define ORAM_PATH(o)            ((o)[6])
 #define ORAM_STATISTICS(o)      ((o)[7])
 #define ORAM_GETENTROPY(o)      ((o)[8])
+#define ORAM_SNAPSHOT_META_PATH(o) ((o)[9])
+#define ORAM_CHECKPOINT_DIR(o)  ((o)[10])
+#define ORAM_TARGET_BLOCK(o)    ((o)[11])
+// Bitmap of the freed blocks below ORAM_ALLOCATED_UB, one bit per block of the capacity. NULL until a block is freed.
+#define ORAM_FREE_BLOCKS(o)     ((o)[12])
+#define ORAM_NUM_FREE_BLOCKS(o) ((o)[13])
+// No block below this one is free
+#define ORAM_FIRST_FREE(o)      ((o)[14])
+// Set for an ORAM restored from a snapshot before version 7, whose position map holds leaves rather than positions
+#define ORAM_LEAF_POSITIONS(o)  ((o)[15])
+#define ORAM_ARENA(o)           ((o)[16])
 /*
 struct oram
 {
@@ -38,32 +53,145 @@ struct oram
     oram_statistics statistics; // make a pointer here?
 
     entropy_func getentropy;
+
+    // Metadata file of a clean snapshot whose bucket file is this ORAM's live bucket store, or NULL. The first
+    // access after the snapshot modifies the bucket file and must first mark the snapshot as no longer restorable.
+    char *snapshot_meta_path;
+    // Directory of the last snapshot or checkpoint. The bucket store's dirty buckets are relative to it.
+    char *checkpoint_dir;
+
+    // Holds the block being accessed. Its size depends on the geometry, so it cannot live on the stack.
+    u64 *target_block;
+
+    // Set if the position map holds leaves rather than positions, see ORAM_LEAF_POSITIONS
+    bool leaf_positions;
+
+    // The arena the ORAM was created in, see `oram_create_in`, or NULL
+    oram_arena *arena;
 };
 */
 
+// Positions in the position map are uniform in [0, ORAM_NUM_POSITIONS), and a position is on the leaf it scales to,
+// see `position_leaf`. POSITION_MAP_NOT_PRESENT is outside the range.
+#define ORAM_NUM_POSITIONS      UINT64_MAX
+
+// Whole buckets are prefetched this many levels ahead of the bucket being read. Measured on a tree far larger than
+// the last level cache; further ahead only adds pressure on the fill buffers.
+#define PATH_PREFETCH_DISTANCE 2
+
+// Layout of a snapshot directory: the buckets, the metadata (header, ORAM fields, statistics, stash, position map),
+// and, for an ORAM-backed position map, the snapshot of that ORAM in a subdirectory with the same layout.
+#define SNAPSHOT_BUCKETS_FILE       "buckets"
+#define SNAPSHOT_META_FILE          "oram.meta"
+#define SNAPSHOT_META_TMP_FILE      "oram.meta.tmp"
+#define SNAPSHOT_POSITION_MAP_DIR   "posmap"
+
+#define SNAPSHOT_MAGIC              0x50414e534d41524fULL // "ORAMSNAP"
+// Version 2 added the bucket geometry after the ORAM fields, version 3 the number of leaves after the geometry,
+// version 4 the branching after that and version 5 the leaf levels and their blocks per bucket. Version 1 snapshots
+// have the default geometry, version 1 and 2 snapshots full trees, snapshots before version 4 binary trees and
+// snapshots before version 5 the same Z on every level. Version 6 added the freed blocks after the geometry: their
+// number and, if there are any, the bitmap of the blocks below the allocated bound. Version 7 position maps hold
+// positions, earlier ones leaves.
+#define SNAPSHOT_VERSION            7
+#define SNAPSHOT_STATE_CLEAN        0
+#define SNAPSHOT_STATE_LIVE         1
+// The state is the third u64 of the header
+#define SNAPSHOT_STATE_OFFSET       (2 * sizeof(u64))
+
+static char* storage_path(const char* dir, const char* name) {
+    size_t len = strlen(dir) + 1 + strlen(name) + 1;
+    char* result;
+    CHECK(result = malloc(len));
+    snprintf(result, len, "%s/%s", dir, name);
+    return result;
+}
+
+
+static bool block_is_free(const oram *p_oram, u64 block_id)
+{
+    const u64 *free_blocks = (const u64 *)ORAM_FREE_BLOCKS(*p_oram);
+    return free_blocks != NULL && ((free_blocks[block_id / 64] >> (block_id % 64)) & 1);
+}
 
 static bool block_is_allocated(const oram *p_oram, u64 block_id)
 {
-    return block_id < ORAM_ALLOCATED_UB(*p_oram);
+    return block_id < ORAM_ALLOCATED_UB(*p_oram) && !block_is_free(p_oram, block_id);
 }
 
-static oram* _create(size_t num_levels, size_t num_blocks, size_t stash_overflow_size, entropy_func getentropy) {
+static size_t free_blocks_words(size_t num_blocks)
+{
+    return (num_blocks + 63) / 64;
+}
+
+// The configuration of the position map ORAM of an ORAM created with `config`. Returns its stash overflow size.
+static size_t posmap_config_for(const oram_config* config, size_t stash_overflow_size, oram_config* posmap_config) {
+    // Only the storage location, scan threshold, path mode, arena and position map levels are passed down to the
+    // position map ORAMs. Each recursion level is stored in a subdirectory of the level above it.
+    *posmap_config = (oram_config){.scan_threshold = config->scan_threshold, .zero_copy_path = config->zero_copy_path, .arena = config->arena};
+    // Acceptable if: not executed in an oram_access
+    if (config->num_posmap_levels == 0) {
+        return stash_overflow_size;
+    }
+    const oram_posmap_level_config *level = config->posmap_levels;
+    posmap_config->bucket_size = level->bucket_size;
+    posmap_config->blocks_per_bucket = level->blocks_per_bucket;
+    posmap_config->block_size_bytes = level->block_size_bytes;
+    posmap_config->branching = level->branching;
+    posmap_config->leaf_levels = level->leaf_levels;
+    posmap_config->leaf_blocks_per_bucket = level->leaf_blocks_per_bucket;
+    // the last entry applies to every deeper level
+    posmap_config->posmap_levels = config->num_posmap_levels > 1 ? level + 1 : level;
+    posmap_config->num_posmap_levels = config->num_posmap_levels > 1 ? config->num_posmap_levels - 1 : 1;
+    return level->stash_overflow_size > 0 ? level->stash_overflow_size : stash_overflow_size;
+}
+
+static oram* _create(size_t num_leaves, size_t num_blocks, size_t stash_overflow_size, const bucket_geometry* geometry, const oram_config* config, entropy_func getentropy) {
     // make sure the number of leaves in our bucket store isn't bigger than the number of blocks
-    CHECK((1ul << (num_levels - 1)) <= num_blocks);
+    CHECK(num_leaves > 0 && num_leaves <= num_blocks);
+    oram_arena *arena = config->arena;
+    // an arena holds anonymous memory only
+    CHECK(arena == NULL || (config->tier_file == NULL && config->storage_dir == NULL)); // Acceptable ||: not executed in an oram_access
 
-    oram *oram;
-    CHECK(oram = calloc(1, sizeof(*oram)));
-    ORAM_BUCKET_STORE(*oram) = bucket_store_create(num_levels);
+    oram *oram = oram_arena_calloc(arena, 1, sizeof(*oram));
+    ORAM_ARENA(*oram) = arena;
+
+    oram_config posmap_config;
+    size_t posmap_stash_overflow_size = posmap_config_for(config, stash_overflow_size, &posmap_config);
+    char *posmap_dir = NULL;
+    // Acceptable if: not executed in an oram_access
+    if (config->tier_file) {
+        // a tiered store cannot also live in a snapshot directory
+        CHECK(config->storage_dir == NULL);
+        ORAM_BUCKET_STORE(*oram) = bucket_store_create_tiered(num_leaves, geometry, config->memory_levels, config->tier_file);
+    } else if (config->storage_dir) {
+        CHECK(mkdir(config->storage_dir, 0700) == 0 || errno == EEXIST);
+        char *buckets_path = storage_path(config->storage_dir, SNAPSHOT_BUCKETS_FILE);
+        ORAM_BUCKET_STORE(*oram) = bucket_store_create_file_backed(num_leaves, geometry, buckets_path);
+        free(buckets_path);
+        posmap_config.storage_dir = posmap_dir = storage_path(config->storage_dir, SNAPSHOT_POSITION_MAP_DIR);
+    } else {
+        ORAM_BUCKET_STORE(*oram) = bucket_store_create_in(arena, num_leaves, geometry);
+    }
 
     ORAM_NUM_LEVELS(*oram) = bucket_store_num_levels(ORAM_BUCKET_STORE(*oram));
     ORAM_CAPACITY_BLOCKS(*oram) = num_blocks; 
 
-    ORAM_POSITION_MAP(*oram) = position_map_create(num_blocks, bucket_store_num_leaves(ORAM_BUCKET_STORE(*oram)), stash_overflow_size, getentropy);
-    ORAM_STASH(*oram) = stash_create(ORAM_NUM_LEVELS(*oram), stash_overflow_size);
-    ORAM_PATH(*oram) = tree_path_create(0, bucket_store_root(ORAM_BUCKET_STORE(*oram)));
+    ORAM_POSITION_MAP(*oram) = position_map_create_with_config(num_blocks, ORAM_NUM_POSITIONS, posmap_stash_overflow_size, &posmap_config, getentropy);
+    free(posmap_dir);
+    // A treetop deeper than the tree is the whole tree.
+    size_t num_levels = ORAM_NUM_LEVELS(*oram);
+    size_t treetop_levels = config->treetop_levels < num_levels ? config->treetop_levels : num_levels;
+    ORAM_STASH(*oram) = stash_create_in(arena, ORAM_NUM_LEVELS(*oram), stash_overflow_size, treetop_levels, geometry);
+    ORAM_TARGET_BLOCK(*oram) = oram_arena_calloc(arena, bucket_geometry_block_qwords(geometry), sizeof(u64));
+    // Acceptable if: not executed in an oram_access
+    if (config->zero_copy_path) {
+        stash_enable_zero_copy(ORAM_STASH(*oram));
+    }
+    ORAM_PATH(*oram) = tree_path_create_kary_in(arena, 0, bucket_store_root(ORAM_BUCKET_STORE(*oram)), geometry->branching);
     ORAM_GETENTROPY(*oram) = getentropy;
 
-    ORAM_STATISTICS(*oram) = calloc(1, sizeof(oram_statistics));
+    ORAM_STATISTICS(*oram) = oram_arena_calloc(arena, 1, sizeof(oram_statistics));
     ((oram_statistics*)ORAM_STATISTICS(*oram))->recursion_depth = position_map_recursion_depth(ORAM_POSITION_MAP(*oram));
     //TEST_LOG("create ORAM capacity_blocks: %zu bucket_store leaves: %zu", ORAM_CAPACITY_BLOCKS(*oram), bucket_store_num_leaves(ORAM_BUCKET_STORE(*oram)));
 
@@ -86,28 +214,77 @@ oram* oram_create_for_available_mem(size_t available_bytes, double load_factor,
     CHECK(load_factor >= 1.0 && load_factor <= 3.0); // Acceptable &&: not executed in an oram_access
     size_t num_blocks = num_leaves * load_factor;
 
-    size_t actual_size = oram_size_bytes(num_levels, num_blocks, stash_overflow_size);
+    size_t actual_size = oram_size_bytes(num_leaves, num_blocks, stash_overflow_size);
     while(actual_size > available_bytes && num_levels > 0) { // Acceptable &&: not executed in an oram_access
         //TEST_LOG("decreasing num_levels actual_size: %zu requested: %zu levels: %zu", actual_size, available_bytes, num_levels);
         num_levels -= 1;
         num_leaves  = 1ul << (num_levels - 1);
         num_blocks = num_leaves * load_factor;
-        actual_size = oram_size_bytes(num_levels, num_blocks, stash_overflow_size);
+        actual_size = oram_size_bytes(num_leaves, num_blocks, stash_overflow_size);
     }
     CHECK(num_levels > 0);
     CHECK(actual_size <= available_bytes);
 
     //TEST_LOG("requested size: %zu actual size: %zu num_blocks: %zu num_levels: %zu", available_bytes, actual_size, num_blocks, num_levels);
 
-    return _create(num_levels, num_blocks, stash_overflow_size, getentropy);
+    oram_config config = {0};
+    return _create(num_leaves, num_blocks, stash_overflow_size, &BUCKET_GEOMETRY_DEFAULT, &config, getentropy);
 }
 
 oram *oram_create(size_t capacity_u64, size_t stash_overflow_size, entropy_func getentropy)
 {
-    size_t num_blocks = (capacity_u64 / BLOCK_DATA_SIZE_QWORDS) + (capacity_u64 % BLOCK_DATA_SIZE_QWORDS == 0 ? 0 : 1);
-    size_t num_levels = ceil_log2(num_blocks);
+    oram_config config = {0};
+    return oram_create_with_config(capacity_u64, stash_overflow_size, &config, getentropy);
+}
+
+// The geometry, blocks and leaves of an ORAM of `capacity_u64` created with `config`
+static bucket_geometry config_geometry(size_t capacity_u64, const oram_config* config, size_t* num_blocks, size_t* num_leaves)
+{
+    bucket_geometry geometry = bucket_geometry_create(config->bucket_size, config->blocks_per_bucket, config->block_size_bytes);
+    geometry.branching = config->branching > 0 ? config->branching : 2;
+    geometry.leaf_levels = config->leaf_levels;
+    geometry.leaf_blocks_per_bucket = config->leaf_blocks_per_bucket;
+    CHECK(bucket_geometry_is_valid(&geometry));
+    size_t block_size = geometry.block_data_qwords;
+    *num_blocks = (capacity_u64 / block_size) + (capacity_u64 % block_size == 0 ? 0 : 1);
+    // One leaf for every two blocks by default, as for a power of two where this is the full tree of
+    // ceil_log2(num_blocks) levels. Otherwise the tree is pruned to these leaves. A single block still needs a root.
+    double load_factor = config->load_factor > 0 ? config->load_factor : 2.0;
+    CHECK(load_factor >= 1.0 && load_factor <= 3.0); // Acceptable &&: not executed in an oram_access
+    *num_leaves = oram_num_leaves_for_blocks(*num_blocks, load_factor);
+    return geometry;
+}
+
+oram *oram_create_with_config(size_t capacity_u64, size_t stash_overflow_size, const oram_config* config, entropy_func getentropy)
+{
+    size_t num_blocks, num_leaves;
+    bucket_geometry geometry = config_geometry(capacity_u64, config, &num_blocks, &num_leaves);
+    return _create(num_leaves, num_blocks, stash_overflow_size, &geometry, config, getentropy);
+}
+
+oram *oram_create_in(oram_arena *arena, size_t capacity_u64, size_t stash_overflow_size, const oram_config* config, entropy_func getentropy)
+{
+    oram_config arena_config = *config;
+    arena_config.arena = arena;
+    return oram_create_with_config(capacity_u64, stash_overflow_size, &arena_config, getentropy);
+}
 
-    return _create(num_levels, num_blocks, stash_overflow_size, getentropy);
+size_t oram_arena_size_bytes(size_t capacity_u64, size_t stash_overflow_size, const oram_config* config)
+{
+    // every allocation of `_create`, in the same sizes
+    size_t num_blocks, num_leaves;
+    bucket_geometry geometry = config_geometry(capacity_u64, config, &num_blocks, &num_leaves);
+    oram_config posmap_config;
+    size_t posmap_stash_overflow_size = posmap_config_for(config, stash_overflow_size, &posmap_config);
+    size_t num_levels = tree_path_num_levels(num_leaves, geometry.branching);
+    size_t treetop_levels = config->treetop_levels < num_levels ? config->treetop_levels : num_levels;
+    return oram_arena_bytes(sizeof(oram))
+           + bucket_store_arena_bytes(num_leaves, &geometry)
+           + position_map_arena_bytes(num_blocks, posmap_stash_overflow_size, &posmap_config)
+           + stash_arena_bytes(num_levels, stash_overflow_size, treetop_levels, &geometry, config->zero_copy_path)
+           + oram_arena_bytes(bucket_geometry_block_qwords(&geometry) * sizeof(u64))
+           + tree_path_arena_bytes(tree_path_root(num_levels, geometry.branching), geometry.branching)
+           + oram_arena_bytes(sizeof(oram_statistics));
 }
 
 void oram_destroy(oram *oram)
@@ -116,13 +293,272 @@ void oram_destroy(oram *oram)
     // Acceptable if: this is not executed in an oram_access
     if (oram)
     {
+        oram_arena *arena = (oram_arena*)ORAM_ARENA(*oram);
         bucket_store_destroy(ORAM_BUCKET_STORE(*oram));
         position_map_destroy(ORAM_POSITION_MAP(*oram));
         stash_destroy(ORAM_STASH(*oram));
-        tree_path_destroy(ORAM_PATH(*oram));
-        free(ORAM_STATISTICS(*oram));
-        free(oram);
+        // Acceptable if: this is not executed in an oram_access
+        if (!oram_arena_owns(arena, ORAM_PATH(*oram))) {
+            tree_path_destroy(ORAM_PATH(*oram));
+        }
+        oram_arena_free(arena, (oram_statistics*)ORAM_STATISTICS(*oram));
+        free(ORAM_SNAPSHOT_META_PATH(*oram));
+        free(ORAM_CHECKPOINT_DIR(*oram));
+        oram_arena_free(arena, (u64*)ORAM_TARGET_BLOCK(*oram));
+        free(ORAM_FREE_BLOCKS(*oram));
+        oram_arena_free(arena, oram);
+    }
+}
+
+// Mark a snapshot as LIVE so that it is not restored once its buckets change. A missing snapshot needs no marking.
+static error_t mark_snapshot_live(const char *meta_path)
+{
+    u64 state = SNAPSHOT_STATE_LIVE;
+    int fd = open(meta_path, O_WRONLY);
+    // Acceptable if: depends only on the snapshot files, not on the access
+    if (fd < 0 && errno != ENOENT) {
+        return err_ORAM__SNAPSHOT_IO;
+    }
+    // Acceptable if: depends only on the snapshot files, not on the access
+    if (fd >= 0) {
+        bool written = pwrite(fd, &state, sizeof(state), SNAPSHOT_STATE_OFFSET) == sizeof(state) && fsync(fd) == 0;
+        close(fd);
+        // Acceptable if: depends only on the snapshot files, not on the access
+        if (!written) {
+            return err_ORAM__SNAPSHOT_IO;
+        }
+    }
+    return err_SUCCESS;
+}
+
+// Invalidate the snapshot that shares this ORAM's bucket file before an access modifies it.
+static error_t oram_invalidate_snapshot(oram *oram)
+{
+    RETURN_IF_ERROR(mark_snapshot_live(ORAM_SNAPSHOT_META_PATH(*oram)));
+    free(ORAM_SNAPSHOT_META_PATH(*oram));
+    ORAM_SNAPSHOT_META_PATH(*oram) = NULL;
+    return err_SUCCESS;
+}
+
+// Write a snapshot of `oram` to `dir`. If `incremental` is set and `dir` holds this ORAM's last snapshot or checkpoint,
+// only the buckets written since then are written, otherwise all of them are. Adds the number of bucket bytes written
+// to `*bucket_bytes_written`.
+static error_t oram_write_snapshot(oram *oram, const char *dir, bool incremental, size_t *bucket_bytes_written)
+{
+    // Acceptable if: not executed in an oram_access
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return err_ORAM__SNAPSHOT_IO;
+    }
+    char *buckets_path = storage_path(dir, SNAPSHOT_BUCKETS_FILE);
+    char *meta_path = storage_path(dir, SNAPSHOT_META_FILE);
+    char *meta_tmp_path = storage_path(dir, SNAPSHOT_META_TMP_FILE);
+    char *posmap_dir = storage_path(dir, SNAPSHOT_POSITION_MAP_DIR);
+    error_t err = err_SUCCESS;
+    FILE *meta = NULL;
+    size_t bytes_written = 0;
+
+    // Acceptable if: not executed in an oram_access
+    if (incremental && ORAM_CHECKPOINT_DIR(*oram) && strcmp(ORAM_CHECKPOINT_DIR(*oram), dir) == 0) {
+        // The buckets are updated in place, so the previous snapshot stops being restorable until the new
+        // metadata replaces it.
+        GOTO_IF_ERROR(err = mark_snapshot_live(meta_path), finish);
+        GOTO_IF_ERROR(err = bucket_store_checkpoint(ORAM_BUCKET_STORE(*oram), buckets_path, &bytes_written), finish);
+    } else {
+        GOTO_IF_ERROR(err = bucket_store_snapshot(ORAM_BUCKET_STORE(*oram), buckets_path, &bytes_written), finish);
+    }
+    *bucket_bytes_written += bytes_written;
+    bucket_geometry geometry = bucket_store_geometry(ORAM_BUCKET_STORE(*oram));
+
+    // Acceptable if: not executed in an oram_access
+    if (!(meta = fopen(meta_tmp_path, "wb"))) {
+        err = err_ORAM__SNAPSHOT_IO;
+        goto finish;
+    }
+    u64 header[3] = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, SNAPSHOT_STATE_CLEAN};
+    u64 fields[4] = {ORAM_NUM_LEVELS(*oram), ORAM_CAPACITY_BLOCKS(*oram), ORAM_ALLOCATED_UB(*oram), bucket_store_epoch(ORAM_BUCKET_STORE(*oram))};
+    u64 geometry_fields[7] = {geometry.bucket_size, geometry.blocks_per_bucket, geometry.block_data_qwords, bucket_store_num_leaves(ORAM_BUCKET_STORE(*oram)),
+        geometry.branching, geometry.leaf_levels, geometry.leaf_blocks_per_bucket};
+    GOTO_IF_ERROR(err = snapshot_write(meta, header, sizeof(header)), finish);
+    GOTO_IF_ERROR(err = snapshot_write(meta, fields, sizeof(fields)), finish);
+    GOTO_IF_ERROR(err = snapshot_write(meta, geometry_fields, sizeof(geometry_fields)), finish);
+    u64 num_free_blocks = ORAM_NUM_FREE_BLOCKS(*oram);
+    GOTO_IF_ERROR(err = snapshot_write(meta, &num_free_blocks, sizeof(num_free_blocks)), finish);
+    // Acceptable if: not executed in an oram_access
+    if (num_free_blocks > 0) {
+        GOTO_IF_ERROR(err = snapshot_write(meta, (u64 *)ORAM_FREE_BLOCKS(*oram), free_blocks_words(ORAM_ALLOCATED_UB(*oram)) * sizeof(u64)), finish);
+    }
+    GOTO_IF_ERROR(err = snapshot_write(meta, (oram_statistics*)ORAM_STATISTICS(*oram), sizeof(oram_statistics)), finish);
+    GOTO_IF_ERROR(err = stash_snapshot(ORAM_STASH(*oram), meta), finish);
+    GOTO_IF_ERROR(err = position_map_snapshot(ORAM_POSITION_MAP(*oram), meta, posmap_dir, incremental, bucket_bytes_written), finish);
+
+    // The metadata must be durable before it replaces the previous snapshot's
+    bool durable = fflush(meta) == 0 && fsync(fileno(meta)) == 0;
+    durable = (fclose(meta) == 0) & durable;
+    meta = NULL;
+    // Acceptable if: not executed in an oram_access
+    if (!durable || rename(meta_tmp_path, meta_path) != 0) {
+        err = err_ORAM__SNAPSHOT_IO;
+        goto finish;
+    }
+
+    // Acceptable if: not executed in an oram_access
+    if (bucket_store_path(ORAM_BUCKET_STORE(*oram)) && strcmp(bucket_store_path(ORAM_BUCKET_STORE(*oram)), buckets_path) == 0) {
+        free(ORAM_SNAPSHOT_META_PATH(*oram));
+        ORAM_SNAPSHOT_META_PATH(*oram) = meta_path;
+        meta_path = NULL;
+    }
+    free(ORAM_CHECKPOINT_DIR(*oram));
+    CHECK(ORAM_CHECKPOINT_DIR(*oram) = strdup(dir));
+
+finish:
+    // Acceptable if: not executed in an oram_access
+    if (meta) {
+        fclose(meta);
+    }
+    free(buckets_path);
+    free(meta_path);
+    free(meta_tmp_path);
+    free(posmap_dir);
+    return err;
+}
+
+error_t oram_snapshot(oram *oram, const char *dir)
+{
+    size_t bucket_bytes_written = 0;
+    return oram_write_snapshot(oram, dir, false, &bucket_bytes_written);
+}
+
+error_t oram_checkpoint_incremental(oram *oram, const char *dir, size_t *bucket_bytes_written)
+{
+    *bucket_bytes_written = 0;
+    return oram_write_snapshot(oram, dir, true, bucket_bytes_written);
+}
+
+error_t oram_restore(const char *dir, entropy_func getentropy, oram **result)
+{
+    char *buckets_path = storage_path(dir, SNAPSHOT_BUCKETS_FILE);
+    char *meta_path = storage_path(dir, SNAPSHOT_META_FILE);
+    char *posmap_dir = storage_path(dir, SNAPSHOT_POSITION_MAP_DIR);
+    bucket_store *bucket_store = NULL;
+    stash *stash = NULL;
+    position_map *position_map = NULL;
+    oram_statistics *statistics;
+    CHECK(statistics = calloc(1, sizeof(*statistics)));
+    u64 *free_blocks = NULL;
+    u64 num_free_blocks = 0;
+    error_t err = err_SUCCESS;
+
+    FILE *meta = fopen(meta_path, "rb");
+    // Acceptable if: not executed in an oram_access
+    if (!meta) {
+        err = err_ORAM__SNAPSHOT_IO;
+        goto finish;
+    }
+    u64 header[3];
+    u64 fields[4];
+    GOTO_IF_ERROR(err = snapshot_read(meta, header, sizeof(header)), finish);
+    GOTO_IF_ERROR(err = snapshot_read(meta, fields, sizeof(fields)), finish);
+    // A LIVE snapshot had its buckets modified after it was taken, so they no longer match its stash and position map.
+    // Acceptable if: not executed in an oram_access
+    if (header[0] != SNAPSHOT_MAGIC || header[1] == 0 || header[1] > SNAPSHOT_VERSION || header[2] != SNAPSHOT_STATE_CLEAN
+        || fields[0] == 0 || fields[0] > 63 || fields[2] > fields[1]) {
+        err = err_ORAM__SNAPSHOT_INVALID;
+        goto finish;
+    }
+    bucket_geometry geometry = BUCKET_GEOMETRY_DEFAULT;
+    u64 num_leaves = 1ULL << (fields[0] - 1);
+    // Acceptable if: not executed in an oram_access
+    if (header[1] >= 2) {
+        // the version 2 fields, then one more field for versions 3 and 4 and two more for version 5
+        u64 geometry_fields[7] = {0};
+        GOTO_IF_ERROR(err = snapshot_read(meta, geometry_fields, (header[1] >= 5 ? 7 : header[1] + 1) * sizeof(u64)), finish);
+        geometry = (bucket_geometry){
+            .bucket_size = geometry_fields[0],
+            .blocks_per_bucket = geometry_fields[1],
+            .block_data_qwords = geometry_fields[2],
+            .branching = header[1] >= 4 ? geometry_fields[4] : 2,
+            .leaf_levels = geometry_fields[5],
+            .leaf_blocks_per_bucket = geometry_fields[6]};
+        num_leaves = header[1] >= 3 ? geometry_fields[3] : num_leaves;
+    }
+    // Acceptable if: not executed in an oram_access
+    if (!bucket_geometry_is_valid(&geometry) || num_leaves == 0 || num_leaves > fields[1] || tree_path_num_levels(num_leaves, geometry.branching) != fields[0]) {
+        err = err_ORAM__SNAPSHOT_INVALID;
+        goto finish;
+    }
+    // Acceptable if: not executed in an oram_access
+    if (header[1] >= 6) {
+        GOTO_IF_ERROR(err = snapshot_read(meta, &num_free_blocks, sizeof(num_free_blocks)), finish);
+    }
+    // Acceptable if: not executed in an oram_access
+    if (num_free_blocks >= fields[2] && num_free_blocks > 0) {
+        err = err_ORAM__SNAPSHOT_INVALID;
+        goto finish;
+    }
+    // Acceptable if: not executed in an oram_access
+    if (num_free_blocks > 0) {
+        size_t num_words = free_blocks_words(fields[2]);
+        CHECK(free_blocks = calloc(free_blocks_words(fields[1]), sizeof(u64)));
+        GOTO_IF_ERROR(err = snapshot_read(meta, free_blocks, num_words * sizeof(u64)), finish);
+        // only blocks below the allocated bound can be free, and the highest allocated block is not
+        u64 num_set = 0;
+        for (size_t i = 0; i < num_words; ++i) {
+            num_set += __builtin_popcountll(free_blocks[i]);
+        }
+        u64 tail_mask = fields[2] % 64 == 0 ? 0 : ~0ULL << (fields[2] % 64);
+        // Acceptable if: not executed in an oram_access
+        if (num_set != num_free_blocks || (free_blocks[num_words - 1] & tail_mask) != 0
+            || ((free_blocks[(fields[2] - 1) / 64] >> ((fields[2] - 1) % 64)) & 1)) {
+            err = err_ORAM__SNAPSHOT_INVALID;
+            goto finish;
+        }
+    }
+    GOTO_IF_ERROR(err = snapshot_read(meta, statistics, sizeof(*statistics)), finish);
+    GOTO_IF_ERROR(err = bucket_store_open_file_backed(num_leaves, &geometry, fields[3], buckets_path, &bucket_store), finish);
+    GOTO_IF_ERROR(err = stash_restore(meta, &geometry, &stash), finish);
+    GOTO_IF_ERROR(err = position_map_restore(meta, posmap_dir, getentropy, &position_map), finish);
+
+    oram *oram;
+    CHECK(oram = calloc(1, sizeof(*oram)));
+    ORAM_BUCKET_STORE(*oram) = bucket_store;
+    ORAM_POSITION_MAP(*oram) = position_map;
+    ORAM_STASH(*oram) = stash;
+    ORAM_ALLOCATED_UB(*oram) = fields[2];
+    ORAM_CAPACITY_BLOCKS(*oram) = fields[1];
+    ORAM_NUM_LEVELS(*oram) = fields[0];
+    ORAM_FREE_BLOCKS(*oram) = free_blocks;
+    ORAM_NUM_FREE_BLOCKS(*oram) = num_free_blocks;
+    ORAM_LEAF_POSITIONS(*oram) = header[1] < 7;
+    ORAM_PATH(*oram) = tree_path_create_kary(0, bucket_store_root(bucket_store), geometry.branching);
+    ORAM_STATISTICS(*oram) = statistics;
+    ORAM_GETENTROPY(*oram) = getentropy;
+    CHECK(ORAM_TARGET_BLOCK(*oram) = calloc(bucket_geometry_block_qwords(&geometry), sizeof(u64)));
+    // The restored ORAM runs on the snapshot's bucket file
+    ORAM_SNAPSHOT_META_PATH(*oram) = meta_path;
+    CHECK(ORAM_CHECKPOINT_DIR(*oram) = strdup(dir));
+    *result = oram;
+
+    meta_path = NULL;
+    bucket_store = NULL;
+    stash = NULL;
+    position_map = NULL;
+    statistics = NULL;
+    free_blocks = NULL;
+
+finish:
+    // Acceptable if: not executed in an oram_access
+    if (meta) {
+        fclose(meta);
     }
+    bucket_store_destroy(bucket_store);
+    stash_destroy(stash);
+    position_map_destroy(position_map);
+    free(statistics);
+    free(free_blocks);
+    free(buckets_path);
+    free(meta_path);
+    free(posmap_dir);
+    return err;
 }
 
 void oram_clear(oram *oram)
@@ -130,6 +566,10 @@ void oram_clear(oram *oram)
     bucket_store_clear(ORAM_BUCKET_STORE(*oram));
     stash_clear(ORAM_STASH(*oram));
     ORAM_ALLOCATED_UB(*oram) = 0;
+    free(ORAM_FREE_BLOCKS(*oram));
+    ORAM_FREE_BLOCKS(*oram) = NULL;
+    ORAM_NUM_FREE_BLOCKS(*oram) = 0;
+    ORAM_FIRST_FREE(*oram) = 0;
     ((oram_statistics*)ORAM_STATISTICS(*oram))->max_stash_overflow_count = 0;
     // The position map has random placements so we do not need to clear these.
 }
@@ -144,9 +584,56 @@ size_t oram_capacity_blocks(const oram *oram)
     return ORAM_CAPACITY_BLOCKS(*oram);
 }
 
-size_t oram_size_bytes(size_t num_levels, size_t num_blocks, size_t stash_overflow_size) {
-    size_t num_leaves = (1ul << (num_levels - 1));
-    size_t bucket_store_size = (2*num_leaves - 1)*ENCRYPTED_BUCKET_SIZE;
+bool oram_block_allocated(const oram *oram, u64 block_id)
+{
+    return block_is_allocated(oram, block_id);
+}
+
+error_t oram_grow(oram *oram, size_t capacity_blocks)
+{
+    size_t old_capacity = ORAM_CAPACITY_BLOCKS(*oram);
+    CHECK(capacity_blocks >= old_capacity);
+    // Acceptable if: not executed in an oram_access
+    if (ORAM_LEAF_POSITIONS(*oram) || ORAM_ARENA(*oram)) {
+        return err_ORAM__GROW_UNSUPPORTED;
+    }
+    bucket_geometry geometry = bucket_store_geometry(ORAM_BUCKET_STORE(*oram));
+    size_t branching_bits = __builtin_ctzll(geometry.branching);
+    // Enough levels for a leaf for every two blocks, as `oram_create_with_config` builds the tree
+    size_t levels = 0;
+    // Acceptable if: not executed in an oram_access
+    while ((oram_num_leaves(oram) << (levels * branching_bits)) < capacity_blocks / 2 + capacity_blocks % 2) {
+        ++levels;
+        CHECK(ORAM_NUM_LEVELS(*oram) + levels < 64);
+    }
+    // Acceptable if: not executed in an oram_access
+    if (levels > 0) {
+        // the first change, so an ORAM that cannot grow is left as it was
+        RETURN_IF_ERROR(bucket_store_grow(ORAM_BUCKET_STORE(*oram), levels));
+        stash_grow(ORAM_STASH(*oram), levels, &geometry);
+        tree_path_destroy(ORAM_PATH(*oram));
+        ORAM_PATH(*oram) = tree_path_create_kary(0, bucket_store_root(ORAM_BUCKET_STORE(*oram)), geometry.branching);
+        ORAM_NUM_LEVELS(*oram) = bucket_store_num_levels(ORAM_BUCKET_STORE(*oram));
+    }
+    RETURN_IF_ERROR(position_map_grow(ORAM_POSITION_MAP(*oram), capacity_blocks, stash_overflow_capacity(ORAM_STASH(*oram))));
+    ORAM_CAPACITY_BLOCKS(*oram) = capacity_blocks;
+    // Acceptable if: not executed in an oram_access
+    if (ORAM_FREE_BLOCKS(*oram)) {
+        size_t old_words = free_blocks_words(old_capacity);
+        size_t words = free_blocks_words(capacity_blocks);
+        CHECK(ORAM_FREE_BLOCKS(*oram) = realloc((u64 *)ORAM_FREE_BLOCKS(*oram), words * sizeof(u64)));
+        memset((u64 *)ORAM_FREE_BLOCKS(*oram) + old_words, 0, (words - old_words) * sizeof(u64));
+    }
+    ((oram_statistics*)ORAM_STATISTICS(*oram))->recursion_depth = position_map_recursion_depth(ORAM_POSITION_MAP(*oram));
+    // The buckets moved, so the dirty buckets no longer describe the changes since the last checkpoint
+    free(ORAM_CHECKPOINT_DIR(*oram));
+    ORAM_CHECKPOINT_DIR(*oram) = NULL;
+    return err_SUCCESS;
+}
+
+size_t oram_size_bytes(size_t num_leaves, size_t num_blocks, size_t stash_overflow_size) {
+    size_t num_levels = tree_path_num_levels(num_leaves, 2);
+    size_t bucket_store_size = bucket_tree_size_bytes(num_leaves, &BUCKET_GEOMETRY_DEFAULT);
     size_t pos_map_size = position_map_size_bytes(num_blocks, stash_overflow_size);
     size_t stash_size = stash_size_bytes(num_levels, stash_overflow_size);
     size_t path_size = num_levels*sizeof(u64);
@@ -154,12 +641,23 @@ size_t oram_size_bytes(size_t num_levels, size_t num_blocks, size_t stash_overfl
     return sizeof(oram) + bucket_store_size + pos_map_size + stash_size + path_size;
 }
 
-static u64 random_mod_by_pow_of_2(oram *oram, u64 modulus)
+// The leaf of a position. The number of leaves need not be a power of two: the high half of the product of a uniform
+// u64 and the modulus is in [0, modulus), with a bias below modulus / 2^64, and is computed without a division. When
+// the tree grows by d levels the product is k^d times larger, so its high half is one of the k^d leaves below the old
+// one.
+static u64 position_leaf(const oram *oram, u64 position)
+{
+    u64 leaf = (u64)(((unsigned __int128)position * oram_num_leaves(oram)) >> 64);
+    return U64_TERNARY(ORAM_LEAF_POSITIONS(*oram), position, leaf);
+}
+
+u64 oram_random_position(oram *oram)
 {
     uint64_t buf[1];
     entropy_func getrandom = (entropy_func)(uintptr_t)(ORAM_GETENTROPY(*oram));
     getrandom(buf, sizeof(buf));
-    return buf[0] & (modulus - 1);
+    u64 leaf = (u64)(((unsigned __int128)buf[0] * oram_num_leaves(oram)) >> 64);
+    return U64_TERNARY(ORAM_LEAF_POSITIONS(*oram), leaf, buf[0] % ORAM_NUM_POSITIONS);
 }
 
 static void oram_collect_statistics(oram* oram) {
@@ -180,6 +678,15 @@ static void oram_collect_statistics(oram* oram) {
 #endif // IS_TEST
 }
 
+// The part of `oram_read_path_for_block` after the bucket store reads: the treetop and the overflow stash.
+static void oram_read_resident_for_block(oram* oram, const tree_path* path, u64 target_block_id, u64 *target, u64 new_position) {
+    stash_add_treetop_buckets(ORAM_STASH(*oram), path, target_block_id, target);
+    stash_scan_overflow_for_target(ORAM_STASH(*oram), target_block_id, target);
+
+    BLOCK_ID(target) = target_block_id;
+    BLOCK_POSITION(target) = new_position;
+}
+
 /**
  * @brief read the path from the bucket store, performing the same sequence of instructions independent of the input.
  * Post-condition: the block with `id == target_block_id` will *not* be in the stash - neither the overflow or the path stash.
@@ -191,14 +698,23 @@ static void oram_collect_statistics(oram* oram) {
  * @param target On output, block with ID `target_block_id` will be available here
  * @param new_position Position for the target block after this access
  */
-static void oram_read_path_for_block(oram* oram, const tree_path* path, u64 target_block_id, block *target, u64 new_position) {
-    for(size_t i = 0; i < TREE_PATH_LENGTH(*path); ++i) {
+static void oram_read_path_for_block(oram* oram, const tree_path* path, u64 target_block_id, u64 *target, u64 new_position) {
+    // the top levels of the path are read from the treetop, not the bucket store
+    size_t num_stored_levels = TREE_PATH_LENGTH(*path) - stash_treetop_levels(ORAM_STASH(*oram));
+    // Every bucket address is known once the path is computed. Start the miss for each bucket now, then pull whole
+    // buckets in a few levels ahead of the compare/swap so the loads overlap with it.
+    bucket_store_prefetch_path(ORAM_BUCKET_STORE(*oram), path, num_stored_levels);
+    for(size_t i = 0; i < num_stored_levels && i < PATH_PREFETCH_DISTANCE; ++i) {
+        bucket_store_prefetch_bucket(ORAM_BUCKET_STORE(*oram), TREE_PATH_VALUES(*path)[i]);
+    }
+    for(size_t i = 0; i < num_stored_levels; ++i) {
+        // Acceptable if: the path length is public
+        if (i + PATH_PREFETCH_DISTANCE < num_stored_levels) {
+            bucket_store_prefetch_bucket(ORAM_BUCKET_STORE(*oram), TREE_PATH_VALUES(*path)[i + PATH_PREFETCH_DISTANCE]);
+        }
         stash_add_path_bucket(ORAM_STASH(*oram), ORAM_BUCKET_STORE(*oram), TREE_PATH_VALUES(*path)[i], target_block_id, target);
     }
-    stash_scan_overflow_for_target(ORAM_STASH(*oram), target_block_id, target);
-
-    BLOCK_ID(*target) = target_block_id;
-    BLOCK_POSITION(*target) = new_position;
+    oram_read_resident_for_block(oram, path, target_block_id, target, new_position);
 }
 
 /**
@@ -209,51 +725,106 @@ static void oram_read_path_for_block(oram* oram, const tree_path* path, u64 targ
  * @param accessor_args input/output arguments for the accessor function
  */
 static error_t perform_access_op(
-    block* target, 
+    u64* target, 
     accessor_func accessor,
     void* accessor_args) 
 {
     CHECK(accessor != NULL);
-    RETURN_IF_ERROR(accessor(BLOCK_DATA(*target), accessor_args));
+    RETURN_IF_ERROR(accessor(BLOCK_DATA(target), accessor_args));
 
     return err_SUCCESS;
 }
 
-static error_t oram_access(
-    oram *oram,
-    u64 block_id,
-    accessor_func accessor,
-    void* accessor_args)
+/**
+ * @brief Access a block whose current leaf is already known and whose new leaf has already been stored in the
+ * position map.
+ *
+ * @param oram
+ * @param block_id
+ * @param position current leaf of the block, read from the position map
+ * @param new_position leaf of the block after this access
+ * @param accessor
+ * @param accessor_args
+ */
+// Start an access whose leaf is known: point the path at it and make its buckets readable.
+static error_t oram_begin_access_path(oram *oram, u64 position, u64 *target)
 {
-    block target_block = {EMPTY_BLOCK_ID, UINT64_MAX};
-    memset(BLOCK_DATA(target_block), 255, BLOCK_DATA_SIZE_BYTES);
-    size_t max_position = bucket_store_num_leaves(ORAM_BUCKET_STORE(*oram));
+    // Acceptable if: only the first access after a snapshot or restore takes this branch
+    if (ORAM_SNAPSHOT_META_PATH(*oram)) {
+        RETURN_IF_ERROR(oram_invalidate_snapshot(oram));
+    }
+
+    BLOCK_ID(target) = EMPTY_BLOCK_ID;
+    BLOCK_POSITION(target) = UINT64_MAX;
+    memset(BLOCK_DATA(target), 255, oram_block_size(oram) * sizeof(u64));
 
-    u64 new_position = random_mod_by_pow_of_2(oram, max_position);
-    u64 x = 0;
-    RETURN_IF_ERROR(position_map_read_then_set(ORAM_POSITION_MAP(*oram), block_id, new_position, &x));
     // bucket locations are always even
-    x *= 2;
+    tree_path_update_kary(ORAM_PATH(*oram), position * 2, bucket_store_geometry(ORAM_BUCKET_STORE(*oram)).branching);
+    // the leaf is known, so the disk levels of a tiered store can be read in one batch
+    return bucket_store_fetch_path(ORAM_BUCKET_STORE(*oram), ORAM_PATH(*oram));
+}
 
-    tree_path_update(ORAM_PATH(*oram), x);
+// Finish an access once the path has been read: apply the accessor, then evict the stash onto the path.
+static error_t oram_finish_access_path(oram *oram, u64 *target, accessor_func accessor, void *accessor_args)
+{
     tree_path* path = ORAM_PATH(*oram);
+    RETURN_IF_ERROR(perform_access_op(target, accessor, accessor_args));
 
-    oram_read_path_for_block(oram, path, block_id, &target_block, new_position * 2);
-    RETURN_IF_ERROR(perform_access_op(&target_block, accessor, accessor_args));
-
-    RETURN_IF_ERROR(stash_add_block(ORAM_STASH(*oram), &target_block));
+    RETURN_IF_ERROR(stash_add_block(ORAM_STASH(*oram), target));
 
     stash_build_path(ORAM_STASH(*oram), ORAM_PATH(*oram));
 
-    for (size_t i = 0; i < TREE_PATH_LENGTH(*path); ++i)
+    // a path sorted in place is already written
+    size_t num_stored_levels = stash_zero_copy(ORAM_STASH(*oram)) ? 0 : TREE_PATH_LENGTH(*path) - stash_treetop_levels(ORAM_STASH(*oram));
+    size_t bucket_qwords = stash_blocks_per_bucket(ORAM_STASH(*oram)) * (BLOCK_HEADER_QWORDS + oram_block_size(oram));
+    for (size_t i = 0; i < num_stored_levels; ++i)
     {
         u64 bucket_id = TREE_PATH_VALUES(*path)[i];
-        bucket_store_write_bucket_blocks(ORAM_BUCKET_STORE(*oram), bucket_id, stash_path_blocks(ORAM_STASH(*oram)) + i * BLOCKS_PER_BUCKET);
+        bucket_store_write_bucket_blocks(ORAM_BUCKET_STORE(*oram), bucket_id, stash_path_blocks(ORAM_STASH(*oram)) + i * bucket_qwords);
     }
+    stash_write_treetop_buckets(ORAM_STASH(*oram), path);
+    RETURN_IF_ERROR(bucket_store_flush_path(ORAM_BUCKET_STORE(*oram), path));
     oram_collect_statistics(oram);
     return err_SUCCESS;
 }
 
+/**
+ * @brief Access a block whose current leaf is already known and whose new leaf has already been stored in the
+ * position map.
+ *
+ * @param oram
+ * @param block_id
+ * @param position current leaf of the block, read from the position map
+ * @param new_position leaf of the block after this access
+ * @param accessor
+ * @param accessor_args
+ */
+static error_t oram_access_path(
+    oram *oram,
+    u64 block_id,
+    u64 position,
+    u64 new_position,
+    accessor_func accessor,
+    void* accessor_args)
+{
+    u64 *target_block = ORAM_TARGET_BLOCK(*oram);
+    RETURN_IF_ERROR(oram_begin_access_path(oram, position_leaf(oram, position), target_block));
+    oram_read_path_for_block(oram, ORAM_PATH(*oram), block_id, target_block, position_leaf(oram, new_position) * 2);
+    return oram_finish_access_path(oram, target_block, accessor, accessor_args);
+}
+
+static error_t oram_access(
+    oram *oram,
+    u64 block_id,
+    accessor_func accessor,
+    void* accessor_args)
+{
+    u64 new_position = oram_random_position(oram);
+    u64 x = 0;
+    RETURN_IF_ERROR(position_map_read_then_set(ORAM_POSITION_MAP(*oram), block_id, new_position, &x));
+    return oram_access_path(oram, block_id, x, new_position, accessor, accessor_args);
+}
+
 error_t oram_function_access(oram* oram, u64 block_id, accessor_func accessor, void* accessor_args) {
     // Acceptable if: failure is a bug that leaks more than the timing here
     if (block_is_allocated(oram, block_id))
@@ -263,15 +834,126 @@ error_t oram_function_access(oram* oram, u64 block_id, accessor_func accessor, v
     return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
 }
 
+error_t oram_function_access_at(oram *oram, u64 block_id, u64 position, u64 new_position, accessor_func accessor, void *accessor_args)
+{
+    // Acceptable if: failure is a bug that leaks more than the timing here
+    if (block_is_allocated(oram, block_id))
+    {
+        return oram_access_path(oram, block_id, position, new_position, accessor, accessor_args);
+    }
+    return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
+}
+
+error_t oram_function_access_interleaved(size_t count, oram *orams[], const u64 block_ids[], accessor_func accessor, void *accessor_args[])
+{
+    CHECK(count <= ORAM_MAX_INTERLEAVED);
+    u64 new_positions[ORAM_MAX_INTERLEAVED];
+    size_t num_stored_levels[ORAM_MAX_INTERLEAVED];
+    size_t max_stored_levels = 0;
+
+    for (size_t g = 0; g < count; ++g)
+    {
+        // Acceptable if: failure is a bug that leaks more than the timing here
+        if (!block_is_allocated(orams[g], block_ids[g]))
+        {
+            return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
+        }
+        for (size_t h = 0; h < g; ++h)
+        {
+            // every access owns the path and stash of its ORAM until it finishes
+            CHECK(orams[h] != orams[g]);
+        }
+    }
+
+    // Position lookups. Small ORAMs have scan maps, so this is mostly sequential scans.
+    for (size_t g = 0; g < count; ++g)
+    {
+        oram *oram = orams[g];
+        new_positions[g] = oram_random_position(oram);
+        u64 position = 0;
+        RETURN_IF_ERROR(position_map_read_then_set(ORAM_POSITION_MAP(*oram), block_ids[g], new_positions[g], &position));
+        RETURN_IF_ERROR(oram_begin_access_path(oram, position_leaf(oram, position), ORAM_TARGET_BLOCK(*oram)));
+        num_stored_levels[g] = TREE_PATH_LENGTH(*(tree_path*)ORAM_PATH(*oram)) - stash_treetop_levels(ORAM_STASH(*oram));
+        max_stored_levels = num_stored_levels[g] > max_stored_levels ? num_stored_levels[g] : max_stored_levels;
+        // Acceptable if: the tree geometry is public
+        if (num_stored_levels[g] > 0)
+        {
+            bucket_store_prefetch_bucket(ORAM_BUCKET_STORE(*oram), TREE_PATH_VALUES(*(tree_path*)ORAM_PATH(*oram))[0]);
+        }
+    }
+
+    // Bucket reads, one level of every path at a time. The next bucket of each path is prefetched before the other
+    // paths are read, so its cache misses overlap with their work.
+    for (size_t i = 0; i < max_stored_levels; ++i)
+    {
+        for (size_t g = 0; g < count; ++g)
+        {
+            oram *oram = orams[g];
+            tree_path *path = ORAM_PATH(*oram);
+            // Acceptable if: the tree geometry is public
+            if (i + 1 < num_stored_levels[g])
+            {
+                bucket_store_prefetch_bucket(ORAM_BUCKET_STORE(*oram), TREE_PATH_VALUES(*path)[i + 1]);
+            }
+            // Acceptable if: the tree geometry is public
+            if (i < num_stored_levels[g])
+            {
+                stash_add_path_bucket(ORAM_STASH(*oram), ORAM_BUCKET_STORE(*oram), TREE_PATH_VALUES(*path)[i], block_ids[g], ORAM_TARGET_BLOCK(*oram));
+            }
+        }
+    }
+
+    for (size_t g = 0; g < count; ++g)
+    {
+        oram_read_resident_for_block(orams[g], ORAM_PATH(*orams[g]), block_ids[g], ORAM_TARGET_BLOCK(*orams[g]), position_leaf(orams[g], new_positions[g]) * 2);
+        RETURN_IF_ERROR(oram_finish_access_path(orams[g], ORAM_TARGET_BLOCK(*orams[g]), accessor, accessor_args[g]));
+    }
+    return err_SUCCESS;
+}
+
+size_t oram_num_leaves(const oram *oram)
+{
+    return bucket_store_num_leaves(ORAM_BUCKET_STORE(*oram));
+}
+
+size_t oram_num_leaves_for_blocks(size_t num_blocks, double load_factor)
+{
+    // ceil without libm
+    size_t num_leaves = (size_t)(num_blocks / load_factor);
+    num_leaves += (double)num_leaves * load_factor < (double)num_blocks ? 1 : 0;
+    return num_leaves > 0 ? num_leaves : 1;
+}
+
+size_t oram_access_bytes(const oram *oram)
+{
+    bucket_geometry geometry = bucket_store_geometry(ORAM_BUCKET_STORE(*oram));
+    size_t result = 0;
+    for (size_t level = 0; level < ORAM_NUM_LEVELS(*oram); ++level) {
+        result += 2 * bucket_geometry_level_bucket_size(&geometry, level);
+    }
+    const position_map *position_map = ORAM_POSITION_MAP(*oram);
+    // Acceptable if: not executed in an oram_access
+    if (position_map_oram(position_map)) {
+        return result + oram_access_bytes(position_map_oram(position_map));
+    }
+    return result + 2 * position_map_capacity(position_map) * sizeof(u64);
+}
+
+position_map *oram_get_position_map(const oram *oram)
+{
+    return ORAM_POSITION_MAP(*oram);
+}
+
 
 typedef struct {
+    size_t block_size;
     u64* out_data;
 } read_accessor_args;
 
 static error_t read_accessor(u64* block_data, void* vargs) {
     read_accessor_args* args = vargs;
     CHECK(args->out_data != NULL);
-    memcpy(args->out_data, block_data, BLOCK_DATA_SIZE_QWORDS*sizeof(block_data[0]));
+    memcpy(args->out_data, block_data, args->block_size*sizeof(block_data[0]));
     return err_SUCCESS;
 }
 
@@ -280,7 +962,7 @@ error_t oram_get(oram *oram, u64 block_id, u64 buf[])
     // Acceptable if: failure is a bug that leaks more than the timing here
     if (block_is_allocated(oram, block_id))
     {
-        read_accessor_args args = {.out_data = buf};
+        read_accessor_args args = {.block_size = oram_block_size(oram), .out_data = buf};
         return oram_access(oram, block_id, read_accessor, &args);
     }
     return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
@@ -288,6 +970,7 @@ error_t oram_get(oram *oram, u64 block_id, u64 buf[])
 
 
 typedef struct {
+    size_t block_size;
     size_t in_data_start;
     size_t in_data_len;
     const u64 *in_data;
@@ -298,10 +981,10 @@ static error_t write_accessor(u64* block_data, void* vargs) {
     write_accessor_args* args = vargs;
     // Acceptable if: we allow leakage of request type
     if(args->out_data){
-        memcpy(args->out_data, block_data, BLOCK_DATA_SIZE_QWORDS*sizeof(block_data[0]));
+        memcpy(args->out_data, block_data, args->block_size*sizeof(block_data[0]));
     }
     CHECK(args->in_data != 0);
-    for(size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i) {
+    for(size_t i = 0; i < args->block_size; ++i) {
         bool cond = (i >= args->in_data_start) & (i < args->in_data_start + args->in_data_len);
 
         // We can only access the source data in the range [args->in_data, args->in_data + args->in_data_len) without
@@ -320,19 +1003,19 @@ error_t oram_put(oram *oram, u64 block_id, const u64 data[])
     // Acceptable if: failure is a bug that leaks more than the timing here
     if (block_is_allocated(oram, block_id))
     {
-        write_accessor_args args = { .in_data_start = 0, .in_data_len = BLOCK_DATA_SIZE_QWORDS, .in_data = data, .out_data = NULL };
+        write_accessor_args args = { .block_size = oram_block_size(oram), .in_data_start = 0, .in_data_len = oram_block_size(oram), .in_data = data, .out_data = NULL };
         return oram_access(oram, block_id, write_accessor, &args);
     }
     return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
 }
 
-error_t oram_put_partial(oram *oram, u64 block_id, size_t start, size_t len, u64 data[len], u64 prev_data[static BLOCK_DATA_SIZE_QWORDS])
+error_t oram_put_partial(oram *oram, u64 block_id, size_t start, size_t len, u64 data[len], u64 *prev_data)
 {
     // Acceptable if: failure is a bug that leaks more than the timing here
     if (block_is_allocated(oram, block_id))
     {
-        CHECK(start + len <= BLOCK_DATA_SIZE_QWORDS);
-        write_accessor_args args = { .in_data_start = start, .in_data_len = len, .in_data = data, .out_data = prev_data };
+        CHECK(start + len <= oram_block_size(oram));
+        write_accessor_args args = { .block_size = oram_block_size(oram), .in_data_start = start, .in_data_len = len, .in_data = data, .out_data = prev_data };
         return oram_access(oram, block_id, write_accessor, &args);
     }
     return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
@@ -340,6 +1023,22 @@ error_t oram_put_partial(oram *oram, u64 block_id, size_t start, size_t len, u64
 
 u64 oram_allocate_block(oram *oram)
 {
+    // Acceptable if: not executed in an oram_access
+    if (ORAM_NUM_FREE_BLOCKS(*oram) > 0)
+    {
+        u64 *free_blocks = (u64 *)ORAM_FREE_BLOCKS(*oram);
+        size_t word = ORAM_FIRST_FREE(*oram) / 64;
+        // Acceptable if: not executed in an oram_access
+        while (free_blocks[word] == 0)
+        {
+            ++word;
+        }
+        u64 block_id = word * 64 + __builtin_ctzll(free_blocks[word]);
+        free_blocks[word] &= free_blocks[word] - 1;
+        --ORAM_NUM_FREE_BLOCKS(*oram);
+        ORAM_FIRST_FREE(*oram) = block_id + 1;
+        return block_id;
+    }
     // Acceptable if: not executed in an oram_access
     if (ORAM_ALLOCATED_UB(*oram) < ORAM_CAPACITY_BLOCKS(*oram))
     {
@@ -360,6 +1059,81 @@ u64 oram_allocate_contiguous(oram *oram, size_t num_blocks)
     return UINT64_MAX;
 }
 
+static error_t free_accessor(u64 *block_data, void *vargs)
+{
+    size_t block_size = *(size_t *)vargs;
+    memset(block_data, 255, block_size * sizeof(block_data[0]));
+    return err_SUCCESS;
+}
+
+// Remove a block from the tree with an access that reads and writes the same buckets as any other: the block is
+// taken off its path as for a get, and an empty block is put back in the stash in its place.
+static error_t oram_erase_block(oram *oram, u64 block_id)
+{
+    u64 new_position = oram_random_position(oram);
+    u64 position = 0;
+    RETURN_IF_ERROR(position_map_read_then_set(ORAM_POSITION_MAP(*oram), block_id, new_position, &position));
+    u64 *target = ORAM_TARGET_BLOCK(*oram);
+    RETURN_IF_ERROR(oram_begin_access_path(oram, position_leaf(oram, position), target));
+    oram_read_path_for_block(oram, ORAM_PATH(*oram), block_id, target, position_leaf(oram, new_position) * 2);
+    BLOCK_ID(target) = EMPTY_BLOCK_ID;
+    BLOCK_POSITION(target) = UINT64_MAX;
+    size_t block_size = oram_block_size(oram);
+    return oram_finish_access_path(oram, target, free_accessor, &block_size);
+}
+
+// Record a block as free. Free blocks at the top of the allocated range are given back to the bump allocator, so the
+// allocated range only extends as far as the highest block in use.
+static void oram_release_block(oram *oram, u64 block_id)
+{
+    // Acceptable if: not executed in an oram_access
+    if (ORAM_FREE_BLOCKS(*oram) == 0)
+    {
+        CHECK(ORAM_FREE_BLOCKS(*oram) = calloc(free_blocks_words(ORAM_CAPACITY_BLOCKS(*oram)), sizeof(u64)));
+    }
+    u64 *free_blocks = (u64 *)ORAM_FREE_BLOCKS(*oram);
+    free_blocks[block_id / 64] |= 1ULL << (block_id % 64);
+    ++ORAM_NUM_FREE_BLOCKS(*oram);
+    ORAM_FIRST_FREE(*oram) = block_id < ORAM_FIRST_FREE(*oram) ? block_id : ORAM_FIRST_FREE(*oram);
+    // Acceptable if: not executed in an oram_access
+    while (ORAM_ALLOCATED_UB(*oram) > 0 && block_is_free(oram, ORAM_ALLOCATED_UB(*oram) - 1))
+    {
+        --ORAM_ALLOCATED_UB(*oram);
+        free_blocks[ORAM_ALLOCATED_UB(*oram) / 64] &= ~(1ULL << (ORAM_ALLOCATED_UB(*oram) % 64));
+        --ORAM_NUM_FREE_BLOCKS(*oram);
+    }
+}
+
+error_t oram_free_block(oram *oram, u64 block_id)
+{
+    // Acceptable if: failure is a bug that leaks more than the timing here
+    if (block_is_allocated(oram, block_id))
+    {
+        RETURN_IF_ERROR(oram_erase_block(oram, block_id));
+        oram_release_block(oram, block_id);
+        return err_SUCCESS;
+    }
+    return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
+}
+
+error_t oram_free_range(oram *oram, u64 first_block_id, size_t num_blocks)
+{
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        // Acceptable if: failure is a bug that leaks more than the timing here
+        if (!block_is_allocated(oram, first_block_id + i))
+        {
+            return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
+        }
+    }
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        RETURN_IF_ERROR(oram_erase_block(oram, first_block_id + i));
+        oram_release_block(oram, first_block_id + i);
+    }
+    return err_SUCCESS;
+}
+
 const oram_statistics* oram_report_statistics(oram* oram) {
     const oram_statistics* pos_map_stats = position_map_oram_statistics(ORAM_POSITION_MAP(*oram));
     // Acceptable if: not executed in an oram_access
@@ -384,12 +1158,6 @@ const oram_statistics* oram_report_statistics(oram* oram) {
 #include "../include/util.h"
 #include "../include/tests.h"
 
-// jasmin functions
-void oram_access_read_jazz(oram *oram, u64 block_id, u64 *out_data);
-void oram_access_write_jazz(oram *oram, u64 block_id, u64 *in_data);
-void oram_access_write_partial_jazz(oram *oram, u64 block_id, size_t start, size_t len, u64 data[len], u64 prev_data[static BLOCK_DATA_SIZE_QWORDS]);
-void oram_clear_jazz(oram *oram);
-
 void print_oram(const oram *oram)
 {
     printf("ORAM state: bucket cap (B): %zu position_map_cap (entries): %zu\n",
@@ -455,6 +1223,25 @@ int init_odd_capacity_test()
     return err_SUCCESS;
 }
 
+// One block past a power of two used to double the tree. Now only the paths to the extra leaves are added.
+int init_pruned_tree_test()
+{
+    size_t num_blocks = (1 << 13) + 1;
+    oram *oram = oram_create(num_blocks * BLOCK_DATA_SIZE_QWORDS, TEST_STASH_SIZE, getentropy);
+    size_t num_leaves = (num_blocks + 1) / 2;
+    size_t full_tree_bytes = tree_path_num_nodes(ORAM_NUM_LEVELS(*oram)) * ENCRYPTED_BUCKET_SIZE;
+
+    TEST_ASSERT(oram_capacity_blocks(oram) == num_blocks);
+    TEST_ASSERT(oram_num_leaves(oram) == num_leaves);
+    TEST_ASSERT(ORAM_NUM_LEVELS(*oram) == ceil_log2(num_blocks));
+    TEST_ASSERT(bucket_store_size_bytes(ORAM_BUCKET_STORE(*oram)) == tree_path_num_nodes_pruned(num_leaves, 2) * ENCRYPTED_BUCKET_SIZE);
+    TEST_ASSERT(bucket_store_size_bytes(ORAM_BUCKET_STORE(*oram)) < full_tree_bytes / 2 + 64 * ENCRYPTED_BUCKET_SIZE);
+    TEST_ASSERT(oram_size_bytes(num_leaves, num_blocks, TEST_STASH_SIZE) < oram_size_bytes(1 << 13, num_blocks, TEST_STASH_SIZE));
+
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
 int allocate_until_full_test()
 {
     size_t capacity = 1 << 20;
@@ -638,16 +1425,12 @@ int getput_must_put_to_change_block()
 }
 
 int test_oram_clears_stash() {size_t capacity = 1 << 20;
-    oram *oram0 = oram_create(capacity, TEST_STASH_SIZE, getentropy);
-    oram *oram1 = oram_create(capacity, TEST_STASH_SIZE, getentropy);
-    u64 buf0[BLOCK_DATA_SIZE_QWORDS];
-    u64 buf1[BLOCK_DATA_SIZE_QWORDS];
+    oram *oram = oram_create(capacity, TEST_STASH_SIZE, getentropy);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
 
     // Allocate some blocks
-    oram_allocate_contiguous(oram0, 1330);
-    oram_allocate_block(oram0);
-    oram_allocate_contiguous(oram1, 1330);
-    oram_allocate_block(oram1);
+    oram_allocate_contiguous(oram, 1330);
+    oram_allocate_block(oram);
 
     block b = {1000, 1234};
 
@@ -655,38 +1438,29 @@ int test_oram_clears_stash() {size_t capacity = 1 << 20;
     {
         BLOCK_DATA(b)[j] = j + 1;
     }
-    RETURN_IF_ERROR(stash_add_block(ORAM_STASH(*oram0), &b));
-    stash_add_block_jazz(ORAM_STASH(*oram1), &b);
-    TEST_ASSERT(stash_num_overflow_blocks(ORAM_STASH(*oram0)) == 1);
-    TEST_ASSERT(stash_num_overflow_blocks(ORAM_STASH(*oram1)) == 1);
+    RETURN_IF_ERROR(stash_add_block(ORAM_STASH(*oram), b));
+    TEST_ASSERT(stash_num_overflow_blocks(ORAM_STASH(*oram)) == 1);
 
-    RETURN_IF_ERROR(oram_get(oram0, 1000, buf0));
-    RETURN_IF_ERROR(oram_get(oram1, 1000, buf1));
+    RETURN_IF_ERROR(oram_get(oram, 1000, buf));
     // Now check that the data we got matches
     for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
     {
-        TEST_ASSERT(buf0[j] == BLOCK_DATA(b)[j]);
-        TEST_ASSERT(buf1[j] == BLOCK_DATA(b)[j]);
+        TEST_ASSERT(buf[j] == BLOCK_DATA(b)[j]);
     }
 
-    oram_clear(oram0);
-    oram_clear_jazz(oram1);
+    oram_clear(oram);
 
     // reallocate the blocks so we can get it without error
-    oram_allocate_contiguous(oram0, 1330);
-    oram_allocate_contiguous(oram1, 1330);
-    TEST_ASSERT(stash_num_overflow_blocks(ORAM_STASH(*oram0)) == 0); RETURN_IF_ERROR(oram_get(oram0, 1000, buf0));
-    TEST_ASSERT(stash_num_overflow_blocks(ORAM_STASH(*oram1)) == 0); RETURN_IF_ERROR(oram_get(oram1, 1000, buf1));
+    oram_allocate_contiguous(oram, 1330);
+    TEST_ASSERT(stash_num_overflow_blocks(ORAM_STASH(*oram)) == 0); RETURN_IF_ERROR(oram_get(oram, 1000, buf));
 
     // Now check that the data we got is clear
     for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
     {
-        TEST_ASSERT(buf0[j] == UINT64_MAX);
-        TEST_ASSERT(buf1[j] == UINT64_MAX);
+        TEST_ASSERT(buf[j] == UINT64_MAX);
     }
 
-    oram_destroy(oram0);
-    oram_destroy(oram1);
+    oram_destroy(oram);
     return err_SUCCESS;
 }
 
@@ -695,6 +1469,7 @@ static void initialization_test_group()
     RUN_TEST(test_ceil_log());
     RUN_TEST(init_oram_test());
     RUN_TEST(init_odd_capacity_test());
+    RUN_TEST(init_pruned_tree_test());
 }
 
 static void allocate_test_group()
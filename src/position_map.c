@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include "../include/position_map.h"
 #include "../include/path_oram.h"
@@ -46,6 +47,7 @@ struct position_map
         scan_position_map scan_position_map;
         oram_position_map oram_position_map;
     } impl;
+    entropy_func getentropy;
 };
 */
 typedef u64 oram_position_map[4];
@@ -58,6 +60,8 @@ typedef u64 scan_position_map[2];
 #define POSITION_MAP_DATA(o)            ((o)[3])
 #define POSITION_MAP_BASE_BLOCK_ID(o)   ((o)[4])
 #define POSITION_MAP_ACCESS_BUF(o)      ((o)[5])
+#define POSITION_MAP_GETENTROPY(o)      ((o)[6])
+#define POSITION_MAP_ARENA(o)           ((o)[7])
 
 // oram_position_map
 #define ORAM_POSITION_MAP_SIZE(o)            ((o)[0])
@@ -70,27 +74,18 @@ typedef u64 scan_position_map[2];
 #define SCAN_POSITION_MAP_DATA(o)            ((o)[1])
 
 // oram implementation
-static oram_position_map *oram_position_map_create(size_t num_blocks, size_t num_positions, size_t overflow_stash_size, entropy_func getentropy)
+static oram_position_map *oram_position_map_create(size_t num_blocks, size_t overflow_stash_size, const oram_config *config, entropy_func getentropy)
 {
-    CHECK(num_positions <= num_blocks);
     // oram capacity is measured in u64s
-    oram *oram = oram_create(num_blocks, overflow_stash_size, getentropy);
+    oram *oram = oram_create_with_config(num_blocks, overflow_stash_size, config, getentropy);
     size_t block_size = oram_block_size(oram);
     size_t blocks_needed = num_blocks / block_size + ((num_blocks % block_size == 0) ? 0 : 1);
     u64 base_block_id = oram_allocate_contiguous(oram, blocks_needed);
     //TEST_LOG("oram_position_map size: %zu blocks: %zu", num_blocks, blocks_needed);
-    // initialize position map with random data
-    u64 *buf;
-    CHECK(buf = calloc(block_size, sizeof(*buf)));
-    for (size_t i = 0; i < blocks_needed; ++i)
-    {
-        for (size_t j = 0; j < block_size; ++j)
-        {
-            getentropy(buf + j, sizeof(*buf));
-            buf[j] = buf[j] % num_positions;
-        }
-        oram_put(oram, base_block_id + i, buf);
-    }
+    // We do not write initial positions: a block that was never written reads as all `POSITION_MAP_NOT_PRESENT`
+    // and `resolve_position` replaces those entries with random positions on access. This keeps creation
+    // independent of the size of the map.
+    u64 *buf = oram_arena_calloc(config->arena, block_size, sizeof(*buf));
 
     oram_position_map *result = calloc(6, sizeof(u64));
     ORAM_POSITION_MAP_SIZE(*result) = num_blocks;
@@ -101,10 +96,32 @@ static oram_position_map *oram_position_map_create(size_t num_blocks, size_t num
     return result;
 }
 
-static void oram_position_map_destroy(oram_position_map *oram_position_map)
+// The entries of a grown map are not written either: those in new blocks read as `POSITION_MAP_NOT_PRESENT`, and so
+// do those in the last block above the old size, which were never set.
+static error_t oram_position_map_grow(oram_position_map *oram_position_map, size_t num_blocks)
+{
+    oram *oram = ORAM_POSITION_MAP_ORAM(*oram_position_map);
+    size_t block_size = oram_block_size(oram);
+    size_t size = ORAM_POSITION_MAP_SIZE(*oram_position_map);
+    size_t blocks_needed = size / block_size + ((size % block_size == 0) ? 0 : 1);
+    size_t new_blocks_needed = num_blocks / block_size + ((num_blocks % block_size == 0) ? 0 : 1);
+    u64 blocks_ub = ORAM_POSITION_MAP_BASE_BLOCK_ID(*oram_position_map) + new_blocks_needed;
+    // Acceptable if: this is not executed in an oram_access
+    if (blocks_ub > oram_capacity_blocks(oram))
+    {
+        RETURN_IF_ERROR(oram_grow(oram, blocks_ub));
+    }
+    // the map is the only allocation in its ORAM, so the new blocks follow the old ones
+    CHECK(new_blocks_needed == blocks_needed
+        || oram_allocate_contiguous(oram, new_blocks_needed - blocks_needed) == ORAM_POSITION_MAP_BASE_BLOCK_ID(*oram_position_map) + blocks_needed);
+    ORAM_POSITION_MAP_SIZE(*oram_position_map) = num_blocks;
+    return err_SUCCESS;
+}
+
+static void oram_position_map_destroy(oram_position_map *oram_position_map, const oram_arena *arena)
 {
     oram_destroy(ORAM_POSITION_MAP_ORAM(*oram_position_map));
-    free(ORAM_POSITION_MAP_ACCESS_BUF(*oram_position_map));
+    oram_arena_free(arena, ORAM_POSITION_MAP_ACCESS_BUF(*oram_position_map));
 }
 
 static u64 block_id_for_index(const oram_position_map *oram_position_map, u64 index)
@@ -113,17 +130,28 @@ static u64 block_id_for_index(const oram_position_map *oram_position_map, u64 in
     return ORAM_POSITION_MAP_BASE_BLOCK_ID(*oram_position_map) + (index / entries_per_block);
 }
 
-static error_t oram_position_map_get(const oram_position_map *oram_position_map, u64 block_id, u64* position)
+// A position that has never been set is stored as `POSITION_MAP_NOT_PRESENT`. Its block is not in the tree, so any
+// path will do, but the path must be fresh and uniformly random so the first access to a block looks like any other.
+// The random position is computed on every call and is revealed by the path read either way.
+static u64 resolve_position(u64 stored_position, size_t num_positions, entropy_func getentropy)
+{
+    u64 random_position;
+    getentropy(&random_position, sizeof(random_position));
+    random_position %= num_positions;
+    return U64_TERNARY(stored_position == POSITION_MAP_NOT_PRESENT, random_position, stored_position);
+}
+
+static error_t oram_position_map_get(const oram_position_map *oram_position_map, u64 block_id, u64* position, size_t num_positions, entropy_func getentropy)
 {
     size_t block_size = oram_block_size(ORAM_POSITION_MAP_ORAM(*oram_position_map));
     u64 *buf = ORAM_POSITION_MAP_ACCESS_BUF(*oram_position_map);
     RETURN_IF_ERROR(oram_get(ORAM_POSITION_MAP_ORAM(*oram_position_map), block_id_for_index(oram_position_map, block_id), buf));
     
-    *position = buf[block_id % block_size];
+    *position = resolve_position(buf[block_id % block_size], num_positions, getentropy);
     return err_SUCCESS;
 }
 
-static error_t oram_position_map_set(oram_position_map *oram_position_map, u64 block_id, u64 position, u64 *prev_position)
+static error_t oram_position_map_set(oram_position_map *oram_position_map, u64 block_id, u64 position, u64 *prev_position, size_t num_positions, entropy_func getentropy)
 {
     CHECK(prev_position!= NULL);
     size_t block_size = oram_block_size(ORAM_POSITION_MAP_ORAM(*oram_position_map));
@@ -133,7 +161,7 @@ static error_t oram_position_map_set(oram_position_map *oram_position_map, u64 b
     size_t len_to_put = 1;
     RETURN_IF_ERROR(oram_put_partial(ORAM_POSITION_MAP_ORAM(*oram_position_map), block_id_for_index(oram_position_map, block_id), idx_in_block, len_to_put, &position, buf));
     
-    *prev_position = buf[idx_in_block];
+    *prev_position = resolve_position(buf[idx_in_block], num_positions, getentropy);
 
     return err_SUCCESS;
 }
@@ -144,10 +172,9 @@ static size_t oram_position_map_capacity(oram_position_map *oram_position_map)
 }
 
 // scan implementation
-static scan_position_map *scan_position_map_create(size_t size, size_t num_positions, entropy_func getentropy)
+static scan_position_map *scan_position_map_create(oram_arena *arena, size_t size, size_t num_positions, entropy_func getentropy)
 {
-    u64 *data;
-    CHECK(data = calloc(size, sizeof(*data)));
+    u64 *data = oram_arena_calloc(arena, size, sizeof(*data));
     //TEST_LOG("scan_position_map size: %zu", size);
     scan_position_map *scan_position_map = calloc(2, sizeof(u64));
     SCAN_POSITION_MAP_SIZE(*scan_position_map) = size;
@@ -161,9 +188,44 @@ static scan_position_map *scan_position_map_create(size_t size, size_t num_posit
     return scan_position_map;
 }
 
-static void scan_position_map_destroy(scan_position_map *scan_position_map)
+static void scan_position_map_grow(scan_position_map *scan_position_map, size_t size, size_t num_positions, entropy_func getentropy)
 {
-    free(SCAN_POSITION_MAP_DATA(*scan_position_map));
+    u64 *data;
+    CHECK(data = realloc((u64*)SCAN_POSITION_MAP_DATA(*scan_position_map), size * sizeof(*data)));
+    for (size_t i = SCAN_POSITION_MAP_SIZE(*scan_position_map); i < size; ++i)
+    {
+        getentropy(data + i, sizeof(*data));
+        data[i] = data[i] % num_positions;
+    }
+    SCAN_POSITION_MAP_SIZE(*scan_position_map) = size;
+    SCAN_POSITION_MAP_DATA(*scan_position_map) = data;
+}
+
+// Move the entries of a scan map into a new ORAM map of `num_blocks` entries, one block at a time.
+static oram_position_map *scan_position_map_to_oram(const scan_position_map *scan_position_map, size_t num_blocks, size_t overflow_stash_size, entropy_func getentropy)
+{
+    oram_config config = {0};
+    oram_position_map *result = oram_position_map_create(num_blocks, overflow_stash_size, &config, getentropy);
+    oram *oram = ORAM_POSITION_MAP_ORAM(*result);
+    size_t block_size = oram_block_size(oram);
+    u64 *buf = ORAM_POSITION_MAP_ACCESS_BUF(*result);
+    const u64 *data = (u64*)SCAN_POSITION_MAP_DATA(*scan_position_map);
+    size_t size = SCAN_POSITION_MAP_SIZE(*scan_position_map);
+    for (size_t i = 0; i < size; i += block_size)
+    {
+        size_t len = size - i < block_size ? size - i : block_size;
+        // the new entries are not present
+        memset(buf, 255, block_size * sizeof(*buf));
+        memcpy(buf, data + i, len * sizeof(*buf));
+        // the blocks were just allocated
+        CHECK(oram_put(oram, block_id_for_index(result, i), buf) == err_SUCCESS);
+    }
+    return result;
+}
+
+static void scan_position_map_destroy(scan_position_map *scan_position_map, const oram_arena *arena)
+{
+    oram_arena_free(arena, (u64*)SCAN_POSITION_MAP_DATA(*scan_position_map));
 }
 
 static error_t scan_position_map_get(const scan_position_map *scan_position_map, u64 block_id, u64* position)
@@ -201,14 +263,22 @@ static size_t scan_position_map_capacity(scan_position_map *scan_position_map)
 // position_map public interface
 position_map *position_map_create(size_t size, size_t num_positions, size_t overflow_stash_size, entropy_func getentropy)
 {
-    position_map *result;
-    CHECK(result = calloc(1, sizeof(*result)));
+    oram_config config = {0};
+    return position_map_create_with_config(size, num_positions, overflow_stash_size, &config, getentropy);
+}
+
+position_map *position_map_create_with_config(size_t size, size_t num_positions, size_t overflow_stash_size, const oram_config *config, entropy_func getentropy)
+{
+    position_map *result = oram_arena_calloc(config->arena, 1, sizeof(*result));
+    POSITION_MAP_ARENA(*result) = config->arena;
     POSITION_MAP_NUM_POSITIONS(*result) = num_positions;
+    POSITION_MAP_GETENTROPY(*result) = getentropy;
+    size_t scan_threshold = config->scan_threshold ? config->scan_threshold : SCAN_THRESHOLD;
     // Acceptable if: this is not executed in an oram_access
-    if (size > SCAN_THRESHOLD)
+    if (size > scan_threshold)
     {
         POSITION_MAP_TYPE(*result) = oram_map;
-        oram_position_map *oram = oram_position_map_create(size, num_positions, overflow_stash_size, getentropy);
+        oram_position_map *oram = oram_position_map_create(size, overflow_stash_size, config, getentropy);
         POSITION_MAP_SIZE(*result) = ORAM_POSITION_MAP_SIZE(*oram);
         POSITION_MAP_DATA(*result) = ORAM_POSITION_MAP_ORAM(*oram);
         POSITION_MAP_BASE_BLOCK_ID(*result) = ORAM_POSITION_MAP_BASE_BLOCK_ID(*oram);
@@ -218,7 +288,7 @@ position_map *position_map_create(size_t size, size_t num_positions, size_t over
     else
     {
         POSITION_MAP_TYPE(*result) = scan_map;
-        scan_position_map *scan = scan_position_map_create(size, num_positions, getentropy);
+        scan_position_map *scan = scan_position_map_create(config->arena, size, num_positions, getentropy);
         POSITION_MAP_SIZE(*result) = SCAN_POSITION_MAP_SIZE(*scan);
         POSITION_MAP_DATA(*result) = SCAN_POSITION_MAP_DATA(*scan);
         free(scan);
@@ -231,19 +301,20 @@ void position_map_destroy(position_map *position_map)
     // Acceptable if: this is not executed in an oram_access
     if (position_map)
     {
+        oram_arena *arena = (oram_arena*)POSITION_MAP_ARENA(*position_map);
         switch (POSITION_MAP_TYPE(*position_map))
         {
         case scan_map:
-            scan_position_map_destroy(&POSITION_MAP_SIZE(*position_map));
+            scan_position_map_destroy(&POSITION_MAP_SIZE(*position_map), arena);
             break;
         case oram_map:
-            oram_position_map_destroy(&POSITION_MAP_SIZE(*position_map));
+            oram_position_map_destroy(&POSITION_MAP_SIZE(*position_map), arena);
             break;
         default:
             CHECK(false);
             break;
         }
-        free(position_map);
+        oram_arena_free(arena, position_map);
     }
 }
 
@@ -256,7 +327,8 @@ error_t position_map_get(const position_map *position_map, u64 block_id, u64* po
         RETURN_IF_ERROR(scan_position_map_get(&POSITION_MAP_SIZE(*position_map), block_id, position));
         break;
     case oram_map:
-        RETURN_IF_ERROR(oram_position_map_get(&POSITION_MAP_SIZE(*position_map), block_id, position));
+        RETURN_IF_ERROR(oram_position_map_get(&POSITION_MAP_SIZE(*position_map), block_id, position,
+            POSITION_MAP_NUM_POSITIONS(*position_map), (entropy_func)(uintptr_t)POSITION_MAP_GETENTROPY(*position_map)));
         break;
     default:
         CHECK(false);
@@ -273,13 +345,152 @@ error_t position_map_read_then_set(position_map *position_map, u64 block_id, u64
     case scan_map:
         return scan_position_map_set(&POSITION_MAP_SIZE(*position_map), block_id, position, prev_position);
     case oram_map:
-        return oram_position_map_set(&POSITION_MAP_SIZE(*position_map), block_id, position, prev_position);
+        return oram_position_map_set(&POSITION_MAP_SIZE(*position_map), block_id, position, prev_position,
+            POSITION_MAP_NUM_POSITIONS(*position_map), (entropy_func)(uintptr_t)POSITION_MAP_GETENTROPY(*position_map));
     default:
         CHECK(false);
         break;
     }
 }
 
+error_t position_map_snapshot(const position_map *position_map, FILE *file, const char *oram_dir, bool incremental, size_t *bucket_bytes_written)
+{
+    size_t oram_bucket_bytes_written = 0;
+    u64 header[4] = {POSITION_MAP_TYPE(*position_map), POSITION_MAP_NUM_POSITIONS(*position_map), POSITION_MAP_SIZE(*position_map), POSITION_MAP_BASE_BLOCK_ID(*position_map)};
+    RETURN_IF_ERROR(snapshot_write(file, header, sizeof(header)));
+    // Acceptable switch: not executed in an oram_access
+    switch (POSITION_MAP_TYPE(*position_map))
+    {
+    case scan_map:
+        return snapshot_write(file, (u64*)POSITION_MAP_DATA(*position_map), POSITION_MAP_SIZE(*position_map) * sizeof(u64));
+    case oram_map:
+        // Acceptable if: not executed in an oram_access
+        if (incremental)
+        {
+            RETURN_IF_ERROR(oram_checkpoint_incremental((oram*)POSITION_MAP_DATA(*position_map), oram_dir, &oram_bucket_bytes_written));
+        }
+        else
+        {
+            RETURN_IF_ERROR(oram_snapshot((oram*)POSITION_MAP_DATA(*position_map), oram_dir));
+        }
+        *bucket_bytes_written += oram_bucket_bytes_written;
+        return err_SUCCESS;
+    default:
+        CHECK(false);
+    }
+    return err_SUCCESS;
+}
+
+error_t position_map_restore(FILE *file, const char *oram_dir, entropy_func getentropy, position_map **result)
+{
+    u64 header[4];
+    RETURN_IF_ERROR(snapshot_read(file, header, sizeof(header)));
+    position_map *position_map;
+    CHECK(position_map = calloc(1, sizeof(*position_map)));
+    POSITION_MAP_TYPE(*position_map) = header[0];
+    POSITION_MAP_NUM_POSITIONS(*position_map) = header[1];
+    POSITION_MAP_SIZE(*position_map) = header[2];
+    POSITION_MAP_BASE_BLOCK_ID(*position_map) = header[3];
+    POSITION_MAP_GETENTROPY(*position_map) = getentropy;
+
+    error_t err = err_SUCCESS;
+    oram *oram = NULL;
+    // Acceptable switch: not executed in an oram_access
+    switch (POSITION_MAP_TYPE(*position_map))
+    {
+    case scan_map:
+        // Acceptable if: not executed in an oram_access
+        if (POSITION_MAP_SIZE(*position_map) > SCAN_THRESHOLD)
+        {
+            err = err_ORAM__SNAPSHOT_INVALID;
+            break;
+        }
+        CHECK(POSITION_MAP_DATA(*position_map) = calloc(POSITION_MAP_SIZE(*position_map), sizeof(u64)));
+        err = snapshot_read(file, (u64*)POSITION_MAP_DATA(*position_map), POSITION_MAP_SIZE(*position_map) * sizeof(u64));
+        break;
+    case oram_map:
+        err = oram_restore(oram_dir, getentropy, &oram);
+        // Acceptable if: not executed in an oram_access
+        if (err == err_SUCCESS)
+        {
+            POSITION_MAP_DATA(*position_map) = oram;
+            CHECK(POSITION_MAP_ACCESS_BUF(*position_map) = calloc(oram_block_size(oram), sizeof(u64)));
+        }
+        break;
+    default:
+        err = err_ORAM__SNAPSHOT_INVALID;
+        break;
+    }
+
+    // Acceptable if: not executed in an oram_access
+    if (err != err_SUCCESS)
+    {
+        // the scan data may have been allocated, but never an ORAM
+        // Acceptable if: not executed in an oram_access
+        if (POSITION_MAP_TYPE(*position_map) == scan_map)
+        {
+            free((u64*)POSITION_MAP_DATA(*position_map));
+        }
+        free(position_map);
+        return err;
+    }
+    *result = position_map;
+    return err_SUCCESS;
+}
+
+error_t position_map_grow(position_map *position_map, size_t num_blocks, size_t overflow_stash_size)
+{
+    CHECK(num_blocks >= POSITION_MAP_SIZE(*position_map));
+    // Acceptable if: not executed in an oram_access
+    if (POSITION_MAP_ARENA(*position_map))
+    {
+        return err_ORAM__GROW_UNSUPPORTED;
+    }
+    entropy_func getentropy = (entropy_func)(uintptr_t)POSITION_MAP_GETENTROPY(*position_map);
+    oram_position_map *oram = NULL;
+    // Acceptable switch: not executed in an oram_access
+    switch (POSITION_MAP_TYPE(*position_map))
+    {
+    case scan_map:
+        // Acceptable if: not executed in an oram_access
+        if (num_blocks <= SCAN_THRESHOLD)
+        {
+            scan_position_map_grow(&POSITION_MAP_SIZE(*position_map), num_blocks, POSITION_MAP_NUM_POSITIONS(*position_map), getentropy);
+            return err_SUCCESS;
+        }
+        oram = scan_position_map_to_oram(&POSITION_MAP_SIZE(*position_map), num_blocks, overflow_stash_size, getentropy);
+        scan_position_map_destroy(&POSITION_MAP_SIZE(*position_map), NULL);
+        POSITION_MAP_TYPE(*position_map) = oram_map;
+        POSITION_MAP_SIZE(*position_map) = ORAM_POSITION_MAP_SIZE(*oram);
+        POSITION_MAP_DATA(*position_map) = ORAM_POSITION_MAP_ORAM(*oram);
+        POSITION_MAP_BASE_BLOCK_ID(*position_map) = ORAM_POSITION_MAP_BASE_BLOCK_ID(*oram);
+        POSITION_MAP_ACCESS_BUF(*position_map) = ORAM_POSITION_MAP_ACCESS_BUF(*oram);
+        free(oram);
+        return err_SUCCESS;
+    case oram_map:
+        return oram_position_map_grow(&POSITION_MAP_SIZE(*position_map), num_blocks);
+    default:
+        CHECK(false);
+    }
+    return err_SUCCESS;
+}
+
+oram *position_map_oram(const position_map *position_map)
+{
+    return POSITION_MAP_TYPE(*position_map) == oram_map ? (oram *)ORAM_POSITION_MAP_ORAM(&POSITION_MAP_SIZE(*position_map)) : NULL;
+}
+
+u64 position_map_block_for_index(const position_map *position_map, u64 block_id)
+{
+    CHECK(POSITION_MAP_TYPE(*position_map) == oram_map);
+    return block_id_for_index(&POSITION_MAP_SIZE(*position_map), block_id);
+}
+
+u64 position_map_resolve_position(const position_map *position_map, u64 stored_position)
+{
+    return resolve_position(stored_position, POSITION_MAP_NUM_POSITIONS(*position_map), (entropy_func)(uintptr_t)POSITION_MAP_GETENTROPY(*position_map));
+}
+
 size_t position_map_capacity(const position_map *position_map)
 {
     u64 result = 0;
@@ -334,12 +545,28 @@ const oram_statistics* position_map_oram_statistics(position_map* position_map)
 size_t position_map_size_bytes(size_t num_blocks, size_t stash_overflow_size) {
     // Acceptable if: this is not executed in an oram_access
     if(num_blocks > SCAN_THRESHOLD) {
-        size_t blocks_needed = num_blocks / BLOCK_DATA_SIZE_QWORDS + 1;
-        size_t num_levels = floor_log2(blocks_needed);
-        return oram_size_bytes(num_levels, blocks_needed, stash_overflow_size) + sizeof(position_map);
+        // the ORAM that `oram_position_map_create` creates, with the leaves of `oram_create_with_config`
+        size_t blocks_needed = num_blocks / BLOCK_DATA_SIZE_QWORDS + (num_blocks % BLOCK_DATA_SIZE_QWORDS == 0 ? 0 : 1);
+        size_t num_leaves = blocks_needed > 1 ? (blocks_needed + 1) / 2 : 1;
+        return oram_size_bytes(num_leaves, blocks_needed, stash_overflow_size) + sizeof(position_map);
     }
     
     return num_blocks * sizeof(u64) + sizeof(position_map);
     
 
 }
+
+size_t position_map_arena_bytes(size_t num_blocks, size_t overflow_stash_size, const oram_config *config)
+{
+    size_t scan_threshold = config->scan_threshold ? config->scan_threshold : SCAN_THRESHOLD;
+    // Acceptable if: this is not executed in an oram_access
+    if (num_blocks > scan_threshold)
+    {
+        // the ORAM and the access buffer of `oram_position_map_create`
+        size_t block_size = bucket_geometry_create(config->bucket_size, config->blocks_per_bucket, config->block_size_bytes).block_data_qwords;
+        return oram_arena_bytes(sizeof(position_map))
+               + oram_arena_size_bytes(num_blocks, overflow_stash_size, config)
+               + oram_arena_bytes(block_size * sizeof(u64));
+    }
+    return oram_arena_bytes(sizeof(position_map)) + oram_arena_bytes(num_blocks * sizeof(u64));
+}
@@ -0,0 +1,508 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+// for pthread_setaffinity_np and the CPU_* macros
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "../include/sharded_oram.h"
+#include "../include/path_oram.h"
+#include "../include/bucket.h"
+
+#define NUMA_SYSFS_DIR "/sys/devices/system/node"
+// nodes are passed to set_mempolicy as a single word
+#define MAX_NUMA_NODES 64
+
+// One request as it is routed through the shards. Every field is a u64 so that entries can be moved with
+// oblivious swaps.
+typedef struct
+{
+    // sort key, recomputed before each routing step
+    u64 key;
+    u64 shard;
+    // block id within the shard
+    u64 block_id;
+    // position in the request batch
+    u64 index;
+    u64 is_dummy;
+    // true if the block is written. Never true for a dummy.
+    u64 write;
+    // data to write; replaced by the previous contents of the block
+    u64 data[BLOCK_DATA_SIZE_QWORDS];
+} route_entry;
+
+#define ROUTE_ENTRY_QWORDS (sizeof(route_entry) / sizeof(u64))
+
+typedef struct
+{
+    sharded_oram *parent;
+    oram *oram;
+    pthread_t thread;
+    // NUMA node this shard is bound to, or -1 if the worker is not pinned
+    int node;
+    cpu_set_t cpus;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool ready;
+    bool pending;
+    bool stop;
+
+    // padded batch, set by the front-end before `pending` is set and served in order
+    route_entry *batch;
+    size_t batch_size;
+    // set by the worker before `pending` is cleared
+    error_t err;
+} shard;
+
+struct sharded_oram
+{
+    size_t num_shards;
+    size_t shard_capacity_u64;
+    size_t shard_capacity_blocks;
+    size_t stash_overflow_size;
+    entropy_func getentropy;
+    shard *shards;
+};
+
+// Swaps the block with `entry->data` if `entry->write` is set and copies it to `entry->data` otherwise. Every entry
+// is served by the same accessor so that real and dummy accesses are indistinguishable.
+static error_t route_entry_accessor(u64 *block_data, void *args)
+{
+    route_entry *entry = args;
+    for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+    {
+        u64 prev = block_data[i];
+        cond_obv_cpy_u64(entry->write, block_data + i, entry->data + i);
+        entry->data[i] = prev;
+    }
+    return err_SUCCESS;
+}
+
+// Best effort: if the policy cannot be set (e.g. in a restricted container), pages are still placed by first touch
+// from the pinned worker, which keeps them on its node under the default policy.
+static void bind_memory_to_node(int node)
+{
+    unsigned long nodemask = 1UL << node;
+    syscall(SYS_set_mempolicy, MPOL_BIND, &nodemask, (unsigned long)MAX_NUMA_NODES);
+}
+
+static void *shard_worker(void *arg)
+{
+    shard *shard = arg;
+    sharded_oram *parent = shard->parent;
+    // Acceptable if: not executed in an oram_access
+    if (shard->node >= 0)
+    {
+        CHECK(pthread_setaffinity_np(pthread_self(), sizeof(shard->cpus), &shard->cpus) == 0);
+        bind_memory_to_node(shard->node);
+    }
+
+    // Everything the shard owns - bucket store, stash and position map - is created and first touched here, on the
+    // worker's node.
+    shard->oram = oram_create(parent->shard_capacity_u64, parent->stash_overflow_size, parent->getentropy);
+    oram_allocate_contiguous(shard->oram, oram_capacity_blocks(shard->oram));
+
+    pthread_mutex_lock(&shard->lock);
+    shard->ready = true;
+    pthread_cond_broadcast(&shard->cond);
+    for (;;)
+    {
+        while (!shard->pending && !shard->stop)
+        {
+            pthread_cond_wait(&shard->cond, &shard->lock);
+        }
+        // Acceptable if: not executed in an oram_access
+        if (shard->stop)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&shard->lock);
+
+        error_t err = err_SUCCESS;
+        for (size_t i = 0; i < shard->batch_size; ++i)
+        {
+            route_entry *entry = &shard->batch[i];
+            error_t access_err = oram_function_access(shard->oram, entry->block_id, route_entry_accessor, entry);
+            err = err == err_SUCCESS ? access_err : err;
+        }
+
+        pthread_mutex_lock(&shard->lock);
+        shard->err = err;
+        shard->pending = false;
+        pthread_cond_broadcast(&shard->cond);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    oram_destroy(shard->oram);
+    shard->oram = NULL;
+    return NULL;
+}
+
+// Parses a sysfs list such as "0-3,8-11" and calls `add` for each entry. Returns the number of entries.
+static size_t parse_sysfs_list(const char *list, void (*add)(size_t, void *), void *args)
+{
+    size_t count = 0;
+    const char *p = list;
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        size_t first = strtoul(p, &end, 10);
+        size_t last = first;
+        // Acceptable if: not executed in an oram_access
+        if (end == p)
+        {
+            break;
+        }
+        // Acceptable if: not executed in an oram_access
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+        }
+        for (size_t i = first; i <= last; ++i)
+        {
+            add(i, args);
+            ++count;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+static bool read_sysfs_line(const char *path, char *buf, size_t len)
+{
+    FILE *file = fopen(path, "r");
+    // Acceptable if: not executed in an oram_access
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool ok = fgets(buf, len, file) != NULL;
+    fclose(file);
+    return ok;
+}
+
+static void add_cpu(size_t cpu, void *args)
+{
+    // Acceptable if: not executed in an oram_access
+    if (cpu < CPU_SETSIZE)
+    {
+        CPU_SET(cpu, (cpu_set_t *)args);
+    }
+}
+
+typedef struct
+{
+    int nodes[MAX_NUMA_NODES];
+    cpu_set_t cpus[MAX_NUMA_NODES];
+    size_t num_nodes;
+} numa_topology;
+
+static void add_node(size_t node, void *args)
+{
+    numa_topology *topology = args;
+    char path[128];
+    char list[4096];
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    snprintf(path, sizeof(path), NUMA_SYSFS_DIR "/node%zu/cpulist", node);
+    // memory-only nodes have no worker to serve them
+    // Acceptable if: not executed in an oram_access
+    if (node < MAX_NUMA_NODES && topology->num_nodes < MAX_NUMA_NODES && read_sysfs_line(path, list, sizeof(list)) && parse_sysfs_list(list, add_cpu, &cpus) > 0)
+    {
+        topology->nodes[topology->num_nodes] = node;
+        topology->cpus[topology->num_nodes] = cpus;
+        ++topology->num_nodes;
+    }
+}
+
+static sharded_oram *sharded_oram_create_on_nodes(size_t capacity_u64, size_t num_shards, const int *nodes, const cpu_set_t *cpus, size_t stash_overflow_size, entropy_func getentropy)
+{
+    CHECK(num_shards > 0);
+    sharded_oram *sharded;
+    CHECK(sharded = calloc(1, sizeof(*sharded)));
+    sharded->num_shards = num_shards;
+    sharded->shard_capacity_u64 = (capacity_u64 + num_shards - 1) / num_shards;
+    sharded->stash_overflow_size = stash_overflow_size;
+    sharded->getentropy = getentropy;
+    CHECK(sharded->shards = calloc(num_shards, sizeof(*sharded->shards)));
+
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        shard *shard = &sharded->shards[s];
+        shard->parent = sharded;
+        shard->node = nodes ? nodes[s] : -1;
+        // Acceptable if: not executed in an oram_access
+        if (cpus)
+        {
+            shard->cpus = cpus[s];
+        }
+        CHECK(pthread_mutex_init(&shard->lock, NULL) == 0);
+        CHECK(pthread_cond_init(&shard->cond, NULL) == 0);
+        CHECK(pthread_create(&shard->thread, NULL, shard_worker, shard) == 0);
+    }
+
+    // shards are created concurrently on their own nodes
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        shard *shard = &sharded->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        while (!shard->ready)
+        {
+            pthread_cond_wait(&shard->cond, &shard->lock);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    // all shards have the same geometry
+    sharded->shard_capacity_blocks = oram_capacity_blocks(sharded->shards[0].oram);
+    return sharded;
+}
+
+sharded_oram *sharded_oram_create(size_t capacity_u64, size_t num_shards, size_t stash_overflow_size, entropy_func getentropy)
+{
+    return sharded_oram_create_on_nodes(capacity_u64, num_shards, NULL, NULL, stash_overflow_size, getentropy);
+}
+
+sharded_oram *sharded_oram_create_numa(size_t capacity_u64, size_t stash_overflow_size, entropy_func getentropy)
+{
+    numa_topology *topology;
+    CHECK(topology = calloc(1, sizeof(*topology)));
+    char list[4096];
+    // Acceptable if: not executed in an oram_access
+    if (read_sysfs_line(NUMA_SYSFS_DIR "/online", list, sizeof(list)))
+    {
+        parse_sysfs_list(list, add_node, topology);
+    }
+
+    sharded_oram *sharded = topology->num_nodes > 0
+                                ? sharded_oram_create_on_nodes(capacity_u64, topology->num_nodes, topology->nodes, topology->cpus, stash_overflow_size, getentropy)
+                                : sharded_oram_create(capacity_u64, 1, stash_overflow_size, getentropy);
+    free(topology);
+    return sharded;
+}
+
+void sharded_oram_destroy(sharded_oram *sharded_oram)
+{
+    // Acceptable if: not executed in an oram_access
+    if (sharded_oram)
+    {
+        for (size_t s = 0; s < sharded_oram->num_shards; ++s)
+        {
+            shard *shard = &sharded_oram->shards[s];
+            pthread_mutex_lock(&shard->lock);
+            shard->stop = true;
+            pthread_cond_broadcast(&shard->cond);
+            pthread_mutex_unlock(&shard->lock);
+        }
+        for (size_t s = 0; s < sharded_oram->num_shards; ++s)
+        {
+            shard *shard = &sharded_oram->shards[s];
+            pthread_join(shard->thread, NULL);
+            pthread_cond_destroy(&shard->cond);
+            pthread_mutex_destroy(&shard->lock);
+        }
+        free(sharded_oram->shards);
+        free(sharded_oram);
+    }
+}
+
+size_t sharded_oram_num_shards(const sharded_oram *sharded_oram)
+{
+    return sharded_oram->num_shards;
+}
+
+size_t sharded_oram_capacity_blocks(const sharded_oram *sharded_oram)
+{
+    return sharded_oram->num_shards * sharded_oram->shard_capacity_blocks;
+}
+
+size_t sharded_oram_shard_batch_size(size_t num_requests, size_t num_shards)
+{
+    // Chernoff bound on the load of one shard, P(load >= mean + sqrt(2 * mean * t) + t) <= e^-t, with e^-t < 2^-40.
+    double t = 28.0;
+    double mean = (double)num_requests / (double)num_shards;
+    size_t bound = (size_t)ceil(mean + sqrt(2.0 * mean * t) + t);
+    return bound < num_requests ? bound : num_requests;
+}
+
+static void cond_swap_route_entries(bool cond, route_entry *a, route_entry *b)
+{
+    for (size_t i = 0; i < ROUTE_ENTRY_QWORDS; ++i)
+    {
+        cond_obv_swap_u64(cond, (u64 *)a + i, (u64 *)b + i);
+    }
+}
+
+// Batcher's odd-even merge sort on `key`, as used for the stash. The sequence of compare-and-swaps depends only on
+// `n`, and entries with equal keys are never swapped.
+static void route_entries_sort(route_entry *entries, size_t n)
+{
+    for (size_t p = 1; p < n; p <<= 1)
+    {
+        for (size_t k = p; k >= 1; k >>= 1)
+        {
+            size_t mod_kp = k % p;
+            for (size_t j = mod_kp; j < n - k; j += 2 * k)
+            {
+                size_t len = k < n - j - k ? k : n - j - k;
+                for (size_t i = 0; i < len; ++i)
+                {
+                    // Acceptable if: depends only on public sizes
+                    if (((i + j) / (p * 2)) == ((i + j + k) / (p * 2)))
+                    {
+                        route_entry *a = entries + i + j;
+                        route_entry *b = a + k;
+                        cond_swap_route_entries(a->key > b->key, a, b);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Keys pack (shard, is_dummy, index) so that requests for a shard are grouped in batch order, ahead of its padding.
+#define ROUTE_KEY(shard, is_dummy, index) (((shard) << 33) | ((is_dummy) << 32) | (index))
+
+error_t sharded_oram_access_batch(sharded_oram *sharded_oram, size_t num_requests, sharded_oram_request requests[], size_t shard_batch_size)
+{
+    size_t num_shards = sharded_oram->num_shards;
+    size_t capacity_blocks = sharded_oram_capacity_blocks(sharded_oram);
+    CHECK(num_requests < (1UL << 32) && num_shards < (1UL << 30));
+    CHECK(shard_batch_size > 0);
+    for (size_t i = 0; i < num_requests; ++i)
+    {
+        // Acceptable if: block ids are checked against the public capacity, as in oram_function_access
+        if (requests[i].block_id >= capacity_blocks)
+        {
+            return err_ORAM__ACCESS_UNALLOCATED_BLOCK;
+        }
+    }
+
+    // every request, followed by `shard_batch_size` dummies for every shard
+    size_t padded_size = num_shards * shard_batch_size;
+    size_t num_entries = num_requests + padded_size;
+    route_entry *entries;
+    CHECK(entries = calloc(num_entries, sizeof(*entries)));
+    u64 *dummy_ids;
+    CHECK(dummy_ids = calloc(padded_size, sizeof(*dummy_ids)));
+    // getentropy returns at most 256 bytes per call
+    for (size_t i = 0; i < padded_size; i += 32)
+    {
+        size_t len = padded_size - i < 32 ? padded_size - i : 32;
+        CHECK(sharded_oram->getentropy(dummy_ids + i, len * sizeof(*dummy_ids)) == 0);
+    }
+
+    for (size_t i = 0; i < num_requests; ++i)
+    {
+        route_entry *entry = &entries[i];
+        entry->shard = requests[i].block_id % num_shards;
+        entry->block_id = requests[i].block_id / num_shards;
+        entry->index = i;
+        entry->write = requests[i].is_put;
+        memcpy(entry->data, requests[i].data, BLOCK_DATA_SIZE_BYTES);
+    }
+    for (size_t i = 0; i < padded_size; ++i)
+    {
+        route_entry *entry = &entries[num_requests + i];
+        entry->shard = i / shard_batch_size;
+        entry->index = num_requests;
+        entry->is_dummy = true;
+    }
+
+    // Group entries by shard, then keep the first `shard_batch_size` of every group. Since every group has at least
+    // that many dummies, each shard gets exactly `shard_batch_size` entries, real ones first.
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        entries[i].key = ROUTE_KEY(entries[i].shard, entries[i].is_dummy, entries[i].index);
+    }
+    route_entries_sort(entries, num_entries);
+    u64 rank = 0;
+    bool overflow = false;
+    for (size_t i = 0; i < num_entries; ++i)
+    {
+        bool same_shard = i > 0 && entries[i].shard == entries[i - 1].shard;
+        rank = U64_TERNARY(same_shard, (rank + 1), 0);
+        bool selected = rank < shard_batch_size;
+        overflow |= !selected & !entries[i].is_dummy;
+        entries[i].key = ((u64)!selected << 63) | ROUTE_KEY(entries[i].shard, entries[i].is_dummy, entries[i].index);
+    }
+    // Acceptable if: overflow is the only thing revealed about how requests are spread across shards
+    if (overflow)
+    {
+        free(dummy_ids);
+        free(entries);
+        return err_SHARD__BATCH_OVERFLOW;
+    }
+    route_entries_sort(entries, num_entries);
+
+    for (size_t i = 0; i < padded_size; ++i)
+    {
+        route_entry *entry = &entries[i];
+        entry->block_id = U64_TERNARY(entry->is_dummy, dummy_ids[i] % sharded_oram->shard_capacity_blocks, entry->block_id);
+        entry->write &= !entry->is_dummy;
+    }
+
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        shard *shard = &sharded_oram->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        shard->batch = entries + s * shard_batch_size;
+        shard->batch_size = shard_batch_size;
+        shard->pending = true;
+        pthread_cond_broadcast(&shard->cond);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    error_t err = err_SUCCESS;
+    for (size_t s = 0; s < num_shards; ++s)
+    {
+        shard *shard = &sharded_oram->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        while (shard->pending)
+        {
+            pthread_cond_wait(&shard->cond, &shard->lock);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        // every block is allocated, so an error from any shard is a failure of the whole batch
+        err = err == err_SUCCESS ? shard->err : err;
+    }
+
+    // route results back: real entries first, in batch order
+    for (size_t i = 0; i < padded_size; ++i)
+    {
+        entries[i].key = (entries[i].is_dummy << 32) | entries[i].index;
+    }
+    route_entries_sort(entries, padded_size);
+    for (size_t i = 0; i < num_requests; ++i)
+    {
+        memcpy(requests[i].data, entries[i].data, BLOCK_DATA_SIZE_BYTES);
+    }
+
+    free(dummy_ids);
+    free(entries);
+    return err;
+}
+
+error_t sharded_oram_get(sharded_oram *sharded_oram, u64 block_id, u64 buf[])
+{
+    sharded_oram_request request = {.block_id = block_id, .is_put = false};
+    // one entry per shard: the request in its shard and a dummy in every other
+    RETURN_IF_ERROR(sharded_oram_access_batch(sharded_oram, 1, &request, 1));
+    memcpy(buf, request.data, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+error_t sharded_oram_put(sharded_oram *sharded_oram, u64 block_id, const u64 data[])
+{
+    sharded_oram_request request = {.block_id = block_id, .is_put = true};
+    memcpy(request.data, data, BLOCK_DATA_SIZE_BYTES);
+    return sharded_oram_access_batch(sharded_oram, 1, &request, 1);
+}
@@ -27,6 +27,14 @@
 #define STASH_OVERFLOW_CAPACITY(s)  ((s)[5])
 #define STASH_BUCKET_OCCUPANCY(s)   ((s)[6])
 #define STASH_BUCKET_ASSIGNMENTS(s) ((s)[7])
+#define STASH_TREETOP_BLOCKS(s)     ((s)[8])
+#define STASH_TREETOP_LEVELS(s)     ((s)[9])
+#define STASH_PATH_SLOTS(s)         ((s)[10])
+#define STASH_BLOCKS_PER_BUCKET(s)  ((s)[11])
+#define STASH_BLOCK_QWORDS(s)       ((s)[12])
+#define STASH_BRANCHING(s)          ((s)[13])
+#define STASH_LEVEL_BLOCKS(s)       ((s)[14])
+#define STASH_ARENA(s)              ((s)[15])
 // struct stash
 // {
 //     /**
@@ -60,6 +68,35 @@
 //     // scratch space for block placement computations
 //     u64* bucket_occupancy;
 //     u64* bucket_assignments;
+//
+//     /**
+//      * @brief Dense, heap-ordered copy of the top `treetop_levels` levels of the tree. Bucket `i` in this
+//      * array is node `k` of the tree in breadth-first order (root is 0). Between accesses, blocks in these
+//      * buckets live here and not in the `bucket_store`.
+//      */
+//     block* treetop_blocks;
+//     size_t treetop_levels;
+//
+//     /**
+//      * @brief NULL unless the stash sorts the path in place. Then entry `i` points at block `i` of the path and
+//      * overflow: the path entries into the bucket store and the treetop, the overflow entries into `overflow_blocks`.
+//      */
+//     u64** path_slots;
+//
+//     /**
+//      * @brief Geometry of the buckets of the path. Blocks are `block_qwords` u64s, so the block arrays above are
+//      * indexed with `stash_block_at` rather than as arrays of `block`, which only fits the default geometry.
+//      */
+//     size_t blocks_per_bucket;
+//     size_t block_qwords;
+//     // Children per internal bucket, which places the blocks of a path and lays out the treetop.
+//     size_t branching;
+//     /**
+//      * @brief Blocks the bucket on each level of the path can hold, at most `blocks_per_bucket`. Every level is
+//      * staged and sorted as `blocks_per_bucket` blocks, but only this many are assigned real blocks, so the blocks
+//      * past it stay empty and need not be stored.
+//      */
+//     size_t* level_blocks;
 // };
 
 
@@ -68,6 +105,24 @@ typedef enum {
     block_type_path
 } block_type;
 
+// Buckets on the top `treetop_levels` levels of a full tree: 1 + k + ... + k^(treetop_levels - 1)
+static size_t treetop_num_buckets(size_t treetop_levels, size_t branching) {
+    size_t result = 0;
+    for (size_t depth = 0; depth < treetop_levels; ++depth) {
+        result = result * branching + 1;
+    }
+    return result;
+}
+
+static inline size_t stash_block_bytes(const stash* stash) {
+    return STASH_BLOCK_QWORDS(*stash) * sizeof(u64);
+}
+
+// Block `i` of an array of blocks of the stash's geometry.
+static inline u64* stash_block_at(const stash* stash, u64 blocks, size_t i) {
+    return (u64*)blocks + i * STASH_BLOCK_QWORDS(*stash);
+}
+
 size_t stash_size_bytes(size_t path_length, size_t overflow_size) {
     size_t num_path_blocks = BLOCKS_PER_BUCKET * path_length;
     size_t num_blocks = overflow_size + num_path_blocks;
@@ -78,24 +133,76 @@ size_t stash_size_bytes(size_t path_length, size_t overflow_size) {
 
 stash *stash_create(size_t path_length, size_t overflow_size)
 {
-    size_t num_path_blocks = BLOCKS_PER_BUCKET * path_length;
+    return stash_create_with_treetop(path_length, overflow_size, 0, &BUCKET_GEOMETRY_DEFAULT);
+}
+
+stash *stash_create_with_treetop(size_t path_length, size_t overflow_size, size_t treetop_levels, const bucket_geometry *geometry)
+{
+    return stash_create_in(NULL, path_length, overflow_size, treetop_levels, geometry);
+}
+
+size_t stash_arena_bytes(size_t path_length, size_t overflow_size, size_t treetop_levels, const bucket_geometry *geometry, bool zero_copy)
+{
+    size_t num_blocks = overflow_size + geometry->blocks_per_bucket * path_length;
+    size_t block_bytes = bucket_geometry_block_qwords(geometry) * sizeof(u64);
+    size_t num_treetop_blocks = geometry->blocks_per_bucket * treetop_num_buckets(treetop_levels, geometry->branching);
+    return oram_arena_bytes(sizeof(stash))
+           + oram_arena_bytes(path_length * sizeof(size_t))
+           + oram_arena_bytes(num_blocks * block_bytes)
+           + oram_arena_bytes(path_length * sizeof(u64))
+           + oram_arena_bytes(num_blocks * sizeof(u64))
+           + (num_treetop_blocks > 0 ? oram_arena_bytes(num_treetop_blocks * block_bytes) : 0)
+           + (zero_copy ? oram_arena_bytes(num_blocks * sizeof(u64*)) : 0);
+}
+
+stash *stash_create_in(oram_arena *arena, size_t path_length, size_t overflow_size, size_t treetop_levels, const bucket_geometry *geometry)
+{
+    CHECK(treetop_levels <= path_length);
+    size_t num_path_blocks = geometry->blocks_per_bucket * path_length;
     size_t num_blocks = overflow_size + num_path_blocks;
-    stash *result;
-    CHECK(result = calloc(1, sizeof(*result)));
-    block *blocks;
-    CHECK(blocks = mmap(NULL, num_blocks * sizeof(block), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    size_t block_bytes = bucket_geometry_block_qwords(geometry) * sizeof(u64);
+    stash *result = oram_arena_calloc(arena, 1, sizeof(*result));
+    STASH_ARENA(*result) = arena;
+    STASH_BLOCKS_PER_BUCKET(*result) = geometry->blocks_per_bucket;
+    STASH_BLOCK_QWORDS(*result) = bucket_geometry_block_qwords(geometry);
+    STASH_BRANCHING(*result) = geometry->branching;
+    size_t *level_blocks = oram_arena_calloc(arena, path_length, sizeof(size_t));
+    for (size_t level = 0; level < path_length; ++level) {
+        level_blocks[level] = bucket_geometry_level_blocks(geometry, level);
+    }
+    STASH_LEVEL_BLOCKS(*result) = level_blocks;
+    u64 *blocks;
+    // Acceptable if: not executed in an oram_access
+    if (arena) {
+        blocks = oram_arena_alloc(arena, num_blocks * block_bytes);
+    } else {
+        CHECK((blocks = mmap(NULL, num_blocks * block_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED);
+    }
     STASH_BLOCKS(*result) = blocks;
-    STASH_PATH_BLOCKS(*result) = (block*)STASH_BLOCKS(*result);
-    STASH_OVERFLOW_BLOCKS(*result) = (block*)STASH_BLOCKS(*result) + num_path_blocks;
+    STASH_PATH_BLOCKS(*result) = STASH_BLOCKS(*result);
+    STASH_OVERFLOW_BLOCKS(*result) = stash_block_at(result, STASH_BLOCKS(*result), num_path_blocks);
     STASH_NUM_BLOCKS(*result) = num_blocks;
     STASH_OVERFLOW_CAPACITY(*result) = num_blocks - num_path_blocks; 
     CHECK(overflow_size == STASH_OVERFLOW_CAPACITY(*result));
     STASH_PATH_LENGTH(*result) = path_length;
 
-    CHECK(STASH_BUCKET_OCCUPANCY(*result) = calloc(path_length, sizeof(u64)));
-    CHECK(STASH_BUCKET_ASSIGNMENTS(*result) = mmap(NULL, num_blocks * sizeof(u64), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    STASH_BUCKET_OCCUPANCY(*result) = oram_arena_calloc(arena, path_length, sizeof(u64));
+    // Acceptable if: not executed in an oram_access
+    if (arena) {
+        STASH_BUCKET_ASSIGNMENTS(*result) = oram_arena_alloc(arena, num_blocks * sizeof(u64));
+    } else {
+        CHECK(STASH_BUCKET_ASSIGNMENTS(*result) = mmap(NULL, num_blocks * sizeof(u64), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    }
+
+    memset(STASH_BLOCKS(*result), 255, block_bytes * num_blocks);
 
-    memset(STASH_BLOCKS(*result), 255,  sizeof(block) * num_blocks);
+    STASH_TREETOP_LEVELS(*result) = treetop_levels;
+    size_t num_treetop_blocks = geometry->blocks_per_bucket * treetop_num_buckets(treetop_levels, geometry->branching);
+    // Acceptable if: not executed in an oram_access
+    if (num_treetop_blocks > 0) {
+        STASH_TREETOP_BLOCKS(*result) = oram_arena_calloc(arena, num_treetop_blocks, block_bytes);
+        memset(STASH_TREETOP_BLOCKS(*result), 255, num_treetop_blocks * block_bytes);
+    }
     return result;
 }
 
@@ -103,34 +210,127 @@ void stash_destroy(stash *stash)
 {
     if (stash)
     {
-        munmap(STASH_BLOCKS(*stash), STASH_NUM_BLOCKS(*stash) * sizeof(block));
-        free(STASH_BUCKET_OCCUPANCY(*stash));
-        munmap(STASH_BUCKET_ASSIGNMENTS(*stash), STASH_NUM_BLOCKS(*stash) * sizeof(u64));
+        oram_arena *arena = (oram_arena*)STASH_ARENA(*stash);
+        // Acceptable if: not executed in an oram_access
+        if (!oram_arena_owns(arena, (u64*)STASH_BLOCKS(*stash))) {
+            munmap(STASH_BLOCKS(*stash), STASH_NUM_BLOCKS(*stash) * stash_block_bytes(stash));
+        }
+        oram_arena_free(arena, (u64*)STASH_BUCKET_OCCUPANCY(*stash));
+        // Acceptable if: not executed in an oram_access
+        if (!oram_arena_owns(arena, (u64*)STASH_BUCKET_ASSIGNMENTS(*stash))) {
+            munmap(STASH_BUCKET_ASSIGNMENTS(*stash), STASH_NUM_BLOCKS(*stash) * sizeof(u64));
+        }
+        oram_arena_free(arena, (u64*)STASH_TREETOP_BLOCKS(*stash));
+        oram_arena_free(arena, (u64**)STASH_PATH_SLOTS(*stash));
+        oram_arena_free(arena, (size_t*)STASH_LEVEL_BLOCKS(*stash));
+        oram_arena_free(arena, stash);
     }
-    free(stash);
 }
 
-const block* stash_path_blocks(const stash* stash) {
-    return (block*)STASH_PATH_BLOCKS(*stash);
+error_t stash_snapshot(const stash* stash, FILE* file) {
+    u64 header[3] = {STASH_PATH_LENGTH(*stash), STASH_TREETOP_LEVELS(*stash), STASH_OVERFLOW_CAPACITY(*stash)};
+    RETURN_IF_ERROR(snapshot_write(file, header, sizeof(header)));
+    // The path blocks are scratch space for a single access. Between accesses only the overflow and the treetop hold blocks.
+    RETURN_IF_ERROR(snapshot_write(file, STASH_OVERFLOW_BLOCKS(*stash), STASH_OVERFLOW_CAPACITY(*stash) * stash_block_bytes(stash)));
+    return snapshot_write(file, STASH_TREETOP_BLOCKS(*stash), STASH_BLOCKS_PER_BUCKET(*stash) * treetop_num_buckets(STASH_TREETOP_LEVELS(*stash), STASH_BRANCHING(*stash)) * stash_block_bytes(stash));
+}
+
+error_t stash_restore(FILE* file, const bucket_geometry* geometry, stash** result) {
+    u64 header[3];
+    RETURN_IF_ERROR(snapshot_read(file, header, sizeof(header)));
+    // Acceptable if: not executed in an oram_access
+    if (header[1] > header[0] || header[0] > 64) {
+        return err_ORAM__SNAPSHOT_INVALID;
+    }
+    stash* stash = stash_create_with_treetop(header[0], header[2], header[1], geometry);
+    error_t err = snapshot_read(file, STASH_OVERFLOW_BLOCKS(*stash), STASH_OVERFLOW_CAPACITY(*stash) * stash_block_bytes(stash));
+    // Acceptable if: not executed in an oram_access
+    if (err == err_SUCCESS) {
+        err = snapshot_read(file, STASH_TREETOP_BLOCKS(*stash), STASH_BLOCKS_PER_BUCKET(*stash) * treetop_num_buckets(STASH_TREETOP_LEVELS(*stash), STASH_BRANCHING(*stash)) * stash_block_bytes(stash));
+    }
+    // Acceptable if: not executed in an oram_access
+    if (err != err_SUCCESS) {
+        stash_destroy(stash);
+        return err;
+    }
+    *result = stash;
+    return err_SUCCESS;
+}
+
+void stash_grow(stash* stash, size_t levels, const bucket_geometry* geometry) {
+    void* grown = stash_create_with_treetop(STASH_PATH_LENGTH(*stash) + levels, STASH_OVERFLOW_CAPACITY(*stash), STASH_TREETOP_LEVELS(*stash), geometry);
+    // Acceptable if: not executed in an oram_access
+    if (STASH_PATH_SLOTS(*stash)) {
+        stash_enable_zero_copy(grown);
+    }
+    // The treetop is ordered by depth, which growth does not change, so both keep their layout and only the
+    // positions of their blocks are renumbered.
+    size_t num_overflow_blocks = STASH_OVERFLOW_CAPACITY(*stash);
+    size_t num_treetop_blocks = STASH_BLOCKS_PER_BUCKET(*stash) * treetop_num_buckets(STASH_TREETOP_LEVELS(*stash), STASH_BRANCHING(*stash));
+    memcpy((u64*)STASH_OVERFLOW_BLOCKS((u64*)grown), (u64*)STASH_OVERFLOW_BLOCKS(*stash), num_overflow_blocks * stash_block_bytes(stash));
+    // Acceptable if: not executed in an oram_access
+    if (num_treetop_blocks > 0) {
+        memcpy((u64*)STASH_TREETOP_BLOCKS((u64*)grown), (u64*)STASH_TREETOP_BLOCKS(*stash), num_treetop_blocks * stash_block_bytes(stash));
+    }
+    for(size_t i = 0; i < num_overflow_blocks + num_treetop_blocks; ++i) {
+        u64* block = i < num_overflow_blocks
+            ? stash_block_at(grown, STASH_OVERFLOW_BLOCKS((u64*)grown), i)
+            : stash_block_at(grown, STASH_TREETOP_BLOCKS((u64*)grown), i - num_overflow_blocks);
+        // the position of an empty block, UINT64_MAX, is unchanged
+        BLOCK_POSITION(block) = tree_path_id_after_growth(BLOCK_POSITION(block), levels, STASH_BRANCHING(*stash));
+    }
+    // `stash` takes the contents of the grown stash, and the old contents are destroyed with `grown`
+    u64 fields[sizeof(*stash) / sizeof(u64)];
+    memcpy(fields, grown, sizeof(fields));
+    memcpy(grown, stash, sizeof(fields));
+    memcpy(stash, fields, sizeof(fields));
+    stash_destroy(grown);
+}
+
+const u64* stash_path_blocks(const stash* stash) {
+    return (u64*)STASH_PATH_BLOCKS(*stash);
 }
 
 static void stash_extend_overflow(stash* stash) {
     size_t old_num_blocks = STASH_NUM_BLOCKS(*stash);
     size_t new_num_blocks = old_num_blocks + STASH_GROWTH_INCREMENT;
 
-    // (re)allocate new space, free the old
-    CHECK(STASH_BLOCKS(*stash) = mremap(STASH_BLOCKS(*stash),
-                                        old_num_blocks * sizeof(block), new_num_blocks * sizeof(block), MREMAP_MAYMOVE));
-    munmap(STASH_BUCKET_ASSIGNMENTS(*stash), old_num_blocks * sizeof(u64));
+    // (re)allocate new space, free the old. Memory in an arena cannot grow, so a stash that outgrows its arena
+    // allocations moves to the heap and leaves them to the arena's owner.
+    oram_arena *arena = (oram_arena*)STASH_ARENA(*stash);
+    // Acceptable if: the number of stash extensions is public
+    if (oram_arena_owns(arena, (u64*)STASH_BLOCKS(*stash))) {
+        u64 *blocks;
+        CHECK((blocks = mmap(NULL, new_num_blocks * stash_block_bytes(stash), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED);
+        memcpy(blocks, (u64*)STASH_BLOCKS(*stash), old_num_blocks * stash_block_bytes(stash));
+        STASH_BLOCKS(*stash) = blocks;
+    } else {
+        CHECK(STASH_BLOCKS(*stash) = mremap(STASH_BLOCKS(*stash),
+                                            old_num_blocks * stash_block_bytes(stash), new_num_blocks * stash_block_bytes(stash), MREMAP_MAYMOVE));
+    }
+    // Acceptable if: the number of stash extensions is public
+    if (!oram_arena_owns(arena, (u64*)STASH_BUCKET_ASSIGNMENTS(*stash))) {
+        munmap(STASH_BUCKET_ASSIGNMENTS(*stash), old_num_blocks * sizeof(u64));
+    }
     CHECK(STASH_BUCKET_ASSIGNMENTS(*stash) = mmap(NULL, new_num_blocks * sizeof(u64),
                                                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
 
+    // Acceptable if: the stash mode is fixed at creation
+    if (STASH_PATH_SLOTS(*stash) && oram_arena_owns(arena, (u64**)STASH_PATH_SLOTS(*stash))) {
+        u64 **slots;
+        CHECK(slots = malloc(new_num_blocks * sizeof(u64*)));
+        memcpy(slots, (u64**)STASH_PATH_SLOTS(*stash), old_num_blocks * sizeof(u64*));
+        STASH_PATH_SLOTS(*stash) = slots;
+    } else if (STASH_PATH_SLOTS(*stash)) {
+        CHECK(STASH_PATH_SLOTS(*stash) = realloc(STASH_PATH_SLOTS(*stash), new_num_blocks * sizeof(u64*)));
+    }
+
     // update our alias pointers
-    STASH_PATH_BLOCKS(*stash) = (block*)STASH_BLOCKS(*stash);
-    STASH_OVERFLOW_BLOCKS(*stash) = (block*)STASH_BLOCKS(*stash) + STASH_PATH_LENGTH(*stash) * BLOCKS_PER_BUCKET;
+    STASH_PATH_BLOCKS(*stash) = STASH_BLOCKS(*stash);
+    STASH_OVERFLOW_BLOCKS(*stash) = stash_block_at(stash, STASH_BLOCKS(*stash), STASH_PATH_LENGTH(*stash) * STASH_BLOCKS_PER_BUCKET(*stash));
 
     // initialize new memory
-    memset((block*)STASH_BLOCKS(*stash) + old_num_blocks, 255,  sizeof(block) * STASH_GROWTH_INCREMENT);
+    memset(stash_block_at(stash, STASH_BLOCKS(*stash), old_num_blocks), 255, stash_block_bytes(stash) * STASH_GROWTH_INCREMENT);
 
     // update counts
     STASH_NUM_BLOCKS(*stash) = new_num_blocks;
@@ -155,74 +355,168 @@ static size_t stash_overflow_ub(const stash* stash) {
     size_t i = STASH_OVERFLOW_CAPACITY(*stash);
     if(allow_overflow_size_leak) {
         while( i > 0) {
-            if(BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i-1]) != EMPTY_BLOCK_ID) break;
+            if(BLOCK_ID(stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i-1)) != EMPTY_BLOCK_ID) break;
             --i;
         }
     }
     return i;
 }
 
+size_t stash_overflow_capacity(const stash* stash) {
+    return STASH_OVERFLOW_CAPACITY(*stash);
+}
+
 size_t stash_num_overflow_blocks(const stash* stash) {
     size_t result = 0;
     for(size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash); ++i) {
-        result += U64_TERNARY(BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i]) != EMPTY_BLOCK_ID, 1, 0);
+        result += U64_TERNARY(BLOCK_ID(stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i)) != EMPTY_BLOCK_ID, 1, 0);
     }
     return result;
 }
-static inline block* first_block_in_bucket_for_level(const stash* stash, size_t level) {
-    return (block*)STASH_PATH_BLOCKS(*stash) + level * BLOCKS_PER_BUCKET;
+static inline u64* first_block_in_bucket_for_level(const stash* stash, size_t level) {
+    return stash_block_at(stash, STASH_PATH_BLOCKS(*stash), level * STASH_BLOCKS_PER_BUCKET(*stash));
+}
+
+// Block `index` of the path and overflow: staged in `blocks`, or wherever its slot points when sorting in place.
+static inline u64* stash_block(const stash* stash, size_t index) {
+    // Acceptable if: the stash mode is fixed at creation
+    if (STASH_PATH_SLOTS(*stash)) {
+        return ((u64**)STASH_PATH_SLOTS(*stash))[index];
+    }
+    return stash_block_at(stash, STASH_BLOCKS(*stash), index);
+}
+
+// Point the slots of a path level at the blocks of its bucket. If the bucket holds fewer blocks than the level has
+// slots, the other slots point at the unused staging blocks of the level, which are empty and stay empty.
+static inline void stash_bind_level(stash* stash, size_t level, u64* bucket_blocks) {
+    size_t level_blocks = ((size_t*)STASH_LEVEL_BLOCKS(*stash))[level];
+    for(size_t i = 0; i < STASH_BLOCKS_PER_BUCKET(*stash); ++i) {
+        ((u64**)STASH_PATH_SLOTS(*stash))[level * STASH_BLOCKS_PER_BUCKET(*stash) + i] = i < level_blocks
+            ? bucket_blocks + i * STASH_BLOCK_QWORDS(*stash)
+            : stash_block_at(stash, first_block_in_bucket_for_level(stash, level), i);
+    }
+}
+
+void stash_enable_zero_copy(stash* stash) {
+    // Acceptable if: not executed in an oram_access
+    if (!STASH_PATH_SLOTS(*stash)) {
+        STASH_PATH_SLOTS(*stash) = oram_arena_calloc((oram_arena*)STASH_ARENA(*stash), STASH_NUM_BLOCKS(*stash), sizeof(u64*));
+    }
+}
+
+bool stash_zero_copy(const stash* stash) {
+    return STASH_PATH_SLOTS(*stash) != 0;
 }
 
-static void cond_copy_block(bool cond, block* dst, const block* src) {
-    u64* tail_dst = (u64*)dst;
-    u64* tail_src = (u64*)src;
-    for(size_t i=0;i<sizeof(*dst)/sizeof(u64);++i) {
-        cond_obv_cpy_u64(cond, tail_dst + i, tail_src + i);
+size_t stash_blocks_per_bucket(const stash* stash) {
+    return STASH_BLOCKS_PER_BUCKET(*stash);
+}
+
+static void cond_copy_block(bool cond, u64* dst, const u64* src, size_t block_qwords) {
+    for(size_t i=0;i<block_qwords;++i) {
+        cond_obv_cpy_u64(cond, dst + i, src + i);
     }
 }
 
-static void cond_swap_blocks(bool cond, block* a, block* b) { 
-    u64* tail_dst = (u64*)a;
-    u64* tail_src = (u64*)b;
-    for(size_t i=0;i<sizeof(*a)/sizeof(u64);++i) {
-        cond_obv_swap_u64(cond, tail_dst + i, tail_src + i);
+static void cond_swap_blocks(bool cond, u64* a, u64* b, size_t block_qwords) {
+    for(size_t i=0;i<block_qwords;++i) {
+        cond_obv_swap_u64(cond, a + i, b + i);
     }
 }
 
 // Precondition: `target` is an empty block OR no block in the bucket has ID equal to `target_block_id`
 // Postcondition: No block in the bucket has ID equal to `target_block_id`, `target` is either empty or `target->id == target_block_id`.
-void stash_add_path_bucket(stash* stash, bucket_store* bucket_store, u64 bucket_id, u64 target_block_id, block *target) {
-    size_t level = tree_path_level(bucket_id);
-    block* bucket_blocks = first_block_in_bucket_for_level(stash, level);
-    bucket_store_read_bucket_blocks(bucket_store, bucket_id, bucket_blocks);
-    for(size_t i = 0; i < BLOCKS_PER_BUCKET; ++i) {
-        bool cond = (target_block_id == BLOCK_ID(bucket_blocks[i]));
-        CHECK(!(cond  & (BLOCK_ID(*target) != EMPTY_BLOCK_ID)));
-        cond_swap_blocks(cond, target, bucket_blocks + i);
+void stash_add_path_bucket(stash* stash, bucket_store* bucket_store, u64 bucket_id, u64 target_block_id, u64 *target) {
+    size_t level = tree_path_level_kary(bucket_id, STASH_BRANCHING(*stash));
+    u64* bucket_blocks;
+    // Acceptable if: the stash mode is fixed at creation
+    if (STASH_PATH_SLOTS(*stash)) {
+        // search the bucket where it is stored and sort it there
+        bucket_blocks = bucket_store_open_bucket(bucket_store, bucket_id);
+        stash_bind_level(stash, level, bucket_blocks);
+    } else {
+        bucket_blocks = first_block_in_bucket_for_level(stash, level);
+        bucket_store_read_bucket_blocks(bucket_store, bucket_id, bucket_blocks);
+    }
+    // the blocks past those the bucket holds are empty
+    for(size_t i = 0; i < ((size_t*)STASH_LEVEL_BLOCKS(*stash))[level]; ++i) {
+        u64* bucket_block = bucket_blocks + i * STASH_BLOCK_QWORDS(*stash);
+        bool cond = (target_block_id == BLOCK_ID(bucket_block));
+        CHECK(!(cond  & (BLOCK_ID(target) != EMPTY_BLOCK_ID)));
+        cond_swap_blocks(cond, target, bucket_block, STASH_BLOCK_QWORDS(*stash));
     }
 }
 
 
+size_t stash_treetop_levels(const stash* stash) {
+    return STASH_TREETOP_LEVELS(*stash);
+}
+
+// First block of bucket `bucket_id` in the heap-ordered treetop. `bucket_id` must be on one of the top
+// `treetop_levels` levels of the tree.
+static inline u64* treetop_bucket(const stash* stash, u64 bucket_id) {
+    size_t branching = STASH_BRANCHING(*stash);
+    size_t level = tree_path_level_kary(bucket_id, branching);
+    size_t depth = STASH_PATH_LENGTH(*stash) - 1 - level;
+    // the offset of the node on its level, see `tree_path_create_kary`
+    size_t offset = bucket_id >> (level * __builtin_ctzll(branching) + 1);
+    return stash_block_at(stash, STASH_TREETOP_BLOCKS(*stash), (treetop_num_buckets(depth, branching) + offset) * STASH_BLOCKS_PER_BUCKET(*stash));
+}
+
+// Precondition: `target` is an empty block OR no block in the treetop buckets on `path` has ID equal to `target_block_id`
+// Postcondition: No block in the treetop buckets on `path` has ID equal to `target_block_id`, `target` is either empty or `target->id == target_block_id`.
+void stash_add_treetop_buckets(stash* stash, const tree_path* path, u64 target_block_id, u64 *target) {
+    for(size_t level = STASH_PATH_LENGTH(*stash) - STASH_TREETOP_LEVELS(*stash); level < STASH_PATH_LENGTH(*stash); ++level) {
+        u64* bucket_blocks = treetop_bucket(stash, TREE_PATH_VALUES(*path)[level]);
+        // the treetop is cache resident so we search it in place and only then stage it for `stash_build_path`
+        for(size_t i = 0; i < STASH_BLOCKS_PER_BUCKET(*stash); ++i) {
+            u64* bucket_block = bucket_blocks + i * STASH_BLOCK_QWORDS(*stash);
+            bool cond = (target_block_id == BLOCK_ID(bucket_block));
+            CHECK(!(cond  & (BLOCK_ID(target) != EMPTY_BLOCK_ID)));
+            cond_swap_blocks(cond, target, bucket_block, STASH_BLOCK_QWORDS(*stash));
+        }
+        // Acceptable if: the stash mode is fixed at creation
+        if (STASH_PATH_SLOTS(*stash)) {
+            stash_bind_level(stash, level, bucket_blocks);
+        } else {
+            memcpy(first_block_in_bucket_for_level(stash, level), bucket_blocks, STASH_BLOCKS_PER_BUCKET(*stash) * stash_block_bytes(stash));
+        }
+    }
+}
+
+void stash_write_treetop_buckets(stash* stash, const tree_path* path) {
+    // Acceptable if: the stash mode is fixed at creation
+    if (STASH_PATH_SLOTS(*stash)) {
+        // the treetop buckets were sorted in place
+        return;
+    }
+    for(size_t level = STASH_PATH_LENGTH(*stash) - STASH_TREETOP_LEVELS(*stash); level < STASH_PATH_LENGTH(*stash); ++level) {
+        memcpy(treetop_bucket(stash, TREE_PATH_VALUES(*path)[level]), first_block_in_bucket_for_level(stash, level), STASH_BLOCKS_PER_BUCKET(*stash) * stash_block_bytes(stash));
+    }
+}
+
 // Precondition: `target` is an empty block OR no block in the overflow has ID equal to `target_block_id`
 // Postcondition: No block in the overflow has ID equal to `target_block_id`, `target` is either empty or `target->id == target_block_id`.
-void stash_scan_overflow_for_target(stash* stash, u64 target_block_id, block *target) {
+void stash_scan_overflow_for_target(stash* stash, u64 target_block_id, u64 *target) {
     size_t num_found = 0;
     size_t ub = stash_overflow_ub(stash);
     for(size_t i = 0; i < ub; ++i) {
-        bool cond = (BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i]) == target_block_id);
-        CHECK(!(cond  & (BLOCK_ID(*target) != EMPTY_BLOCK_ID)));
-        cond_swap_blocks(cond, target, (block*)STASH_OVERFLOW_BLOCKS(*stash) + i);
+        u64* overflow_block = stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i);
+        bool cond = (BLOCK_ID(overflow_block) == target_block_id);
+        CHECK(!(cond  & (BLOCK_ID(target) != EMPTY_BLOCK_ID)));
+        cond_swap_blocks(cond, target, overflow_block, STASH_BLOCK_QWORDS(*stash));
         num_found += cond ? 1 : 0;
     }
     CHECK(num_found <= 1);
 }
 
 // Precondition: there is no block with ID `new_block->id` anywhere in the stash - neither the path_Stash nor the overflow.
-error_t stash_add_block(stash* stash, block* new_block) {
+error_t stash_add_block(stash* stash, u64* new_block) {
     bool inserted = false;
     for(size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash); ++i) {
-        bool cond = (BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i]) == EMPTY_BLOCK_ID) & !inserted;
-        cond_copy_block(cond, (block*)STASH_OVERFLOW_BLOCKS(*stash) + i, new_block);
+        u64* overflow_block = stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i);
+        bool cond = (BLOCK_ID(overflow_block) == EMPTY_BLOCK_ID) & !inserted;
+        cond_copy_block(cond, overflow_block, new_block, STASH_BLOCK_QWORDS(*stash));
         inserted = inserted | cond;
     }
 
@@ -237,21 +531,23 @@ error_t stash_add_block(stash* stash, block* new_block) {
     return err_SUCCESS;
 }
 
-static void stash_assign_block_to_bucket(stash* stash, const tree_path* path, block_type type, size_t index) {
+// `lower_bounds[level]` and `upper_bounds[level]` are the range of leaves below the bucket of the path on `level`.
+static void stash_assign_block_to_bucket(stash* stash, const u64* lower_bounds, const u64* upper_bounds, block_type type, size_t index) {
     bool is_overflow_block = (type == block_type_overflow);
 
     // the block cannot be assigned to this level or higher 
-    size_t max_level = U64_TERNARY(is_overflow_block, STASH_PATH_LENGTH(*stash), (index / BLOCKS_PER_BUCKET) + 1);
-    size_t assignment_index = U64_TERNARY(is_overflow_block,  BLOCKS_PER_BUCKET * STASH_PATH_LENGTH(*stash)  + index, index);
-    block* assigned_block = ((block*)STASH_PATH_BLOCKS(*stash)) + assignment_index;
+    size_t max_level = U64_TERNARY(is_overflow_block, STASH_PATH_LENGTH(*stash), (index / STASH_BLOCKS_PER_BUCKET(*stash)) + 1);
+    size_t assignment_index = U64_TERNARY(is_overflow_block,  STASH_BLOCKS_PER_BUCKET(*stash) * STASH_PATH_LENGTH(*stash)  + index, index);
+    u64* assigned_block = stash_block(stash, assignment_index);
 
     bool is_assigned = false;
     for(u64 level = 0; level < max_level; ++level) {
         u64 bucket_occupancy = ((u64*)STASH_BUCKET_OCCUPANCY(*stash))[level];
-        u64 bucket_id = TREE_PATH_VALUES(*path)[level];
-        bool is_valid = tree_path_lower_bound(bucket_id) <= BLOCK_POSITION(*assigned_block) & tree_path_upper_bound(bucket_id) >= BLOCK_POSITION(*assigned_block);
-        bool bucket_has_room = bucket_occupancy < BLOCKS_PER_BUCKET;
-        bool cond = is_valid & bucket_has_room & !is_assigned & BLOCK_ID(*assigned_block) != EMPTY_BLOCK_ID;
+        bool is_valid = lower_bounds[level] <= BLOCK_POSITION(assigned_block) & upper_bounds[level] >= BLOCK_POSITION(assigned_block);
+        // Only the blocks the bucket holds take real blocks. Empty blocks fill every level to `blocks_per_bucket` and,
+        // with position UINT64_MAX, sort after the real blocks of their level, into the blocks that are not stored.
+        bool bucket_has_room = bucket_occupancy < ((size_t*)STASH_LEVEL_BLOCKS(*stash))[level];
+        bool cond = is_valid & bucket_has_room & !is_assigned & BLOCK_ID(assigned_block) != EMPTY_BLOCK_ID;
 
         // If `cond` is true, put it in the bucket: increment the bucket occupancy and set the bucket assignment
         // for this position.
@@ -269,13 +565,13 @@ static void stash_place_empty_blocks(stash* stash) {
     for(size_t i = 0; i < STASH_NUM_BLOCKS(*stash); ++i) {
         bool found_curr_bucket = false;
         for(size_t j = 0; j < STASH_PATH_LENGTH(*stash); ++j) {
-            bool bucket_has_room = (((u64*)STASH_BUCKET_OCCUPANCY(*stash))[j] != BLOCKS_PER_BUCKET);
+            bool bucket_has_room = (((u64*)STASH_BUCKET_OCCUPANCY(*stash))[j] != STASH_BLOCKS_PER_BUCKET(*stash));
             bool set_curr_bucket = bucket_has_room & !found_curr_bucket;
             cond_obv_cpy_u64(set_curr_bucket, &curr_bucket, &j);
             found_curr_bucket = set_curr_bucket | found_curr_bucket;
         }
         u64 bucket_occupancy = ((u64*)STASH_BUCKET_OCCUPANCY(*stash))[curr_bucket];
-        bool cond_place_in_bucket = bucket_occupancy < BLOCKS_PER_BUCKET & BLOCK_ID(((block*)STASH_BLOCKS(*stash))[i]) == EMPTY_BLOCK_ID;
+        bool cond_place_in_bucket = bucket_occupancy < STASH_BLOCKS_PER_BUCKET(*stash) & BLOCK_ID(stash_block(stash, i)) == EMPTY_BLOCK_ID;
         bucket_occupancy++;
 
         cond_obv_cpy_u64(cond_place_in_bucket, (u64*)STASH_BUCKET_OCCUPANCY(*stash) + curr_bucket, &bucket_occupancy);
@@ -291,18 +587,26 @@ static error_t stash_assign_buckets(stash* stash, const tree_path* path) {
     memset(STASH_BUCKET_ASSIGNMENTS(*stash), 255, STASH_NUM_BLOCKS(*stash) * sizeof(STASH_BUCKET_ASSIGNMENTS(*stash)));
     memset(STASH_BUCKET_OCCUPANCY(*stash), 0, STASH_PATH_LENGTH(*stash) * sizeof(u64));
 
+    // The path is public, so the subtree of each of its buckets is computed once rather than for every block.
+    u64 lower_bounds[STASH_PATH_LENGTH(*stash)];
+    u64 upper_bounds[STASH_PATH_LENGTH(*stash)];
+    for(size_t level = 0; level < STASH_PATH_LENGTH(*stash); ++level) {
+        lower_bounds[level] = tree_path_lower_bound_kary(TREE_PATH_VALUES(*path)[level], STASH_BRANCHING(*stash));
+        upper_bounds[level] = tree_path_upper_bound_kary(TREE_PATH_VALUES(*path)[level], STASH_BRANCHING(*stash));
+    }
+
 
     // assign blocks in path to buckets first
     for(size_t level = 0; level < STASH_PATH_LENGTH(*stash); ++level) {
-        for(size_t b = 0; b < BLOCKS_PER_BUCKET; ++b) {
-            stash_assign_block_to_bucket(stash, path, block_type_path, level * BLOCKS_PER_BUCKET + b);
+        for(size_t b = 0; b < STASH_BLOCKS_PER_BUCKET(*stash); ++b) {
+            stash_assign_block_to_bucket(stash, lower_bounds, upper_bounds, block_type_path, level * STASH_BLOCKS_PER_BUCKET(*stash) + b);
         }
     }
 
     // assign blocks in overflow to buckets
     size_t ub = stash_overflow_ub(stash);
     for(size_t i = 0; i < ub; ++i) {
-        stash_assign_block_to_bucket(stash, path, block_type_overflow, i);
+        stash_assign_block_to_bucket(stash, lower_bounds, upper_bounds, block_type_overflow, i);
     }
 
     // now assign empty blocks to fill the buckets
@@ -311,9 +615,9 @@ static error_t stash_assign_buckets(stash* stash, const tree_path* path) {
 }
 
 
-static inline bool comp_blocks(block* blocks, u64* block_level_assignments, size_t idx1, size_t idx2) {
+static inline bool comp_blocks(u64* blocks, size_t block_qwords, u64* block_level_assignments, size_t idx1, size_t idx2) {
     return (block_level_assignments[idx1] > block_level_assignments[idx2])
-                | ((block_level_assignments[idx1] == block_level_assignments[idx2]) & (BLOCK_POSITION(blocks[idx1]) > BLOCK_POSITION(blocks[idx2])));
+                | ((block_level_assignments[idx1] == block_level_assignments[idx2]) & (BLOCK_POSITION(blocks + idx1 * block_qwords) > BLOCK_POSITION(blocks + idx2 * block_qwords)));
 }
 
 /**
@@ -321,19 +625,20 @@ static inline bool comp_blocks(block* blocks, u64* block_level_assignments, size
  * of conditional swaps.
  * 
  * @param blocks blocks to sort
+ * @param block_qwords size of each block in `blocks`
  * @param block_level_assignments level assignments for blocks. Blocks will be sorted in order of increasing level
  * @param lb lower bound for array to sort
  * @param ub upper bound for array to sort (non-inclusive)
  * @param direction result is ascending sort if true, descending if false.
  */
-static void bitonic_merge(block* blocks, u64* block_level_assignments, size_t lb, size_t ub, bool direction) {
+static void bitonic_merge(u64* blocks, size_t block_qwords, u64* block_level_assignments, size_t lb, size_t ub, bool direction) {
     size_t n = ub - lb;
     if(n > 1) {
         size_t pow2 = first_pow2_leq(n);
         if(pow2 == n) pow2 >>= 1;
         for(size_t i = lb; i < ub - pow2; ++i) {
-            bool cond = direction == comp_blocks(blocks, block_level_assignments, i, i+pow2);
-            cond_swap_blocks(cond, blocks + i, blocks + i + pow2);
+            bool cond = direction == comp_blocks(blocks, block_qwords, block_level_assignments, i, i+pow2);
+            cond_swap_blocks(cond, blocks + i * block_qwords, blocks + (i + pow2) * block_qwords, block_qwords);
             cond_obv_swap_u64(cond, block_level_assignments + i, block_level_assignments + i + pow2);
         }
 
@@ -341,8 +646,8 @@ static void bitonic_merge(block* blocks, u64* block_level_assignments, size_t lb
         // index >= lb + pow2 has a "larger" value (relative to `direction`) than the entries
         // with index < lb + pow2. Also, both the upper and lower part of the array are bitonic
         // subarrays.
-        bitonic_merge(blocks, block_level_assignments, lb, lb + pow2, direction);
-        bitonic_merge(blocks, block_level_assignments, lb + pow2, ub, direction);
+        bitonic_merge(blocks, block_qwords, block_level_assignments, lb, lb + pow2, direction);
+        bitonic_merge(blocks, block_qwords, block_level_assignments, lb + pow2, ub, direction);
     }
 }
 
@@ -354,18 +659,19 @@ static void bitonic_merge(block* blocks, u64* block_level_assignments, size_t lb
  * (i.e. sorted) list.
  * 
  * @param blocks blocks to sort
+ * @param block_qwords size of each block in `blocks`
  * @param block_level_assignments level assignments for blocks. Blocks will be sorted in order of increasing level
  * @param lb lower bound for array to sort
  * @param ub upper bound for array to sort (non-inclusive)
  * @param direction Ascending sort if true, descending if false.
  */
-static void bitonic_sort(block* blocks, u64* block_level_assignments, size_t lb, size_t ub, bool direction) {
+static void bitonic_sort(u64* blocks, size_t block_qwords, u64* block_level_assignments, size_t lb, size_t ub, bool direction) {
     size_t n = ub - lb;
     if(n > 1) {
         size_t half_n = n>>1;
-        bitonic_sort(blocks, block_level_assignments, lb, lb + half_n, !direction);
-        bitonic_sort(blocks, block_level_assignments, lb + half_n, ub, direction);
-        bitonic_merge(blocks, block_level_assignments, lb, ub, direction);
+        bitonic_sort(blocks, block_qwords, block_level_assignments, lb, lb + half_n, !direction);
+        bitonic_sort(blocks, block_qwords, block_level_assignments, lb + half_n, ub, direction);
+        bitonic_merge(blocks, block_qwords, block_level_assignments, lb, ub, direction);
     }
 }
 
@@ -373,7 +679,7 @@ static inline size_t min(size_t a, size_t b) {
     return U64_TERNARY(a < b, a, b);
 }
 
-static void odd_even_msort(block* blocks, u64 *block_level_assignments, size_t lb, size_t ub) {
+static void odd_even_msort(u64* blocks, size_t block_qwords, u64 *block_level_assignments, size_t lb, size_t ub) {
     size_t n = ub - lb;
     for (size_t p = 1; p < n; p <<= 1) {
         for (size_t k = p; k >= 1; k >>= 1) {
@@ -382,8 +688,34 @@ static void odd_even_msort(block* blocks, u64 *block_level_assignments, size_t l
                 for (size_t i = 0; i < min(k, n-j-k); ++i) {
                     if (((i+j) / (p*2)) == ((i+j+k) / (p*2))) {
                         size_t idx = i + j + lb;
-                        bool cond = comp_blocks(blocks, block_level_assignments, idx, idx+k);
-                        cond_swap_blocks(cond, blocks + idx, blocks + idx + k);
+                        bool cond = comp_blocks(blocks, block_qwords, block_level_assignments, idx, idx+k);
+                        cond_swap_blocks(cond, blocks + idx * block_qwords, blocks + (idx + k) * block_qwords, block_qwords);
+                        cond_obv_swap_u64(cond, block_level_assignments + idx, block_level_assignments + idx + k);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static inline bool comp_slots(u64** slots, u64* block_level_assignments, size_t idx1, size_t idx2) {
+    return (block_level_assignments[idx1] > block_level_assignments[idx2])
+                | ((block_level_assignments[idx1] == block_level_assignments[idx2]) & (BLOCK_POSITION(slots[idx1]) > BLOCK_POSITION(slots[idx2])));
+}
+
+// `odd_even_msort` over blocks reached through `slots`, for a path sorted in place. Performs the same sequence of
+// comparisons and swaps; the blocks move between the locations the slots point at.
+static void odd_even_msort_slots(u64** slots, size_t block_qwords, u64 *block_level_assignments, size_t lb, size_t ub) {
+    size_t n = ub - lb;
+    for (size_t p = 1; p < n; p <<= 1) {
+        for (size_t k = p; k >= 1; k >>= 1) {
+            size_t mod_kp = k % p;
+            for (size_t j = mod_kp; j < n-k; j += 2*k) {
+                for (size_t i = 0; i < min(k, n-j-k); ++i) {
+                    if (((i+j) / (p*2)) == ((i+j+k) / (p*2))) {
+                        size_t idx = i + j + lb;
+                        bool cond = comp_slots(slots, block_level_assignments, idx, idx+k);
+                        cond_swap_blocks(cond, slots[idx], slots[idx + k], block_qwords);
                         cond_obv_swap_u64(cond, block_level_assignments + idx, block_level_assignments + idx + k);
                     }
                 }
@@ -395,20 +727,41 @@ static void odd_even_msort(block* blocks, u64 *block_level_assignments, size_t l
 void print_bucket_assignments(const stash* stash) {
     for(size_t i = 0; i < STASH_NUM_BLOCKS(*stash); ++i) {
         fprintf(stderr, "%zu: block: %" PRIu64 " pos: %" PRIu64 " assignment: %" PRIu64 "\n",
-            i, BLOCK_ID(((block*)STASH_BLOCKS(*stash))[i]), BLOCK_POSITION(((block*)STASH_BLOCKS(*stash))[i]), ((u64*)STASH_BUCKET_ASSIGNMENTS(*stash))[i]);
+            i, BLOCK_ID(stash_block_at(stash, STASH_BLOCKS(*stash), i)), BLOCK_POSITION(stash_block_at(stash, STASH_BLOCKS(*stash), i)), ((u64*)STASH_BUCKET_ASSIGNMENTS(*stash))[i]);
     }
 }
 
 void stash_build_path(stash* stash, const tree_path* path) {
     size_t overflow_size = stash_overflow_ub(stash);
+    size_t num_path_blocks = STASH_BLOCKS_PER_BUCKET(*stash) * STASH_PATH_LENGTH(*stash);
+    // Acceptable if: the stash mode is fixed at creation
+    if (STASH_PATH_SLOTS(*stash)) {
+        // the overflow may have moved since the last access, and so may the staging blocks that `stash_bind_level`
+        // used for the blocks a bucket does not hold if the stash was extended during this one
+        for(size_t i = num_path_blocks; i < STASH_NUM_BLOCKS(*stash); ++i) {
+            ((u64**)STASH_PATH_SLOTS(*stash))[i] = stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i - num_path_blocks);
+        }
+        for(size_t level = 0; level < STASH_PATH_LENGTH(*stash); ++level) {
+            for(size_t i = ((size_t*)STASH_LEVEL_BLOCKS(*stash))[level]; i < STASH_BLOCKS_PER_BUCKET(*stash); ++i) {
+                ((u64**)STASH_PATH_SLOTS(*stash))[level * STASH_BLOCKS_PER_BUCKET(*stash) + i] = stash_block_at(stash, first_block_in_bucket_for_level(stash, level), i);
+            }
+        }
+        stash_assign_buckets(stash, path);
+        odd_even_msort_slots((u64**)STASH_PATH_SLOTS(*stash), STASH_BLOCK_QWORDS(*stash), STASH_BUCKET_ASSIGNMENTS(*stash), 0, num_path_blocks + overflow_size);
+        return;
+    }
     stash_assign_buckets(stash, path);
-    odd_even_msort((block*)STASH_BLOCKS(*stash), STASH_BUCKET_ASSIGNMENTS(*stash), 0, BLOCKS_PER_BUCKET * STASH_PATH_LENGTH(*stash) + overflow_size);
+    odd_even_msort((u64*)STASH_BLOCKS(*stash), STASH_BLOCK_QWORDS(*stash), STASH_BUCKET_ASSIGNMENTS(*stash), 0, num_path_blocks + overflow_size);
     // print_bucket_assignments(stash);
 }
 
 
 error_t stash_clear(stash* stash) {
-    memset((block*)STASH_BLOCKS(*stash), 255,  sizeof(block) * STASH_NUM_BLOCKS(*stash));
+    memset((u64*)STASH_BLOCKS(*stash), 255, stash_block_bytes(stash) * STASH_NUM_BLOCKS(*stash));
+    // Acceptable if: not executed in an oram_access
+    if (STASH_TREETOP_BLOCKS(*stash)) {
+        memset((u64*)STASH_TREETOP_BLOCKS(*stash), 255, stash_block_bytes(stash) * STASH_BLOCKS_PER_BUCKET(*stash) * treetop_num_buckets(STASH_TREETOP_LEVELS(*stash), STASH_BRANCHING(*stash)));
+    }
     return err_SUCCESS;
 }
 
@@ -428,7 +781,7 @@ void stash_print(const stash *stash)
     size_t num_blocks = 0;
     for (size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash); ++i)
     {
-        if (BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i]) != EMPTY_BLOCK_ID)
+        if (BLOCK_ID(stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i)) != EMPTY_BLOCK_ID)
         {
             num_blocks++;
         }
@@ -436,9 +789,9 @@ void stash_print(const stash *stash)
     printf("Stash holds %zu blocks.\n", num_blocks);
     for (size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash); ++i)
     {
-        if (BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i]) != EMPTY_BLOCK_ID)
+        if (BLOCK_ID(stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i)) != EMPTY_BLOCK_ID)
         {
-            printf("block_id: %" PRIu64 "\n", BLOCK_ID(((block*)STASH_OVERFLOW_BLOCKS(*stash))[i]));
+            printf("block_id: %" PRIu64 "\n", BLOCK_ID(stash_block_at(stash, STASH_OVERFLOW_BLOCKS(*stash), i)));
         }
     }
 }
@@ -457,22 +810,22 @@ int test_cond_cpy_block() {
     block target_jazz = {EMPTY_BLOCK_ID, UINT64_MAX};
     block mt_block_jazz = {EMPTY_BLOCK_ID, UINT64_MAX};
 
-    cond_copy_block(false, &target, &b1);
+    cond_copy_block(false, target, b1, sizeof(block) / sizeof(u64));
     cond_copy_block_jazz(false, &target_jazz, &b1_jazz);
     TEST_ASSERT(memcmp(&mt_block, &target, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&mt_block_jazz, &target_jazz, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&b1_orig, &b1, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&b1_jazz, &b1, sizeof(block)) == 0);
 
-    cond_copy_block(true, &target, &b1);
+    cond_copy_block(true, target, b1, sizeof(block) / sizeof(u64));
     cond_copy_block_jazz(true, &target_jazz, &b1_jazz);
     TEST_ASSERT(memcmp(&target, &b1, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&target_jazz, &b1_jazz, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&b1_orig, &b1, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&b1_jazz, &b1, sizeof(block)) == 0);
 
-    cond_swap_blocks(false, &b1, &b2);
-    cond_swap_blocks(false, &b1_jazz, &b2_jazz);
+    cond_swap_blocks(false, b1, b2, sizeof(block) / sizeof(u64));
+    cond_swap_blocks(false, b1_jazz, b2_jazz, sizeof(block) / sizeof(u64));
     TEST_ASSERT(memcmp(&b1_orig, &b1, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&b1_orig, &b1_jazz, sizeof(block)) == 0);
     TEST_ASSERT(memcmp(&b2_orig, &b2, sizeof(block)) == 0);
@@ -504,7 +857,7 @@ int test_oblv_sort() {
     memcpy(original_bucket_assignments, bucket_assignments, sizeof(bucket_assignments));
     memcpy(jazz_bucket_assignments, bucket_assignments, sizeof(bucket_assignments));
 
-    odd_even_msort(blocks, bucket_assignments, 0, num_blocks);
+    odd_even_msort((u64*)blocks, sizeof(block) / sizeof(u64), bucket_assignments, 0, num_blocks);
     odd_even_msort_jazz(jazz_blocks, jazz_bucket_assignments, 0, num_blocks, true);
 
     for(size_t i = 1; i < num_blocks; ++i) {
@@ -621,8 +974,8 @@ static void load_bucket_store(
         }
         *num_blocks_created += num_blocks;
         generate_blocks_for_bucket(TREE_PATH_VALUES(*path)[level], *num_blocks_created, num_blocks, bucket_blocks);
-        bucket_store_write_bucket_blocks(bucket_store0, TREE_PATH_VALUES(*path)[level], bucket_blocks);
-        bucket_store_write_bucket_blocks(bucket_store1, TREE_PATH_VALUES(*path)[level], bucket_blocks);
+        bucket_store_write_bucket_blocks(bucket_store0, TREE_PATH_VALUES(*path)[level], (u64*)bucket_blocks);
+        bucket_store_write_bucket_blocks(bucket_store1, TREE_PATH_VALUES(*path)[level], (u64*)bucket_blocks);
     }
     
 }
@@ -646,7 +999,7 @@ int test_load_bucket_path_to_stash(bucket_density density) {
     block target0 = {EMPTY_BLOCK_ID};
     block target1 = {EMPTY_BLOCK_ID};
     for(size_t i = 0; i < TREE_PATH_LENGTH(*path0); ++i) {
-        stash_add_path_bucket(stash0, bucket_store0, TREE_PATH_VALUES(*path0)[i], target_block_id, &target0);
+        stash_add_path_bucket(stash0, bucket_store0, TREE_PATH_VALUES(*path0)[i], target_block_id, target0);
         stash_add_path_bucket_jazz(stash1, bucket_store1, TREE_PATH_VALUES(*path1)[i], target_block_id, &target1);
     }
 
@@ -691,8 +1044,8 @@ int test_stash_insert_read()
     memcpy(BLOCK_DATA(b0), data0, sizeof(data0));
     memcpy(BLOCK_DATA(b1), data1, sizeof(data1));
 
-    RETURN_IF_ERROR(stash_add_block(stash0, &b0));
-    RETURN_IF_ERROR(stash_add_block(stash0, &b1));
+    RETURN_IF_ERROR(stash_add_block(stash0, b0));
+    RETURN_IF_ERROR(stash_add_block(stash0, b1));
     stash_add_block_jazz(stash1, &b0);
     stash_add_block_jazz(stash1, &b1);
 
@@ -711,8 +1064,8 @@ int test_stash_insert_read()
     TEST_ASSERT(b2_in_stash);
     TEST_ASSERT(b3_in_stash);
 
-    stash_scan_overflow_for_target(stash0, block_id0, &target0);
-    stash_scan_overflow_for_target(stash0, block_id1, &target1);
+    stash_scan_overflow_for_target(stash0, block_id0, target0);
+    stash_scan_overflow_for_target(stash0, block_id1, target1);
     stash_scan_overflow_for_target_jazz(stash1, block_id0, &target2);
     stash_scan_overflow_for_target_jazz(stash1, block_id1, &target3);
 
@@ -746,7 +1099,7 @@ int test_fill_stash() {
     stash *stash1 = stash_create(20, small_stash_size);
     for(size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash0); ++i) {
         block b = {0}; BLOCK_ID(b) = i; BLOCK_POSITION(b) = 2*(100+i);
-        RETURN_IF_ERROR(stash_add_block(stash0, &b));
+        RETURN_IF_ERROR(stash_add_block(stash0, b));
         // check that it is in the stash
     }
     for(size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash1); ++i) {
@@ -761,7 +1114,7 @@ int test_fill_stash() {
     BLOCK_ID(b1) = STASH_OVERFLOW_CAPACITY(*stash1); BLOCK_POSITION(b1) = 2*(100+STASH_OVERFLOW_CAPACITY(*stash1));
 
     // This will trigger an extension of the stash
-    RETURN_IF_ERROR(stash_add_block(stash0, &b0));
+    RETURN_IF_ERROR(stash_add_block(stash0, b0));
     stash_add_block_jazz(stash1, &b1);
 
     // now remove a block and then confirm that we have room
@@ -769,15 +1122,15 @@ int test_fill_stash() {
     block target1 = {0}; BLOCK_ID(target1) = EMPTY_BLOCK_ID; BLOCK_POSITION(target1) = UINT64_MAX;
 
     u64 search_block_id = 11;
-    stash_scan_overflow_for_target(stash0, search_block_id, &target0);
-    stash_scan_overflow_for_target(stash1, search_block_id, &target1);
+    stash_scan_overflow_for_target(stash0, search_block_id, target0);
+    stash_scan_overflow_for_target(stash1, search_block_id, target1);
     TEST_ASSERT(BLOCK_ID(target0) == search_block_id);
     TEST_ASSERT(BLOCK_ID(target1) == search_block_id);
 
     for(size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash0); ++i) {
         TEST_ASSERT(BLOCK_ID(((block*)STASH_BLOCKS(*stash0))[i]) != search_block_id);
     }
-    RETURN_IF_ERROR(stash_add_block(stash0, &b0));
+    RETURN_IF_ERROR(stash_add_block(stash0, b0));
     for(size_t i = 0; i < STASH_OVERFLOW_CAPACITY(*stash1); ++i) {
         TEST_ASSERT(BLOCK_ID(((block*)STASH_BLOCKS(*stash1))[i]) != search_block_id);
     }
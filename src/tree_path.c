@@ -117,6 +117,109 @@ size_t tree_path_num_nodes(size_t num_levels)
     return ((size_t)1 << num_levels) - 1;
 }
 
+// log2 of a branching factor
+static size_t branching_bits(size_t branching)
+{
+    CHECK(branching >= 2 && (branching & (branching - 1)) == 0);
+    return __builtin_ctzll(branching);
+}
+
+size_t tree_path_level_kary(u64 val, size_t branching)
+{
+    return level(val) / branching_bits(branching);
+}
+
+static u64 node_val_kary(size_t level, u64 offset, size_t bits)
+{
+    return ((2 * offset + 1) << (level * bits)) - 1;
+}
+
+u64 tree_path_root(size_t num_levels, size_t branching)
+{
+    return node_val_kary(num_levels - 1, 0, branching_bits(branching));
+}
+
+u64 tree_path_id_after_growth(u64 val, size_t levels, size_t branching)
+{
+    // the node keeps its offset and moves `levels` levels up: see `node_val_kary`
+    return ((val + 1) << (levels * branching_bits(branching))) - 1;
+}
+
+tree_path *tree_path_create_kary(u64 leaf, u64 root, size_t branching)
+{
+    return tree_path_create_kary_in(NULL, leaf, root, branching);
+}
+
+tree_path *tree_path_create_kary_in(oram_arena *arena, u64 leaf, u64 root, size_t branching)
+{
+    size_t length = tree_path_level_kary(root, branching) + 1;
+    tree_path *t = oram_arena_calloc(arena, length + 1, sizeof(u64));
+    (*t)[0] = length;
+
+    tree_path_update_kary(t, leaf, branching);
+
+    return t;
+}
+
+size_t tree_path_arena_bytes(u64 root, size_t branching)
+{
+    return oram_arena_bytes((tree_path_level_kary(root, branching) + 2) * sizeof(u64));
+}
+
+void tree_path_update_kary(tree_path *t, u64 leaf, size_t branching)
+{
+    size_t bits = branching_bits(branching);
+    size_t root_level = TREE_PATH_LENGTH(*t) - 1;
+
+    // leaves are even numbers, and must be below the root
+    CHECK(leaf % 2 == 0);
+    CHECK(leaf <= 2 * node_val_kary(root_level, 0, bits));
+
+    // the ancestor of leaf `o` on `level` is at offset o / k^level
+    u64 offset = leaf / 2;
+    for (size_t l = 0; l <= root_level; ++l)
+    {
+        TREE_PATH_VALUES(*t)[l] = node_val_kary(l, offset >> (l * bits), bits);
+    }
+}
+
+u64 tree_path_lower_bound_kary(u64 val, size_t branching)
+{
+    size_t bits = branching_bits(branching);
+    u64 step = (1ULL << (level(val) / bits * bits)) - 1;
+    return val - step;
+}
+
+u64 tree_path_upper_bound_kary(u64 val, size_t branching)
+{
+    size_t bits = branching_bits(branching);
+    u64 step = (1ULL << (level(val) / bits * bits)) - 1;
+    return val + step;
+}
+
+size_t tree_path_num_levels(size_t num_leaves, size_t branching)
+{
+    size_t bits = branching_bits(branching);
+    return (ceil_log2(num_leaves) + bits - 1) / bits + 1;
+}
+
+size_t tree_path_num_nodes_on_level(size_t num_leaves, size_t branching, size_t level)
+{
+    // the parent of the node at offset o is at offset o / k
+    return ((num_leaves - 1) >> (level * branching_bits(branching))) + 1;
+}
+
+size_t tree_path_num_nodes_pruned(size_t num_leaves, size_t branching)
+{
+    size_t num_levels = tree_path_num_levels(num_leaves, branching);
+    size_t result = 0;
+    for (size_t level = 0; level < num_levels; ++level)
+    {
+        result += tree_path_num_nodes_on_level(num_leaves, branching, level);
+    }
+    return result;
+}
+
 u64 tree_path_lower_bound(u64 val)
 {
     size_t l = level(val);
@@ -254,6 +357,92 @@ int test_descendent_range()
     return err_SUCCESS;
 }
 
+int test_pruned_tree()
+{
+    TEST_ASSERT(tree_path_num_levels(1, 2) == 1);
+    TEST_ASSERT(tree_path_num_levels(2, 2) == 2);
+    TEST_ASSERT(tree_path_num_levels(5, 2) == 4);
+    TEST_ASSERT(tree_path_num_levels(1024, 2) == 11);
+    TEST_ASSERT(tree_path_num_levels(1025, 2) == 12);
+    // 5 leaves, 3, 2 and the root
+    TEST_ASSERT(tree_path_num_nodes_pruned(5, 2) == 11);
+    for (size_t l = 0; l < 20; ++l)
+    {
+        TEST_ASSERT(tree_path_num_nodes_pruned((size_t)1 << l, 2) == tree_path_num_nodes(l + 1));
+    }
+
+    // every node on the path to a remaining leaf is one of the remaining nodes of its level
+    for (size_t num_leaves = 1; num_leaves < 70; ++num_leaves)
+    {
+        u64 root = ((u64)1 << (tree_path_num_levels(num_leaves, 2) - 1)) - 1;
+        tree_path *path = tree_path_create(0, root);
+        for (u64 leaf = 0; leaf < num_leaves; ++leaf)
+        {
+            tree_path_update(path, leaf * 2);
+            TEST_ASSERT(TREE_PATH_LENGTH(*path) == tree_path_num_levels(num_leaves, 2));
+            for (size_t i = 0; i < TREE_PATH_LENGTH(*path); ++i)
+            {
+                tree_coords coords = coords_for_val(TREE_PATH_VALUES(*path)[i]);
+                TEST_ASSERT(coords.level == i);
+                TEST_ASSERT(coords.offset < tree_path_num_nodes_on_level(num_leaves, 2, i));
+            }
+        }
+        tree_path_destroy(path);
+    }
+    return err_SUCCESS;
+}
+
+int test_kary_paths(size_t branching)
+{
+    // the binary tree is the in-order tree
+    tree_path *binary = tree_path_create(0, 1023);
+    tree_path *kary = tree_path_create_kary(0, tree_path_root(11, 2), 2);
+    TEST_ASSERT(TREE_PATH_LENGTH(*kary) == 11);
+    for (u64 leaf = 0; leaf < 2048; leaf += 2)
+    {
+        tree_path_update(binary, leaf);
+        tree_path_update_kary(kary, leaf, 2);
+        for (size_t i = 0; i < 11; ++i)
+        {
+            TEST_ASSERT(TREE_PATH_VALUES(*binary)[i] == TREE_PATH_VALUES(*kary)[i]);
+        }
+    }
+    tree_path_destroy(binary);
+    tree_path_destroy(kary);
+
+    size_t num_leaves = branching * branching * branching - 1;
+    size_t num_levels = tree_path_num_levels(num_leaves, branching);
+    TEST_ASSERT(num_levels == 4);
+    TEST_ASSERT(tree_path_num_nodes_pruned(num_leaves, branching) == num_leaves + branching * branching + branching + 1);
+    u64 root = tree_path_root(num_levels, branching);
+    tree_path *path = tree_path_create_kary(0, root, branching);
+    TEST_ASSERT(TREE_PATH_LENGTH(*path) == num_levels);
+    for (u64 leaf = 0; leaf < num_leaves; ++leaf)
+    {
+        tree_path_update_kary(path, leaf * 2, branching);
+        TEST_ASSERT(TREE_PATH_VALUES(*path)[0] == leaf * 2);
+        TEST_ASSERT(TREE_PATH_VALUES(*path)[num_levels - 1] == root);
+        for (size_t i = 0; i < num_levels; ++i)
+        {
+            u64 val = TREE_PATH_VALUES(*path)[i];
+            TEST_ASSERT(tree_path_level_kary(val, branching) == i);
+            // the node covers the k^i leaves of its subtree, which include this one
+            TEST_ASSERT(tree_path_lower_bound_kary(val, branching) <= leaf * 2 && leaf * 2 <= tree_path_upper_bound_kary(val, branching));
+            u64 subtree_leaves = 1ULL << (i * __builtin_ctzll(branching));
+            TEST_ASSERT(tree_path_upper_bound_kary(val, branching) - tree_path_lower_bound_kary(val, branching) == 2 * (subtree_leaves - 1));
+            // and is one of the remaining nodes of its level
+            TEST_ASSERT(leaf / subtree_leaves < tree_path_num_nodes_on_level(num_leaves, branching, i));
+            // once a level is added below the leaves, the node is one level up and above the children of this leaf
+            u64 grown = tree_path_id_after_growth(val, 1, branching);
+            TEST_ASSERT(tree_path_level_kary(grown, branching) == i + 1);
+            TEST_ASSERT(tree_path_lower_bound_kary(grown, branching) == leaf / subtree_leaves * subtree_leaves * branching * 2);
+            TEST_ASSERT(tree_path_upper_bound_kary(grown, branching) == ((leaf / subtree_leaves + 1) * subtree_leaves * branching - 1) * 2);
+        }
+    }
+    tree_path_destroy(path);
+    return err_SUCCESS;
+}
+
 void private_tree_path_tests()
 {
     RUN_TEST(test_level());
@@ -261,5 +450,9 @@ void private_tree_path_tests()
     RUN_TEST(test_val_from_coords());
     RUN_TEST(test_val_coords_roundtrip());
     RUN_TEST(test_descendent_range());
+    RUN_TEST(test_pruned_tree());
+    RUN_TEST(test_kary_paths(2));
+    RUN_TEST(test_kary_paths(4));
+    RUN_TEST(test_kary_paths(8));
 }
 #endif
@@ -0,0 +1,183 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "../include/uring.h"
+
+struct uring
+{
+    int fd;
+    size_t entries;
+    // requests handed to the kernel that have not been reaped
+    size_t in_flight;
+    // requests written to the submission queue that have not been handed to the kernel
+    size_t queued;
+    // set if any reaped request failed or was short
+    bool failed;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+uring *uring_create(size_t entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring *ring;
+    CHECK(ring = calloc(1, sizeof(*ring)));
+    ring->fd = io_uring_setup(entries, &params);
+    CHECK(ring->fd >= 0);
+    ring->entries = entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // Acceptable if: not executed in an oram_access
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_ring_size = max(ring->sq_ring_size, ring->cq_ring_size);
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    CHECK(ring->sq_ring != MAP_FAILED);
+    // Acceptable if: not executed in an oram_access
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        CHECK(ring->cq_ring != MAP_FAILED);
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    CHECK(ring->sqes != MAP_FAILED);
+
+    ring->sq_tail = (unsigned *)((u8 *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((u8 *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((u8 *)ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *)((u8 *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((u8 *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((u8 *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((u8 *)ring->cq_ring + params.cq_off.cqes);
+    return ring;
+}
+
+void uring_destroy(uring *ring)
+{
+    // Acceptable if: not executed in an oram_access
+    if (ring)
+    {
+        uring_wait_all(ring);
+        munmap(ring->sqes, ring->sqes_size);
+        // Acceptable if: not executed in an oram_access
+        if (ring->cq_ring != ring->sq_ring)
+        {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        free(ring);
+    }
+}
+
+void uring_queue_rw(uring *ring, bool write, int fd, void *buf, size_t len, off_t offset)
+{
+    CHECK(ring->queued + ring->in_flight < ring->entries);
+    // we are the only producer, the kernel only reads the tail
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    // the completion carries the expected length so that short transfers are detected
+    sqe->user_data = len;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->queued;
+}
+
+// Reap all available completions without blocking.
+static void uring_reap(uring *ring)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        ring->failed |= cqe->res < 0 || (u64)cqe->res != cqe->user_data;
+        ++head;
+        --ring->in_flight;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static error_t uring_enter(uring *ring, unsigned min_complete)
+{
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = io_uring_enter(ring->fd, ring->queued, min_complete, flags);
+    // Acceptable if: not executed in an oram_access
+    if (submitted < 0)
+    {
+        return errno == EINTR ? err_SUCCESS : err_ORAM__STORAGE_IO;
+    }
+    ring->queued -= submitted;
+    ring->in_flight += submitted;
+    return err_SUCCESS;
+}
+
+error_t uring_submit(uring *ring)
+{
+    while (ring->queued > 0)
+    {
+        RETURN_IF_ERROR(uring_enter(ring, 0));
+    }
+    return err_SUCCESS;
+}
+
+error_t uring_wait_all(uring *ring)
+{
+    RETURN_IF_ERROR(uring_submit(ring));
+    uring_reap(ring);
+    while (ring->in_flight > 0)
+    {
+        RETURN_IF_ERROR(uring_enter(ring, ring->in_flight));
+        uring_reap(ring);
+    }
+    error_t result = ring->failed ? err_ORAM__STORAGE_IO : err_SUCCESS;
+    ring->failed = false;
+    return result;
+}
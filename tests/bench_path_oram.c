@@ -0,0 +1,711 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/path_oram.h"
+#include "../include/position_map.h"
+#include "../include/oram_pipeline.h"
+#include "../include/oram_queue.h"
+#include "../include/sharded_oram.h"
+#include "../include/bucket.h"
+#include "../include/cuckoo_map.h"
+#include "../include/tree_path.h"
+#include "../include/util.h"
+#include "../include/tests_fs.h"
+
+#define DEFAULT_CAPACITY_U64 (1ul << 24)
+#define DEFAULT_NUM_ACCESSES 20000
+#define BENCH_STASH_SIZE 100
+
+static inline u64 get_cycles() {
+    u32 low, high;
+    __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+    return ((u64)high << 32) | low;
+}
+
+static u64 random_u64() {
+    u64 r;
+    getentropy(&r, sizeof(r));
+    return r;
+}
+
+// Resident set size of this process, in bytes.
+static size_t rss_bytes() {
+    size_t total_pages = 0, resident_pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    CHECK(statm != NULL);
+    CHECK(fscanf(statm, "%zu %zu", &total_pages, &resident_pages) == 2);
+    fclose(statm);
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Allocate every block of `oram` and touch each once so the stash and tree reach a steady state.
+static void fill_oram(oram *oram) {
+    u64 *buf;
+    CHECK(buf = calloc(oram_block_size(oram), sizeof(*buf)));
+    size_t num_blocks = oram_capacity_blocks(oram);
+    CHECK(oram_allocate_contiguous(oram, num_blocks) == 0);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        buf[0] = i;
+        CHECK(oram_put(oram, i, buf) == err_SUCCESS);
+    }
+    free(buf);
+}
+
+// Returns mean cycles per `oram_get` of a uniformly random block.
+static double cycles_per_random_get(oram *oram, size_t num_accesses) {
+    u64 *buf;
+    CHECK(buf = malloc(oram_block_size(oram) * sizeof(*buf)));
+    size_t num_blocks = oram_capacity_blocks(oram);
+    u64 total = 0;
+    for (size_t i = 0; i < num_accesses; ++i) {
+        u64 block_id = random_u64() % num_blocks;
+        u64 start = get_cycles();
+        CHECK(oram_get(oram, block_id, buf) == err_SUCCESS);
+        total += get_cycles() - start;
+    }
+    free(buf);
+    return (double)total / num_accesses;
+}
+
+static void bench_treetop(size_t capacity_u64, size_t num_accesses) {
+    printf("treetop: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    printf("%8s %16s\n", "levels", "cycles/access");
+    for (size_t treetop_levels = 0; treetop_levels <= 12; treetop_levels += 2) {
+        oram_config config = {.treetop_levels = treetop_levels};
+        oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+        printf("%8zu %16.0f\n", treetop_levels, cycles_per_random_get(oram, num_accesses));
+        oram_destroy(oram);
+    }
+}
+
+static void bench_clear(size_t capacity_u64, size_t num_accesses) {
+    printf("clear: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    oram *oram = oram_create(capacity_u64, BENCH_STASH_SIZE, getentropy);
+    fill_oram(oram);
+
+    u64 start = get_cycles();
+    oram_clear(oram);
+    u64 clear_cycles = get_cycles() - start;
+
+    CHECK(oram_allocate_contiguous(oram, oram_capacity_blocks(oram)) == 0);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    start = get_cycles();
+    CHECK(oram_get(oram, random_u64() % oram_capacity_blocks(oram), buf) == err_SUCCESS);
+    u64 first_access_cycles = get_cycles() - start;
+
+    printf("%24s %16" PRIu64 "\n", "clear cycles", clear_cycles);
+    printf("%24s %16" PRIu64 "\n", "first access cycles", first_access_cycles);
+    printf("%24s %16.0f\n", "cycles/access after", cycles_per_random_get(oram, num_accesses));
+    oram_destroy(oram);
+}
+
+static void bench_create(size_t capacity_u64, size_t num_accesses) {
+    printf("create: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    size_t rss_before = rss_bytes();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    oram *oram = oram_create(capacity_u64, BENCH_STASH_SIZE, getentropy);
+    printf("%24s %16.6f\n", "create seconds", seconds_since(&start));
+    printf("%24s %16zu\n", "RSS after create (KiB)", (rss_bytes() - rss_before) / 1024);
+
+    u64 buf[BLOCK_DATA_SIZE_QWORDS] = {0};
+    size_t num_blocks = oram_capacity_blocks(oram);
+    CHECK(oram_allocate_contiguous(oram, num_blocks) == 0);
+    for (size_t i = 0; i < num_accesses; ++i) {
+        CHECK(oram_put(oram, random_u64() % num_blocks, buf) == err_SUCCESS);
+    }
+    printf("%24s %16zu\n", "RSS after puts (KiB)", (rss_bytes() - rss_before) / 1024);
+    oram_destroy(oram);
+}
+
+// Checkpoint cost as a function of the number of accesses since the previous checkpoint.
+static void bench_checkpoint(size_t capacity_u64, size_t num_accesses) {
+    printf("checkpoint: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    char dir[] = "/tmp/oram_checkpoint_bench_XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+    oram *oram = oram_create(capacity_u64, BENCH_STASH_SIZE, getentropy);
+    fill_oram(oram);
+
+    size_t bytes_written;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(oram_checkpoint_incremental(oram, dir, &bytes_written) == err_SUCCESS);
+    printf("%10s %16s %12s\n", "accesses", "written (KiB)", "seconds");
+    printf("%10s %16zu %12.6f\n", "full", bytes_written / 1024, seconds_since(&start));
+
+    for (size_t accesses = 1; accesses <= num_accesses; accesses *= 10) {
+        cycles_per_random_get(oram, accesses);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CHECK(oram_checkpoint_incremental(oram, dir, &bytes_written) == err_SUCCESS);
+        printf("%10zu %16zu %12.6f\n", accesses, bytes_written / 1024, seconds_since(&start));
+    }
+    oram_destroy(oram);
+    CHECK(remove_tree(dir) == 0);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+// Throughput and latency of a tiered store as the tree grows past the memory levels. Keeping `disk_levels` levels on
+// disk makes the tree about 2^disk_levels times the size of the part held in DRAM.
+static void bench_tiered(size_t capacity_u64, size_t num_accesses) {
+    printf("tiered: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    char dir[] = "/tmp/oram_tiered_bench_XXXXXX";
+    CHECK(mkdtemp(dir) != NULL);
+    char tier_file[sizeof(dir) + 16];
+    snprintf(tier_file, sizeof(tier_file), "%s/buckets", dir);
+
+    size_t num_blocks = capacity_u64 / BLOCK_DATA_SIZE_QWORDS + (capacity_u64 % BLOCK_DATA_SIZE_QWORDS == 0 ? 0 : 1);
+    size_t num_levels = ceil_log2(num_blocks);
+    u64 *latencies;
+    CHECK(latencies = calloc(num_accesses, sizeof(*latencies)));
+    printf("%12s %10s %14s %12s %12s\n", "tree/DRAM", "RSS (MiB)", "accesses/sec", "p50 cycles", "p99 cycles");
+    for (size_t disk_levels = 0; disk_levels <= 3; ++disk_levels) {
+        size_t rss_before = rss_bytes();
+        oram_config config = {.tier_file = tier_file, .memory_levels = num_levels - disk_levels};
+        oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < num_accesses; ++i) {
+            u64 block_id = random_u64() % oram_capacity_blocks(oram);
+            u64 access_start = get_cycles();
+            CHECK(oram_get(oram, block_id, buf) == err_SUCCESS);
+            latencies[i] = get_cycles() - access_start;
+        }
+        double seconds = seconds_since(&start);
+        qsort(latencies, num_accesses, sizeof(*latencies), compare_u64);
+        printf("%11zux %10zu %14.0f %12" PRIu64 " %12" PRIu64 "\n", (size_t)1 << disk_levels, (rss_bytes() - rss_before) >> 20,
+            num_accesses / seconds, latencies[num_accesses / 2], latencies[num_accesses * 99 / 100]);
+        oram_destroy(oram);
+    }
+    free(latencies);
+    CHECK(remove_tree(dir) == 0);
+}
+
+// Throughput of the sharded front-end for 1, 2, 4 and 8 shards, with batches of 256 random requests padded to
+// `sharded_oram_shard_batch_size`. Scales with the number of cores available to the workers.
+static void bench_sharded(size_t capacity_u64, size_t num_accesses) {
+    size_t batch_size = 256;
+    printf("sharded: capacity_u64=%zu accesses=%zu batch=%zu cores=%ld\n", capacity_u64, num_accesses, batch_size, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %12s %14s\n", "shards", "shard batch", "accesses/sec");
+    sharded_oram_request *requests;
+    CHECK(requests = calloc(batch_size, sizeof(*requests)));
+    for (size_t num_shards = 1; num_shards <= 8; num_shards <<= 1) {
+        sharded_oram *oram = sharded_oram_create(capacity_u64, num_shards, BENCH_STASH_SIZE, getentropy);
+        size_t num_blocks = sharded_oram_capacity_blocks(oram);
+        size_t shard_batch_size = sharded_oram_shard_batch_size(batch_size, num_shards);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t done = 0;
+        while (done < num_accesses) {
+            for (size_t i = 0; i < batch_size; ++i) {
+                requests[i].block_id = random_u64() % num_blocks;
+                requests[i].is_put = i & 1;
+            }
+            CHECK(sharded_oram_access_batch(oram, batch_size, requests, shard_batch_size) == err_SUCCESS);
+            done += batch_size;
+        }
+        printf("%8zu %12zu %14.0f\n", num_shards, shard_batch_size, done / seconds_since(&start));
+        sharded_oram_destroy(oram);
+    }
+    free(requests);
+}
+
+// Sequential and pipelined throughput of random gets for 2, 3 and 4 recursion levels. The scan threshold is lowered
+// to reach the deeper recursions at the given capacity.
+static void bench_pipeline(size_t capacity_u64, size_t num_accesses) {
+    size_t batch = 64;
+    printf("pipeline: capacity_u64=%zu accesses=%zu cores=%ld\n", capacity_u64, num_accesses, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %16s %16s\n", "levels", "sequential/sec", "pipelined/sec");
+    u64 (*bufs)[BLOCK_DATA_SIZE_QWORDS];
+    CHECK(bufs = calloc(batch, sizeof(*bufs)));
+    for (size_t levels = 2; levels <= 4; ++levels) {
+        // entries in the position map of each level; level `levels` must be the first one that fits a scan map
+        size_t entries = capacity_u64 / BLOCK_DATA_SIZE_QWORDS + (capacity_u64 % BLOCK_DATA_SIZE_QWORDS == 0 ? 0 : 1);
+        size_t prev_entries = entries;
+        for (size_t level = 1; level < levels; ++level) {
+            prev_entries = entries;
+            entries = entries / BLOCK_DATA_SIZE_QWORDS + (entries % BLOCK_DATA_SIZE_QWORDS == 0 ? 0 : 1);
+        }
+        if (prev_entries <= entries) {
+            printf("%8zu %16s %16s\n", levels, "capacity too small", "");
+            continue;
+        }
+        oram_config config = {.scan_threshold = entries};
+        oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+        CHECK(oram_report_statistics(oram)->recursion_depth == levels);
+        size_t num_blocks = oram_capacity_blocks(oram);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < num_accesses; ++i) {
+            CHECK(oram_get(oram, random_u64() % num_blocks, bufs[0]) == err_SUCCESS);
+        }
+        double sequential = num_accesses / seconds_since(&start);
+
+        oram_pipeline *pipeline = oram_pipeline_create(oram, batch);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < num_accesses; ++i) {
+            oram_pipeline_get(pipeline, random_u64() % num_blocks, bufs[i % batch]);
+            if (i % batch == batch - 1) {
+                CHECK(oram_pipeline_drain(pipeline) == err_SUCCESS);
+            }
+        }
+        CHECK(oram_pipeline_drain(pipeline) == err_SUCCESS);
+        double pipelined = num_accesses / seconds_since(&start);
+        oram_pipeline_destroy(pipeline);
+
+        printf("%8zu %16.0f %16.0f\n", levels, sequential, pipelined);
+        oram_destroy(oram);
+    }
+    free(bufs);
+}
+
+static error_t copy_out_accessor(u64 *block_data, void *args) {
+    memcpy(args, block_data, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+// Throughput per core of G interleaved accesses over ORAM_MAX_INTERLEAVED independent ORAMs that share the capacity.
+static void bench_interleaved(size_t capacity_u64, size_t num_accesses) {
+    size_t num_orams = ORAM_MAX_INTERLEAVED;
+    printf("interleaved: capacity_u64=%zu orams=%zu accesses=%zu\n", capacity_u64, num_orams, num_accesses);
+    printf("%8s %14s %16s\n", "G", "accesses/sec", "cycles/access");
+    oram *orams[ORAM_MAX_INTERLEAVED];
+    for (size_t i = 0; i < num_orams; ++i) {
+        orams[i] = oram_create(capacity_u64 / num_orams, BENCH_STASH_SIZE, getentropy);
+        fill_oram(orams[i]);
+    }
+    u64 bufs[ORAM_MAX_INTERLEAVED][BLOCK_DATA_SIZE_QWORDS];
+    void *args[ORAM_MAX_INTERLEAVED];
+    for (size_t i = 0; i < num_orams; ++i) {
+        args[i] = bufs[i];
+    }
+    for (size_t group = 1; group <= num_orams; group <<= 1) {
+        u64 block_ids[ORAM_MAX_INTERLEAVED];
+        size_t done = 0;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        u64 start_cycles = get_cycles();
+        while (done < num_accesses) {
+            // rotate through the ORAMs so every group size touches all of them
+            size_t first = (done / group) * group % num_orams;
+            for (size_t g = 0; g < group; ++g) {
+                block_ids[g] = random_u64() % oram_capacity_blocks(orams[first + g]);
+            }
+            CHECK(oram_function_access_interleaved(group, orams + first, block_ids, copy_out_accessor, args) == err_SUCCESS);
+            done += group;
+        }
+        printf("%8zu %14.0f %16.0f\n", group, done / seconds_since(&start), (double)(get_cycles() - start_cycles) / done);
+    }
+    for (size_t i = 0; i < num_orams; ++i) {
+        oram_destroy(orams[i]);
+    }
+}
+
+#define QUEUE_WINDOW 16
+
+typedef struct {
+    oram *oram;
+    oram_queue *queue;
+    pthread_mutex_t *lock;
+    size_t num_accesses;
+} queue_client_args;
+
+// A client that serializes on a mutex around every access.
+static void *locked_client(void *arg) {
+    queue_client_args *args = arg;
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    size_t num_blocks = oram_capacity_blocks(args->oram);
+    for (size_t i = 0; i < args->num_accesses; ++i) {
+        pthread_mutex_lock(args->lock);
+        CHECK(oram_get(args->oram, random_u64() % num_blocks, buf) == err_SUCCESS);
+        pthread_mutex_unlock(args->lock);
+    }
+    return NULL;
+}
+
+// A client that keeps QUEUE_WINDOW requests in flight on the queue.
+static void *queue_client(void *arg) {
+    queue_client_args *args = arg;
+    u64 bufs[QUEUE_WINDOW][BLOCK_DATA_SIZE_QWORDS];
+    oram_future futures[QUEUE_WINDOW];
+    size_t num_blocks = oram_capacity_blocks(args->oram);
+    for (size_t i = 0; i < args->num_accesses; ++i) {
+        if (i >= QUEUE_WINDOW) {
+            CHECK(oram_future_wait(&futures[i % QUEUE_WINDOW]) == err_SUCCESS);
+        }
+        CHECK(oram_queue_submit_future(args->queue, random_u64() % num_blocks, copy_out_accessor, bufs[i % QUEUE_WINDOW], &futures[i % QUEUE_WINDOW]) == err_SUCCESS);
+    }
+    for (size_t i = 0; i < QUEUE_WINDOW && i < args->num_accesses; ++i) {
+        CHECK(oram_future_wait(&futures[i]) == err_SUCCESS);
+    }
+    return NULL;
+}
+
+static double run_clients(void *(*client)(void *), queue_client_args *args, size_t num_threads) {
+    pthread_t threads[8];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t t = 0; t < num_threads; ++t) {
+        CHECK(pthread_create(&threads[t], NULL, client, args) == 0);
+    }
+    for (size_t t = 0; t < num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    return args->num_accesses * num_threads / seconds_since(&start);
+}
+
+// Throughput of random gets from 1, 2, 4 and 8 client threads, through a mutex around `oram_get` and through an
+// `oram_queue` drained in batches of 32.
+static void bench_queue(size_t capacity_u64, size_t num_accesses) {
+    printf("queue: capacity_u64=%zu accesses=%zu cores=%ld\n", capacity_u64, num_accesses, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %14s %14s\n", "threads", "locked/sec", "queued/sec");
+    oram *oram = oram_create(capacity_u64, BENCH_STASH_SIZE, getentropy);
+    fill_oram(oram);
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    for (size_t num_threads = 1; num_threads <= 8; num_threads <<= 1) {
+        queue_client_args args = {.oram = oram, .lock = &lock, .num_accesses = num_accesses / num_threads};
+        double locked = run_clients(locked_client, &args, num_threads);
+
+        args.queue = oram_queue_create(oram, 256, 32);
+        double queued = run_clients(queue_client, &args, num_threads);
+        oram_queue_destroy(args.queue);
+        printf("%8zu %14.0f %14.0f\n", num_threads, locked, queued);
+    }
+    oram_destroy(oram);
+}
+
+// Cycles per random get as the tree grows from capacity_u64 / 64 to capacity_u64, to show where the path reads and
+// writes stop fitting in the last level cache, with paths staged in the stash and sorted in place.
+static void bench_path(size_t capacity_u64, size_t num_accesses) {
+    printf("path: accesses=%zu\n", num_accesses);
+    printf("%14s %10s %16s %16s\n", "capacity_u64", "rss MiB", "staged cycles", "zero-copy cycles");
+    for (size_t capacity = capacity_u64 >> 6; capacity <= capacity_u64; capacity <<= 2) {
+        oram *oram = oram_create(capacity, BENCH_STASH_SIZE, getentropy);
+        fill_oram(oram);
+        size_t rss = rss_bytes();
+        double staged = cycles_per_random_get(oram, num_accesses);
+        oram_destroy(oram);
+
+        oram_config config = {.zero_copy_path = true};
+        oram = oram_create_with_config(capacity, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+        printf("%14zu %10zu %16.0f %16.0f\n", capacity, rss >> 20, staged, cycles_per_random_get(oram, num_accesses));
+        oram_destroy(oram);
+    }
+}
+
+// Cycles per random get of the same capacity under several bucket geometries, with the bytes of data ORAM buckets on
+// each path. Small blocks give a taller tree of small buckets, large blocks a short tree of large ones.
+static void bench_geometry(size_t capacity_u64, size_t num_accesses) {
+    static const struct {
+        size_t bucket_size;
+        size_t blocks_per_bucket;
+        size_t block_size_bytes;
+    } geometries[] = {
+        {0, 4, 256},
+        {0, 4, 1024},
+        {0, 0, 0},
+        {8192, 0, 0},
+        {0, 0, 4096},
+        {0, 4, 4096},
+        {2 << 20, 0, 0},
+    };
+    printf("geometry: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    printf("%10s %4s %10s %8s %12s %16s %12s\n", "bucket B", "Z", "block B", "levels", "path KiB", "cycles/access", "cycles/KiB");
+    for (size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); ++g) {
+        oram_config config = {
+            .bucket_size = geometries[g].bucket_size,
+            .blocks_per_bucket = geometries[g].blocks_per_bucket,
+            .block_size_bytes = geometries[g].block_size_bytes};
+        bucket_geometry geometry = bucket_geometry_create(config.bucket_size, config.blocks_per_bucket, config.block_size_bytes);
+        oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+        size_t levels = ceil_log2(oram_num_leaves(oram)) + 1;
+        double cycles = cycles_per_random_get(oram, num_accesses);
+        printf("%10zu %4zu %10zu %8zu %12zu %16.0f %12.0f\n", geometry.bucket_size, geometry.blocks_per_bucket,
+               geometry.block_data_qwords * sizeof(u64), levels, levels * geometry.bucket_size / 1024, cycles,
+               cycles * 1024 / (geometry.block_data_qwords * sizeof(u64)));
+        oram_destroy(oram);
+    }
+}
+
+// Bytes moved and cycles per random get with position map levels of several block sizes, Z=4, with the default
+// scan threshold and with a low one that gives deeper recursion.
+static void bench_posmap(size_t capacity_u64, size_t num_accesses) {
+    static const size_t block_sizes[] = {0, 512, 256, 128};
+    static const size_t scan_thresholds[] = {0, 1024};
+    printf("posmap: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    printf("%10s %10s %8s %12s %16s\n", "scan", "block B", "depth", "bytes KiB", "cycles/access");
+    for (size_t t = 0; t < sizeof(scan_thresholds) / sizeof(scan_thresholds[0]); ++t) {
+        for (size_t b = 0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); ++b) {
+            oram_posmap_level_config posmap_level = {.blocks_per_bucket = 4, .block_size_bytes = block_sizes[b]};
+            oram_config config = {
+                .scan_threshold = scan_thresholds[t],
+                .posmap_levels = &posmap_level,
+                .num_posmap_levels = block_sizes[b] > 0 ? 1 : 0};
+            oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+            fill_oram(oram);
+            printf("%10zu %10zu %8zu %12zu %16.0f\n", scan_thresholds[t] ? scan_thresholds[t] : SCAN_THRESHOLD,
+                   block_sizes[b] ? block_sizes[b] : BLOCK_DATA_SIZE_BYTES, oram_report_statistics(oram)->recursion_depth,
+                   oram_access_bytes(oram) / 1024, cycles_per_random_get(oram, num_accesses));
+            oram_destroy(oram);
+        }
+    }
+}
+
+// Binary and k-ary trees of the same capacity and block size. The first two rows have about the same bucket memory: a
+// k-ary tree has about k/(k-1) buckets per leaf instead of 2, so its buckets are larger by (2k-2)/k. With path
+// eviction that is not enough room on the internal levels and the stash grows, so the last rows give each bucket
+// Z = 3k/2 blocks, which keeps the stash as small as the binary tree's at the cost of more memory.
+static void bench_kary(size_t capacity_u64, size_t num_accesses) {
+    static const struct {
+        size_t branching;
+        size_t bucket_size;
+        size_t blocks_per_bucket;
+    } trees[] = {
+        {2, 4096, 3},
+        {4, 6144, 4},
+        {4, 0, 6},
+        {8, 0, 12},
+        {16, 0, 24},
+    };
+    printf("kary: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    printf("%4s %10s %4s %8s %12s %10s %10s %16s\n", "k", "bucket B", "Z", "levels", "path KiB", "RSS MiB", "max stash", "cycles/access");
+    for (size_t t = 0; t < sizeof(trees) / sizeof(trees[0]); ++t) {
+        oram_config config = {
+            .bucket_size = trees[t].bucket_size,
+            .blocks_per_bucket = trees[t].blocks_per_bucket,
+            .block_size_bytes = BLOCK_DATA_SIZE_BYTES,
+            .branching = trees[t].branching};
+        size_t rss_before = rss_bytes();
+        oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+        size_t rss = rss_bytes() - rss_before;
+        size_t levels = tree_path_num_levels(oram_num_leaves(oram), trees[t].branching);
+        double cycles = cycles_per_random_get(oram, num_accesses);
+        bucket_geometry geometry = bucket_geometry_create(config.bucket_size, config.blocks_per_bucket, config.block_size_bytes);
+        printf("%4zu %10zu %4zu %8zu %12zu %10zu %10zu %16.0f\n", trees[t].branching, geometry.bucket_size,
+               trees[t].blocks_per_bucket, levels, levels * geometry.bucket_size / 1024, rss >> 20,
+               oram_report_statistics(oram)->max_stash_overflow_count, cycles);
+        oram_destroy(oram);
+    }
+}
+
+// Z = 4 and Z = 3 on every level against Z = 4 with fewer blocks per bucket on the bottom levels: bucket memory, the
+// stash between accesses as reported by the ORAM's statistics, and cycles per random get.
+static void bench_leafz(size_t capacity_u64, size_t num_accesses) {
+    static const struct {
+        size_t blocks_per_bucket;
+        size_t leaf_levels;
+        size_t leaf_blocks_per_bucket;
+    } trees[] = {
+        {4, 0, 0},
+        {3, 0, 0},
+        {4, 1, 3},
+        {4, 1, 2},
+        {4, 2, 2},
+        {4, 3, 2},
+        {4, 1, 1},
+        {5, 2, 2},
+    };
+    printf("leafz: capacity_u64=%zu accesses=%zu\n", capacity_u64, num_accesses);
+    printf("%4s %12s %8s %10s %10s %12s %16s\n", "Z", "leaf levels", "leaf Z", "tree MiB", "max stash", "mean stash", "cycles/access");
+    for (size_t t = 0; t < sizeof(trees) / sizeof(trees[0]); ++t) {
+        oram_config config = {
+            .blocks_per_bucket = trees[t].blocks_per_bucket,
+            .block_size_bytes = BLOCK_DATA_SIZE_BYTES,
+            .leaf_levels = trees[t].leaf_levels,
+            .leaf_blocks_per_bucket = trees[t].leaf_blocks_per_bucket};
+        oram *oram = oram_create_with_config(capacity_u64, BENCH_STASH_SIZE, &config, getentropy);
+        fill_oram(oram);
+        const oram_statistics *statistics = oram_report_statistics(oram);
+        size_t fill_accesses = statistics->access_count;
+        size_t fill_stash = statistics->sum_stash_overflow_count;
+        double cycles = cycles_per_random_get(oram, num_accesses);
+        bucket_geometry geometry = bucket_geometry_create(0, config.blocks_per_bucket, config.block_size_bytes);
+        geometry.leaf_levels = config.leaf_levels;
+        geometry.leaf_blocks_per_bucket = config.leaf_blocks_per_bucket;
+        printf("%4zu %12zu %8zu %10zu %10zu %12.2f %16.0f\n", trees[t].blocks_per_bucket, trees[t].leaf_levels,
+               trees[t].leaf_blocks_per_bucket, bucket_tree_size_bytes(oram_num_leaves(oram), &geometry) >> 20,
+               statistics->max_stash_overflow_count,
+               (double)(statistics->sum_stash_overflow_count - fill_stash) / (statistics->access_count - fill_accesses), cycles);
+        oram_destroy(oram);
+    }
+}
+
+#define KV_RECORD_QWORDS 8
+
+typedef struct {
+    u64 key;
+    u64 *record;
+    u64 placed;
+} linear_probe_args;
+
+// Place a record in the first empty slot of a block, if it has not been placed yet.
+static error_t linear_probe_place_accessor(u64 *block_data, void *vargs) {
+    linear_probe_args *args = vargs;
+    for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS / KV_RECORD_QWORDS && !args->placed; ++i) {
+        u64 *slot = block_data + i * KV_RECORD_QWORDS;
+        if (slot[0] == UINT64_MAX) {
+            memcpy(slot, args->record, KV_RECORD_QWORDS * sizeof(u64));
+            args->placed = 1;
+        }
+    }
+    return err_SUCCESS;
+}
+
+// Copy out the record of a key with the same instructions for every slot.
+static error_t linear_probe_find_accessor(u64 *block_data, void *vargs) {
+    linear_probe_args *args = vargs;
+    for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS / KV_RECORD_QWORDS; ++i) {
+        u64 *slot = block_data + i * KV_RECORD_QWORDS;
+        bool match = slot[0] == args->key;
+        for (size_t j = 0; j < KV_RECORD_QWORDS; ++j) {
+            cond_obv_cpy_u64(match, args->record + j, slot + j);
+        }
+        args->placed |= match;
+    }
+    return err_SUCCESS;
+}
+
+// Lookups per second in a cuckoo map against a linear-probe table over an ORAM of the same number of slots, at load
+// factors from 0.5 to 0.9. To be oblivious, every lookup in the linear-probe table visits as many blocks as the
+// longest probe of any record, which grows with the load, while the cuckoo map always visits two. Records are 8 u64s
+// and the tables have `capacity_u64 / 8` slots.
+static void bench_cuckoo(size_t capacity_u64, size_t num_accesses) {
+    size_t num_slots = capacity_u64 / KV_RECORD_QWORDS;
+    size_t slots_per_block = BLOCK_DATA_SIZE_QWORDS / KV_RECORD_QWORDS;
+    printf("cuckoo: capacity_u64=%zu slots=%zu accesses=%zu\n", capacity_u64, num_slots, num_accesses);
+    printf("%6s %10s %14s %14s %10s %14s %14s\n", "load", "records", "cuckoo puts/s", "cuckoo gets/s", "max stash",
+           "linear blocks", "linear gets/s");
+    u64 record[KV_RECORD_QWORDS] = {0};
+    u64 salt[2] = {random_u64(), random_u64()};
+    for (size_t percent = 50; percent <= 90; percent += 10) {
+        size_t num_records = num_slots * percent / 100;
+        cuckoo_map_config config = {.load_factor = percent / 100.0};
+        cuckoo_map *map = cuckoo_map_create(num_records, KV_RECORD_QWORDS, &config, BENCH_STASH_SIZE, getentropy);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < num_records; ++i) {
+            record[0] = i;
+            CHECK(cuckoo_map_put(map, record) == err_SUCCESS);
+        }
+        double puts = num_records / seconds_since(&start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < num_accesses; ++i) {
+            CHECK(cuckoo_map_get(map, random_u64() % num_records, record) == err_SUCCESS);
+        }
+        double gets = num_accesses / seconds_since(&start);
+        size_t max_stash = cuckoo_map_report_statistics(map)->max_stash_items;
+        cuckoo_map_destroy(map);
+
+        // the baseline is built without hiding where records go, which only the padded lookups measure
+        size_t num_blocks = (num_slots + slots_per_block - 1) / slots_per_block;
+        oram *oram = oram_create(num_blocks * BLOCK_DATA_SIZE_QWORDS, BENCH_STASH_SIZE, getentropy);
+        u64 base = oram_allocate_contiguous(oram, num_blocks);
+        size_t max_probe = 1;
+        for (size_t i = 0; i < num_records; ++i) {
+            record[0] = i;
+            u64 home = muluh64(siphash_u64(salt, i), num_blocks);
+            linear_probe_args args = {.key = i, .record = record};
+            size_t probe = 0;
+            while (!args.placed) {
+                CHECK(oram_function_access(oram, base + (home + probe) % num_blocks, linear_probe_place_accessor, &args) == err_SUCCESS);
+                probe++;
+            }
+            max_probe = probe > max_probe ? probe : max_probe;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < num_accesses; ++i) {
+            u64 key = random_u64() % num_records;
+            u64 home = muluh64(siphash_u64(salt, key), num_blocks);
+            linear_probe_args args = {.key = key, .record = record};
+            for (size_t probe = 0; probe < max_probe; ++probe) {
+                CHECK(oram_function_access(oram, base + (home + probe) % num_blocks, linear_probe_find_accessor, &args) == err_SUCCESS);
+            }
+            CHECK(args.placed);
+        }
+        double linear_gets = num_accesses / seconds_since(&start);
+        oram_destroy(oram);
+
+        printf("%6.2f %10zu %14.0f %14.0f %10zu %14zu %14.0f\n", percent / 100.0, num_records, puts, gets, max_stash,
+               max_probe, linear_gets);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s <benchmark> [capacity_u64] [num_accesses]\n", prog);
+    fprintf(stderr, "benchmarks: treetop clear create checkpoint tiered sharded pipeline interleaved queue path geometry posmap kary leafz cuckoo\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    size_t capacity_u64 = argc > 2 ? strtoull(argv[2], NULL, 0) : DEFAULT_CAPACITY_U64;
+    size_t num_accesses = argc > 3 ? strtoull(argv[3], NULL, 0) : DEFAULT_NUM_ACCESSES;
+
+    if (strcmp(argv[1], "treetop") == 0) {
+        bench_treetop(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "clear") == 0) {
+        bench_clear(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "create") == 0) {
+        bench_create(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "checkpoint") == 0) {
+        bench_checkpoint(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "tiered") == 0) {
+        bench_tiered(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "sharded") == 0) {
+        bench_sharded(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "pipeline") == 0) {
+        bench_pipeline(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "interleaved") == 0) {
+        bench_interleaved(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "queue") == 0) {
+        bench_queue(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "path") == 0) {
+        bench_path(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "geometry") == 0) {
+        bench_geometry(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "posmap") == 0) {
+        bench_posmap(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "kary") == 0) {
+        bench_kary(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "leafz") == 0) {
+        bench_leafz(capacity_u64, num_accesses);
+    } else if (strcmp(argv[1], "cuckoo") == 0) {
+        bench_cuckoo(capacity_u64, num_accesses);
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
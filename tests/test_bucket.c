@@ -32,14 +32,14 @@ int test_bucket_store_put_get()
     assert(DECRYPTED_BLOCK_SIZE >= sizeof(block1));
 
     u64 bucket_id = 1234;
-    bucket_store_write_bucket_blocks(store0, bucket_id, blocks);
+    bucket_store_write_bucket_blocks(store0, bucket_id, (u64*)blocks);
     bucket_store_write_bucket_blocks_jazz(store1, bucket_id, blocks);
 
     u8 bucket_data0[DECRYPTED_BUCKET_SIZE];
     u8 bucket_data1[DECRYPTED_BUCKET_SIZE];
     block* new_blocks0 = (block*)bucket_data0;
     block* new_blocks1 = (block*)bucket_data1;
-    bucket_store_read_bucket_blocks(store0, bucket_id, new_blocks0);
+    bucket_store_read_bucket_blocks(store0, bucket_id, (u64*)new_blocks0);
     bucket_store_read_bucket_blocks_jazz(store1, bucket_id, new_blocks1);
     assert(BLOCK_ID(new_blocks0[0]) == BLOCK_ID(block1));
     assert(BLOCK_ID(new_blocks0[1]) == BLOCK_ID(block2));
@@ -84,7 +84,7 @@ int test_bucket_store_clear()
 
     u64 bucket_id = 1234;
 
-    bucket_store_write_bucket_blocks(store0, bucket_id, blocks);
+    bucket_store_write_bucket_blocks(store0, bucket_id, (u64*)blocks);
     bucket_store_write_bucket_blocks_jazz(store1, bucket_id, blocks);
 
 
@@ -92,7 +92,7 @@ int test_bucket_store_clear()
     u8 bucket_data1[DECRYPTED_BUCKET_SIZE];
     block* new_blocks0 = (block*)bucket_data0;
     block* new_blocks1 = (block*)bucket_data1;
-    bucket_store_read_bucket_blocks(store0, bucket_id, new_blocks0);
+    bucket_store_read_bucket_blocks(store0, bucket_id, (u64*)new_blocks0);
     bucket_store_read_bucket_blocks_jazz(store1, bucket_id, new_blocks1);
 
     assert(BLOCK_ID(new_blocks0[0]) == BLOCK_ID(block1));
@@ -122,7 +122,7 @@ int test_bucket_store_clear()
     // Now clear the bucket store and confirm data is gone
     bucket_store_clear(store0);
     bucket_store_clear_jazz(store1);
-    bucket_store_read_bucket_blocks(store0, bucket_id, new_blocks0);
+    bucket_store_read_bucket_blocks(store0, bucket_id, (u64*)new_blocks0);
     bucket_store_read_bucket_blocks_jazz(store1, bucket_id, new_blocks1);
     for (size_t i = 0; i < BLOCKS_PER_BUCKET; ++i)
     {
@@ -144,12 +144,48 @@ int test_bucket_store_clear()
     return 0;
 }
 
+int test_bucket_store_write_after_clear()
+{
+    bucket_store *store = bucket_store_create(11);
+
+    block blocks[BLOCKS_PER_BUCKET];
+    memset(blocks, 255, sizeof(blocks));
+    BLOCK_ID(blocks[0]) = 1331;
+    BLOCK_DATA(blocks[0])[0] = 42;
+
+    u64 cleared_bucket_id = 1234;
+    u64 rewritten_bucket_id = 1236;
+    bucket_store_write_bucket_blocks(store, cleared_bucket_id, (u64*)blocks);
+    bucket_store_write_bucket_blocks(store, rewritten_bucket_id, (u64*)blocks);
+
+    // Clear repeatedly. Only buckets written after the last clear hold data.
+    bucket_store_clear(store);
+    bucket_store_clear(store);
+    bucket_store_write_bucket_blocks(store, rewritten_bucket_id, (u64*)blocks);
+
+    block new_blocks[BLOCKS_PER_BUCKET];
+    bucket_store_read_bucket_blocks(store, rewritten_bucket_id, (u64*)new_blocks);
+    TEST_ASSERT(BLOCK_ID(new_blocks[0]) == 1331);
+    TEST_ASSERT(BLOCK_DATA(new_blocks[0])[0] == 42);
+
+    bucket_store_read_bucket_blocks(store, cleared_bucket_id, (u64*)new_blocks);
+    for (size_t i = 0; i < BLOCKS_PER_BUCKET; ++i)
+    {
+        TEST_ASSERT(block_is_empty(new_blocks[i]));
+        TEST_ASSERT(BLOCK_DATA(new_blocks[i])[0] == UINT64_MAX);
+    }
+
+    bucket_store_destroy(store);
+    return 0;
+}
+
 void public_bucket_store_tests()
 {
     printf("Public bucket store tests\n");
     RUN_TEST(test_bucket_store_lifecycle());
     RUN_TEST(test_bucket_store_put_get());
     RUN_TEST(test_bucket_store_clear());
+    RUN_TEST(test_bucket_store_write_after_clear());
 }
 
 int main()
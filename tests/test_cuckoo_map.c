@@ -0,0 +1,213 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "../include/cuckoo_map.h"
+#include "../include/bucket.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+#define RECORD_QWORDS 4
+
+static void make_record(u64 *record, u64 key, u64 version)
+{
+    record[0] = key;
+    for (size_t j = 1; j < RECORD_QWORDS; ++j)
+    {
+        record[j] = key * 1000 + version * 10 + j;
+    }
+}
+
+int put_get_remove(size_t capacity, double load_factor, size_t max_evictions)
+{
+    cuckoo_map_config config = {.load_factor = load_factor, .max_evictions = max_evictions};
+    cuckoo_map *map = cuckoo_map_create(capacity, RECORD_QWORDS, &config, TEST_STASH_SIZE, getentropy);
+    // keys are sparse, and version 0 means absent
+    size_t num_keys = 2 * capacity;
+    u64 *versions;
+    TEST_ASSERT(versions = calloc(num_keys, sizeof(*versions)));
+    size_t num_items = 0;
+    u64 record[RECORD_QWORDS];
+    u64 expected[RECORD_QWORDS];
+    for (size_t round = 1; round < 8 * capacity; ++round)
+    {
+        u64 r;
+        getentropy(&r, sizeof(r));
+        u64 index = (r >> 2) % num_keys;
+        u64 key = index * 7919 + 3;
+        error_t err;
+        switch (r & 3)
+        {
+        case 0:
+        case 1:
+            make_record(record, key, round);
+            err = cuckoo_map_put(map, record);
+            // Acceptable if: test code
+            if (versions[index] == 0 && num_items == capacity)
+            {
+                TEST_ASSERT(err == err_OHTABLE__TABLE_FULL);
+                break;
+            }
+            // a new key may find the stash full
+            // Acceptable if: test code
+            if (err == err_OHTABLE__TABLE_FULL)
+            {
+                TEST_ASSERT(versions[index] == 0);
+                TEST_ASSERT(cuckoo_map_report_statistics(map)->stash_items >= CUCKOO_MAP_DEFAULT_STASH_SIZE - 1);
+                break;
+            }
+            TEST_ERR(err);
+            num_items += versions[index] == 0;
+            versions[index] = round;
+            break;
+        case 2:
+            TEST_ASSERT(cuckoo_map_remove(map, key) == (versions[index] ? err_SUCCESS : err_OHTABLE__GET__FAILURE));
+            num_items -= versions[index] != 0;
+            versions[index] = 0;
+            break;
+        default:
+            // Acceptable if: test code
+            if (versions[index])
+            {
+                TEST_ERR(cuckoo_map_get(map, key, record));
+                make_record(expected, key, versions[index]);
+                TEST_ASSERT(memcmp(record, expected, sizeof(record)) == 0);
+            }
+            else
+            {
+                TEST_ASSERT(cuckoo_map_get(map, key, record) == err_OHTABLE__GET__FAILURE);
+                TEST_ASSERT(record[0] == CUCKOO_MAP_EMPTY_KEY);
+            }
+            break;
+        }
+        TEST_ASSERT(cuckoo_map_num_items(map) == num_items);
+    }
+
+    for (size_t index = 0; index < num_keys; ++index)
+    {
+        u64 key = index * 7919 + 3;
+        TEST_ASSERT(cuckoo_map_get(map, key, record) == (versions[index] ? err_SUCCESS : err_OHTABLE__GET__FAILURE));
+        TEST_ASSERT(versions[index] == 0 || record[RECORD_QWORDS - 1] == key * 1000 + versions[index] * 10 + RECORD_QWORDS - 1);
+    }
+    const cuckoo_map_statistics *statistics = cuckoo_map_report_statistics(map);
+    TEST_ASSERT(statistics->num_items == num_items);
+    TEST_ASSERT(statistics->capacity == capacity);
+    TEST_ASSERT(statistics->stash_items <= statistics->max_stash_items);
+    fprintf(stderr, "  capacity %zu load_factor %.2f num_items %zu stash_items %zu max_stash_items %zu stashed_count %zu\n",
+            capacity, load_factor, statistics->num_items, statistics->stash_items, statistics->max_stash_items,
+            statistics->stashed_count);
+
+    // records in the stash are found and removed too
+    for (size_t index = 0; index < num_keys; ++index)
+    {
+        TEST_ASSERT(cuckoo_map_remove(map, index * 7919 + 3) == (versions[index] ? err_SUCCESS : err_OHTABLE__GET__FAILURE));
+    }
+    statistics = cuckoo_map_report_statistics(map);
+    TEST_ASSERT(statistics->num_items == 0);
+    TEST_ASSERT(statistics->stash_items == 0);
+
+    free(versions);
+    cuckoo_map_destroy(map);
+    return err_SUCCESS;
+}
+
+int fixed_access_count()
+{
+    cuckoo_map_config config = {.max_evictions = 5};
+    cuckoo_map *map = cuckoo_map_create(1000, RECORD_QWORDS, &config, TEST_STASH_SIZE, getentropy);
+    u64 record[RECORD_QWORDS];
+    make_record(record, 42, 1);
+    TEST_ASSERT(cuckoo_map_put(map, record) == err_SUCCESS);
+
+    // hits and misses make two ORAM accesses
+    size_t accesses = cuckoo_map_report_statistics(map)->oram_access_count;
+    TEST_ASSERT(cuckoo_map_get(map, 42, record) == err_SUCCESS);
+    TEST_ASSERT(cuckoo_map_get(map, 43, record) == err_OHTABLE__GET__FAILURE);
+    TEST_ASSERT(cuckoo_map_report_statistics(map)->oram_access_count == accesses + 4);
+
+    // puts make the whole eviction chain, whether they insert or replace
+    make_record(record, 43, 1);
+    TEST_ERR(cuckoo_map_put(map, record));
+    make_record(record, 43, 2);
+    TEST_ERR(cuckoo_map_put(map, record));
+    TEST_ASSERT(cuckoo_map_remove(map, 43) == err_SUCCESS);
+    TEST_ASSERT(cuckoo_map_remove(map, 43) == err_OHTABLE__GET__FAILURE);
+    TEST_ASSERT(cuckoo_map_report_statistics(map)->oram_access_count == accesses + 4 + 2 * (2 + 5) + 2 * 2);
+
+    // the empty key cannot be stored
+    make_record(record, CUCKOO_MAP_EMPTY_KEY, 1);
+    TEST_ASSERT(cuckoo_map_put(map, record) == err_OHTABLE__PUT__FAILURE);
+    TEST_ASSERT(cuckoo_map_get(map, CUCKOO_MAP_EMPTY_KEY, record) == err_OHTABLE__GET__FAILURE);
+    TEST_ASSERT(cuckoo_map_num_items(map) == 1);
+    cuckoo_map_destroy(map);
+    return err_SUCCESS;
+}
+
+// A map filled past what its chains can place spills into the stash, and puts that replace records drain it again.
+// Records of half a block make blocks fill up often.
+int stash_fills_and_drains()
+{
+    size_t capacity = 2000;
+    cuckoo_map_config config = {.load_factor = 0.95, .max_evictions = 2, .stash_size = 4};
+    cuckoo_map *map = cuckoo_map_create(capacity, BLOCK_DATA_SIZE_QWORDS / 2, &config, TEST_STASH_SIZE, getentropy);
+    u64 record[BLOCK_DATA_SIZE_QWORDS / 2] = {0};
+    size_t num_items = 0;
+    error_t err = err_SUCCESS;
+    for (u64 key = 0; key < capacity && err == err_SUCCESS; ++key)
+    {
+        make_record(record, key, 1);
+        err = cuckoo_map_put(map, record);
+        num_items += err == err_SUCCESS;
+    }
+    const cuckoo_map_statistics *statistics = cuckoo_map_report_statistics(map);
+    TEST_ASSERT(statistics->stashed_count > 0);
+    // a put fails only on a full stash, and then carries one of its records back to the tables
+    TEST_ASSERT(err == err_SUCCESS || statistics->stash_items >= config.stash_size - 1);
+    TEST_ASSERT(cuckoo_map_num_items(map) == num_items);
+    for (u64 key = 0; key < num_items; ++key)
+    {
+        TEST_ERR(cuckoo_map_get(map, key, record));
+        TEST_ASSERT(record[1] == key * 1000 + 11);
+    }
+
+    // remove a tenth of the records, then replace the rest until the stash is empty
+    for (u64 key = 0; key < num_items; key += 10)
+    {
+        TEST_ERR(cuckoo_map_remove(map, key));
+    }
+    for (size_t round = 0; round < 8 && cuckoo_map_report_statistics(map)->stash_items > 0; ++round)
+    {
+        for (u64 key = 1; key < num_items; key += 10)
+        {
+            make_record(record, key, 2);
+            TEST_ERR(cuckoo_map_put(map, record));
+        }
+    }
+    TEST_ASSERT(cuckoo_map_report_statistics(map)->stash_items == 0);
+    for (u64 key = 0; key < num_items; ++key)
+    {
+        // Acceptable if: test code
+        if (key % 10 == 0)
+        {
+            TEST_ASSERT(cuckoo_map_get(map, key, record) == err_OHTABLE__GET__FAILURE);
+            continue;
+        }
+        TEST_ERR(cuckoo_map_get(map, key, record));
+        TEST_ASSERT(record[1] == key * 1000 + (key % 10 == 1 ? 21 : 11));
+    }
+    cuckoo_map_destroy(map);
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(fixed_access_count());
+    RUN_TEST(stash_fills_and_drains());
+    RUN_TEST(put_get_remove(10, 0, 0));
+    RUN_TEST(put_get_remove(500, 0.5, 2));
+    RUN_TEST(put_get_remove(5000, 0.9, 0));
+    return 0;
+}
@@ -0,0 +1,143 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "../include/ohtable.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+#define RECORD_QWORDS 4
+
+static void make_record(u64 *record, u64 key, u64 version)
+{
+    record[0] = key;
+    for (size_t j = 1; j < RECORD_QWORDS; ++j)
+    {
+        record[j] = key * 1000 + version * 10 + j;
+    }
+}
+
+int put_get_remove(size_t capacity, size_t probe_blocks)
+{
+    ohtable *table = ohtable_create(capacity, RECORD_QWORDS, probe_blocks, TEST_STASH_SIZE, getentropy);
+    // keys are sparse, and version 0 means absent
+    size_t num_keys = 2 * capacity;
+    u64 *versions;
+    TEST_ASSERT(versions = calloc(num_keys, sizeof(*versions)));
+    size_t num_items = 0;
+    u64 record[RECORD_QWORDS];
+    u64 expected[RECORD_QWORDS];
+    for (size_t round = 1; round < 8 * capacity; ++round)
+    {
+        u64 r;
+        getentropy(&r, sizeof(r));
+        u64 index = (r >> 2) % num_keys;
+        u64 key = index * 7919 + 3;
+        switch (r & 3)
+        {
+        case 0:
+        case 1:
+            // Acceptable if: test code
+            if (versions[index] == 0 && num_items == capacity)
+            {
+                make_record(record, key, round);
+                TEST_ASSERT(ohtable_put(table, record) == err_OHTABLE__TABLE_FULL);
+                break;
+            }
+            make_record(record, key, round);
+            TEST_ERR(ohtable_put(table, record));
+            num_items += versions[index] == 0;
+            versions[index] = round;
+            break;
+        case 2:
+            TEST_ASSERT(ohtable_remove(table, key) == (versions[index] ? err_SUCCESS : err_OHTABLE__GET__FAILURE));
+            num_items -= versions[index] != 0;
+            versions[index] = 0;
+            break;
+        default:
+            // Acceptable if: test code
+            if (versions[index])
+            {
+                TEST_ERR(ohtable_get(table, key, record));
+                make_record(expected, key, versions[index]);
+                TEST_ASSERT(memcmp(record, expected, sizeof(record)) == 0);
+            }
+            else
+            {
+                TEST_ASSERT(ohtable_get(table, key, record) == err_OHTABLE__GET__FAILURE);
+                TEST_ASSERT(record[0] == OHTABLE_EMPTY_KEY);
+            }
+            break;
+        }
+        TEST_ASSERT(ohtable_num_items(table) == num_items);
+    }
+
+    for (size_t index = 0; index < num_keys; ++index)
+    {
+        u64 key = index * 7919 + 3;
+        TEST_ASSERT(ohtable_get(table, key, record) == (versions[index] ? err_SUCCESS : err_OHTABLE__GET__FAILURE));
+        TEST_ASSERT(versions[index] == 0 || record[RECORD_QWORDS - 1] == key * 1000 + versions[index] * 10 + RECORD_QWORDS - 1);
+    }
+    const ohtable_statistics *statistics = ohtable_report_statistics(table);
+    TEST_ASSERT(statistics->num_items == num_items);
+    TEST_ASSERT(statistics->capacity == capacity);
+    TEST_ASSERT(statistics->oram_access_count > 0);
+    fprintf(stderr, "  capacity %zu max_trace_length %zu total_displacement %zu num_items %zu\n", capacity, statistics->max_trace_length,
+            statistics->total_displacement, statistics->num_items);
+
+    // displacements are accounted exactly: an empty table has none
+    for (size_t index = 0; index < num_keys; ++index)
+    {
+        TEST_ASSERT(ohtable_remove(table, index * 7919 + 3) == (versions[index] ? err_SUCCESS : err_OHTABLE__GET__FAILURE));
+    }
+    statistics = ohtable_report_statistics(table);
+    TEST_ASSERT(statistics->num_items == 0);
+    TEST_ASSERT(statistics->total_displacement == 0);
+
+    free(versions);
+    ohtable_destroy(table);
+    return err_SUCCESS;
+}
+
+int fixed_probe_length()
+{
+    size_t probe_blocks = 3;
+    ohtable *table = ohtable_create(1000, RECORD_QWORDS, probe_blocks, TEST_STASH_SIZE, getentropy);
+    u64 record[RECORD_QWORDS];
+    make_record(record, 42, 1);
+    TEST_ASSERT(ohtable_put(table, record) == err_SUCCESS);
+
+    // hits and misses make the same number of ORAM accesses
+    size_t accesses = ohtable_report_statistics(table)->oram_access_count;
+    TEST_ASSERT(ohtable_get(table, 42, record) == err_SUCCESS);
+    TEST_ASSERT(ohtable_get(table, 43, record) == err_OHTABLE__GET__FAILURE);
+    TEST_ASSERT(ohtable_report_statistics(table)->oram_access_count == accesses + 2 * probe_blocks);
+
+    make_record(record, 43, 1);
+    TEST_ERR(ohtable_put(table, record));
+    make_record(record, 43, 2);
+    TEST_ERR(ohtable_put(table, record));
+    TEST_ASSERT(ohtable_remove(table, 43) == err_SUCCESS);
+    TEST_ASSERT(ohtable_remove(table, 43) == err_OHTABLE__GET__FAILURE);
+    TEST_ASSERT(ohtable_report_statistics(table)->oram_access_count == accesses + 10 * probe_blocks);
+
+    // the empty key cannot be stored
+    make_record(record, OHTABLE_EMPTY_KEY, 1);
+    TEST_ASSERT(ohtable_put(table, record) == err_OHTABLE__ROBIN_HOOD_UPSERT__RECORD_EMPTY);
+    TEST_ASSERT(ohtable_get(table, OHTABLE_EMPTY_KEY, record) == err_OHTABLE__GET__FAILURE);
+    TEST_ASSERT(ohtable_num_items(table) == 1);
+    ohtable_destroy(table);
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(fixed_probe_length());
+    RUN_TEST(put_get_remove(10, 1));
+    RUN_TEST(put_get_remove(500, 0));
+    RUN_TEST(put_get_remove(5000, 2));
+    return 0;
+}
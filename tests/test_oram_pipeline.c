@@ -0,0 +1,105 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include "../include/oram_pipeline.h"
+#include "../include/path_oram.h"
+#include "../include/position_map.h"
+#include "../include/bucket.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+#define NUM_BLOCKS 500
+#define BATCH 64
+
+// Puts and gets through a pipeline, with repeated blocks in flight at once, then reads everything back with plain
+// `oram_get` to check that every level was left consistent. A nonzero `posmap_block_size_bytes` gives every position
+// map level blocks of that size.
+int pipeline_get_put(size_t scan_threshold, size_t expected_stages, size_t posmap_block_size_bytes)
+{
+    size_t capacity = 1 << 20;
+    oram_posmap_level_config posmap_level = {.blocks_per_bucket = 4, .block_size_bytes = posmap_block_size_bytes};
+    oram_config config = {
+        .scan_threshold = scan_threshold,
+        .posmap_levels = &posmap_level,
+        .num_posmap_levels = posmap_block_size_bytes > 0 ? 1 : 0};
+    oram *oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &config, getentropy);
+    oram_allocate_contiguous(oram, oram_capacity_blocks(oram));
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == expected_stages);
+
+    oram_pipeline *pipeline = oram_pipeline_create(oram, 8);
+    TEST_ASSERT(oram_pipeline_num_stages(pipeline) == expected_stages);
+
+    u64 expected[NUM_BLOCKS];
+    memset(expected, 0xff, sizeof(expected));
+    u64 bufs[BATCH][BLOCK_DATA_SIZE_QWORDS];
+    u64 want[BATCH];
+    for (size_t round = 0; round < 20; ++round)
+    {
+        for (size_t i = 0; i < BATCH; ++i)
+        {
+            u64 r;
+            getentropy(&r, sizeof(r));
+            u64 block_id = (r >> 1) % NUM_BLOCKS;
+            if (r & 1)
+            {
+                for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
+                {
+                    bufs[i][j] = (round << 32) + block_id * BLOCK_DATA_SIZE_QWORDS + j;
+                }
+                expected[block_id] = bufs[i][0];
+                want[i] = bufs[i][0];
+                oram_pipeline_put(pipeline, block_id, bufs[i]);
+            }
+            else
+            {
+                want[i] = expected[block_id];
+                oram_pipeline_get(pipeline, block_id, bufs[i]);
+            }
+        }
+        TEST_ERR(oram_pipeline_drain(pipeline));
+        for (size_t i = 0; i < BATCH; ++i)
+        {
+            TEST_ASSERT(bufs[i][0] == want[i]);
+        }
+    }
+
+    oram_pipeline_get(pipeline, oram_capacity_blocks(oram), bufs[0]);
+    TEST_ASSERT(err_ORAM__ACCESS_UNALLOCATED_BLOCK == oram_pipeline_drain(pipeline));
+    oram_pipeline_destroy(pipeline);
+
+    // a freed block below the capacity fails without accessing any level, as in `oram_function_access`
+    u64 freed = oram_capacity_blocks(oram) / 2;
+    TEST_ERR(oram_free_block(oram, freed));
+    position_map *position_map = oram_get_position_map(oram);
+    const oram_statistics *posmap_statistics = position_map_oram_statistics(position_map);
+    size_t posmap_accesses = posmap_statistics ? posmap_statistics->access_count : 0;
+    pipeline = oram_pipeline_create(oram, 8);
+    oram_pipeline_get(pipeline, freed, bufs[0]);
+    TEST_ASSERT(err_ORAM__ACCESS_UNALLOCATED_BLOCK == oram_pipeline_drain(pipeline));
+    oram_pipeline_destroy(pipeline);
+    posmap_statistics = position_map_oram_statistics(position_map);
+    TEST_ASSERT(posmap_statistics == NULL || posmap_statistics->access_count == posmap_accesses);
+
+    for (size_t b = 0; b < NUM_BLOCKS; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        TEST_ERR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == expected[b]);
+    }
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    // 1 << 20 u64s is 6242 blocks, whose positions fill 38 position map blocks
+    RUN_TEST(pipeline_get_put(0, 1, 0));
+    RUN_TEST(pipeline_get_put(1024, 2, 0));
+    RUN_TEST(pipeline_get_put(16, 3, 0));
+    // 32 entries per position map block instead of 168 adds a level
+    RUN_TEST(pipeline_get_put(64, 3, 256));
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include "../include/oram_planner.h"
+#include "../include/path_oram.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+int simulated_stash_grows_with_load()
+{
+    oram_stash_simulation loose = oram_simulate_stash(1 << 10, 4, 1.0, 1 << 14, getentropy);
+    oram_stash_simulation tight = oram_simulate_stash(1 << 10, 2, 3.0, 1 << 14, getentropy);
+    TEST_ASSERT(loose.mean_overflow <= loose.max_overflow);
+    TEST_ASSERT(tight.mean_overflow <= tight.max_overflow);
+    TEST_ASSERT(loose.max_overflow < 20);
+    TEST_ASSERT(tight.mean_overflow > loose.mean_overflow);
+    TEST_ASSERT(tight.max_overflow > loose.max_overflow);
+    return err_SUCCESS;
+}
+
+// Seeds every stash simulation the same way, so that plans for the same capacity compare
+static int fixed_entropy(void *buf, size_t len)
+{
+    memset(buf, 0x5a, len);
+    return 0;
+}
+
+// The ORAM created from a plan has the predicted shape and holds the capacity.
+static int check_plan(const oram_plan *plan, size_t capacity_u64, size_t budget_bytes)
+{
+    TEST_ASSERT(plan->size_bytes <= budget_bytes);
+    TEST_ASSERT(plan->accesses_per_second > 0);
+    oram *oram = oram_create_from_plan(plan, getentropy);
+    TEST_ASSERT(oram_capacity_blocks(oram) * oram_block_size(oram) >= capacity_u64);
+    TEST_ASSERT(oram_block_size(oram) * sizeof(u64) == plan->block_size_bytes);
+    TEST_ASSERT(oram_access_bytes(oram) == plan->access_bytes);
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == plan->recursion_depth);
+
+    u64 buf[4096 / sizeof(u64)] = {0};
+    size_t num_blocks = oram_capacity_blocks(oram);
+    oram_allocate_contiguous(oram, num_blocks);
+    for (size_t i = 0; i < num_blocks; i += num_blocks / 64 + 1)
+    {
+        buf[0] = i;
+        TEST_ERR(oram_put(oram, i, buf));
+    }
+    for (size_t i = 0; i < num_blocks; i += num_blocks / 64 + 1)
+    {
+        TEST_ERR(oram_get(oram, i, buf));
+        TEST_ASSERT(buf[0] == i);
+    }
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int plan_within_budget(size_t capacity_u64)
+{
+    oram_cost_model model = ORAM_COST_MODEL_DEFAULT;
+    oram_plan generous, tight;
+    TEST_ERR(oram_plan_create(capacity_u64, capacity_u64 * sizeof(u64) * 16, 0, &model, fixed_entropy, &generous));
+    TEST_ERR(check_plan(&generous, capacity_u64, capacity_u64 * sizeof(u64) * 16));
+
+    // less memory cannot be faster, and the fastest plan may also be the smallest
+    size_t budget = generous.size_bytes - 1;
+    error_t err = oram_plan_create(capacity_u64, budget, 0, &model, fixed_entropy, &tight);
+    TEST_ASSERT(err == err_SUCCESS || err == err_ORAM__PLAN_INFEASIBLE);
+    // Acceptable if: test code
+    if (err == err_SUCCESS)
+    {
+        TEST_ERR(check_plan(&tight, capacity_u64, budget));
+        TEST_ASSERT(tight.accesses_per_second <= generous.accesses_per_second);
+    }
+
+    // a fixed block size is kept
+    oram_plan fixed;
+    TEST_ERR(oram_plan_create(capacity_u64, capacity_u64 * sizeof(u64) * 16, 512, &model, fixed_entropy, &fixed));
+    TEST_ASSERT(fixed.block_size_bytes == 512);
+    TEST_ERR(check_plan(&fixed, capacity_u64, capacity_u64 * sizeof(u64) * 16));
+
+    // the data alone does not fit
+    TEST_ASSERT(oram_plan_create(capacity_u64, capacity_u64 * sizeof(u64), 0, &model, fixed_entropy, &tight) == err_ORAM__PLAN_INFEASIBLE);
+    return err_SUCCESS;
+}
+
+int calibrate_cost_model()
+{
+    oram_cost_model model;
+    oram_cost_model_calibrate(&model, 1 << 16, getentropy);
+    fprintf(stderr, "  ns_per_byte %.4f ns_per_sort_byte %.4f ns_per_assignment %.4f ns_per_level %.1f\n",
+            model.ns_per_byte, model.ns_per_sort_byte, model.ns_per_assignment, model.ns_per_level);
+    TEST_ASSERT(model.ns_per_byte >= 0 && model.ns_per_sort_byte >= 0 && model.ns_per_assignment >= 0 && model.ns_per_level >= 0);
+    TEST_ASSERT(model.ns_per_byte + model.ns_per_sort_byte + model.ns_per_assignment + model.ns_per_level > 0);
+
+    // a plan made with the calibrated model is valid too
+    oram_plan plan;
+    TEST_ERR(oram_plan_create(1 << 16, 1 << 22, 0, &model, getentropy, &plan));
+    TEST_ERR(check_plan(&plan, 1 << 16, 1 << 22));
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(simulated_stash_grows_with_load());
+    RUN_TEST(plan_within_budget(1 << 14));
+    RUN_TEST(plan_within_budget(1 << 20));
+    RUN_TEST(plan_within_budget(3 << 19));
+    RUN_TEST(calibrate_cost_model());
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include "../include/oram_queue.h"
+#include "../include/path_oram.h"
+#include "../include/bucket.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+#define NUM_PRODUCERS 4
+#define BLOCKS_PER_PRODUCER 32
+#define ROUNDS 8
+
+static error_t copy_out_accessor(u64 *block_data, void *args)
+{
+    memcpy(args, block_data, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+static error_t copy_in_accessor(u64 *block_data, void *args)
+{
+    memcpy(block_data, args, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+static void count_completion(error_t err, void *args)
+{
+    u64 *completed = args;
+    // Acceptable if: test code
+    if (err == err_SUCCESS)
+    {
+        __atomic_fetch_add(completed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+typedef struct
+{
+    oram_queue *queue;
+    size_t producer;
+    u64 completed;
+    error_t err;
+} producer_args;
+
+// Each producer owns a disjoint range of blocks, so it can check its own reads while the others write.
+static void *producer(void *arg)
+{
+    producer_args *args = arg;
+    u64 bufs[BLOCKS_PER_PRODUCER][BLOCK_DATA_SIZE_QWORDS];
+    oram_future futures[BLOCKS_PER_PRODUCER];
+    for (size_t round = 0; round < ROUNDS && args->err == err_SUCCESS; ++round)
+    {
+        // writes complete through a callback, reads through futures
+        for (size_t i = 0; i < BLOCKS_PER_PRODUCER; ++i)
+        {
+            u64 block_id = args->producer * BLOCKS_PER_PRODUCER + i;
+            for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
+            {
+                bufs[i][j] = (round << 32) + block_id * BLOCK_DATA_SIZE_QWORDS + j;
+            }
+            args->err = oram_queue_submit(args->queue, block_id, copy_in_accessor, bufs[i], count_completion, &args->completed);
+        }
+        u64 out[BLOCKS_PER_PRODUCER][BLOCK_DATA_SIZE_QWORDS];
+        for (size_t i = 0; i < BLOCKS_PER_PRODUCER; ++i)
+        {
+            u64 block_id = args->producer * BLOCKS_PER_PRODUCER + i;
+            // the ring is FIFO and has one consumer, so this runs after the write above
+            oram_queue_submit_future(args->queue, block_id, copy_out_accessor, out[i], &futures[i]);
+        }
+        for (size_t i = 0; i < BLOCKS_PER_PRODUCER; ++i)
+        {
+            u64 block_id = args->producer * BLOCKS_PER_PRODUCER + i;
+            error_t err = oram_future_wait(&futures[i]);
+            // Acceptable if: test code
+            if (err != err_SUCCESS || out[i][0] != (round << 32) + block_id * BLOCK_DATA_SIZE_QWORDS)
+            {
+                args->err = err == err_SUCCESS ? err_ORAM__ACCESS_UNALLOCATED_BLOCK : err;
+            }
+        }
+    }
+    return NULL;
+}
+
+int queue_many_producers(size_t capacity, size_t batch_size)
+{
+    oram *oram = oram_create(1 << 16, TEST_STASH_SIZE, getentropy);
+    oram_allocate_contiguous(oram, oram_capacity_blocks(oram));
+    TEST_ASSERT(oram_capacity_blocks(oram) >= NUM_PRODUCERS * BLOCKS_PER_PRODUCER);
+    oram_queue *queue = oram_queue_create(oram, capacity, batch_size);
+
+    pthread_t threads[NUM_PRODUCERS];
+    producer_args args[NUM_PRODUCERS];
+    for (size_t p = 0; p < NUM_PRODUCERS; ++p)
+    {
+        args[p] = (producer_args){.queue = queue, .producer = p};
+        TEST_ASSERT(pthread_create(&threads[p], NULL, producer, &args[p]) == 0);
+    }
+    for (size_t p = 0; p < NUM_PRODUCERS; ++p)
+    {
+        pthread_join(threads[p], NULL);
+        TEST_ERR(args[p].err);
+        TEST_ASSERT(args[p].completed == ROUNDS * BLOCKS_PER_PRODUCER);
+    }
+
+    // errors from the accessor path reach the future
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    oram_future future;
+    TEST_ERR(oram_queue_submit_future(queue, oram_capacity_blocks(oram), copy_out_accessor, buf, &future));
+    TEST_ASSERT(oram_future_wait(&future) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    TEST_ASSERT(oram_future_done(&future));
+
+    oram_queue_close(queue);
+    TEST_ASSERT(oram_queue_submit_future(queue, 0, copy_out_accessor, buf, &future) == err_QUEUE__CLOSED);
+    // a rejected future keeps the state of its last request
+    TEST_ASSERT(oram_future_done(&future));
+    TEST_ASSERT(oram_future_wait(&future) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    oram_queue_destroy(queue);
+
+    // the queue left the ORAM consistent for direct use
+    for (size_t b = 0; b < NUM_PRODUCERS * BLOCKS_PER_PRODUCER; ++b)
+    {
+        TEST_ERR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == ((u64)(ROUNDS - 1) << 32) + b * BLOCK_DATA_SIZE_QWORDS);
+    }
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(queue_many_producers(1024, 32));
+    // a ring smaller than one producer's round makes producers wait for the worker
+    RUN_TEST(queue_many_producers(8, 4));
+    RUN_TEST(queue_many_producers(2, 1));
+    return 0;
+}
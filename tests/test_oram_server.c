@@ -0,0 +1,157 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/wait.h>
+#include "../include/oram_server.h"
+#include "../include/path_oram.h"
+#include "../include/bucket.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+#define NUM_CLIENTS 3
+#define BLOCKS_PER_CLIENT 40
+#define ROUNDS 4
+
+static u64 expected_word(size_t round, u64 block_id)
+{
+    return (round << 32) + block_id * BLOCK_DATA_SIZE_QWORDS;
+}
+
+// Runs in a child process. Each client owns a disjoint range of blocks; odd blocks go through the zero-copy slot
+// API and even ones through get and put.
+static int client_process(int fd, size_t client_index)
+{
+    oram_client *client;
+    TEST_ERR(oram_client_attach(fd, &client));
+    TEST_ASSERT(oram_client_capacity_blocks(client) >= NUM_CLIENTS * BLOCKS_PER_CLIENT);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    for (size_t round = 0; round < ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < BLOCKS_PER_CLIENT; ++i)
+        {
+            u64 block_id = client_index * BLOCKS_PER_CLIENT + i;
+            // Acceptable if: test code
+            if (i & 1)
+            {
+                oram_client_slot slot;
+                TEST_ERR(oram_client_acquire(client, &slot));
+                for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
+                {
+                    slot.data[j] = expected_word(round, block_id) + j;
+                }
+                TEST_ERR(oram_client_access(client, &slot, block_id, true));
+                // the slot now holds the previous contents
+                TEST_ASSERT(slot.data[0] == (round == 0 ? UINT64_MAX : expected_word(round - 1, block_id)));
+                TEST_ERR(oram_client_access(client, &slot, block_id, false));
+                TEST_ASSERT(slot.data[BLOCK_DATA_SIZE_QWORDS - 1] == expected_word(round, block_id) + BLOCK_DATA_SIZE_QWORDS - 1);
+                oram_client_release(client, &slot);
+            }
+            else
+            {
+                for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
+                {
+                    buf[j] = expected_word(round, block_id) + j;
+                }
+                TEST_ERR(oram_client_put(client, block_id, buf));
+                memset(buf, 0, sizeof(buf));
+                TEST_ERR(oram_client_get(client, block_id, buf));
+                TEST_ASSERT(buf[0] == expected_word(round, block_id));
+            }
+        }
+    }
+    TEST_ASSERT(oram_client_get(client, oram_client_capacity_blocks(client), buf) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    oram_client_detach(client);
+    return 0;
+}
+
+int server_many_processes(size_t num_slots, size_t batch_size)
+{
+    oram *oram = oram_create(1 << 16, TEST_STASH_SIZE, getentropy);
+    oram_allocate_contiguous(oram, oram_capacity_blocks(oram));
+    oram_server *server = oram_server_create(oram, num_slots, batch_size);
+
+    pid_t pids[NUM_CLIENTS];
+    for (size_t c = 0; c < NUM_CLIENTS; ++c)
+    {
+        pids[c] = fork();
+        TEST_ASSERT(pids[c] >= 0);
+        // Acceptable if: test code
+        if (pids[c] == 0)
+        {
+            _exit(client_process(oram_server_fd(server), c));
+        }
+    }
+    for (size_t c = 0; c < NUM_CLIENTS; ++c)
+    {
+        int status;
+        TEST_ASSERT(waitpid(pids[c], &status, 0) == pids[c]);
+        TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    // a client that outlives the server is refused
+    oram_client *client;
+    TEST_ERR(oram_client_attach(oram_server_fd(server), &client));
+    int fds[2];
+    TEST_ASSERT(pipe(fds) == 0);
+    oram_client *not_a_client;
+    TEST_ASSERT(oram_client_attach(fds[0], &not_a_client) == err_SERVER__ATTACH);
+    close(fds[0]);
+    close(fds[1]);
+    oram_server_destroy(server);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    TEST_ASSERT(oram_client_get(client, 0, buf) == err_QUEUE__CLOSED);
+    oram_client_detach(client);
+
+    // the server left the ORAM consistent for direct use
+    for (size_t b = 0; b < NUM_CLIENTS * BLOCKS_PER_CLIENT; ++b)
+    {
+        TEST_ERR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == expected_word(ROUNDS - 1, b));
+    }
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+// Byte offset of `submitters` in the header of the shared region, which a client can write.
+#define HEADER_SUBMITTERS_OFFSET 72
+
+// A client that dies between announcing a submission and pushing it leaves `submitters` set forever. The server
+// still stops.
+int server_stops_despite_stuck_submitter()
+{
+    oram *oram = oram_create(1 << 10, TEST_STASH_SIZE, getentropy);
+    oram_allocate_contiguous(oram, oram_capacity_blocks(oram));
+    oram_server *server = oram_server_create(oram, 4, 2);
+    oram_client *client;
+    TEST_ERR(oram_client_attach(oram_server_fd(server), &client));
+    u64 buf[BLOCK_DATA_SIZE_QWORDS] = {7};
+    TEST_ERR(oram_client_put(client, 3, buf));
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    u8 *header = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, oram_server_fd(server), 0);
+    TEST_ASSERT(header != MAP_FAILED);
+    __atomic_fetch_add((u64 *)(header + HEADER_SUBMITTERS_OFFSET), 1, __ATOMIC_SEQ_CST);
+    munmap(header, page_size);
+
+    oram_server_destroy(server);
+    TEST_ASSERT(oram_client_get(client, 3, buf) == err_QUEUE__CLOSED);
+    oram_client_detach(client);
+    TEST_ERR(oram_get(oram, 3, buf));
+    TEST_ASSERT(buf[0] == 7);
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(server_many_processes(64, 16));
+    // fewer slots than clients makes clients wait for a release
+    RUN_TEST(server_many_processes(2, 1));
+    RUN_TEST(server_stops_despite_stuck_submitter());
+    return 0;
+}
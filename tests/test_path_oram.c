@@ -1,14 +1,17 @@
 // Copyright 2022 Signal Messenger, LLC
 // SPDX-License-Identifier: AGPL-3.0-only
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
 #include <sys/random.h>
 #include "../include/path_oram.h"
 #include "../include/bucket.h"
+#include "../include/position_map.h"
 #include "../include/util.h"
 #include "../include/tests.h"
+#include "../include/tests_fs.h"
 
 int get_put_repeat()
 {
@@ -79,6 +82,685 @@ int test_oram_clear()
     return err_SUCCESS;
 }
 
+int get_put_with_treetop(size_t treetop_levels)
+{
+    size_t capacity = 1 << 20;
+    oram_config config = {.treetop_levels = treetop_levels};
+    oram *oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &config, getentropy);
+
+    oram_allocate_contiguous(oram, 1330);
+    oram_allocate_block(oram);
+
+    for (size_t b = 0; b < 1331; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+
+    for (size_t b = 0; b < 1331; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            TEST_ASSERT(buf[i] == b * BLOCK_DATA_SIZE_QWORDS + i);
+        }
+    }
+
+    // the treetop is cleared with the rest of the ORAM
+    oram_clear(oram);
+    oram_allocate_contiguous(oram, 1331);
+    for (size_t b = 0; b < 1331; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            TEST_ASSERT(buf[i] == UINT64_MAX);
+        }
+    }
+
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+// Random gets and puts with paths sorted in place, compared against a plain array, with enough blocks that the overflow
+// stash is used.
+int get_put_zero_copy(size_t treetop_levels)
+{
+    size_t capacity = 1 << 18;
+    oram_config config = {.treetop_levels = treetop_levels, .zero_copy_path = true, .scan_threshold = 64};
+    oram *oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &config, getentropy);
+    size_t num_blocks = oram_capacity_blocks(oram);
+    oram_allocate_contiguous(oram, num_blocks);
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == 2);
+
+    u64 *expected;
+    TEST_ASSERT(expected = malloc(num_blocks * sizeof(*expected)));
+    memset(expected, 0xff, num_blocks * sizeof(*expected));
+    for (size_t round = 0; round < 8 * num_blocks; ++round)
+    {
+        u64 r;
+        getentropy(&r, sizeof(r));
+        u64 b = (r >> 1) % num_blocks;
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        if (r & 1)
+        {
+            for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+            {
+                buf[i] = round * BLOCK_DATA_SIZE_QWORDS + i;
+            }
+            expected[b] = buf[0];
+            RETURN_IF_ERROR(oram_put(oram, b, buf));
+        }
+        else
+        {
+            RETURN_IF_ERROR(oram_get(oram, b, buf));
+            TEST_ASSERT(buf[0] == expected[b]);
+            TEST_ASSERT(buf[BLOCK_DATA_SIZE_QWORDS - 1] == (expected[b] == UINT64_MAX ? UINT64_MAX : expected[b] + BLOCK_DATA_SIZE_QWORDS - 1));
+        }
+    }
+
+    // buckets left untouched by the clear read as empty when opened in place
+    oram_clear(oram);
+    oram_allocate_contiguous(oram, num_blocks);
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == UINT64_MAX);
+    }
+    free(expected);
+    oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int snapshot_restore(bool file_backed)
+{
+    char dir[] = "/tmp/oram_snapshot_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+
+    // large enough that the position map is backed by an ORAM
+    size_t capacity = 1 << 22;
+    size_t num_blocks = 2000;
+    oram_config config = {.treetop_levels = 2, .storage_dir = file_backed ? dir : NULL};
+    oram *oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &config, getentropy);
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == 2);
+
+    oram_allocate_contiguous(oram, num_blocks);
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+    RETURN_IF_ERROR(oram_snapshot(oram, dir));
+    oram_destroy(oram);
+
+    oram = NULL;
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == 2);
+    TEST_ASSERT(oram_report_statistics(oram)->access_count == num_blocks);
+    // the allocation bound was restored
+    TEST_ASSERT(oram_allocate_block(oram) == num_blocks);
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            TEST_ASSERT(buf[i] == b * BLOCK_DATA_SIZE_QWORDS + i);
+        }
+    }
+    oram_destroy(oram);
+
+    // the accesses above changed the snapshot's buckets, so it can no longer be restored
+    oram = NULL;
+    TEST_ASSERT(oram_restore(dir, getentropy, &oram) == err_ORAM__SNAPSHOT_INVALID);
+    TEST_ASSERT(oram == NULL);
+
+    TEST_ASSERT(remove_tree(dir) == 0);
+    return err_SUCCESS;
+}
+
+// Freed blocks read as unallocated, are reused lowest first and read as new blocks, free ranges at the top lower the
+// allocated bound, and the freed blocks survive a snapshot.
+int free_reuse()
+{
+    char dir[] = "/tmp/oram_snapshot_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+
+    size_t num_blocks = 1000;
+    oram *oram = oram_create(1 << 20, TEST_STASH_SIZE, getentropy);
+    TEST_ASSERT(oram_allocate_contiguous(oram, num_blocks) == 0);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+
+    // free every third block below 600
+    for (size_t b = 0; b < 600; b += 3)
+    {
+        RETURN_IF_ERROR(oram_free_block(oram, b));
+    }
+    TEST_ASSERT(oram_free_block(oram, 3) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    TEST_ASSERT(oram_get(oram, 3, buf) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    TEST_ASSERT(oram_put(oram, 3, buf) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    // a range with a freed block is not freed at all
+    TEST_ASSERT(oram_free_range(oram, 590, 10) == err_ORAM__ACCESS_UNALLOCATED_BLOCK);
+    RETURN_IF_ERROR(oram_get(oram, 590, buf));
+
+    // freeing the top of the allocated range lowers the bound that contiguous allocations start from
+    RETURN_IF_ERROR(oram_free_range(oram, 800, num_blocks - 800));
+    TEST_ASSERT(oram_allocate_contiguous(oram, 10) == 800);
+    TEST_ASSERT(oram_get(oram, 805, buf) == err_SUCCESS && buf[0] == UINT64_MAX);
+
+    RETURN_IF_ERROR(oram_snapshot(oram, dir));
+    oram_destroy(oram);
+    oram = NULL;
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+
+    // the lowest freed blocks come back first, erased
+    for (size_t b = 0; b < 300; b += 3)
+    {
+        TEST_ASSERT(oram_allocate_block(oram) == b);
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            TEST_ASSERT(buf[i] == UINT64_MAX);
+        }
+    }
+    for (size_t b = 1; b < 800; ++b)
+    {
+        // Acceptable if: test code
+        if (b % 3 == 0)
+        {
+            TEST_ASSERT(oram_get(oram, b, buf) == (b < 300 || b >= 600 ? err_SUCCESS : err_ORAM__ACCESS_UNALLOCATED_BLOCK));
+            continue;
+        }
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == b * BLOCK_DATA_SIZE_QWORDS);
+    }
+    // the removed blocks no longer take room in the stash
+    TEST_ASSERT(oram_report_statistics(oram)->stash_overflow_count <= TEST_STASH_SIZE);
+
+    // freeing everything gives back the whole capacity, for contiguous allocations too
+    for (size_t b = 0; b < 810; ++b)
+    {
+        // Acceptable if: test code
+        if (b % 3 != 0 || b < 300 || b >= 600)
+        {
+            RETURN_IF_ERROR(oram_free_block(oram, b));
+        }
+    }
+    TEST_ASSERT(oram_allocate_contiguous(oram, oram_capacity_blocks(oram)) == 0);
+    oram_destroy(oram);
+
+    TEST_ASSERT(remove_tree(dir) == 0);
+    return err_SUCCESS;
+}
+
+// Blocks written before an ORAM grows keep their contents while their buckets move, even when the tree grows again
+// before they have all moved. The new blocks can be allocated and written, and the grown ORAM snapshotted and restored.
+int grow_online(size_t branching, bool zero_copy, size_t treetop_levels, size_t scan_threshold, size_t grown_blocks)
+{
+    char dir[] = "/tmp/oram_snapshot_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+
+    size_t num_blocks = 1000;
+    size_t new_block_stride = 7;
+    // a k-ary tree has fewer buckets per leaf, so they hold more blocks
+    oram_config config = {.branching = branching, .blocks_per_bucket = branching == 2 ? 0 : 6, .block_size_bytes = BLOCK_DATA_SIZE_BYTES,
+        .zero_copy_path = zero_copy, .treetop_levels = treetop_levels, .scan_threshold = scan_threshold};
+    oram *oram = oram_create_with_config(num_blocks * BLOCK_DATA_SIZE_QWORDS, TEST_STASH_SIZE, &config, getentropy);
+    TEST_ASSERT(oram_allocate_contiguous(oram, num_blocks) == 0);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+    RETURN_IF_ERROR(oram_free_block(oram, 7));
+    size_t num_leaves = oram_num_leaves(oram);
+
+    // the tree already has room for its capacity
+    RETURN_IF_ERROR(oram_grow(oram, num_blocks));
+    TEST_ASSERT(oram_num_leaves(oram) == num_leaves);
+
+    RETURN_IF_ERROR(oram_grow(oram, 2 * num_blocks));
+    TEST_ASSERT(oram_num_leaves(oram) == num_leaves * branching);
+    for (size_t b = 0; b < 50; ++b)
+    {
+        TEST_ASSERT(oram_get(oram, b, buf) == (b == 7 ? err_ORAM__ACCESS_UNALLOCATED_BLOCK : err_SUCCESS));
+        TEST_ASSERT(b == 7 || buf[BLOCK_DATA_SIZE_QWORDS - 1] == (b + 1) * BLOCK_DATA_SIZE_QWORDS - 1);
+    }
+    RETURN_IF_ERROR(oram_grow(oram, grown_blocks));
+    TEST_ASSERT(oram_capacity_blocks(oram) == grown_blocks);
+    TEST_ASSERT(oram_num_leaves(oram) * 2 >= grown_blocks);
+    // the position map grew too, into an ORAM once it is too large to scan
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == (grown_blocks > SCAN_THRESHOLD || scan_threshold > 0 ? 2 : 1));
+
+    // the freed block is still reused first, and the new blocks follow the old ones
+    TEST_ASSERT(oram_allocate_block(oram) == 7);
+    TEST_ASSERT(oram_allocate_contiguous(oram, grown_blocks - num_blocks) == num_blocks);
+    for (size_t b = num_blocks; b < grown_blocks; b += new_block_stride)
+    {
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == UINT64_MAX);
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+    for (size_t pass = 0; pass < 2; ++pass)
+    {
+        for (size_t b = 0; b < grown_blocks; b += b < num_blocks ? 1 : new_block_stride)
+        {
+            RETURN_IF_ERROR(oram_get(oram, b, buf));
+            for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+            {
+                TEST_ASSERT(buf[i] == (b == 7 ? UINT64_MAX : b * BLOCK_DATA_SIZE_QWORDS + i));
+            }
+        }
+        // Acceptable if: test code
+        if (pass == 0)
+        {
+            RETURN_IF_ERROR(oram_snapshot(oram, dir));
+            oram_destroy(oram);
+            oram = NULL;
+            RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+            TEST_ASSERT(oram_capacity_blocks(oram) == grown_blocks);
+        }
+    }
+    TEST_ASSERT(oram_report_statistics(oram)->stash_overflow_count <= TEST_STASH_SIZE);
+    // a restored ORAM runs on its snapshot's bucket file, so its tree cannot grow
+    TEST_ASSERT(oram_grow(oram, 4 * oram_num_leaves(oram)) == err_ORAM__GROW_UNSUPPORTED);
+    TEST_ASSERT(oram_capacity_blocks(oram) == grown_blocks);
+    oram_destroy(oram);
+
+    TEST_ASSERT(remove_tree(dir) == 0);
+    return err_SUCCESS;
+}
+
+// Every block of an ORAM whose number of leaves is not a power of two, written, read back and restored from a snapshot.
+int get_put_pruned(size_t num_blocks, bool file_backed)
+{
+    char dir[] = "/tmp/oram_pruned_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+
+    oram_config config = {.treetop_levels = 2, .storage_dir = file_backed ? dir : NULL};
+    oram *oram = oram_create_with_config(num_blocks * BLOCK_DATA_SIZE_QWORDS, TEST_STASH_SIZE, &config, getentropy);
+    TEST_ASSERT(oram_num_leaves(oram) == (num_blocks + 1) / 2);
+    oram_allocate_contiguous(oram, num_blocks);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+    for (size_t round = 0; round < 2; ++round)
+    {
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            RETURN_IF_ERROR(oram_get(oram, b, buf));
+            for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+            {
+                TEST_ASSERT(buf[i] == b * BLOCK_DATA_SIZE_QWORDS + i);
+            }
+        }
+        // Acceptable if: test code
+        if (round == 0)
+        {
+            RETURN_IF_ERROR(oram_snapshot(oram, dir));
+            oram_destroy(oram);
+            oram = NULL;
+            RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+            TEST_ASSERT(oram_num_leaves(oram) == (num_blocks + 1) / 2);
+        }
+    }
+    oram_destroy(oram);
+
+    TEST_ASSERT(remove_tree(dir) == 0);
+    return err_SUCCESS;
+}
+
+// Random gets and puts on an ORAM with a non-default geometry or branching, then a snapshot and restore of it.
+int get_put_geometry(size_t bucket_size, size_t blocks_per_bucket, size_t block_size_bytes, size_t num_blocks, bool zero_copy, size_t branching)
+{
+    bucket_geometry geometry = bucket_geometry_create(bucket_size, blocks_per_bucket, block_size_bytes);
+    size_t block_size = geometry.block_data_qwords;
+    oram_config config = {
+        .treetop_levels = 2,
+        .zero_copy_path = zero_copy,
+        .bucket_size = bucket_size,
+        .blocks_per_bucket = blocks_per_bucket,
+        .block_size_bytes = block_size_bytes,
+        .branching = branching};
+    oram *oram = oram_create_with_config(num_blocks * block_size, TEST_STASH_SIZE, &config, getentropy);
+    TEST_ASSERT(oram_block_size(oram) == block_size);
+    TEST_ASSERT(oram_capacity_blocks(oram) == num_blocks);
+    oram_allocate_contiguous(oram, num_blocks);
+
+    u64 *expected;
+    u64 *buf;
+    TEST_ASSERT(expected = malloc(num_blocks * sizeof(*expected)));
+    TEST_ASSERT(buf = malloc(block_size * sizeof(*buf)));
+    memset(expected, 0xff, num_blocks * sizeof(*expected));
+    for (size_t round = 0; round < 8 * num_blocks; ++round)
+    {
+        u64 r;
+        getentropy(&r, sizeof(r));
+        u64 b = (r >> 1) % num_blocks;
+        if (r & 1)
+        {
+            for (size_t i = 0; i < block_size; ++i)
+            {
+                buf[i] = round * block_size + i;
+            }
+            expected[b] = buf[0];
+            RETURN_IF_ERROR(oram_put(oram, b, buf));
+        }
+        else
+        {
+            RETURN_IF_ERROR(oram_get(oram, b, buf));
+            TEST_ASSERT(buf[0] == expected[b]);
+            TEST_ASSERT(buf[block_size - 1] == (expected[b] == UINT64_MAX ? UINT64_MAX : expected[b] + block_size - 1));
+        }
+    }
+
+    // the geometry is part of the snapshot
+    char dir[] = "/tmp/oram_geometry_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+    RETURN_IF_ERROR(oram_snapshot(oram, dir));
+    oram_destroy(oram);
+    oram = NULL;
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+    TEST_ASSERT(oram_block_size(oram) == block_size);
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == expected[b]);
+        TEST_ASSERT(buf[block_size - 1] == (expected[b] == UINT64_MAX ? UINT64_MAX : expected[b] + block_size - 1));
+    }
+    oram_destroy(oram);
+    TEST_ASSERT(remove_tree(dir) == 0);
+    free(buf);
+    free(expected);
+    return err_SUCCESS;
+}
+
+// Buckets with fewer blocks on the bottom levels: fewer bytes per access than Z = 4 on every level, a stash that stays
+// small by the statistics the ORAM collects, and checkpoints and a restore of a store whose slots differ in size.
+int get_put_leaf_levels(size_t leaf_levels, size_t leaf_blocks_per_bucket, bool zero_copy)
+{
+    size_t num_blocks = 1 << 12;
+    size_t block_size = 256 / sizeof(u64);
+    oram_config uniform_config = {.blocks_per_bucket = 4, .block_size_bytes = 256};
+    oram *oram = oram_create_with_config(num_blocks * block_size, TEST_STASH_SIZE, &uniform_config, getentropy);
+    size_t uniform_access_bytes = oram_access_bytes(oram);
+    oram_destroy(oram);
+
+    char dir[] = "/tmp/oram_leaf_levels_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+    oram_config config = {
+        .treetop_levels = 2,
+        .storage_dir = dir,
+        .zero_copy_path = zero_copy,
+        .blocks_per_bucket = 4,
+        .block_size_bytes = 256,
+        .leaf_levels = leaf_levels,
+        .leaf_blocks_per_bucket = leaf_blocks_per_bucket};
+    oram = oram_create_with_config(num_blocks * block_size, TEST_STASH_SIZE, &config, getentropy);
+    TEST_ASSERT(oram_access_bytes(oram) < uniform_access_bytes);
+    oram_allocate_contiguous(oram, num_blocks);
+
+    u64 *expected;
+    u64 buf[256 / sizeof(u64)];
+    TEST_ASSERT(expected = malloc(num_blocks * sizeof(*expected)));
+    memset(expected, 0xff, num_blocks * sizeof(*expected));
+    size_t checkpoint_bytes = 0;
+    for (size_t round = 0; round < 8 * num_blocks; ++round)
+    {
+        u64 r;
+        getentropy(&r, sizeof(r));
+        u64 b = (r >> 1) % num_blocks;
+        if (r & 1)
+        {
+            for (size_t i = 0; i < block_size; ++i)
+            {
+                buf[i] = round * block_size + i;
+            }
+            expected[b] = buf[0];
+            RETURN_IF_ERROR(oram_put(oram, b, buf));
+        }
+        else
+        {
+            RETURN_IF_ERROR(oram_get(oram, b, buf));
+            TEST_ASSERT(buf[0] == expected[b]);
+            TEST_ASSERT(buf[block_size - 1] == (expected[b] == UINT64_MAX ? UINT64_MAX : expected[b] + block_size - 1));
+        }
+        if (round == 4 * num_blocks)
+        {
+            RETURN_IF_ERROR(oram_checkpoint_incremental(oram, dir, &checkpoint_bytes));
+        }
+    }
+    // blocks rarely wait in the stash between accesses, as with Z = 4 on every level
+    const oram_statistics *statistics = oram_report_statistics(oram);
+    TEST_ASSERT(statistics->sum_stash_overflow_count < statistics->access_count);
+    TEST_ASSERT(statistics->max_stash_overflow_count < TEST_STASH_SIZE);
+
+    RETURN_IF_ERROR(oram_checkpoint_incremental(oram, dir, &checkpoint_bytes));
+    TEST_ASSERT(checkpoint_bytes > 0);
+    oram_destroy(oram);
+    oram = NULL;
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == expected[b]);
+        TEST_ASSERT(buf[block_size - 1] == (expected[b] == UINT64_MAX ? UINT64_MAX : expected[b] + block_size - 1));
+    }
+    oram_destroy(oram);
+    TEST_ASSERT(remove_tree(dir) == 0);
+    free(expected);
+    return err_SUCCESS;
+}
+
+// Position map levels with their own block size, Z and stash overflow size: random gets and puts, then a snapshot and
+// restore, which must bring back the geometry of every level.
+int get_put_posmap_levels()
+{
+    size_t capacity = 1 << 20;
+    oram_config default_config = {.scan_threshold = 64};
+    oram *oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &default_config, getentropy);
+    size_t default_depth = oram_report_statistics(oram)->recursion_depth;
+    size_t default_access_bytes = oram_access_bytes(oram);
+    oram_destroy(oram);
+
+    oram_posmap_level_config posmap_levels[] = {
+        {.blocks_per_bucket = 4, .block_size_bytes = 256, .stash_overflow_size = 2 * TEST_STASH_SIZE},
+        {.blocks_per_bucket = 4, .block_size_bytes = 128}};
+    oram_config config = {.scan_threshold = 64, .treetop_levels = 2, .posmap_levels = posmap_levels, .num_posmap_levels = 2};
+    oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &config, getentropy);
+    // 32 and then 16 entries per block rather than 168
+    TEST_ASSERT(oram_report_statistics(oram)->recursion_depth == default_depth + 1);
+    TEST_ASSERT(oram_access_bytes(oram) < default_access_bytes);
+
+    size_t num_blocks = oram_capacity_blocks(oram);
+    oram_allocate_contiguous(oram, num_blocks);
+    u64 *expected;
+    TEST_ASSERT(expected = malloc(num_blocks * sizeof(*expected)));
+    memset(expected, 0xff, num_blocks * sizeof(*expected));
+    for (size_t round = 0; round < 4 * num_blocks; ++round)
+    {
+        u64 r;
+        getentropy(&r, sizeof(r));
+        u64 b = (r >> 1) % num_blocks;
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        if (r & 1)
+        {
+            for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+            {
+                buf[i] = round * BLOCK_DATA_SIZE_QWORDS + i;
+            }
+            expected[b] = buf[0];
+            RETURN_IF_ERROR(oram_put(oram, b, buf));
+        }
+        else
+        {
+            RETURN_IF_ERROR(oram_get(oram, b, buf));
+            TEST_ASSERT(buf[0] == expected[b]);
+        }
+    }
+
+    char dir[] = "/tmp/oram_posmap_levels_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+    size_t access_bytes = oram_access_bytes(oram);
+    RETURN_IF_ERROR(oram_snapshot(oram, dir));
+    oram_destroy(oram);
+    oram = NULL;
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+    TEST_ASSERT(oram_access_bytes(oram) == access_bytes);
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == expected[b]);
+    }
+    oram_destroy(oram);
+    TEST_ASSERT(remove_tree(dir) == 0);
+    free(expected);
+    return err_SUCCESS;
+}
+
+int checkpoint_incremental()
+{
+    char dir[] = "/tmp/oram_checkpoint_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+
+    size_t capacity = 1 << 22;
+    size_t num_blocks = 2000;
+    size_t num_updates = 10;
+    oram *oram = oram_create(capacity, TEST_STASH_SIZE, getentropy);
+    oram_allocate_contiguous(oram, num_blocks);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+
+    // the first checkpoint has no base in `dir` and writes every bucket
+    size_t full_bytes = 0;
+    RETURN_IF_ERROR(oram_checkpoint_incremental(oram, dir, &full_bytes));
+    TEST_ASSERT(full_bytes > 0);
+
+    for (size_t b = 0; b < num_updates; ++b)
+    {
+        memset(buf, 0, sizeof(buf));
+        buf[0] = b;
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+    size_t incremental_bytes = 0;
+    RETURN_IF_ERROR(oram_checkpoint_incremental(oram, dir, &incremental_bytes));
+    TEST_ASSERT(incremental_bytes > 0);
+    TEST_ASSERT(incremental_bytes < full_bytes);
+
+    // nothing was written since the last checkpoint
+    RETURN_IF_ERROR(oram_checkpoint_incremental(oram, dir, &incremental_bytes));
+    TEST_ASSERT(incremental_bytes == 0);
+    oram_destroy(oram);
+
+    oram = NULL;
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &oram));
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            u64 expected = b < num_updates ? (i == 0 ? b : 0) : b * BLOCK_DATA_SIZE_QWORDS + i;
+            TEST_ASSERT(buf[i] == expected);
+        }
+    }
+    oram_destroy(oram);
+
+    TEST_ASSERT(remove_tree(dir) == 0);
+    return err_SUCCESS;
+}
+
+int get_put_tiered(size_t memory_levels)
+{
+    char dir[] = "/tmp/oram_tiered_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+    char tier_file[sizeof(dir) + 16];
+    snprintf(tier_file, sizeof(tier_file), "%s/buckets", dir);
+
+    size_t capacity = 1 << 20;
+    oram_config config = {.tier_file = tier_file, .memory_levels = memory_levels};
+    oram *oram = oram_create_with_config(capacity, TEST_STASH_SIZE, &config, getentropy);
+
+    oram_allocate_contiguous(oram, 1331);
+    for (size_t b = 0; b < 1331; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(oram_put(oram, b, buf));
+    }
+    for (size_t b = 0; b < 1331; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            TEST_ASSERT(buf[i] == b * BLOCK_DATA_SIZE_QWORDS + i);
+        }
+    }
+
+    // buckets on disk are cleared with the rest of the ORAM
+    oram_clear(oram);
+    oram_allocate_contiguous(oram, 1331);
+    for (size_t b = 0; b < 1331; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(oram_get(oram, b, buf));
+        TEST_ASSERT(buf[0] == UINT64_MAX);
+    }
+
+    if (memory_levels < 64)
+    {
+        TEST_ASSERT(oram_snapshot(oram, dir) == err_ORAM__SNAPSHOT_UNSUPPORTED);
+    }
+    oram_destroy(oram);
+
+    TEST_ASSERT(remove_tree(dir) == 0);
+    return err_SUCCESS;
+}
+
 error_t test_create_for_avail_mem() {
 
     // 2+ GiB
@@ -98,11 +780,179 @@ error_t test_create_for_avail_mem() {
     return err_SUCCESS;
 }
 
+static error_t copy_in_accessor(u64 *block_data, void *args)
+{
+    memcpy(block_data, args, BLOCK_DATA_SIZE_BYTES);
+    return err_SUCCESS;
+}
+
+// Interleaved puts to `count` ORAMs of different sizes, read back with plain gets.
+int get_put_interleaved(size_t count)
+{
+    oram *orams[ORAM_MAX_INTERLEAVED];
+    for (size_t g = 0; g < count; ++g)
+    {
+        orams[g] = oram_create((1 << 16) << (g % 3), TEST_STASH_SIZE, getentropy);
+        oram_allocate_contiguous(orams[g], 300);
+    }
+
+    u64 bufs[ORAM_MAX_INTERLEAVED][BLOCK_DATA_SIZE_QWORDS];
+    void *args[ORAM_MAX_INTERLEAVED];
+    u64 block_ids[ORAM_MAX_INTERLEAVED];
+    for (size_t b = 0; b < 300; ++b)
+    {
+        for (size_t g = 0; g < count; ++g)
+        {
+            block_ids[g] = (b * 7 + g) % 300;
+            for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+            {
+                bufs[g][i] = (g << 32) + block_ids[g] * BLOCK_DATA_SIZE_QWORDS + i;
+            }
+            args[g] = bufs[g];
+        }
+        RETURN_IF_ERROR(oram_function_access_interleaved(count, orams, block_ids, copy_in_accessor, args));
+    }
+
+    for (size_t g = 0; g < count; ++g)
+    {
+        for (size_t b = 0; b < 300; ++b)
+        {
+            u64 buf[BLOCK_DATA_SIZE_QWORDS];
+            RETURN_IF_ERROR(oram_get(orams[g], b, buf));
+            for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+            {
+                TEST_ASSERT(buf[i] == (g << 32) + b * BLOCK_DATA_SIZE_QWORDS + i);
+            }
+        }
+    }
+
+    block_ids[0] = 300;
+    TEST_ASSERT(err_ORAM__ACCESS_UNALLOCATED_BLOCK == oram_function_access_interleaved(count, orams, block_ids, copy_in_accessor, args));
+    for (size_t g = 0; g < count; ++g)
+    {
+        oram_destroy(orams[g]);
+    }
+    return err_SUCCESS;
+}
+
+int get_put_in_arena(size_t branching, size_t treetop_levels, bool zero_copy, size_t scan_threshold, size_t stash_overflow_size)
+{
+    size_t num_blocks = 1500;
+    oram_posmap_level_config posmap_levels[] = {{.blocks_per_bucket = 4, .block_size_bytes = 256}};
+    // k-ary trees also take smaller leaf buckets, and recursive position maps small blocks
+    oram_config config = {.branching = branching, .blocks_per_bucket = branching == 2 ? 0 : 6, .block_size_bytes = BLOCK_DATA_SIZE_BYTES,
+        .leaf_levels = branching == 2 ? 0 : 1, .leaf_blocks_per_bucket = branching == 2 ? 0 : 3, .treetop_levels = treetop_levels,
+        .zero_copy_path = zero_copy, .scan_threshold = scan_threshold, .posmap_levels = posmap_levels, .num_posmap_levels = scan_threshold > 0 ? 1 : 0};
+    size_t capacity = num_blocks * BLOCK_DATA_SIZE_QWORDS;
+    size_t size_bytes = oram_arena_size_bytes(capacity, stash_overflow_size, &config);
+
+    // two ORAMs fill the arena exactly
+    void *base;
+    TEST_ASSERT(base = aligned_alloc(ORAM_ARENA_ALIGNMENT, 2 * size_bytes));
+    oram_arena arena;
+    oram_arena_init(&arena, base, 2 * size_bytes);
+    oram *orams[2];
+    for (size_t o = 0; o < 2; ++o)
+    {
+        orams[o] = oram_create_in(&arena, capacity, stash_overflow_size, &config, getentropy);
+        TEST_ASSERT(arena.used == (o + 1) * size_bytes);
+        TEST_ASSERT(oram_allocate_contiguous(orams[o], num_blocks) == 0);
+    }
+    TEST_ASSERT(oram_report_statistics(orams[0])->recursion_depth == (scan_threshold > 0 ? 2 : 1));
+
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    for (size_t round = 0; round < 3; ++round)
+    {
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            for (size_t o = 0; o < 2; ++o)
+            {
+                buf[0] = (round * num_blocks + b) * 2 + o;
+                RETURN_IF_ERROR(oram_put(orams[o], b, buf));
+            }
+        }
+    }
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t o = 0; o < 2; ++o)
+        {
+            RETURN_IF_ERROR(oram_get(orams[o], b, buf));
+            TEST_ASSERT(buf[0] == (2 * num_blocks + b) * 2 + o);
+        }
+    }
+    // the layout is fixed
+    TEST_ASSERT(oram_grow(orams[0], 2 * num_blocks) == err_ORAM__GROW_UNSUPPORTED);
+    TEST_ASSERT(arena.used == 2 * size_bytes);
+
+    // a snapshot restores to the heap
+    char dir[] = "/tmp/oram_arena_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != NULL);
+    RETURN_IF_ERROR(oram_snapshot(orams[1], dir));
+    oram_destroy(orams[1]);
+    RETURN_IF_ERROR(oram_restore(dir, getentropy, &orams[1]));
+    for (size_t b = 0; b < num_blocks; b += 7)
+    {
+        RETURN_IF_ERROR(oram_get(orams[1], b, buf));
+        TEST_ASSERT(buf[0] == (2 * num_blocks + b) * 2 + 1);
+    }
+    TEST_ASSERT(remove_tree(dir) == 0);
+
+    oram_destroy(orams[0]);
+    oram_destroy(orams[1]);
+    free(base);
+    return err_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
     run_path_oram_tests();
     RUN_TEST(get_put_repeat());
     RUN_TEST(test_oram_clear());
+    RUN_TEST(get_put_with_treetop(1));
+    RUN_TEST(get_put_with_treetop(4));
+    RUN_TEST(get_put_with_treetop(64));
+    RUN_TEST(get_put_zero_copy(0));
+    RUN_TEST(get_put_zero_copy(4));
+    RUN_TEST(snapshot_restore(false));
+    RUN_TEST(snapshot_restore(true));
+    RUN_TEST(free_reuse());
+    RUN_TEST(grow_online(2, false, 0, 0, 8000));
+    RUN_TEST(grow_online(4, true, 3, 0, 8000));
+    // an ORAM position map that grows, and a scan position map that becomes one
+    RUN_TEST(grow_online(2, false, 0, 64, 8000));
+    RUN_TEST(grow_online(2, true, 2, 0, 20000));
+    RUN_TEST(checkpoint_incremental());
+    RUN_TEST(get_put_tiered(0));
+    RUN_TEST(get_put_tiered(4));
+    RUN_TEST(get_put_tiered(64));
+    RUN_TEST(get_put_interleaved(1));
+    RUN_TEST(get_put_interleaved(5));
+    RUN_TEST(get_put_interleaved(ORAM_MAX_INTERLEAVED));
+    // small blocks with a larger Z, as for a small table
+    RUN_TEST(get_put_geometry(0, 4, 256, 1 << 12, false, 2));
+    RUN_TEST(get_put_geometry(0, 4, 256, 1 << 12, true, 2));
+    // 4 KB blocks, as for a document store
+    RUN_TEST(get_put_geometry(0, 0, 4096, 1 << 10, false, 2));
+    RUN_TEST(get_put_geometry(8192, 0, 0, 1 << 10, true, 2));
+    RUN_TEST(get_put_geometry(2 << 20, 0, 0, 8, true, 2));
+    // k-ary trees: with the memory of the binary tree, where the stash grows, then with Z = 3k/2
+    RUN_TEST(get_put_geometry(6144, 4, 0, 1 << 12, false, 4));
+    RUN_TEST(get_put_geometry(0, 6, BLOCK_DATA_SIZE_BYTES, 1500, true, 4));
+    RUN_TEST(get_put_geometry(0, 12, BLOCK_DATA_SIZE_BYTES, 1 << 12, true, 8));
+    RUN_TEST(get_put_geometry(0, 24, 256, 1 << 12, false, 16));
+    // Z = 2 or 1 on the bottom levels under Z = 4
+    RUN_TEST(get_put_leaf_levels(1, 1, false));
+    RUN_TEST(get_put_leaf_levels(3, 2, true));
+    RUN_TEST(get_put_posmap_levels());
+    RUN_TEST(get_put_pruned(1025, false));
+    RUN_TEST(get_put_pruned(1500, true));
+    // the position map is an ORAM with a pruned tree too
+    RUN_TEST(get_put_pruned(3000, false));
+    RUN_TEST(get_put_in_arena(2, 0, false, 0, TEST_STASH_SIZE));
+    RUN_TEST(get_put_in_arena(2, 3, true, 64, TEST_STASH_SIZE));
+    RUN_TEST(get_put_in_arena(4, 2, false, 64, TEST_STASH_SIZE));
+    // the stash outgrows its arena allocation
+    RUN_TEST(get_put_in_arena(4, 0, true, 0, 1));
     // RUN_TEST(test_create_for_avail_mem());
     return 0;
 }
@@ -86,6 +86,36 @@ int test_position_map_initial_data()
     return err_SUCCESS;
 }
 
+int test_oram_position_map_unset_positions()
+{
+    // ORAM-backed maps do not write initial positions, unset entries must still look random.
+    size_t size = 1 << 18;
+    size_t num_positions = 1 << 17;
+    position_map *pm = position_map_create(size, num_positions, TEST_STASH_SIZE, getentropy);
+    TEST_ASSERT(position_map_recursion_depth(pm) > 1);
+
+    u64 first = UINT64_MAX;
+    bool all_equal = true;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        u64 position;
+        RETURN_IF_ERROR(position_map_get(pm, i * 97, &position));
+        TEST_ASSERT(position < num_positions);
+        first = i == 0 ? position : first;
+        all_equal = all_equal && position == first;
+    }
+    TEST_ASSERT(!all_equal);
+
+    u64 prev;
+    RETURN_IF_ERROR(position_map_read_then_set(pm, 4321, 1234, &prev));
+    TEST_ASSERT(prev < num_positions);
+    RETURN_IF_ERROR(position_map_read_then_set(pm, 4321, 4321, &prev));
+    TEST_ASSERT(prev == 1234);
+
+    position_map_destroy(pm);
+    return err_SUCCESS;
+}
+
 int test_position_map_put_get()
 {
     position_map *pm = position_map_create(1 << 18, 1 << 17, TEST_STASH_SIZE, getentropy);
@@ -141,6 +171,7 @@ void public_position_map_tests()
     RUN_TEST(test_position_map_lifecycle());
     RUN_TEST(test_position_map_recursion_depth());
     RUN_TEST(test_position_map_initial_data());
+    RUN_TEST(test_oram_position_map_unset_positions());
     RUN_TEST(test_position_map_put_get());
     RUN_TEST(test_position_map_put_get_repeat());
 }
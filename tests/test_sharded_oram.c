@@ -0,0 +1,153 @@
+// Copyright 2022 Signal Messenger, LLC
+// SPDX-License-Identifier: AGPL-3.0-only
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include "../include/sharded_oram.h"
+#include "../include/bucket.h"
+#include "../include/util.h"
+#include "../include/tests.h"
+
+static int get_put_sharded(sharded_oram *oram)
+{
+    size_t capacity_blocks = sharded_oram_capacity_blocks(oram);
+    size_t num_blocks = capacity_blocks < 1331 ? capacity_blocks : 1331;
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            buf[i] = b * BLOCK_DATA_SIZE_QWORDS + i;
+        }
+        RETURN_IF_ERROR(sharded_oram_put(oram, b, buf));
+    }
+
+    // read back in a different order than written so that shards are interleaved differently
+    for (size_t k = 0; k < num_blocks; ++k)
+    {
+        size_t b = (k * 7) % num_blocks;
+        u64 buf[BLOCK_DATA_SIZE_QWORDS];
+        RETURN_IF_ERROR(sharded_oram_get(oram, b, buf));
+        for (size_t i = 0; i < BLOCK_DATA_SIZE_QWORDS; ++i)
+        {
+            TEST_ASSERT(buf[i] == b * BLOCK_DATA_SIZE_QWORDS + i);
+        }
+    }
+
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    TEST_ASSERT(err_ORAM__ACCESS_UNALLOCATED_BLOCK == sharded_oram_get(oram, sharded_oram_capacity_blocks(oram), buf));
+    return err_SUCCESS;
+}
+
+int get_put_with_shards(size_t num_shards)
+{
+    size_t capacity = 1 << 18;
+    sharded_oram *oram = sharded_oram_create(capacity, num_shards, TEST_STASH_SIZE, getentropy);
+    TEST_ASSERT(sharded_oram_num_shards(oram) == num_shards);
+    TEST_ASSERT(sharded_oram_capacity_blocks(oram) * BLOCK_DATA_SIZE_QWORDS >= capacity);
+
+    int result = get_put_sharded(oram);
+    sharded_oram_destroy(oram);
+    return result;
+}
+
+int get_put_numa()
+{
+    size_t capacity = 1 << 18;
+    sharded_oram *oram = sharded_oram_create_numa(capacity, TEST_STASH_SIZE, getentropy);
+    TEST_ASSERT(sharded_oram_num_shards(oram) >= 1);
+    TEST_ASSERT(sharded_oram_capacity_blocks(oram) * BLOCK_DATA_SIZE_QWORDS >= capacity);
+
+    int result = get_put_sharded(oram);
+    sharded_oram_destroy(oram);
+    return result;
+}
+
+// Random batches of gets and puts, with repeated blocks, checked against a plain array.
+int access_batch(size_t num_shards, size_t batch_size)
+{
+    size_t capacity = 1 << 16;
+    sharded_oram *oram = sharded_oram_create(capacity, num_shards, TEST_STASH_SIZE, getentropy);
+    size_t num_blocks = sharded_oram_capacity_blocks(oram);
+    u64 *expected;
+    CHECK(expected = malloc(num_blocks * sizeof(*expected)));
+    // blocks that were never written read as all ones
+    memset(expected, 0xff, num_blocks * sizeof(*expected));
+    sharded_oram_request *requests;
+    CHECK(requests = calloc(batch_size, sizeof(*requests)));
+    u64 *prev;
+    CHECK(prev = calloc(batch_size, sizeof(*prev)));
+
+    for (size_t round = 0; round < 20; ++round)
+    {
+        for (size_t i = 0; i < batch_size; ++i)
+        {
+            u64 r;
+            getentropy(&r, sizeof(r));
+            // a small range of blocks so that batches repeat blocks
+            requests[i].block_id = (r >> 1) % (batch_size < num_blocks ? batch_size : num_blocks);
+            requests[i].is_put = r & 1;
+            for (size_t j = 0; j < BLOCK_DATA_SIZE_QWORDS; ++j)
+            {
+                requests[i].data[j] = (round << 32) + i * BLOCK_DATA_SIZE_QWORDS + j;
+            }
+            // requests for the same block are applied in batch order
+            prev[i] = expected[requests[i].block_id];
+            expected[requests[i].block_id] = requests[i].is_put ? requests[i].data[0] : prev[i];
+        }
+        size_t shard_batch_size = round % 2 == 0 ? batch_size : sharded_oram_shard_batch_size(batch_size, num_shards);
+        TEST_ERR(sharded_oram_access_batch(oram, batch_size, requests, shard_batch_size));
+        for (size_t i = 0; i < batch_size; ++i)
+        {
+            TEST_ASSERT(requests[i].data[0] == prev[i]);
+        }
+    }
+
+    free(prev);
+    free(requests);
+    free(expected);
+    sharded_oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int access_batch_overflow()
+{
+    size_t num_shards = 4;
+    sharded_oram *oram = sharded_oram_create(1 << 16, num_shards, TEST_STASH_SIZE, getentropy);
+    u64 buf[BLOCK_DATA_SIZE_QWORDS];
+    memset(buf, 0, sizeof(buf));
+    TEST_ERR(sharded_oram_put(oram, 0, buf));
+
+    // every request goes to shard 0
+    sharded_oram_request requests[8];
+    for (size_t i = 0; i < 8; ++i)
+    {
+        requests[i].block_id = i * num_shards;
+        requests[i].is_put = true;
+        memset(requests[i].data, 0x5a, BLOCK_DATA_SIZE_BYTES);
+    }
+    TEST_ASSERT(err_SHARD__BATCH_OVERFLOW == sharded_oram_access_batch(oram, 8, requests, 4));
+
+    // nothing was applied
+    TEST_ERR(sharded_oram_get(oram, 0, buf));
+    TEST_ASSERT(buf[0] == 0);
+    TEST_ERR(sharded_oram_access_batch(oram, 8, requests, 8));
+    TEST_ERR(sharded_oram_get(oram, 0, buf));
+    TEST_ASSERT(buf[0] == 0x5a5a5a5a5a5a5a5a);
+
+    sharded_oram_destroy(oram);
+    return err_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    RUN_TEST(get_put_with_shards(1));
+    RUN_TEST(get_put_with_shards(3));
+    RUN_TEST(get_put_numa());
+    RUN_TEST(access_batch(1, 64));
+    RUN_TEST(access_batch(3, 64));
+    RUN_TEST(access_batch(4, 500));
+    RUN_TEST(access_batch_overflow());
+    return 0;
+}